@@ -0,0 +1,615 @@
+#include "Cloth/ClothGridMeshCPUSolver.h"
+#include "Cloth/ClothGridMeshReferenceSolver.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/AutomationTest.h"
+
+namespace
+{
+// ClothSimulationGridMesh.usfのSMALL_NUMBERと同じ値
+const float ClothSmallNumber = 0.0001f;
+// 0のrsqrtを避けるための下限
+const float ClothTinyNumber = 1.e-20f;
+const uint32 NumLane = 4;
+const uint32 NumColor = 4;
+// 各行の端数も4頂点単位で処理するため、最終行の末尾からはみ出して8頂点まで読み書きする
+const uint32 NumPaddingVertex = 2 * NumLane;
+
+struct FVectorRegister3
+{
+	VectorRegister X;
+	VectorRegister Y;
+	VectorRegister Z;
+};
+
+FORCEINLINE FVectorRegister3 Set3(const FVector& V)
+{
+	return FVectorRegister3{VectorSetFloat1(V.X), VectorSetFloat1(V.Y), VectorSetFloat1(V.Z)};
+}
+
+FORCEINLINE FVectorRegister3 Add3(const FVectorRegister3& A, const FVectorRegister3& B)
+{
+	return FVectorRegister3{VectorAdd(A.X, B.X), VectorAdd(A.Y, B.Y), VectorAdd(A.Z, B.Z)};
+}
+
+FORCEINLINE FVectorRegister3 Subtract3(const FVectorRegister3& A, const FVectorRegister3& B)
+{
+	return FVectorRegister3{VectorSubtract(A.X, B.X), VectorSubtract(A.Y, B.Y), VectorSubtract(A.Z, B.Z)};
+}
+
+FORCEINLINE FVectorRegister3 Scale3(const FVectorRegister3& A, const VectorRegister& S)
+{
+	return FVectorRegister3{VectorMultiply(A.X, S), VectorMultiply(A.Y, S), VectorMultiply(A.Z, S)};
+}
+
+/** A * S + B */
+FORCEINLINE FVectorRegister3 MultiplyAdd3(const FVectorRegister3& A, const VectorRegister& S, const FVectorRegister3& B)
+{
+	return FVectorRegister3{VectorMultiplyAdd(A.X, S, B.X), VectorMultiplyAdd(A.Y, S, B.Y), VectorMultiplyAdd(A.Z, S, B.Z)};
+}
+
+FORCEINLINE VectorRegister Dot3(const FVectorRegister3& A, const FVectorRegister3& B)
+{
+	return VectorMultiplyAdd(A.X, B.X, VectorMultiplyAdd(A.Y, B.Y, VectorMultiply(A.Z, B.Z)));
+}
+
+FORCEINLINE FVectorRegister3 Cross3(const FVectorRegister3& A, const FVectorRegister3& B)
+{
+	return FVectorRegister3{
+		VectorSubtract(VectorMultiply(A.Y, B.Z), VectorMultiply(A.Z, B.Y)),
+		VectorSubtract(VectorMultiply(A.Z, B.X), VectorMultiply(A.X, B.Z)),
+		VectorSubtract(VectorMultiply(A.X, B.Y), VectorMultiply(A.Y, B.X))
+	};
+}
+
+FORCEINLINE FVectorRegister3 Select3(const VectorRegister& Mask, const FVectorRegister3& A, const FVectorRegister3& B)
+{
+	return FVectorRegister3{VectorSelect(Mask, A.X, B.X), VectorSelect(Mask, A.Y, B.Y), VectorSelect(Mask, A.Z, B.Z)};
+}
+
+/** 先頭NumValidLane個のレーンが真のマスク */
+FORCEINLINE VectorRegister GetLaneMask(uint32 NumValidLane)
+{
+	return VectorCompareGT(VectorSetFloat1((float)NumValidLane), MakeVectorRegister(0.0f, 1.0f, 2.0f, 3.0f));
+}
+
+/** FClothGridMeshCPUStateのxyzの3配列 */
+struct FFloat3Arrays
+{
+	float* X;
+	float* Y;
+	float* Z;
+};
+
+FORCEINLINE FVectorRegister3 Load3(const FFloat3Arrays& Arrays, uint32 Index)
+{
+	return FVectorRegister3{VectorLoad(Arrays.X + Index), VectorLoad(Arrays.Y + Index), VectorLoad(Arrays.Z + Index)};
+}
+
+FORCEINLINE void Store3(const FFloat3Arrays& Arrays, uint32 Index, const FVectorRegister3& V)
+{
+	VectorStore(V.X, Arrays.X + Index);
+	VectorStore(V.Y, Arrays.Y + Index);
+	VectorStore(V.Z, Arrays.Z + Index);
+}
+
+/** 連続する8要素を偶数番目と奇数番目の4要素ずつに分けて読む */
+FORCEINLINE void LoadEvenOdd(const float* Ptr, VectorRegister& OutEven, VectorRegister& OutOdd)
+{
+	const VectorRegister Lo = VectorLoad(Ptr);
+	const VectorRegister Hi = VectorLoad(Ptr + 4);
+	OutEven = VectorShuffle(Lo, Hi, 0, 2, 0, 2);
+	OutOdd = VectorShuffle(Lo, Hi, 1, 3, 1, 3);
+}
+
+/** LoadEvenOdd()の逆 */
+FORCEINLINE void StoreEvenOdd(float* Ptr, const VectorRegister& Even, const VectorRegister& Odd)
+{
+	VectorStore(VectorSwizzle(VectorShuffle(Even, Odd, 0, 1, 0, 1), 0, 2, 1, 3), Ptr);
+	VectorStore(VectorSwizzle(VectorShuffle(Even, Odd, 2, 3, 2, 3), 0, 2, 1, 3), Ptr + 4);
+}
+
+FORCEINLINE void LoadEvenOdd3(const FFloat3Arrays& Arrays, uint32 Index, FVectorRegister3& OutEven, FVectorRegister3& OutOdd)
+{
+	LoadEvenOdd(Arrays.X + Index, OutEven.X, OutOdd.X);
+	LoadEvenOdd(Arrays.Y + Index, OutEven.Y, OutOdd.Y);
+	LoadEvenOdd(Arrays.Z + Index, OutEven.Z, OutOdd.Z);
+}
+
+FORCEINLINE void StoreEvenOdd3(const FFloat3Arrays& Arrays, uint32 Index, const FVectorRegister3& Even, const FVectorRegister3& Odd)
+{
+	StoreEvenOdd(Arrays.X + Index, Even.X, Odd.X);
+	StoreEvenOdd(Arrays.Y + Index, Even.Y, Odd.Y);
+	StoreEvenOdd(Arrays.Z + Index, Even.Z, Odd.Z);
+}
+
+FFloat3Arrays GetPositions(FClothGridMeshCPUState& State)
+{
+	return FFloat3Arrays{State.PositionX.GetData(), State.PositionY.GetData(), State.PositionZ.GetData()};
+}
+
+FFloat3Arrays GetPrevPositions(FClothGridMeshCPUState& State)
+{
+	return FFloat3Arrays{State.PrevPositionX.GetData(), State.PrevPositionY.GetData(), State.PrevPositionZ.GetData()};
+}
+
+FFloat3Arrays GetExternalAccelerations(FClothGridMeshCPUState& State)
+{
+	return FFloat3Arrays{State.ExternalAccelerationX.GetData(), State.ExternalAccelerationY.GetData(), State.ExternalAccelerationZ.GetData()};
+}
+
+void Integrate(const FGridClothParameters& Params, FClothGridMeshCPUState& State)
+{
+	const FFloat3Arrays Positions = GetPositions(State);
+	const FFloat3Arrays PrevPositions = GetPrevPositions(State);
+	const FFloat3Arrays ExternalAccelerations = GetExternalAccelerations(State);
+	const bool bUseExternalAcceleration = (Params.bUseExternalAcceleration != 0);
+	const FVectorRegister3 UniformAccelerationMove = Set3(Params.AccelerationMove);
+	const VectorRegister SqrIterDeltaTime = VectorSetFloat1(Params.IterDeltaTime * Params.IterDeltaTime);
+	const VectorRegister Decay = VectorSetFloat1(1.0f - Params.Damping);
+	const VectorRegister SmallNumber = VectorSetFloat1(ClothSmallNumber);
+	const FVectorRegister3 PreviousInertia = Set3(Params.PreviousInertia);
+
+	// 端数の頂点はパディングとまとめて処理する。パディングのInvMassは0なので動かない
+	for (uint32 VertIdx = 0; VertIdx < Params.NumVertex; VertIdx += NumLane)
+	{
+		const FVectorRegister3 CurrPos = Load3(Positions, VertIdx);
+		const FVectorRegister3 PrevPos = Load3(PrevPositions, VertIdx);
+		FVectorRegister3 AccelerationMove = UniformAccelerationMove;
+		if (bUseExternalAcceleration)
+		{
+			AccelerationMove = MultiplyAdd3(Load3(ExternalAccelerations, VertIdx), SqrIterDeltaTime, AccelerationMove);
+		}
+		const VectorRegister bMovable = VectorCompareGE(VectorLoad(State.InvMass.GetData() + VertIdx), SmallNumber);
+
+		const FVectorRegister3 NextPos = Add3(MultiplyAdd3(Subtract3(CurrPos, PrevPos), Decay, CurrPos), AccelerationMove);
+		Store3(Positions, VertIdx, Select3(bMovable, NextPos, CurrPos));
+		Store3(PrevPositions, VertIdx, Select3(bMovable, Add3(CurrPos, PreviousInertia), CurrPos));
+	}
+}
+
+struct FWindConstants
+{
+	explicit FWindConstants(const FGridClothParameters& Params)
+		: WindDelta(Set3(Params.WindVelocity * Params.IterDeltaTime))
+		, LiftScale(VectorSetFloat1(Params.LiftCoefficient * Params.FluidDensity / Params.IterDeltaTime))
+		, DragScale(VectorSetFloat1(Params.DragCoefficient * Params.FluidDensity / Params.IterDeltaTime))
+	{
+	}
+
+	FVectorRegister3 WindDelta;
+	VectorRegister LiftScale;
+	VectorRegister DragScale;
+};
+
+/** ClothSimulationGridMesh.usfのCalculateWindImpulse()を4三角形ずつ行う */
+FVectorRegister3 CalculateWindImpulse(const FWindConstants& Constants, const FVectorRegister3& CurrPos0, const FVectorRegister3& CurrPos1, const FVectorRegister3& CurrPos2, const FVectorRegister3& PrevPos0, const FVectorRegister3& PrevPos1, const FVectorRegister3& PrevPos2, const FVectorRegister3& Normal)
+{
+	const VectorRegister Half = VectorSetFloat1(0.5f);
+	const VectorRegister TinyNumber = VectorSetFloat1(ClothTinyNumber);
+
+	const FVectorRegister3 CoGMove = Scale3(Subtract3(Add3(Add3(CurrPos0, CurrPos1), CurrPos2), Add3(Add3(PrevPos0, PrevPos1), PrevPos2)), VectorSetFloat1(1.0f / 3.0f));
+	const FVectorRegister3 Delta = Subtract3(Constants.WindDelta, CoGMove);
+	const VectorRegister DeltaSqrLength = Dot3(Delta, Delta);
+	// 1 / max(|Delta|, SMALL_NUMBER)
+	const FVectorRegister3 DeltaDir = Scale3(Delta, VectorReciprocalSqrtAccurate(VectorMax(DeltaSqrLength, VectorSetFloat1(ClothSmallNumber * ClothSmallNumber))));
+
+	const VectorRegister NormalSqrLength = Dot3(Normal, Normal);
+	const VectorRegister InvNormalLength = VectorReciprocalSqrtAccurate(VectorMax(NormalSqrLength, TinyNumber));
+	const VectorRegister Area = VectorMultiply(VectorMultiply(NormalSqrLength, InvNormalLength), Half);
+	const FVectorRegister3 UnitNormal = Scale3(Normal, InvNormalLength);
+
+	const VectorRegister Cos = Dot3(UnitNormal, DeltaDir);
+	const VectorRegister SqrSin = VectorMax(VectorSubtract(VectorSetFloat1(1.0f), VectorMultiply(Cos, Cos)), VectorZero());
+	const VectorRegister Sin = VectorMultiply(SqrSin, VectorReciprocalSqrtAccurate(VectorMax(SqrSin, TinyNumber)));
+	const VectorRegister Sin2 = VectorMultiply(VectorMultiply(Cos, Sin), Half);
+
+	const FVectorRegister3 LiftDir = Cross3(Cross3(DeltaDir, UnitNormal), DeltaDir);
+	const VectorRegister AreaDeltaSqr = VectorMultiply(Area, DeltaSqrLength);
+	const VectorRegister LiftMagnitude = VectorMultiply(VectorMultiply(AreaDeltaSqr, Constants.LiftScale), Sin2);
+	const VectorRegister DragMagnitude = VectorMultiply(VectorMultiply(AreaDeltaSqr, Constants.DragScale), VectorAbs(Cos));
+	return MultiplyAdd3(LiftDir, LiftMagnitude, Scale3(DeltaDir, DragMagnitude));
+}
+
+FORCEINLINE FVectorRegister3 AddWindImpulse(const FVectorRegister3& CurrPos, const VectorRegister& InvMass, const FVectorRegister3& Impulse, const VectorRegister& bValid)
+{
+	const VectorRegister bMovable = VectorBitwiseAnd(VectorCompareGE(InvMass, VectorSetFloat1(ClothSmallNumber)), bValid);
+	return Select3(bMovable, Add3(CurrPos, Impulse), CurrPos);
+}
+
+void ApplyWind(const FGridClothParameters& Params, FClothGridMeshCPUState& State)
+{
+	const FFloat3Arrays Positions = GetPositions(State);
+	const FFloat3Arrays PrevPositions = GetPrevPositions(State);
+	const float* InvMasses = State.InvMass.GetData();
+	const FWindConstants Constants(Params);
+	const uint32 NumVertexPerRow = Params.NumColumn + 1;
+
+	for (uint32 Color = 0; Color < NumColor; Color++)
+	{
+		const uint32 RowParity = Color / 2;
+		const uint32 ColumnParity = Color % 2;
+		const uint32 NumColorColumn = (Params.NumColumn + 1 - ColumnParity) / 2;
+
+		for (uint32 RowIndex = RowParity; RowIndex < Params.NumRow; RowIndex += 2)
+		{
+			// 同じ色の4セルの頂点は上下の行それぞれで連続する8頂点なので、偶数番目を左、奇数番目を右の頂点として読む。
+			// 無効なレーンは読んだ値をそのまま書き戻す。行が短いと上の行の書き戻しが下の行の頂点にかかるので、必ず上、下の順に書く
+			for (uint32 ColorColumnIndex = 0; ColorColumnIndex < NumColorColumn; ColorColumnIndex += NumLane)
+			{
+				const uint32 UpperVertIdx = RowIndex * NumVertexPerRow + ColorColumnIndex * 2 + ColumnParity;
+				const uint32 LowerVertIdx = UpperVertIdx + NumVertexPerRow;
+				const VectorRegister bValid = GetLaneMask(NumColorColumn - ColorColumnIndex);
+
+				FVectorRegister3 CurrLeftUpper, CurrRightUpper, CurrLeftLower, CurrRightLower;
+				FVectorRegister3 PrevLeftUpper, PrevRightUpper, PrevLeftLower, PrevRightLower;
+				VectorRegister LeftUpperInvMass, RightUpperInvMass, LeftLowerInvMass, RightLowerInvMass;
+				LoadEvenOdd3(Positions, UpperVertIdx, CurrLeftUpper, CurrRightUpper);
+				LoadEvenOdd3(Positions, LowerVertIdx, CurrLeftLower, CurrRightLower);
+				LoadEvenOdd3(PrevPositions, UpperVertIdx, PrevLeftUpper, PrevRightUpper);
+				LoadEvenOdd3(PrevPositions, LowerVertIdx, PrevLeftLower, PrevRightLower);
+				LoadEvenOdd(InvMasses + UpperVertIdx, LeftUpperInvMass, RightUpperInvMass);
+				LoadEvenOdd(InvMasses + LowerVertIdx, LeftLowerInvMass, RightLowerInvMass);
+
+				const FVectorRegister3 RightUpperImpulse = CalculateWindImpulse(Constants,
+					CurrLeftUpper, CurrRightUpper, CurrRightLower,
+					PrevLeftUpper, PrevRightUpper, PrevRightLower,
+					Cross3(Subtract3(CurrLeftUpper, CurrRightUpper), Subtract3(CurrRightLower, CurrRightUpper)));
+				// シェーダの-cross(a, b)と同じ値をcross(b, a)で求める
+				const FVectorRegister3 LeftLowerImpulse = CalculateWindImpulse(Constants,
+					CurrLeftUpper, CurrLeftLower, CurrRightLower,
+					PrevLeftUpper, PrevLeftLower, PrevRightLower,
+					Cross3(Subtract3(CurrRightLower, CurrLeftLower), Subtract3(CurrLeftUpper, CurrLeftLower)));
+				const FVectorRegister3 DiagonalImpulse = Add3(RightUpperImpulse, LeftLowerImpulse);
+
+				StoreEvenOdd3(Positions, UpperVertIdx,
+					AddWindImpulse(CurrLeftUpper, LeftUpperInvMass, DiagonalImpulse, bValid),
+					AddWindImpulse(CurrRightUpper, RightUpperInvMass, RightUpperImpulse, bValid));
+				StoreEvenOdd3(Positions, LowerVertIdx,
+					AddWindImpulse(CurrLeftLower, LeftLowerInvMass, LeftLowerImpulse, bValid),
+					AddWindImpulse(CurrRightLower, RightLowerInvMass, DiagonalImpulse, bValid));
+			}
+		}
+	}
+}
+
+/** ClothSimulationGridMesh.usfのProjectDistanceConstraint()を4エッジずつ行う */
+FORCEINLINE void ProjectDistanceConstraint(FVectorRegister3& InOutPos, const VectorRegister& InvMass, FVectorRegister3& InOutOtherPos, const VectorRegister& OtherInvMass, const VectorRegister& RestLength, const VectorRegister& Stiffness, const VectorRegister& bValid)
+{
+	const VectorRegister SmallNumber = VectorSetFloat1(ClothSmallNumber);
+	const VectorRegister bActive = VectorBitwiseAnd(VectorCompareGT(VectorMax(InvMass, OtherInvMass), SmallNumber), bValid);
+
+	const FVectorRegister3 Edge = Subtract3(InOutOtherPos, InOutPos);
+	// max(|Edge|, SMALL_NUMBER)とその逆数
+	const VectorRegister ClampedSqrLength = VectorMax(Dot3(Edge, Edge), VectorSetFloat1(ClothSmallNumber * ClothSmallNumber));
+	const VectorRegister InvEdgeLength = VectorReciprocalSqrtAccurate(ClampedSqrLength);
+	const VectorRegister Diff = VectorSubtract(VectorMultiply(ClampedSqrLength, InvEdgeLength), RestLength);
+	const FVectorRegister3 EdgeAxis = Scale3(Edge, InvEdgeLength);
+
+	const VectorRegister Correction = VectorMultiply(VectorMultiply(Diff, Stiffness), VectorReciprocalAccurate(VectorMax(VectorAdd(InvMass, OtherInvMass), SmallNumber)));
+	InOutPos = Select3(bActive, MultiplyAdd3(EdgeAxis, VectorMultiply(InvMass, Correction), InOutPos), InOutPos);
+	InOutOtherPos = Select3(bActive, MultiplyAdd3(EdgeAxis, VectorNegate(VectorMultiply(OtherInvMass, Correction)), InOutOtherPos), InOutOtherPos);
+}
+
+void SolveDistanceConstraint(const FGridClothParameters& Params, FClothGridMeshCPUState& State)
+{
+	const FFloat3Arrays Positions = GetPositions(State);
+	const float* InvMasses = State.InvMass.GetData();
+	const uint32 NumVertexPerRow = Params.NumColumn + 1;
+	const VectorRegister Stiffness = VectorSetFloat1(Params.Stiffness);
+
+	// 横のエッジ。同じ色の4エッジの頂点は連続する8頂点なので、偶数番目を左、奇数番目を右の頂点として読む
+	const VectorRegister GridWidth = VectorSetFloat1(Params.GridWidth);
+	for (uint32 Parity = 0; Parity < 2; Parity++)
+	{
+		const uint32 NumColorEdgePerRow = (Params.NumColumn + 1 - Parity) / 2;
+
+		for (uint32 RowIndex = 0; RowIndex <= Params.NumRow; RowIndex++)
+		{
+			for (uint32 ColorColumnIndex = 0; ColorColumnIndex < NumColorEdgePerRow; ColorColumnIndex += NumLane)
+			{
+				const uint32 VertIdx = RowIndex * NumVertexPerRow + ColorColumnIndex * 2 + Parity;
+
+				FVectorRegister3 LeftPos, RightPos;
+				VectorRegister LeftInvMass, RightInvMass;
+				LoadEvenOdd3(Positions, VertIdx, LeftPos, RightPos);
+				LoadEvenOdd(InvMasses + VertIdx, LeftInvMass, RightInvMass);
+
+				ProjectDistanceConstraint(LeftPos, LeftInvMass, RightPos, RightInvMass, GridWidth, Stiffness, GetLaneMask(NumColorEdgePerRow - ColorColumnIndex));
+				StoreEvenOdd3(Positions, VertIdx, LeftPos, RightPos);
+			}
+		}
+	}
+
+	// 縦のエッジ。同じ色の4エッジの頂点は上下の行それぞれで連続する4頂点。ApplyWind()と同じく上、下の順に書く
+	const VectorRegister GridHeight = VectorSetFloat1(Params.GridHeight);
+	for (uint32 Parity = 0; Parity < 2; Parity++)
+	{
+		for (uint32 RowIndex = Parity; RowIndex < Params.NumRow; RowIndex += 2)
+		{
+			for (uint32 ColumnIndex = 0; ColumnIndex < NumVertexPerRow; ColumnIndex += NumLane)
+			{
+				const uint32 UpperVertIdx = RowIndex * NumVertexPerRow + ColumnIndex;
+				const uint32 LowerVertIdx = UpperVertIdx + NumVertexPerRow;
+
+				FVectorRegister3 UpperPos = Load3(Positions, UpperVertIdx);
+				FVectorRegister3 LowerPos = Load3(Positions, LowerVertIdx);
+				const VectorRegister UpperInvMass = VectorLoad(InvMasses + UpperVertIdx);
+				const VectorRegister LowerInvMass = VectorLoad(InvMasses + LowerVertIdx);
+
+				ProjectDistanceConstraint(UpperPos, UpperInvMass, LowerPos, LowerInvMass, GridHeight, Stiffness, GetLaneMask(NumVertexPerRow - ColumnIndex));
+				Store3(Positions, UpperVertIdx, UpperPos);
+				Store3(Positions, LowerVertIdx, LowerPos);
+			}
+		}
+	}
+}
+
+void SolveCollision(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshCPUState& State)
+{
+	const FFloat3Arrays Positions = GetPositions(State);
+
+	for (uint32 CollisionIdx = 0; CollisionIdx < Params.NumSphereCollision; CollisionIdx++)
+	{
+		const FVector4& SphereCenterAndRadius = SphereCollisionParams[CollisionIdx];
+		const float SphereRadius = SphereCenterAndRadius.W + Params.VertexRadius;
+		if (SphereRadius < ClothSmallNumber)
+		{
+			continue;
+		}
+
+		const FVectorRegister3 SphereCenter = Set3(FVector(SphereCenterAndRadius));
+		const VectorRegister Radius = VectorSetFloat1(SphereRadius);
+		const VectorRegister SqrRadius = VectorSetFloat1(SphereRadius * SphereRadius);
+
+		// 頂点ごとに独立なので、シェーダと違いコリジョンごとに全頂点をループしても結果は同じ
+		for (uint32 VertIdx = 0; VertIdx < Params.NumVertex; VertIdx += NumLane)
+		{
+			const FVectorRegister3 Pos = Load3(Positions, VertIdx);
+			const FVectorRegister3 CenterToPos = Subtract3(Pos, SphereCenter);
+			const VectorRegister SqrDistance = Dot3(CenterToPos, CenterToPos);
+			const VectorRegister bInside = VectorCompareGT(SqrRadius, SqrDistance);
+
+			const FVectorRegister3 PushedPos = MultiplyAdd3(CenterToPos, VectorMultiply(Radius, VectorReciprocalSqrtAccurate(VectorMax(SqrDistance, VectorSetFloat1(ClothTinyNumber)))), SphereCenter);
+			Store3(Positions, VertIdx, Select3(bInside, PushedPos, Pos));
+		}
+	}
+}
+
+void InitPaddedArray(TArray<float>& Array, uint32 NumVertex)
+{
+	Array.Reset(NumVertex + NumPaddingVertex);
+	Array.AddZeroed(NumVertex + NumPaddingVertex);
+}
+} // namespace
+
+void FClothGridMeshCPUState::Init(const TArray<FVector4>& Positions)
+{
+	NumVertex = Positions.Num();
+
+	for (TArray<float>* Array : {&PositionX, &PositionY, &PositionZ, &PrevPositionX, &PrevPositionY, &PrevPositionZ, &InvMass, &ExternalAccelerationX, &ExternalAccelerationY, &ExternalAccelerationZ})
+	{
+		InitPaddedArray(*Array, NumVertex);
+	}
+
+	// パディングはInvMass=0で固定された頂点として扱われる
+	for (uint32 VertIdx = 0; VertIdx < NumVertex; VertIdx++)
+	{
+		const FVector4& Position = Positions[VertIdx];
+		PositionX[VertIdx] = PrevPositionX[VertIdx] = Position.X;
+		PositionY[VertIdx] = PrevPositionY[VertIdx] = Position.Y;
+		PositionZ[VertIdx] = PrevPositionZ[VertIdx] = Position.Z;
+		InvMass[VertIdx] = Position.W;
+	}
+}
+
+void FClothGridMeshCPUState::SetExternalAccelerations(uint32 FirstVertex, TArrayView<const FVector> ExternalAccelerations)
+{
+	check(FirstVertex + ExternalAccelerations.Num() <= NumVertex);
+
+	for (int32 i = 0; i < ExternalAccelerations.Num(); i++)
+	{
+		ExternalAccelerationX[FirstVertex + i] = ExternalAccelerations[i].X;
+		ExternalAccelerationY[FirstVertex + i] = ExternalAccelerations[i].Y;
+		ExternalAccelerationZ[FirstVertex + i] = ExternalAccelerations[i].Z;
+	}
+}
+
+void SimulateClothGridMeshCPU(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshCPUState& InOutState)
+{
+	check((uint32)SphereCollisionParams.Num() == Params.NumSphereCollision);
+	check(InOutState.Num() == Params.NumVertex);
+	check(Params.NumVertex == (Params.NumRow + 1) * (Params.NumColumn + 1));
+	check((uint32)InOutState.PositionX.Num() >= Params.NumVertex + NumPaddingVertex);
+
+	for (uint32 IterCount = 0; IterCount < Params.NumIteration; IterCount++)
+	{
+		Integrate(Params, InOutState);
+
+		if (Params.FluidDensity > 0.0f)
+		{
+			ApplyWind(Params, InOutState);
+		}
+
+		SolveDistanceConstraint(Params, InOutState);
+		SolveCollision(Params, SphereCollisionParams, InOutState);
+	}
+}
+
+void GetClothGridMeshCPUResult(uint32 NumRow, uint32 NumColumn, const FClothGridMeshCPUState& State, FClothGridMeshCPUResult& OutResult)
+{
+	const uint32 NumVertex = State.Num();
+	check(NumVertex == (NumRow + 1) * (NumColumn + 1));
+
+	OutResult.Positions.SetNumUninitialized(NumVertex);
+	OutResult.Tangents.SetNumUninitialized(NumVertex * 2);
+
+	for (uint32 VertIdx = 0; VertIdx < NumVertex; VertIdx++)
+	{
+		OutResult.Positions[VertIdx] = State.GetPosition(VertIdx);
+	}
+
+	// 以下はGridMeshTangent.usfと同じ計算
+	for (uint32 VertIdx = 0; VertIdx < NumVertex; VertIdx++)
+	{
+		const uint32 RowIndex = VertIdx / (NumColumn + 1);
+		const uint32 ColumnIndex = VertIdx % (NumColumn + 1);
+		const FVector CurrPos(OutResult.Positions[VertIdx]);
+
+		const FVector RightEdge = (ColumnIndex < NumColumn) ? FVector(OutResult.Positions[VertIdx + 1]) - CurrPos : FVector::ZeroVector;
+		const FVector LowerEdge = (RowIndex < NumRow) ? FVector(OutResult.Positions[VertIdx + NumColumn + 1]) - CurrPos : FVector::ZeroVector;
+		const FVector LeftEdge = (ColumnIndex > 0) ? FVector(OutResult.Positions[VertIdx - 1]) - CurrPos : FVector::ZeroVector;
+		const FVector UpperEdge = (RowIndex > 0) ? FVector(OutResult.Positions[VertIdx - NumColumn - 1]) - CurrPos : FVector::ZeroVector;
+
+		// 左手系
+		FVector SumOfEachEdgeNormal = FVector::ZeroVector;
+		if (ColumnIndex < NumColumn && RowIndex < NumRow)
+		{
+			SumOfEachEdgeNormal += FVector::CrossProduct(RightEdge, LowerEdge).GetUnsafeNormal();
+		}
+		if (RowIndex < NumRow && ColumnIndex > 0)
+		{
+			SumOfEachEdgeNormal += FVector::CrossProduct(LowerEdge, LeftEdge).GetUnsafeNormal();
+		}
+		if (ColumnIndex > 0 && RowIndex > 0)
+		{
+			SumOfEachEdgeNormal += FVector::CrossProduct(LeftEdge, UpperEdge).GetUnsafeNormal();
+		}
+		if (RowIndex > 0 && ColumnIndex < NumColumn)
+		{
+			SumOfEachEdgeNormal += FVector::CrossProduct(UpperEdge, RightEdge).GetUnsafeNormal();
+		}
+
+		const FVector TangentZ = SumOfEachEdgeNormal.GetUnsafeNormal();
+		const FVector TangentX = (FVector(1.0f, 0.0f, 0.0f) - TangentZ.X * TangentZ).GetUnsafeNormal();
+
+		OutResult.Tangents[VertIdx * 2] = FPackedNormal(FVector4(TangentX, 1.0f));
+		OutResult.Tangents[VertIdx * 2 + 1] = FPackedNormal(FVector4(TangentZ, 1.0f));
+	}
+}
+
+namespace
+{
+void MakeVerificationCPUState(const FClothGridMeshReferenceState& ReferenceState, FClothGridMeshCPUState& OutState)
+{
+	OutState.Init(ReferenceState.Positions);
+	OutState.SetExternalAccelerations(0, ReferenceState.ExternalAccelerations);
+}
+
+void BenchmarkCPUSolver(const TArray<FString>& Args)
+{
+	const int32 NumFrame = (Args.Num() > 0) ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 60;
+	const uint32 NumRows[] = {16, 32, 64};
+	const int32 NumCloths[] = {1, 8, 64};
+
+	for (uint32 NumRow : NumRows)
+	{
+		FGridClothParameters Params;
+		TArray<FVector4> SphereCollisionParams;
+		FClothGridMeshReferenceState InitialState;
+		MakeClothGridMeshVerificationSetup(NumRow, true, Params, SphereCollisionParams, InitialState);
+
+		for (int32 NumCloth : NumCloths)
+		{
+			TArray<FClothGridMeshReferenceState> ReferenceStates;
+			ReferenceStates.Init(InitialState, NumCloth);
+			TArray<FClothGridMeshCPUState> States;
+			States.SetNum(NumCloth);
+			for (FClothGridMeshCPUState& State : States)
+			{
+				MakeVerificationCPUState(InitialState, State);
+			}
+
+			double StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrame; Frame++)
+			{
+				for (FClothGridMeshReferenceState& ReferenceState : ReferenceStates)
+				{
+					SimulateClothGridMeshReference(Params, SphereCollisionParams, EClothGridMeshSolveOrder::Colored, ReferenceState);
+				}
+			}
+			const double ScalarSeconds = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrame; Frame++)
+			{
+				for (FClothGridMeshCPUState& State : States)
+				{
+					SimulateClothGridMeshCPU(Params, SphereCollisionParams, State);
+				}
+			}
+			const double SIMDSeconds = FPlatformTime::Seconds() - StartTime;
+
+			// UClothGridMeshComponentと同じく1クロス1タスクにして、全タスクを待つまでを1フレームとする
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrame; Frame++)
+			{
+				FGraphEventArray Tasks;
+				Tasks.Reserve(NumCloth);
+				for (FClothGridMeshCPUState& State : States)
+				{
+					FClothGridMeshCPUState* StatePtr = &State;
+					Tasks.Add(FFunctionGraphTask::CreateAndDispatchWhenReady([&Params, &SphereCollisionParams, StatePtr]()
+					{
+						SimulateClothGridMeshCPU(Params, SphereCollisionParams, *StatePtr);
+					}, TStatId()));
+				}
+				FTaskGraphInterface::Get().WaitUntilTasksComplete(Tasks);
+			}
+			const double TaskSeconds = FPlatformTime::Seconds() - StartTime;
+
+			// 頂点数×イテレーション数/秒
+			const double Work = (double)Params.NumVertex * Params.NumIteration * NumCloth * NumFrame;
+			UE_LOG(LogTemp, Log, TEXT("Cloth CPU solver %ux%u x %d cloths: scalar %.3g, SIMD %.3g, SIMD one task per cloth %.3g vertex iterations/s (%.3f ms/frame)"),
+				NumRow, NumRow, NumCloth, Work / ScalarSeconds, Work / SIMDSeconds, Work / TaskSeconds, TaskSeconds * 1000.0 / NumFrame);
+		}
+	}
+}
+
+FAutoConsoleCommand BenchmarkCPUSolverCommand(
+	TEXT("ShaderSandbox.Cloth.BenchmarkCPUSolver"),
+	TEXT("Measures vertices x iterations per second of the scalar reference, SimulateClothGridMeshCPU() on one thread and in one task graph task per cloth as UClothGridMeshComponent does for 16, 32 and 64 rows and 1, 8 and 64 cloths. Optional argument is the number of frames (default 60)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkCPUSolver)
+);
+} // namespace
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+void CopyToReferenceState(const FClothGridMeshCPUState& State, FClothGridMeshReferenceState& OutReferenceState)
+{
+	for (uint32 VertIdx = 0; VertIdx < State.Num(); VertIdx++)
+	{
+		OutReferenceState.Positions[VertIdx] = State.GetPosition(VertIdx);
+		OutReferenceState.PrevPositions[VertIdx] = FVector4(State.GetPrevPosition(VertIdx), 0.0f);
+	}
+}
+} // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FClothGridMeshCPUSolverTest, "ShaderSandbox.Cloth.CPUSolver", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FClothGridMeshCPUSolverTest::RunTest(const FString& Parameters)
+{
+	// 許容値はGridWidthに対する位置の差。同じ色順なので1フレームの違いはrsqrtなどの丸め誤差だけになる
+	const float Tolerance = 1e-3f;
+	// 丸め誤差はフレームを重ねると拡大し、64x64の300フレームでは1e-3を超える（エンジン外のSSEビルドで約1.1e-3）ので、累積の差は別の許容値で見る
+	const float AccumulatedTolerance = 1e-2f;
+	const uint32 NumRows[] = {16, 32, 64};
+
+	FClothGridMeshCPUState State;
+	VerifyClothGridMeshSolver(*this, TEXT("CPU"), EClothGridMeshSolveOrder::Colored, NumRows, Tolerance, AccumulatedTolerance,
+		[&State](const FClothGridMeshReferenceState& InitialState)
+		{
+			MakeVerificationCPUState(InitialState, State);
+		},
+		[&State](const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshReferenceState& InOutState)
+		{
+			SimulateClothGridMeshCPU(Params, SphereCollisionParams, State);
+			CopyToReferenceState(State, InOutState);
+		});
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -17,7 +17,7 @@
 #include "Cloth/ClothManager.h"
 #include "Cloth/SphereCollisionComponent.h"
 
-//TODO:FDeformGridMeshSceneProxyƃ\[XR[h̋ʉłȂ
+//TODO:FDeformGridMeshSceneProxyとソースコードの共通化ができないか
 
 /** almost all is copy of FCustomMeshSceneProxy. */
 class FClothGridMeshSceneProxy final : public FPrimitiveSceneProxy
@@ -42,20 +42,19 @@ public:
 
 		for (int32 VertIdx = 0; VertIdx < Component->GetVertices().Num(); VertIdx++)
 		{
-			// TODO:ColorTangent͂Ƃ肠FDynamicMeshVertex̃ftHgl܂ɂ
+			// TODO:ColorとTangentはとりあえずFDynamicMeshVertexのデフォルト値まかせにする
 			Vertices.Emplace(Component->GetVertices()[VertIdx]);
 			InvMasses.Emplace(Component->GetVertices()[VertIdx].W);
 		}
-		VertexBuffers.InitFromClothVertexAttributes(&VertexFactory, Vertices, InvMasses, Component->GetAccelerationMoves());
+		VertexBuffers.InitFromClothVertexAttributes(&VertexFactory, Vertices, InvMasses, Component->GetExternalAccelerations(), Component->IsCPUBackend());
 
 		// Enqueue initialization of render resource
-		BeginInitResource(&VertexBuffers.PositionVertexBuffer);
+		// 位置、前フレームの位置、加速度はGClothVertexPoolの中に、CPUバックエンドの位置とタンジェントはクロス専用のダイナミックバッファにあるので、
+		// どちらもInitFromClothVertexAttributes()で確保している。
+		// バーテックスファクトリはプールの範囲が決まってからFClothVertexBuffersが初期化する
 		BeginInitResource(&VertexBuffers.DeformableMeshVertexBuffer);
 		BeginInitResource(&VertexBuffers.ColorVertexBuffer);
-		BeginInitResource(&VertexBuffers.PrevPositionVertexBuffer);
-		BeginInitResource(&VertexBuffers.AccelerationMoveVertexBuffer);
 		BeginInitResource(&IndexBuffer);
-		BeginInitResource(&VertexFactory);
 
 		// Grab material
 		Material = Component->GetMaterial(0);
@@ -67,11 +66,12 @@ public:
 
 	virtual ~FClothGridMeshSceneProxy()
 	{
+		// 範囲を返したあとはプールから再バインドのコールバックが呼ばれないので、自分のバーテックスファクトリの解放より先に返す
+		VertexBuffers.ReleasePoolRange();
 		VertexBuffers.PositionVertexBuffer.ReleaseResource();
+		VertexBuffers.ReleaseCPUBackendResources();
 		VertexBuffers.DeformableMeshVertexBuffer.ReleaseResource();
 		VertexBuffers.ColorVertexBuffer.ReleaseResource();
-		VertexBuffers.PrevPositionVertexBuffer.ReleaseResource();
-		VertexBuffers.AccelerationMoveVertexBuffer.ReleaseResource();
 		IndexBuffer.ReleaseResource();
 		VertexFactory.ReleaseResource();
 	}
@@ -80,6 +80,12 @@ public:
 	{
 		QUICK_SCOPE_CYCLE_COUNTER( STAT_ClothGridMeshSceneProxy_GetDynamicMeshElements );
 
+		// 最初のシミュレーションでプールの範囲が決まるまではバーテックスファクトリがない
+		if (!VertexFactory.IsInitialized())
+		{
+			return;
+		}
+
 		const bool bWireframe = AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
 
 		auto WireframeMaterialInstance = new FColoredMaterialRenderProxy(
@@ -125,7 +131,7 @@ public:
 				BatchElement.FirstIndex = 0;
 				BatchElement.NumPrimitives = IndexBuffer.Indices.Num() / 3;
 				BatchElement.MinVertexIndex = 0;
-				BatchElement.MaxVertexIndex = VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
+				BatchElement.MaxVertexIndex = VertexBuffers.GetNumVertex() - 1;
 				Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
 				Mesh.Type = PT_TriangleList;
 				Mesh.DepthPriorityGroup = SDPG_World;
@@ -163,13 +169,24 @@ public:
 
 	uint32 GetAllocatedSize( void ) const { return( FPrimitiveSceneProxy::GetAllocatedSize() ); }
 
+	/** 変更された範囲の外力だけをプールに送る */
+	void UpdateExternalAccelerations(uint32 FirstVertex, const TArray<FVector>& ExternalAccelerations)
+	{
+		VertexBuffers.UpdateExternalAccelerations(FirstVertex, ExternalAccelerations);
+	}
+
 	void EnqueClothGridMeshRenderCommand(UClothGridMeshComponent* Component, FClothGridMeshDeformCommand& Command)
 	{
-		VertexBuffers.SetAccelerationMoves(Component->GetAccelerationMoves());
 		Command.VertexBuffers = &VertexBuffers;
 		AClothManager::GetInstance()->EnqueueSimulateClothCommand(Command);
 	}
 
+	/** CPUバックエンドの結果で位置とタンジェントのダイナミックバッファを上書きする。レンダースレッドで呼ぶ */
+	void UpdateFromCPUResult(FRHICommandListImmediate& RHICmdList, const FClothGridMeshCPUResult& Result)
+	{
+		VertexBuffers.WriteCPUResult(Result.Positions, Result.Tangents);
+	}
+
 private:
 
 	UMaterialInterface* Material;
@@ -192,16 +209,15 @@ UClothGridMeshComponent::~UClothGridMeshComponent()
 
 void UClothGridMeshComponent::InitClothSettings(int32 NumRow, int32 NumColumn, float GridWidth, float GridHeight, float Stiffness, float Damping, float LinearDrag, float FluidDensity, float LiftCoefficient, float DragCoefficient, float VertexRadius, int32 NumIteration)
 {
-	// ̕ϐlog(x)ŕێĂ̂́Â̂σt[[gΉy悷̂ŁAݏvZ
-	// exp(log(x)*y)xptH[}X
-	// log(1-x)ŕێĂ̂́A[0,1)͈̔͂̕ϐ0t߂̐xdĂ̂
+	// 多くの変数がlog(x)で保持しているのは、のちのち可変フレームレート対応でy乗するので、累乗計算をやるより
+	// exp(log(x)*y)をやった方が精度もパフォーマンスもいいから
+	// log(1-x)で保持しているのは、[0,1)の範囲の変数で0付近の精度を重視しているので
 	_NumRow = NumRow;
 	_NumColumn = NumColumn;
 	_GridWidth = GridWidth;
 	_GridHeight = GridHeight;
 	_Vertices.Reset((NumRow + 1) * (NumColumn + 1));
-	_Indices.Reset(NumRow * NumColumn * 2 * 3); // ЂƂ̃Obhɂ3TriangleA6̒_CfbNXw肪
-	_AccelerationMoves.Reset((NumRow + 1) * (NumColumn + 1));
+	_Indices.Reset(NumRow * NumColumn * 2 * 3); // ひとつのグリッドには3つのTriangle、6つの頂点インデックス指定がある
 	_LogStiffness = FMath::Loge(1.0f - Stiffness);
 	_LogDamping = FMath::Loge(1.0f - Damping);
 	_LinearLogDrag = FMath::Loge(1.0f - LinearDrag);
@@ -211,17 +227,26 @@ void UClothGridMeshComponent::InitClothSettings(int32 NumRow, int32 NumColumn, f
 	_VertexRadius = VertexRadius;
 	_NumIteration = NumIteration;
 
+	WaitCPUSimulation();
+	_bCPUBackend = (SimulationBackend == EClothSimulationBackend::CPU);
+	_CPUResult.Reset();
+	_CPUResultPool.Reset();
+
+	_ExternalAccelerations.Reset();
+	_DirtyExternalAccelerationBegin = 0;
+	_DirtyExternalAccelerationEnd = 0;
+
 	_PrevLocation = GetComponentLocation();
 	_CurLinearVelocity = FVector::ZeroVector;
 	_PrevLinearVelocity = FVector::ZeroVector;
 
-	//TODO:Ƃ肠y=0̈sڂ̂InvMass=0
+	//TODO:とりあえずy=0の一行目のみInvMass=0に
 	for (int32 x = 0; x < NumColumn + 1; x++)
 	{
 		_Vertices.Emplace(x * GridWidth, 0.0f, 0.0f, 0.0f);
 	}
 
-	//TODO:Ƃ肠y>0̓sڈȍ~InvMass=1
+	//TODO:とりあえずy>0の二行目以降はInvMass=1に
 	for (int32 y = 1; y < NumRow + 1; y++)
 	{
 		for (int32 x = 0; x < NumColumn + 1; x++)
@@ -230,17 +255,6 @@ void UClothGridMeshComponent::InitClothSettings(int32 NumRow, int32 NumColumn, f
 		}
 	}
 
-	float IterDeltaTime = 1.0f / FGridClothParameters::BASE_FREQUENCY;
-	float SqrIterDeltaTime = IterDeltaTime * IterDeltaTime;
-
-	for (int32 y = 0; y < NumRow + 1; y++)
-	{
-		for (int32 x = 0; x < NumColumn + 1; x++)
-		{
-			_AccelerationMoves.Emplace(FGridClothParameters::GRAVITY * SqrIterDeltaTime);
-		}
-	}
-
 	for (int32 Row = 0; Row < NumRow; Row++)
 	{
 		for (int32 Column = 0; Column < NumColumn; Column++)
@@ -255,6 +269,11 @@ void UClothGridMeshComponent::InitClothSettings(int32 NumRow, int32 NumColumn, f
 		}
 	}
 
+	if (_bCPUBackend)
+	{
+		_CPUState.Init(_Vertices);
+	}
+
 	MarkRenderStateDirty();
 	UpdateBounds();
 
@@ -263,10 +282,15 @@ void UClothGridMeshComponent::InitClothSettings(int32 NumRow, int32 NumColumn, f
 	{
 		UE_LOG(LogTemp, Error, TEXT("UClothGridMeshComponent::OnRegister() There is no AClothManager. So failed to register this cloth mesh."));
 	}
-	else
+	else if (!_bCPUBackend)
 	{
+		// AClothManagerは登録されたクロスの数だけコマンドが揃ったらディスパッチするので、GPUでシミュレーションするクロスだけ登録する
 		Manager->RegisterClothMesh(this);
 	}
+	else
+	{
+		Manager->UnregisterClothMesh(this);
+	}
 }
 
 void UClothGridMeshComponent::IgnoreVelocityDiscontinuityNextFrame()
@@ -274,6 +298,65 @@ void UClothGridMeshComponent::IgnoreVelocityDiscontinuityNextFrame()
 	_IgnoreVelocityDiscontinuityNextFrame = true;
 }
 
+void UClothGridMeshComponent::SetExternalAccelerations(int32 FirstVertexIndex, const TArray<FVector>& Accelerations)
+{
+	const int32 NumVertex = _Vertices.Num();
+	if (FirstVertexIndex < 0 || FirstVertexIndex + Accelerations.Num() > NumVertex)
+	{
+		UE_LOG(LogTemp, Error, TEXT("UClothGridMeshComponent::SetExternalAccelerations() Range [%d, %d) is out of %d vertices."), FirstVertexIndex, FirstVertexIndex + Accelerations.Num(), NumVertex);
+		return;
+	}
+
+	if (Accelerations.Num() == 0)
+	{
+		return;
+	}
+
+	if (_ExternalAccelerations.Num() == 0)
+	{
+		// 初めて使うときはシミュレーション側の値が前回のClearExternalAccelerations()の前のままかもしれないので全体を送る
+		_ExternalAccelerations.SetNumZeroed(NumVertex);
+		_DirtyExternalAccelerationBegin = 0;
+		_DirtyExternalAccelerationEnd = NumVertex;
+	}
+
+	FMemory::Memcpy(&_ExternalAccelerations[FirstVertexIndex], Accelerations.GetData(), Accelerations.Num() * Accelerations.GetTypeSize());
+
+	if (_DirtyExternalAccelerationBegin == _DirtyExternalAccelerationEnd)
+	{
+		_DirtyExternalAccelerationBegin = FirstVertexIndex;
+		_DirtyExternalAccelerationEnd = FirstVertexIndex + Accelerations.Num();
+	}
+	else
+	{
+		_DirtyExternalAccelerationBegin = FMath::Min(_DirtyExternalAccelerationBegin, FirstVertexIndex);
+		_DirtyExternalAccelerationEnd = FMath::Max(_DirtyExternalAccelerationEnd, FirstVertexIndex + Accelerations.Num());
+	}
+}
+
+void UClothGridMeshComponent::ClearExternalAccelerations()
+{
+	// bUseExternalAccelerationが0になりシミュレーション側の値は読まれなくなるので、送り直さない
+	_ExternalAccelerations.Reset();
+	_DirtyExternalAccelerationBegin = 0;
+	_DirtyExternalAccelerationEnd = 0;
+}
+
+bool UClothGridMeshComponent::ConsumeDirtyExternalAccelerations(uint32& OutFirstVertex, TArray<FVector>& OutExternalAccelerations)
+{
+	if (_DirtyExternalAccelerationBegin == _DirtyExternalAccelerationEnd)
+	{
+		return false;
+	}
+
+	OutFirstVertex = _DirtyExternalAccelerationBegin;
+	OutExternalAccelerations.Reset(_DirtyExternalAccelerationEnd - _DirtyExternalAccelerationBegin);
+	OutExternalAccelerations.Append(&_ExternalAccelerations[_DirtyExternalAccelerationBegin], _DirtyExternalAccelerationEnd - _DirtyExternalAccelerationBegin);
+	_DirtyExternalAccelerationBegin = 0;
+	_DirtyExternalAccelerationEnd = 0;
+	return true;
+}
+
 FPrimitiveSceneProxy* UClothGridMeshComponent::CreateSceneProxy()
 {
 	FPrimitiveSceneProxy* Proxy = NULL;
@@ -284,19 +367,141 @@ FPrimitiveSceneProxy* UClothGridMeshComponent::CreateSceneProxy()
 	return Proxy;
 }
 
+const FClothGridMeshCPUState* UClothGridMeshComponent::GetCPUState()
+{
+	if (!_bCPUBackend)
+	{
+		return nullptr;
+	}
+
+	WaitCPUSimulation();
+	return &_CPUState;
+}
+
+void UClothGridMeshComponent::OnUnregister()
+{
+	// タスクはthisの_CPUStateを書き換えるので、破棄される前に待つ
+	WaitCPUSimulation();
+	Super::OnUnregister();
+}
+
+void UClothGridMeshComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (_bCPUBackend)
+	{
+		SimulateOnCPU();
+	}
+}
+
+void UClothGridMeshComponent::SimulateOnCPU()
+{
+	WaitCPUSimulation();
+
+	if (AClothManager::GetInstance() == nullptr || GetDeltaTime() <= 0.0f || _CPUState.Num() == 0)
+	{
+		return;
+	}
+
+	FClothGridMeshDeformCommand Command;
+	MakeDeformCommand(Command);
+
+	uint32 FirstDirtyVertex = 0;
+	TArray<FVector> DirtyExternalAccelerations;
+	if (ConsumeDirtyExternalAccelerations(FirstDirtyVertex, DirtyExternalAccelerations))
+	{
+		_CPUState.SetExternalAccelerations(FirstDirtyVertex, DirtyExternalAccelerations);
+	}
+
+	// レンダースレッドがまだ参照している結果は上書きできないので、プールのほかに参照のないものを使い回す。
+	// プールはレンダースレッドの遅れのぶんだけの数で増えなくなり、配列も前回の容量のまま再利用される
+	TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe>* FreeResult = _CPUResultPool.FindByPredicate(
+		[](const TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe>& PooledResult)
+		{
+			return PooledResult.IsUnique();
+		});
+	if (FreeResult != nullptr)
+	{
+		_CPUResult = *FreeResult;
+	}
+	else
+	{
+		_CPUResult = MakeShared<FClothGridMeshCPUResult, ESPMode::ThreadSafe>();
+		_CPUResultPool.Add(_CPUResult);
+	}
+
+	// GPUで1クロス1グループだったのと同じく1クロス1タスクにし、ゲームスレッドのほかのTickと並行して進める
+	FClothGridMeshCPUState* State = &_CPUState;
+	TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe> Result = _CPUResult;
+	const FGridClothParameters Params = Command.Params;
+	TArray<FVector4> SphereCollisionParams = MoveTemp(Command.SphereCollisionParams);
+	// CPUソルバはクロスのローカル座標のスフィアを受け取るので、GPUではシェーダでしている変換をここでする
+	const FTransform& ComponentTransform = GetComponentTransform();
+	for (FVector4& SphereCollisionParam : SphereCollisionParams)
+	{
+		SphereCollisionParam = FVector4(ComponentTransform.InverseTransformPosition(FVector(SphereCollisionParam)), SphereCollisionParam.W);
+	}
+	_CPUSimulationTask = FFunctionGraphTask::CreateAndDispatchWhenReady([State, Result, Params, SphereCollisionParams = MoveTemp(SphereCollisionParams)]()
+	{
+		SimulateClothGridMeshCPU(Params, SphereCollisionParams, *State);
+		GetClothGridMeshCPUResult(Params.NumRow, Params.NumColumn, *State, *Result);
+	}, TStatId());
+}
+
+void UClothGridMeshComponent::WaitCPUSimulation()
+{
+	if (_CPUSimulationTask.IsValid())
+	{
+		if (!_CPUSimulationTask->IsComplete())
+		{
+			FTaskGraphInterface::Get().WaitUntilTaskCompletes(_CPUSimulationTask);
+		}
+		_CPUSimulationTask.SafeRelease();
+	}
+}
+
 void UClothGridMeshComponent::SendRenderDynamicData_Concurrent()
 {
 	//SCOPE_CYCLE_COUNTER(STAT_ClothGridMeshCompUpdate);
 	Super::SendRenderDynamicData_Concurrent();
 
+	if (_bCPUBackend)
+	{
+		// シミュレーションはTickComponent()で始めている
+		WaitCPUSimulation();
+
+		if (SceneProxy != nullptr && _CPUResult.IsValid() && _CPUResult->Positions.Num() > 0)
+		{
+			FClothGridMeshSceneProxy* ClothSceneProxy = (FClothGridMeshSceneProxy*)SceneProxy;
+			TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe> CPUResult = _CPUResult;
+			ENQUEUE_RENDER_COMMAND(UpdateClothGridMeshFromCPUResult)(
+				[ClothSceneProxy, CPUResult](FRHICommandListImmediate& RHICmdList)
+				{
+					ClothSceneProxy->UpdateFromCPUResult(RHICmdList, *CPUResult);
+				});
+		}
+		return;
+	}
+
 	AClothManager* ClothManager = AClothManager::GetInstance();
 
-	if (SceneProxy != nullptr && ClothManager != nullptr) // ClothManager͑retrun̂߂Ɏ擾Ă邾
+	if (SceneProxy != nullptr && ClothManager != nullptr) // ClothManagerは早期retrunのために取得しているだけ
 	{
 		FClothGridMeshDeformCommand Command;
 		MakeDeformCommand(Command);
 
-		((FClothGridMeshSceneProxy*)SceneProxy)->EnqueClothGridMeshRenderCommand(this, Command);
+		FClothGridMeshSceneProxy* ClothSceneProxy = (FClothGridMeshSceneProxy*)SceneProxy;
+
+		// 外力が変わったときだけ、その範囲をシミュレーションのコマンドより先に送る
+		uint32 FirstDirtyVertex = 0;
+		TArray<FVector> DirtyExternalAccelerations;
+		if (ConsumeDirtyExternalAccelerations(FirstDirtyVertex, DirtyExternalAccelerations))
+		{
+			ClothSceneProxy->UpdateExternalAccelerations(FirstDirtyVertex, DirtyExternalAccelerations);
+		}
+
+		ClothSceneProxy->EnqueClothGridMeshRenderCommand(this, Command);
 	}
 }
 
@@ -323,19 +528,13 @@ void UClothGridMeshComponent::MakeDeformCommand(FClothGridMeshDeformCommand& Com
 	float LinearAlpha = 0.5f * (_NumIteration + 1) / _NumIteration;
 
 	const FVector& LinearVelocityDiff = _CurLinearVelocity - _PrevLinearVelocity;
-	const FVector& CurInertia = -LinearVelocityDiff * LinearAlpha / GetDeltaTime(); // 񊵐ñNX̍Wł̓[hWł̉xƂ͋t̉x
+	const FVector& CurInertia = -LinearVelocityDiff * LinearAlpha / GetDeltaTime(); // 非慣性系のクロスの座標ではワールド座標での加速度とは逆方向の加速度がかかる
 	_PreviousInertia = -LinearVelocityDiff * (1.0f - LinearAlpha) / GetDeltaTime() * SqrIterDeltaTime;
 
 	const FVector& Translation = _CurLinearVelocity * IterDeltaTime;
 	const FVector& LinearDrag = Translation * (1.0f - FMath::Exp(_LinearLogDrag * DampStiffnessExp));
 
-	// TODO:_AccelerationMovesݒ肵Ă̂͊֐ɍĂȂ
-	for (uint32 i = 0; i < (_NumRow + 1) * (_NumColumn + 1); i++)
-	{
-		_AccelerationMoves[i] = (CurInertia + FGridClothParameters::GRAVITY) * SqrIterDeltaTime - LinearDrag;
-	}
-
-	// NXWnŎ󂯂镗xBt[AO[oȕ͂ɂ̓_Ȃ炬Z
+	// クロス座標系で受ける風速度。毎フレーム、グローバルな風力にはランダムなゆらぎを乗算する
 	const FVector& WindVeclocity = ClothManager->WindVelocity* FMath::FRandRange(0.0f, 2.0f) - _CurLinearVelocity;
 
 	Command.Params.NumIteration = _NumIteration;
@@ -347,22 +546,28 @@ void UClothGridMeshComponent::MakeDeformCommand(FClothGridMeshDeformCommand& Com
 	Command.Params.Stiffness = (1.0f - FMath::Exp(_LogStiffness * DampStiffnessExp));
 	Command.Params.Damping = (1.0f - FMath::Exp(_LogDamping * DampStiffnessExp));
 	Command.Params.PreviousInertia = _PreviousInertia;
+	// 重力、慣性力、空気抵抗は全頂点で同じなので頂点ごとのバッファではなく定数で渡す
+	Command.Params.AccelerationMove = (CurInertia + FGridClothParameters::GRAVITY) * SqrIterDeltaTime - LinearDrag;
+	Command.Params.bUseExternalAcceleration = (_ExternalAccelerations.Num() > 0) ? 1 : 0;
 	Command.Params.WindVelocity = WindVeclocity;
-	//ñp[^̓VF[_̌vZMKSPʌnȂ̂łɓFluidDensity͂˂΂Ȃ炸[U͂ɂ̂ŁAMKSPʌnœꂳĂĂŃXP[
+	//風系のパラメータはシェーダの計算がMKS単位系基準なのでそれに入れるFluidDensityはすごく小さくせねばならずユーザが入力しにくいので、MKS単位系で入れさせておいてここでスケールする
 	Command.Params.FluidDensity = _FluidDensity / (100.0f * 100.0f * 100.0f);
 	Command.Params.LiftCoefficient = (1.0f - FMath::Exp(_LiftLogCoefficient * DampStiffnessExp)) / 100.0f;
 	Command.Params.DragCoefficient = (1.0f - FMath::Exp(_DragLogCoefficient * DampStiffnessExp)) / 100.0f;
 	Command.Params.IterDeltaTime = IterDeltaTime;
 	Command.Params.VertexRadius = _VertexRadius;
 
-	TArray<USphereCollisionComponent*> SphereCollisions = ClothManager->GetSphereCollisions();
+	const FMatrix WorldToLocal = GetComponentTransform().ToInverseMatrixWithScale();
+	Command.Params.WorldToLocalX = FVector4(WorldToLocal.M[0][0], WorldToLocal.M[1][0], WorldToLocal.M[2][0], WorldToLocal.M[3][0]);
+	Command.Params.WorldToLocalY = FVector4(WorldToLocal.M[0][1], WorldToLocal.M[1][1], WorldToLocal.M[2][1], WorldToLocal.M[3][1]);
+	Command.Params.WorldToLocalZ = FVector4(WorldToLocal.M[0][2], WorldToLocal.M[1][2], WorldToLocal.M[2][2], WorldToLocal.M[3][2]);
+
+	const TArray<USphereCollisionComponent*>& SphereCollisions = ClothManager->GetSphereCollisions();
 	Command.Params.NumSphereCollision = SphereCollisions.Num();
+	Command.SphereCollisionParams.Reset(SphereCollisions.Num());
 
-	for (uint32 i = 0; i < Command.Params.NumSphereCollision; i++)
+	for (USphereCollisionComponent* SphereCollision : SphereCollisions)
 	{
-		Command.Params.SphereCollisionParams[i] = FVector4(
-			GetComponentTransform().InverseTransformPosition(SphereCollisions[i]->GetComponentLocation()),
-			SphereCollisions[i]->GetRadius()
-		);
+		Command.SphereCollisionParams.Emplace(SphereCollision->GetComponentLocation(), SphereCollision->GetRadius());
 	}
 }
@@ -1,69 +1,20 @@
 #include "Cloth/ClothGridMeshDeformer.h"
 #include "Cloth/ClothVertexBuffers.h"
+#include "Cloth/ClothVertexPool.h"
 #include "GlobalShader.h"
 #include "RHIResources.h"
 #include "RenderGraphBuilder.h"
 #include "RenderGraphUtils.h"
 
-class FClothMeshCopyToWorkBufferCS : public FGlobalShader
-{
-	DECLARE_GLOBAL_SHADER(FClothMeshCopyToWorkBufferCS);
-	SHADER_USE_PARAMETER_STRUCT(FClothMeshCopyToWorkBufferCS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, VertexIndexOffset)
-		SHADER_PARAMETER(uint32, NumVertex)
-		SHADER_PARAMETER_SRV(Buffer<float>, AccelerationMoveVertexBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkAccelerationMoveBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, PrevPositionVertexBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPrevPositionBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, PositionVertexBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPositionBuffer)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
-	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
-	}
-};
-
-IMPLEMENT_GLOBAL_SHADER(FClothMeshCopyToWorkBufferCS, "/Plugin/ShaderSandbox/Private/ClothMeshCopy.usf", "CopyToWorkBuffer", SF_Compute);
-
-class FClothMeshCopyFromWorkBufferCS : public FGlobalShader
-{
-	DECLARE_GLOBAL_SHADER(FClothMeshCopyFromWorkBufferCS);
-	SHADER_USE_PARAMETER_STRUCT(FClothMeshCopyFromWorkBufferCS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, VertexIndexOffset)
-		SHADER_PARAMETER(uint32, NumVertex)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, PrevPositionVertexBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPrevPositionBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, PositionVertexBuffer)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPositionBuffer)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
-	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
-	}
-};
-
-IMPLEMENT_GLOBAL_SHADER(FClothMeshCopyFromWorkBufferCS, "/Plugin/ShaderSandbox/Private/ClothMeshCopy.usf", "CopyFromWorkBuffer", SF_Compute);
-
 class FClothSimulationCS : public FGlobalShader
 {
-public:
-	static const uint32 MAX_CLOTH_MESH = 16;
-
 	DECLARE_GLOBAL_SHADER(FClothSimulationCS);
 	SHADER_USE_PARAMETER_STRUCT(FClothSimulationCS, FGlobalShader);
 
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER_SRV(StructuredBuffer<FGridClothParameters>, Params)
-		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkAccelerationMoveVertexBuffer)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float4>, SphereCollisionParams)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkExternalAccelerationVertexBuffer)
 		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPrevPositionVertexBuffer)
 		SHADER_PARAMETER_UAV(RWBuffer<float>, WorkPositionVertexBuffer)
 	END_SHADER_PARAMETER_STRUCT()
@@ -86,6 +37,7 @@ class FClothGridMeshTangentCS : public FGlobalShader
 		SHADER_PARAMETER(uint32, NumRow)
 		SHADER_PARAMETER(uint32, NumColumn)
 		SHADER_PARAMETER(uint32, NumVertex)
+		SHADER_PARAMETER(uint32, VertexIndexOffset)
 		SHADER_PARAMETER_UAV(RWBuffer<float>, InPositionVertexBuffer)
 		SHADER_PARAMETER_UAV(RWBuffer<float4>, OutTangentVertexBuffer)
 	END_SHADER_PARAMETER_STRUCT()
@@ -99,9 +51,34 @@ public:
 
 IMPLEMENT_GLOBAL_SHADER(FClothGridMeshTangentCS, "/Plugin/ShaderSandbox/Private/GridMeshTangent.usf", "MainCS", SF_Compute);
 
+#if ENGINE_MINOR_VERSION < 26
+// 4.25以前はバーテックスファクトリがプールの範囲を直接読めないので、シミュレーション結果をクロス専用の位置バッファへコピーする
+class FClothPositionCopyCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FClothPositionCopyCS);
+	SHADER_USE_PARAMETER_STRUCT(FClothPositionCopyCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, SrcVertexIndexOffset)
+		SHADER_PARAMETER(uint32, NumVertex)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, SrcPositionBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, OutPositionVertexBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FClothPositionCopyCS, "/Plugin/ShaderSandbox/Private/ClothMeshCopy.usf", "CopyPositionsFromPool", SF_Compute);
+#endif
+
 FClothGridMeshDeformer::~FClothGridMeshDeformer()
 {
 	ClothParameterStructuredBuffer.ReleaseResource();
+	SphereCollisionStructuredBuffer.ReleaseResource();
 }
 
 void FClothGridMeshDeformer::EnqueueDeformCommand(const FClothGridMeshDeformCommand& Command)
@@ -109,7 +86,7 @@ void FClothGridMeshDeformer::EnqueueDeformCommand(const FClothGridMeshDeformComm
 	DeformCommandQueue.Add(Command);
 }
 
-void FClothGridMeshDeformer::FlushDeformCommandQueue(FRHICommandListImmediate& RHICmdList, FRHIUnorderedAccessView* WorkAccelerationMoveVertexBufferUAV, FRHIUnorderedAccessView* WorkPrevVertexBufferUAV, FRHIUnorderedAccessView* WorkVertexBufferUAV)
+void FClothGridMeshDeformer::FlushDeformCommandQueue(FRHICommandListImmediate& RHICmdList)
 {
 	FRDGBuilder GraphBuilder(RHICmdList);
 
@@ -119,74 +96,59 @@ void FClothGridMeshDeformer::FlushDeformCommandQueue(FRHICommandListImmediate& R
 	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
 #endif
 
+	// 前のフレームからの確保と解放をここで反映する。コンパクションのコピーもこのグラフに積まれ、シミュレーションより前に実行される
+	GClothVertexPool.ApplyPendingChanges(GraphBuilder);
+
 	uint32 NumClothMesh = DeformCommandQueue.Num();
-	// TODO:ǂŃof[V
+	// TODO:どこかでバリデーションしたい
 	check(NumClothMesh > 0);
-	check(NumClothMesh <= FClothSimulationCS::MAX_CLOTH_MESH);
-
-	// TODO:֐悤
-	{
-		uint32 Offset = 0;
-		for (uint32 MeshIdx = 0; MeshIdx < NumClothMesh; MeshIdx++)
-		{
-			TShaderMapRef<FClothMeshCopyToWorkBufferCS> ClothMeshCopyToWorkBufferCS(ShaderMap);
-			FClothMeshCopyToWorkBufferCS::FParameters* ClothCopyToWorkParams = GraphBuilder.AllocParameters<FClothMeshCopyToWorkBufferCS::FParameters>();
-
-			const FClothGridMeshDeformCommand& DeformCommand = DeformCommandQueue[MeshIdx];
-			ClothCopyToWorkParams->VertexIndexOffset = Offset;
-			Offset += DeformCommand.Params.NumVertex;
-			ClothCopyToWorkParams->NumVertex = DeformCommand.Params.NumVertex;
-			ClothCopyToWorkParams->AccelerationMoveVertexBuffer = DeformCommand.VertexBuffers->AccelerationMoveVertexBuffer.GetSRV();
-			ClothCopyToWorkParams->WorkAccelerationMoveBuffer = WorkAccelerationMoveVertexBufferUAV;
-			ClothCopyToWorkParams->PrevPositionVertexBuffer = DeformCommand.VertexBuffers->PrevPositionVertexBuffer.GetUAV();
-			ClothCopyToWorkParams->WorkPrevPositionBuffer = WorkPrevVertexBufferUAV;
-			ClothCopyToWorkParams->PositionVertexBuffer = DeformCommand.VertexBuffers->PositionVertexBuffer.GetUAV();
-			ClothCopyToWorkParams->WorkPositionBuffer = WorkVertexBufferUAV;
-
-			FComputeShaderUtils::AddPass(
-				GraphBuilder,
-				RDG_EVENT_NAME("ClothMeshCopyToWorkBuffer"),
-				ERDGPassFlags::AsyncCompute,
-#if ENGINE_MINOR_VERSION >= 25
-				ClothMeshCopyToWorkBufferCS,
-#else
-				*ClothMeshCopyToWorkBufferCS,
-#endif
-				ClothCopyToWorkParams,
-				FIntVector(1, 1, 1)
-			);
-		}
-	}
+	// 1クロス1グループでディスパッチするので、グループ数の上限だけが制限
+	check(NumClothMesh <= 65535);
 
 	{
 		FClothSimulationCS::FParameters* ClothSimParams = GraphBuilder.AllocParameters<FClothSimulationCS::FParameters>();
 
 		TArray<FGridClothParameters> ClothParams;
 		ClothParams.Reserve(NumClothMesh);
+		TArray<FVector4> SphereCollisionParams;
+		// スフィアコリジョンはワールド座標で、どのクロスもAClothManagerの同じものを持ってくるので、前のクロスと同じならその範囲を使い回す
+		uint32 PrevSphereCollisionOffset = 0;
+		uint32 PrevNumSphereCollision = 0;
 
-		// TODO:StiffnessADampinǧʂNumIterationt[[gɈˑĂ܂Ă̂łǂɂ˂
+		// TODO:Stiffness、Dampingの効果がNumIterationやフレームレートに依存してしまっているのでどうにかせねば
 
-		// sɌ܂NXp[^̐ݒStructuredBufferpTArray̍쐬
-		uint32 Offset = 0;
+		// 実行時に決まるクロスパラメータの設定とStructuredBuffer用のTArrayの作成
+		// 頂点はFClothVertexPoolの中で直接シミュレーションするので、オフセットはプールの割り当て位置。コンパクションで動くのでフラッシュ時に取得する
 		for (uint32 MeshIdx = 0; MeshIdx < NumClothMesh; MeshIdx++)
 		{
 			FClothGridMeshDeformCommand& DeformCommand = DeformCommandQueue[MeshIdx];
 			FGridClothParameters& GridClothParams = DeformCommand.Params;
 
-			GridClothParams.VertexIndexOffset = Offset;
-			Offset += GridClothParams.NumVertex;
+			GridClothParams.VertexIndexOffset = DeformCommand.VertexBuffers->GetPoolOffset();
+			check(GridClothParams.NumVertex == DeformCommand.VertexBuffers->GetNumVertex());
+
+			check(GridClothParams.NumSphereCollision == (uint32)DeformCommand.SphereCollisionParams.Num());
+			const bool bSameAsPrevSphereCollision = GridClothParams.NumSphereCollision == PrevNumSphereCollision
+				&& FMemory::Memcmp(SphereCollisionParams.GetData() + PrevSphereCollisionOffset, DeformCommand.SphereCollisionParams.GetData(), PrevNumSphereCollision * sizeof(FVector4)) == 0;
+			if (!bSameAsPrevSphereCollision)
+			{
+				PrevSphereCollisionOffset = SphereCollisionParams.Num();
+				PrevNumSphereCollision = GridClothParams.NumSphereCollision;
+				SphereCollisionParams.Append(DeformCommand.SphereCollisionParams);
+			}
+			GridClothParams.SphereCollisionOffset = PrevSphereCollisionOffset;
 
-			check(GridClothParams.NumSphereCollision <= FGridClothParameters::MAX_SPHERE_COLLISION_PER_MESH);
-			
 			ClothParams.Add(GridClothParams);
 		}
 
 		ClothParameterStructuredBuffer.SetData(ClothParams);
+		SphereCollisionStructuredBuffer.SetData(SphereCollisionParams);
 
 		ClothSimParams->Params = ClothParameterStructuredBuffer.GetSRV();
-		ClothSimParams->WorkAccelerationMoveVertexBuffer = WorkAccelerationMoveVertexBufferUAV;
-		ClothSimParams->WorkPrevPositionVertexBuffer = WorkPrevVertexBufferUAV;
-		ClothSimParams->WorkPositionVertexBuffer = WorkVertexBufferUAV;
+		ClothSimParams->SphereCollisionParams = SphereCollisionStructuredBuffer.GetSRV();
+		ClothSimParams->WorkExternalAccelerationVertexBuffer = GClothVertexPool.GetExternalAccelerationBuffer().GetUAV();
+		ClothSimParams->WorkPrevPositionVertexBuffer = GClothVertexPool.GetPrevPositionBuffer().GetUAV();
+		ClothSimParams->WorkPositionVertexBuffer = GClothVertexPool.GetPositionBuffer().GetUAV();
 
 		TShaderMapRef<FClothSimulationCS> ClothSimulationCS(ShaderMap);
 
@@ -205,68 +167,68 @@ void FClothGridMeshDeformer::FlushDeformCommandQueue(FRHICommandListImmediate& R
 	}
 
 	{
-		uint32 Offset = 0;
-		for (uint32 MeshIdx = 0; MeshIdx < NumClothMesh; MeshIdx++)
+		for (const FClothGridMeshDeformCommand& DeformCommand : DeformCommandQueue)
 		{
-			TShaderMapRef<FClothMeshCopyFromWorkBufferCS> ClothMeshCopyFromWorkBufferCS(ShaderMap);
+			TShaderMapRef<FClothGridMeshTangentCS> GridMeshTangentCS(ShaderMap);
 
-			FClothMeshCopyFromWorkBufferCS::FParameters* ClothCopyFromWorkParams = GraphBuilder.AllocParameters<FClothMeshCopyFromWorkBufferCS::FParameters>();
-			const FClothGridMeshDeformCommand& DeformCommand = DeformCommandQueue[MeshIdx];
+			FClothGridMeshTangentCS::FParameters* GridMeshTangentParams = GraphBuilder.AllocParameters<FClothGridMeshTangentCS::FParameters>();
 
-			ClothCopyFromWorkParams->VertexIndexOffset = Offset;
-			Offset += DeformCommand.Params.NumVertex;
-			ClothCopyFromWorkParams->NumVertex = DeformCommand.Params.NumVertex;
-			ClothCopyFromWorkParams->PrevPositionVertexBuffer = DeformCommand.VertexBuffers->PrevPositionVertexBuffer.GetUAV();
-			ClothCopyFromWorkParams->WorkPrevPositionBuffer = WorkPrevVertexBufferUAV;
-			ClothCopyFromWorkParams->PositionVertexBuffer = DeformCommand.VertexBuffers->PositionVertexBuffer.GetUAV();
-			ClothCopyFromWorkParams->WorkPositionBuffer = WorkVertexBufferUAV;
+			const FGridClothParameters& GridClothParams = DeformCommand.Params;
+			GridMeshTangentParams->NumRow = GridClothParams.NumRow;
+			GridMeshTangentParams->NumColumn = GridClothParams.NumColumn;
+			GridMeshTangentParams->NumVertex = GridClothParams.NumVertex;
+			GridMeshTangentParams->VertexIndexOffset = GridClothParams.VertexIndexOffset;
+			GridMeshTangentParams->InPositionVertexBuffer = GClothVertexPool.GetPositionBuffer().GetUAV();
+			GridMeshTangentParams->OutTangentVertexBuffer = DeformCommand.VertexBuffers->DeformableMeshVertexBuffer.GetTangentsUAV();
+
+			const uint32 DispatchCount = FMath::DivideAndRoundUp(GridClothParams.NumVertex, (uint32)32);
+			check(DispatchCount <= 65535);
 
 			FComputeShaderUtils::AddPass(
 				GraphBuilder,
-				RDG_EVENT_NAME("ClothMeshCopyFromWorkBuffer"),
+				RDG_EVENT_NAME("GridMeshTangent"),
 				ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
-				ClothMeshCopyFromWorkBufferCS,
+				GridMeshTangentCS,
 #else
-				*ClothMeshCopyFromWorkBufferCS,
+				*GridMeshTangentCS,
 #endif
-				ClothCopyFromWorkParams,
-				FIntVector(1, 1, 1)
+				GridMeshTangentParams,
+				FIntVector(DispatchCount, 1, 1)
 			);
 		}
 	}
 
+#if ENGINE_MINOR_VERSION < 26
 	{
 		for (const FClothGridMeshDeformCommand& DeformCommand : DeformCommandQueue)
 		{
-			TShaderMapRef<FClothGridMeshTangentCS> GridMeshTangentCS(ShaderMap);
+			TShaderMapRef<FClothPositionCopyCS> ClothPositionCopyCS(ShaderMap);
 
-			FClothGridMeshTangentCS::FParameters* GridMeshTangentParams = GraphBuilder.AllocParameters<FClothGridMeshTangentCS::FParameters>();
+			FClothPositionCopyCS::FParameters* CopyParams = GraphBuilder.AllocParameters<FClothPositionCopyCS::FParameters>();
+			CopyParams->SrcVertexIndexOffset = DeformCommand.Params.VertexIndexOffset;
+			CopyParams->NumVertex = DeformCommand.Params.NumVertex;
+			CopyParams->SrcPositionBuffer = GClothVertexPool.GetPositionBuffer().GetUAV();
+			CopyParams->OutPositionVertexBuffer = DeformCommand.VertexBuffers->PositionVertexBuffer.GetUAV();
 
-			const FGridClothParameters& GridClothParams = DeformCommand.Params;
-			GridMeshTangentParams->NumRow = GridClothParams.NumRow;
-			GridMeshTangentParams->NumColumn = GridClothParams.NumColumn;
-			GridMeshTangentParams->NumVertex = GridClothParams.NumVertex;
-			GridMeshTangentParams->InPositionVertexBuffer = DeformCommand.VertexBuffers->PositionVertexBuffer.GetUAV();
-			GridMeshTangentParams->OutTangentVertexBuffer = DeformCommand.VertexBuffers->DeformableMeshVertexBuffer.GetTangentsUAV();
-
-			const uint32 DispatchCount = FMath::DivideAndRoundUp(GridClothParams.NumVertex, (uint32)32);
+			const uint32 DispatchCount = FMath::DivideAndRoundUp(DeformCommand.Params.NumVertex, (uint32)32);
 			check(DispatchCount <= 65535);
 
 			FComputeShaderUtils::AddPass(
 				GraphBuilder,
-				RDG_EVENT_NAME("GridMeshTangent"),
+				RDG_EVENT_NAME("ClothPositionCopy"),
 				ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
-				GridMeshTangentCS,
+				ClothPositionCopyCS,
 #else
-				*GridMeshTangentCS,
+				*ClothPositionCopyCS,
 #endif
-				GridMeshTangentParams,
+				CopyParams,
 				FIntVector(DispatchCount, 1, 1)
 			);
 		}
 	}
+#endif
 
 	GraphBuilder.Execute();
 
@@ -0,0 +1,375 @@
+#include "Cloth/ClothGridMeshReferenceSolver.h"
+#include "Misc/AutomationTest.h"
+
+namespace
+{
+// ClothSimulationGridMesh.usfのSMALL_NUMBERと同じ値
+const float ClothSmallNumber = 0.0001f;
+const uint32 NumColor = 4;
+
+void Integrate(const FGridClothParameters& Params, FClothGridMeshReferenceState& State)
+{
+	for (uint32 VertIdx = 0; VertIdx < Params.NumVertex; VertIdx++)
+	{
+		FVector CurrPos(State.Positions[VertIdx]);
+		const FVector PrevPos(State.PrevPositions[VertIdx]);
+		const float InvMass = State.Positions[VertIdx].W;
+
+		FVector NextPos;
+		if (InvMass < ClothSmallNumber)
+		{
+			NextPos = CurrPos;
+		}
+		else
+		{
+			FVector AccelerationMove = Params.AccelerationMove;
+			if (Params.bUseExternalAcceleration != 0)
+			{
+				AccelerationMove += State.ExternalAccelerations[VertIdx] * Params.IterDeltaTime * Params.IterDeltaTime;
+			}
+			NextPos = CurrPos + (CurrPos - PrevPos) * (1.0f - Params.Damping) + AccelerationMove;
+			CurrPos = CurrPos + Params.PreviousInertia;
+		}
+
+		State.Positions[VertIdx] = FVector4(NextPos, InvMass);
+		State.PrevPositions[VertIdx] = FVector4(CurrPos, State.PrevPositions[VertIdx].W);
+	}
+}
+
+FVector CalculateWindImpulse(const FGridClothParameters& Params, const FVector& CurrPos0, const FVector& CurrPos1, const FVector& CurrPos2, const FVector& PrevPos0, const FVector& PrevPos1, const FVector& PrevPos2, FVector Normal)
+{
+	const FVector CurrCoG = (CurrPos0 + CurrPos1 + CurrPos2) / 3.0f;
+	const FVector PrevCoG = (PrevPos0 + PrevPos1 + PrevPos2) / 3.0f;
+	const FVector Delta = -(CurrCoG - PrevCoG) + Params.WindVelocity * Params.IterDeltaTime;
+	const float DeltaLength = Delta.Size();
+	const FVector DeltaDir = Delta / FMath::Max(DeltaLength, ClothSmallNumber);
+
+	const float NormalLength = Normal.Size();
+	const float Area = NormalLength / 2;
+	Normal = Normal / NormalLength;
+
+	const float Cos = FVector::DotProduct(Normal, DeltaDir);
+	const float Sin = FMath::Sqrt(FMath::Max(0.0f, 1.0f - Cos * Cos));
+	const float Sin2 = Cos * Sin * 0.5f;
+
+	const FVector LiftDir = FVector::CrossProduct(FVector::CrossProduct(DeltaDir, Normal), DeltaDir);
+	const FVector LiftImpulse = Params.LiftCoefficient * Params.FluidDensity * Area * Sin2 * LiftDir * DeltaLength * DeltaLength / Params.IterDeltaTime;
+	const FVector DragImpulse = Params.DragCoefficient * Params.FluidDensity * Area * FMath::Abs(Cos) * DeltaDir * DeltaLength * DeltaLength / Params.IterDeltaTime;
+	return LiftImpulse + DragImpulse;
+}
+
+void AddWindImpulse(FClothGridMeshReferenceState& State, uint32 VertIdx, const FVector& CurrPos, const FVector& Impulse)
+{
+	if (State.Positions[VertIdx].W >= ClothSmallNumber)
+	{
+		State.Positions[VertIdx] = FVector4(CurrPos + Impulse, State.Positions[VertIdx].W);
+	}
+}
+
+void ApplyWindToCell(const FGridClothParameters& Params, FClothGridMeshReferenceState& State, uint32 RowIndex, uint32 ColumnIndex)
+{
+	const uint32 LeftUpperVertIdx = RowIndex * (Params.NumColumn + 1) + ColumnIndex;
+	const uint32 RightUpperVertIdx = LeftUpperVertIdx + 1;
+	const uint32 LeftLowerVertIdx = LeftUpperVertIdx + Params.NumColumn + 1;
+	const uint32 RightLowerVertIdx = LeftLowerVertIdx + 1;
+
+	const FVector CurrLeftUpper(State.Positions[LeftUpperVertIdx]);
+	const FVector CurrRightUpper(State.Positions[RightUpperVertIdx]);
+	const FVector CurrLeftLower(State.Positions[LeftLowerVertIdx]);
+	const FVector CurrRightLower(State.Positions[RightLowerVertIdx]);
+	const FVector PrevLeftUpper(State.PrevPositions[LeftUpperVertIdx]);
+	const FVector PrevRightUpper(State.PrevPositions[RightUpperVertIdx]);
+	const FVector PrevLeftLower(State.PrevPositions[LeftLowerVertIdx]);
+	const FVector PrevRightLower(State.PrevPositions[RightLowerVertIdx]);
+
+	const FVector RightUpperImpulse = CalculateWindImpulse(Params, CurrLeftUpper, CurrRightUpper, CurrRightLower, PrevLeftUpper, PrevRightUpper, PrevRightLower,
+		FVector::CrossProduct(CurrLeftUpper - CurrRightUpper, CurrRightLower - CurrRightUpper));
+	const FVector LeftLowerImpulse = CalculateWindImpulse(Params, CurrLeftUpper, CurrLeftLower, CurrRightLower, PrevLeftUpper, PrevLeftLower, PrevRightLower,
+		-FVector::CrossProduct(CurrLeftUpper - CurrLeftLower, CurrRightLower - CurrLeftLower));
+
+	AddWindImpulse(State, LeftUpperVertIdx, CurrLeftUpper, RightUpperImpulse + LeftLowerImpulse);
+	AddWindImpulse(State, RightUpperVertIdx, CurrRightUpper, RightUpperImpulse);
+	AddWindImpulse(State, LeftLowerVertIdx, CurrLeftLower, LeftLowerImpulse);
+	AddWindImpulse(State, RightLowerVertIdx, CurrRightLower, RightUpperImpulse + LeftLowerImpulse);
+}
+
+void ApplyWind(const FGridClothParameters& Params, EClothGridMeshSolveOrder Order, FClothGridMeshReferenceState& State)
+{
+	if (Order == EClothGridMeshSolveOrder::Serial)
+	{
+		for (uint32 RowIndex = 0; RowIndex < Params.NumRow; RowIndex++)
+		{
+			for (uint32 ColumnIndex = 0; ColumnIndex < Params.NumColumn; ColumnIndex++)
+			{
+				ApplyWindToCell(Params, State, RowIndex, ColumnIndex);
+			}
+		}
+		return;
+	}
+
+	// シェーダと同じく行と列の偶奇の4色の順に処理する。同じ色の中の順序は結果に影響しない
+	for (uint32 Color = 0; Color < NumColor; Color++)
+	{
+		for (uint32 RowIndex = Color / 2; RowIndex < Params.NumRow; RowIndex += 2)
+		{
+			for (uint32 ColumnIndex = Color % 2; ColumnIndex < Params.NumColumn; ColumnIndex += 2)
+			{
+				ApplyWindToCell(Params, State, RowIndex, ColumnIndex);
+			}
+		}
+	}
+}
+
+void ProjectDistanceConstraint(const FGridClothParameters& Params, FClothGridMeshReferenceState& State, uint32 VertIdx, uint32 OtherVertIdx, float RestLength)
+{
+	const float InvMass = State.Positions[VertIdx].W;
+	const float OtherInvMass = State.Positions[OtherVertIdx].W;
+	if (InvMass <= ClothSmallNumber && OtherInvMass <= ClothSmallNumber)
+	{
+		return;
+	}
+
+	FVector Pos(State.Positions[VertIdx]);
+	FVector OtherPos(State.Positions[OtherVertIdx]);
+
+	const float EdgeLength = FMath::Max((OtherPos - Pos).Size(), ClothSmallNumber);
+	const float Diff = EdgeLength - RestLength;
+	const FVector EdgeAxis = (OtherPos - Pos) / EdgeLength;
+
+	Pos += InvMass / (InvMass + OtherInvMass) * Diff * EdgeAxis * Params.Stiffness;
+	OtherPos -= OtherInvMass / (InvMass + OtherInvMass) * Diff * EdgeAxis * Params.Stiffness;
+
+	State.Positions[VertIdx] = FVector4(Pos, InvMass);
+	State.Positions[OtherVertIdx] = FVector4(OtherPos, OtherInvMass);
+}
+
+void SolveDistanceConstraint(const FGridClothParameters& Params, EClothGridMeshSolveOrder Order, FClothGridMeshReferenceState& State)
+{
+	const uint32 NumVertexPerRow = Params.NumColumn + 1;
+
+	if (Order == EClothGridMeshSolveOrder::Serial)
+	{
+		for (uint32 VertIdx = 0; VertIdx < Params.NumVertex; VertIdx++)
+		{
+			if (VertIdx % NumVertexPerRow < Params.NumColumn)
+			{
+				ProjectDistanceConstraint(Params, State, VertIdx, VertIdx + 1, Params.GridWidth);
+			}
+
+			if (VertIdx / NumVertexPerRow < Params.NumRow)
+			{
+				ProjectDistanceConstraint(Params, State, VertIdx, VertIdx + NumVertexPerRow, Params.GridHeight);
+			}
+		}
+		return;
+	}
+
+	// シェーダと同じく横のエッジの偶数列、奇数列、縦のエッジの偶数行、奇数行の順に処理する
+	for (uint32 Parity = 0; Parity < 2; Parity++)
+	{
+		for (uint32 RowIndex = 0; RowIndex <= Params.NumRow; RowIndex++)
+		{
+			for (uint32 ColumnIndex = Parity; ColumnIndex < Params.NumColumn; ColumnIndex += 2)
+			{
+				const uint32 VertIdx = RowIndex * NumVertexPerRow + ColumnIndex;
+				ProjectDistanceConstraint(Params, State, VertIdx, VertIdx + 1, Params.GridWidth);
+			}
+		}
+	}
+
+	for (uint32 Parity = 0; Parity < 2; Parity++)
+	{
+		for (uint32 RowIndex = Parity; RowIndex < Params.NumRow; RowIndex += 2)
+		{
+			for (uint32 ColumnIndex = 0; ColumnIndex <= Params.NumColumn; ColumnIndex++)
+			{
+				const uint32 VertIdx = RowIndex * NumVertexPerRow + ColumnIndex;
+				ProjectDistanceConstraint(Params, State, VertIdx, VertIdx + NumVertexPerRow, Params.GridHeight);
+			}
+		}
+	}
+}
+
+void SolveCollision(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshReferenceState& State)
+{
+	for (uint32 VertIdx = 0; VertIdx < Params.NumVertex; VertIdx++)
+	{
+		FVector Pos(State.Positions[VertIdx]);
+
+		for (uint32 CollisionIdx = 0; CollisionIdx < Params.NumSphereCollision; CollisionIdx++)
+		{
+			const FVector4& SphereCenterAndRadius = SphereCollisionParams[CollisionIdx];
+			const float SphereRadius = SphereCenterAndRadius.W + Params.VertexRadius;
+			if (SphereRadius < ClothSmallNumber)
+			{
+				continue;
+			}
+
+			const FVector SphereCenter(SphereCenterAndRadius);
+			if ((Pos - SphereCenter).SizeSquared() < SphereRadius * SphereRadius)
+			{
+				Pos = SphereCenter + (Pos - SphereCenter).GetSafeNormal() * SphereRadius;
+			}
+		}
+
+		State.Positions[VertIdx] = FVector4(Pos, State.Positions[VertIdx].W);
+	}
+}
+} // namespace
+
+void SimulateClothGridMeshReference(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, EClothGridMeshSolveOrder Order, FClothGridMeshReferenceState& InOutState)
+{
+	check((uint32)SphereCollisionParams.Num() == Params.NumSphereCollision);
+	check((uint32)InOutState.Positions.Num() == Params.NumVertex);
+	check((uint32)InOutState.PrevPositions.Num() == Params.NumVertex);
+	check((uint32)InOutState.ExternalAccelerations.Num() == Params.NumVertex);
+	check(Params.NumVertex == (Params.NumRow + 1) * (Params.NumColumn + 1));
+
+	for (uint32 IterCount = 0; IterCount < Params.NumIteration; IterCount++)
+	{
+		Integrate(Params, InOutState);
+
+		if (Params.FluidDensity > 0.0f)
+		{
+			ApplyWind(Params, Order, InOutState);
+		}
+
+		SolveDistanceConstraint(Params, Order, InOutState);
+		SolveCollision(Params, SphereCollisionParams, InOutState);
+	}
+}
+
+void MakeClothGridMeshVerificationSetup(uint32 NumRow, bool bUseExternalAcceleration, FGridClothParameters& OutParams, TArray<FVector4>& OutSphereCollisionParams, FClothGridMeshReferenceState& OutState)
+{
+	// UClothGridMeshComponent::InitClothSettings()と同じく1行目を固定した水平なクロスと、60fpsでのMakeDeformCommand()相当のパラメータ
+	const uint32 NumIteration = 4;
+	const float DeltaTime = 1.0f / 60.0f;
+	const float IterDeltaTime = DeltaTime / NumIteration;
+	const float DampStiffnessExp = FGridClothParameters::BASE_FREQUENCY * IterDeltaTime;
+
+	OutParams.NumIteration = NumIteration;
+	OutParams.NumRow = NumRow;
+	OutParams.NumColumn = NumRow;
+	OutParams.NumVertex = (NumRow + 1) * (NumRow + 1);
+	OutParams.GridWidth = 10.0f;
+	OutParams.GridHeight = 10.0f;
+	OutParams.Stiffness = 1.0f - FMath::Exp(FMath::Loge(1.0f - 0.9f) * DampStiffnessExp);
+	OutParams.Damping = 1.0f - FMath::Exp(FMath::Loge(1.0f - 0.01f) * DampStiffnessExp);
+	OutParams.WindVelocity = FVector(0.0f, 300.0f, 200.0f);
+	OutParams.FluidDensity = 1.2f / (100.0f * 100.0f * 100.0f);
+	OutParams.LiftCoefficient = (1.0f - FMath::Exp(FMath::Loge(1.0f - 0.5f) * DampStiffnessExp)) / 100.0f;
+	OutParams.DragCoefficient = (1.0f - FMath::Exp(FMath::Loge(1.0f - 0.5f) * DampStiffnessExp)) / 100.0f;
+	OutParams.IterDeltaTime = IterDeltaTime;
+	OutParams.VertexRadius = 1.0f;
+	OutSphereCollisionParams.Reset(1);
+	OutSphereCollisionParams.Emplace(NumRow * 5.0f, NumRow * 5.0f, -NumRow * 8.0f, NumRow * 2.0f);
+	OutParams.NumSphereCollision = OutSphereCollisionParams.Num();
+	OutParams.AccelerationMove = FGridClothParameters::GRAVITY * IterDeltaTime * IterDeltaTime;
+	OutParams.bUseExternalAcceleration = bUseExternalAcceleration ? 1 : 0;
+
+	OutState.Positions.Reset(OutParams.NumVertex);
+	OutState.ExternalAccelerations.Reset(OutParams.NumVertex);
+	for (uint32 y = 0; y <= NumRow; y++)
+	{
+		for (uint32 x = 0; x <= NumRow; x++)
+		{
+			OutState.Positions.Emplace(x * OutParams.GridWidth, y * OutParams.GridHeight, 0.0f, (y == 0) ? 0.0f : 1.0f);
+			// 外部加速度の経路も検証できるよう最終行だけに横向きの加速度をかける。bUseExternalAccelerationでなければ無視されるはず
+			OutState.ExternalAccelerations.Add((y == NumRow) ? FVector(500.0f, 0.0f, 0.0f) : FVector::ZeroVector);
+		}
+	}
+	OutState.PrevPositions = OutState.Positions;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+float GetMaxPositionDifference(const FClothGridMeshReferenceState& A, const FClothGridMeshReferenceState& B)
+{
+	float Ret = 0.0f;
+	for (int32 VertIdx = 0; VertIdx < A.Positions.Num(); VertIdx++)
+	{
+		Ret = FMath::Max(Ret, FVector::Dist(FVector(A.Positions[VertIdx]), FVector(B.Positions[VertIdx])));
+	}
+	return Ret;
+}
+} // namespace
+
+void VerifyClothGridMeshSolver(FAutomationTestBase& Test, const TCHAR* SolverName, EClothGridMeshSolveOrder ReferenceOrder, TArrayView<const uint32> NumRows, float FrameTolerance, float AccumulatedTolerance,
+	TFunctionRef<void(const FClothGridMeshReferenceState& InitialState)> InitSolver,
+	TFunctionRef<void(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshReferenceState& InOutState)> StepSolver)
+{
+	const int32 NumFrame = 300;
+	const TCHAR* ReferenceName = (ReferenceOrder == EClothGridMeshSolveOrder::Serial) ? TEXT("serial") : TEXT("colored");
+
+	for (uint32 NumRow : NumRows)
+	{
+		for (bool bUseExternalAcceleration : {false, true})
+		{
+			const FString SetupName = FString::Printf(TEXT("%ux%u%s"), NumRow, NumRow, bUseExternalAcceleration ? TEXT(" with external acceleration") : TEXT(""));
+			FGridClothParameters Params;
+			TArray<FVector4> SphereCollisionParams;
+			FClothGridMeshReferenceState ReferenceState;
+			MakeClothGridMeshVerificationSetup(NumRow, bUseExternalAcceleration, Params, SphereCollisionParams, ReferenceState);
+			FClothGridMeshReferenceState SolverState = ReferenceState;
+			InitSolver(ReferenceState);
+
+			float MaxFrameDifference = 0.0f;
+			double ReferenceSeconds = 0.0;
+			double SolverSeconds = 0.0;
+			for (int32 Frame = 0; Frame < NumFrame; Frame++)
+			{
+				// 1フレームぶんの差は、テスト対象の前フレームの状態をリファレンスで1フレーム進めて測る
+				FClothGridMeshReferenceState StepState = SolverState;
+				SimulateClothGridMeshReference(Params, SphereCollisionParams, ReferenceOrder, StepState);
+
+				double StartTime = FPlatformTime::Seconds();
+				SimulateClothGridMeshReference(Params, SphereCollisionParams, ReferenceOrder, ReferenceState);
+				ReferenceSeconds += FPlatformTime::Seconds() - StartTime;
+
+				StartTime = FPlatformTime::Seconds();
+				StepSolver(Params, SphereCollisionParams, SolverState);
+				SolverSeconds += FPlatformTime::Seconds() - StartTime;
+
+				MaxFrameDifference = FMath::Max(MaxFrameDifference, GetMaxPositionDifference(SolverState, StepState));
+			}
+
+			const float RelativeFrameDifference = MaxFrameDifference / Params.GridWidth;
+			const float RelativeDifference = GetMaxPositionDifference(SolverState, ReferenceState) / Params.GridWidth;
+			Test.AddInfo(FString::Printf(TEXT("%s %s: max difference from the %s reference after %d frames %g grid widths, max one frame difference %g grid widths, %s %.3f ms/frame, %s %.3f ms/frame"),
+				SolverName, *SetupName, ReferenceName, NumFrame, RelativeDifference, RelativeFrameDifference, ReferenceName, ReferenceSeconds * 1000.0 / NumFrame, SolverName, SolverSeconds * 1000.0 / NumFrame));
+			if (FrameTolerance > 0.0f)
+			{
+				Test.TestTrue(FString::Printf(TEXT("%s %s one frame difference within %g grid widths"), SolverName, *SetupName, FrameTolerance), RelativeFrameDifference <= FrameTolerance);
+			}
+			Test.TestTrue(FString::Printf(TEXT("%s %s difference after %d frames within %g grid widths"), SolverName, *SetupName, NumFrame, AccumulatedTolerance), RelativeDifference <= AccumulatedTolerance);
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FClothGridMeshColoredSolveTest, "ShaderSandbox.Cloth.ColoredSolve", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FClothGridMeshColoredSolveTest::RunTest(const FString& Parameters)
+{
+	// 許容値はGridWidthに対する位置の差。順序が違うGauss-Seidel法は1フレームごとの収束途中の値は一致しないので、
+	// 1フレームの差は出力だけにし、同じ初期状態から独立にシミュレーションして布が落ち着いた後の形状を比べる
+	const float Tolerance = 0.1f;
+	const uint32 NumRows[] = {16, 32};
+
+	FClothGridMeshReferenceState ColoredState;
+	VerifyClothGridMeshSolver(*this, TEXT("Colored"), EClothGridMeshSolveOrder::Serial, NumRows, 0.0f, Tolerance,
+		[&ColoredState](const FClothGridMeshReferenceState& InitialState)
+		{
+			ColoredState = InitialState;
+		},
+		[&ColoredState](const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshReferenceState& InOutState)
+		{
+			SimulateClothGridMeshReference(Params, SphereCollisionParams, EClothGridMeshSolveOrder::Colored, ColoredState);
+			InOutState = ColoredState;
+		});
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -3,18 +3,6 @@
 #include "Cloth/ClothGridMeshComponent.h"
 #include "Cloth/SphereCollisionComponent.h"
 
-static inline void InitOrUpdateResourceMacroClothManager(FRenderResource* Resource)
-{
-	if (!Resource->IsInitialized())
-	{
-		Resource->InitResource();
-	}
-	else
-	{
-		Resource->UpdateRHI();
-	}
-}
-
 class FClothManagerSceneProxy final : public FPrimitiveSceneProxy
 {
 public:
@@ -31,77 +19,41 @@ public:
 
 	virtual ~FClothManagerSceneProxy()
 	{
-		WorkAccelerationVertexBuffer.ReleaseResource();
-		WorkPrevPositionVertexBuffer.ReleaseResource();
-		WorkPositionVertexBuffer.ReleaseResource();
 	}
 
 	virtual uint32 GetMemoryFootprint( void ) const override { return( sizeof( *this ) + GetAllocatedSize() ); }
 
 	uint32 GetAllocatedSize( void ) const { return( FPrimitiveSceneProxy::GetAllocatedSize() ); }
 
+	// 頂点バッファはクロスごとにGClothVertexPoolに確保されているので、ここではディスパッチするタイミングを決めるためにクロスを数えるだけ
 	void RegisterClothMesh(UClothGridMeshComponent* ClothMesh)
 	{
-		FMergeData MergeData;
-		MergeData.NumVertex = ClothMesh->GetVertices().Num();
-
-		uint32 Offset = 0;
-		for (const TPair<UClothGridMeshComponent*, FMergeData>& ClothMeshData : ClothMeshDataMap)
-		{
-			Offset += ClothMeshData.Value.NumVertex;
-		}
-
-		MergeData.Offset = Offset;
-
-		check(ClothMeshDataMap.Find(ClothMesh) == nullptr);
-		ClothMeshDataMap.Add(ClothMesh, MergeData);
-
-		// TODO:NX̉񐔂InitUpdateRHIĂ̂͂Ȃ
-		// Init͍ē\BReallocĂ
-		WorkAccelerationVertexBuffer.Init(MergeData.Offset + MergeData.NumVertex);
-		WorkPrevPositionVertexBuffer.Init(MergeData.Offset + MergeData.NumVertex);
-		WorkPositionVertexBuffer.Init(MergeData.Offset + MergeData.NumVertex);
-
-		InitOrUpdateResourceMacroClothManager(&WorkAccelerationVertexBuffer);
-		InitOrUpdateResourceMacroClothManager(&WorkPrevPositionVertexBuffer);
-		InitOrUpdateResourceMacroClothManager(&WorkPositionVertexBuffer);
+		check(!RegisteredClothMeshes.Contains(ClothMesh));
+		RegisteredClothMeshes.Add(ClothMesh);
 	}
 
 	void UnregisterClothMesh(UClothGridMeshComponent* ClothMesh)
 	{
-		ClothMeshDataMap.Remove(ClothMesh);
-		// TODO:RemoveĂÂƂAo[ebNXobt@͏k߂ȂB
+		RegisteredClothMeshes.Remove(ClothMesh);
 	}
 
-	// TODO:1bVɂ܂Ƃ߂Ȍێ邽߉ɍ
+	// TODO:1メッシュにまとめる前の処理を維持するため仮に作った
 	void EnqueueSimulateClothCommand(FRHICommandListImmediate& RHICmdList, const FClothGridMeshDeformCommand& Command)
 	{
 		NumCommand++;
 		VertexDeformer.EnqueueDeformCommand(Command);
 
-		if ((int32)NumCommand >= ClothMeshDataMap.Num())
+		if ((int32)NumCommand >= RegisteredClothMeshes.Num())
 		{
-			VertexDeformer.FlushDeformCommandQueue(RHICmdList, WorkAccelerationVertexBuffer.GetUAV(), WorkPrevPositionVertexBuffer.GetUAV(), WorkPositionVertexBuffer.GetUAV());
+			VertexDeformer.FlushDeformCommandQueue(RHICmdList);
 			NumCommand = 0;
 		}
 	}
 
 private:
-	// Data for 
-	struct FMergeData
-	{
-		int32 Offset;
-		int32 NumVertex;
-	};
-
 	int32 NumCommand = 0;
-	TMap<class UClothGridMeshComponent*, FMergeData> ClothMeshDataMap;
+	TSet<class UClothGridMeshComponent*> RegisteredClothMeshes;
 	FClothGridMeshDeformer VertexDeformer;
-	// vertex buffer to simulate all clothes by one dispatch by merging all vertex buffers.
-	// TODO:UAVł悭ASRV̂
-	FDeformablePositionVertexBuffer WorkAccelerationVertexBuffer;
-	FDeformablePositionVertexBuffer WorkPrevPositionVertexBuffer;
-	FDeformablePositionVertexBuffer WorkPositionVertexBuffer;
 };
 
 void UClothManagerComponent::RegisterClothMesh(UClothGridMeshComponent* ClothMesh)
@@ -130,7 +82,7 @@ void UClothManagerComponent::UnregisterClothMesh(UClothGridMeshComponent* ClothM
 	}
 }
 
-// TODO:1bVɂ܂Ƃ߂Ȍێ邽߉ɍ
+// TODO:1メッシュにまとめる前の処理を維持するため仮に作った
 void UClothManagerComponent::EnqueueSimulateClothCommand(const FClothGridMeshDeformCommand& Command)
 {
 	if (SceneProxy != nullptr)
@@ -190,7 +142,7 @@ void AClothManager::UnregisterSphereCollision(USphereCollisionComponent* SphereC
 	SphereCollisions.Remove(SphereCollision);
 }
 
-// TODO:1bVɂ܂Ƃ߂Ȍێ邽߉ɍ
+// TODO:1メッシュにまとめる前の処理を維持するため仮に作った
 void AClothManager::EnqueueSimulateClothCommand(const FClothGridMeshDeformCommand& Command)
 {
 	Cast<UClothManagerComponent>(RootComponent)->EnqueueSimulateClothCommand(Command);
@@ -0,0 +1,50 @@
+#include "Cloth/ClothStructuredBuffer.h"
+#include "Cloth/ClothGridMeshParameters.h"
+
+void FClothStructuredBuffer::SetData(const TArray<struct FGridClothParameters>& Data)
+{
+	SetData(Data.GetData(), sizeof(FGridClothParameters), Data.Num());
+}
+
+void FClothStructuredBuffer::SetData(const TArray<FVector4>& Data)
+{
+	SetData(Data.GetData(), sizeof(FVector4), Data.Num());
+}
+
+void FClothStructuredBuffer::SetData(const void* Data, uint32 ByteStride, uint32 NumElements)
+{
+	if (!IsInitialized())
+	{
+		InitResource();
+	}
+
+	// 要素数が増えたら倍々で作り直す。要素が0でもシェーダにバインドするSRVは必要なので最低1要素は確保する
+	if (!ComponentsData.IsValid() || NumElements > Capacity)
+	{
+		Capacity = FMath::Max3(NumElements, Capacity * 2, 1u);
+
+		FRHIResourceCreateInfo CreateInfo;
+
+		ComponentsData = RHICreateStructuredBuffer(ByteStride, Capacity * ByteStride, EBufferUsageFlags::BUF_Dynamic | EBufferUsageFlags::BUF_ShaderResource, CreateInfo);
+		ComponentsDataSRV = RHICreateShaderResourceView(ComponentsData);
+	}
+
+	check(ComponentsData->GetStride() == ByteStride);
+
+	if (NumElements == 0)
+	{
+		return;
+	}
+
+	uint32 Size = NumElements * ByteStride;
+	uint8* Buffer = (uint8*)RHILockStructuredBuffer(ComponentsData, 0, Size, EResourceLockMode::RLM_WriteOnly);
+	FMemory::Memcpy(Buffer, Data, Size);
+	RHIUnlockStructuredBuffer(ComponentsData);
+}
+
+void FClothStructuredBuffer::ReleaseDynamicRHI()
+{
+	ComponentsDataSRV.SafeRelease();
+	ComponentsData.SafeRelease();
+	Capacity = 0;
+}
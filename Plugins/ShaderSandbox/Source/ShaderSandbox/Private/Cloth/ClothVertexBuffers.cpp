@@ -1,5 +1,5 @@
 #include "Cloth/ClothVertexBuffers.h"
-#include "Cloth/ClothGridMeshParameters.h"
+#include "Cloth/ClothVertexPool.h"
 #include "DynamicMeshBuilder.h"
 
 static inline void InitOrUpdateResourceMacroCloth(FRenderResource* Resource)
@@ -14,95 +14,299 @@ static inline void InitOrUpdateResourceMacroCloth(FRenderResource* Resource)
 	}
 }
 
-void FClothVertexBuffers::InitFromClothVertexAttributes(FLocalVertexFactory* VertexFactory, const TArray<FDynamicMeshVertex>& Vertices, const TArray<float>& InvMasses, const TArray<FVector>& AccelerationMoves, uint32 NumTexCoords, uint32 LightMapIndex)
+void FClothDynamicVertexBuffer::Init(uint32 InNumVertices, uint32 InStride, EPixelFormat InSRVFormat)
+{
+	NumVertices = InNumVertices;
+	Stride = InStride;
+	SRVFormat = InSRVFormat;
+}
+
+void FClothDynamicVertexBuffer::InitRHI()
+{
+	if (NumVertices == 0)
+	{
+		return;
+	}
+
+	// 毎フレーム全体を書き換えるので、ロックでGPUを待たずにドライバがメモリを差し替えられるようBUF_Dynamicにする
+	FRHIResourceCreateInfo CreateInfo;
+	VertexBufferRHI = RHICreateVertexBuffer(NumVertices * Stride, EBufferUsageFlags::BUF_Dynamic | EBufferUsageFlags::BUF_ShaderResource, CreateInfo);
+	SRV = RHICreateShaderResourceView(VertexBufferRHI, 4, SRVFormat);
+}
+
+void FClothDynamicVertexBuffer::ReleaseRHI()
+{
+	SRV.SafeRelease();
+	FVertexBuffer::ReleaseRHI();
+}
+
+void FClothDynamicVertexBuffer::Write(const void* Data, uint32 Size)
+{
+	check(IsInRenderingThread());
+	check(Size == NumVertices * Stride);
+
+	void* BufferData = RHILockVertexBuffer(VertexBufferRHI, 0, Size, RLM_WriteOnly);
+	FMemory::Memcpy(BufferData, Data, Size);
+	RHIUnlockVertexBuffer(VertexBufferRHI);
+}
+
+void FClothVertexBuffers::InitFromClothVertexAttributes(FLocalVertexFactory* InVertexFactory, const TArray<FDynamicMeshVertex>& Vertices, const TArray<float>& InvMasses, const TArray<FVector>& ExternalAccelerations, bool bInCPUBackend, uint32 NumTexCoords, uint32 InLightMapIndex)
 {
 	check(NumTexCoords < MAX_STATIC_TEXCOORDS && NumTexCoords > 0);
-	check(LightMapIndex < NumTexCoords);
+	check(InLightMapIndex < NumTexCoords);
 	check(Vertices.Num() == InvMasses.Num());
-	check(Vertices.Num() == AccelerationMoves.Num());
+	check(ExternalAccelerations.Num() == 0 || Vertices.Num() == ExternalAccelerations.Num());
+
+	// 位置、前フレームの位置、外力はプールに書き込むのでここではCPU側の配列だけ作る
+	TArray<FVector4> Positions;
+	TArray<FVector4> ExternalAccelerations4;
+	// CPUバックエンドのタンジェントはダイナミックバッファに置くので、その初期値
+	TArray<FPackedNormal> CPUTangents;
 
 	if (Vertices.Num())
 	{
-		PositionVertexBuffer.Init(Vertices.Num());
+#if ENGINE_MINOR_VERSION < 26
+		if (!bInCPUBackend)
+		{
+			PositionVertexBuffer.Init(Vertices.Num());
+		}
+#endif
 		DeformableMeshVertexBuffer.Init(Vertices.Num(), NumTexCoords);
 		ColorVertexBuffer.Init(Vertices.Num());
-		PrevPositionVertexBuffer.Init(Vertices.Num());
-		AccelerationMoveVertexBuffer.Init(Vertices.Num());
+		Positions.Reserve(Vertices.Num());
+		ExternalAccelerations4.Reserve(Vertices.Num());
+		if (bInCPUBackend)
+		{
+			CPUTangents.Reserve(Vertices.Num() * 2);
+		}
 
 		for (int32 i = 0; i < Vertices.Num(); i++)
 		{
 			const FDynamicMeshVertex& Vertex = Vertices[i];
 			float InvMass = InvMasses[i];
 
-			PositionVertexBuffer.VertexPosition(i) = FVector4(Vertex.Position, InvMass);
+			Positions.Emplace(Vertex.Position, InvMass);
+#if ENGINE_MINOR_VERSION < 26
+			if (!bInCPUBackend)
+			{
+				PositionVertexBuffer.VertexPosition(i) = Positions[i];
+			}
+#endif
+			if (bInCPUBackend)
+			{
+				CPUTangents.Add(Vertex.TangentX);
+				CPUTangents.Add(Vertex.TangentZ);
+			}
 			DeformableMeshVertexBuffer.SetVertexTangents(i, Vertex.TangentX.ToFVector(), Vertex.GetTangentY(), Vertex.TangentZ.ToFVector());
 			for (uint32 j = 0; j < NumTexCoords; j++)
 			{
 				DeformableMeshVertexBuffer.SetVertexUV(i, j, Vertex.TextureCoordinate[j]);
 			}
 			ColorVertexBuffer.VertexColor(i) = Vertex.Color;
-			// Ot[̈ʒu͏ł͌t[Ɠɂ
-			PrevPositionVertexBuffer.VertexPosition(i) = FVector4(Vertex.Position, InvMass);
-			AccelerationMoveVertexBuffer.VertexPosition(i) = AccelerationMoves[i];
+			ExternalAccelerations4.Emplace(ExternalAccelerations.Num() > 0 ? ExternalAccelerations[i] : FVector::ZeroVector, 0.0f);
 		}
 	}
 	else
 	{
-		PositionVertexBuffer.Init(1);
+#if ENGINE_MINOR_VERSION < 26
+		if (!bInCPUBackend)
+		{
+			PositionVertexBuffer.Init(1);
+			PositionVertexBuffer.VertexPosition(0) = FVector4(0, 0, 0, 0);
+		}
+#endif
 		DeformableMeshVertexBuffer.Init(1, 1);
 		ColorVertexBuffer.Init(1);
-		PrevPositionVertexBuffer.Init(1);
-		AccelerationMoveVertexBuffer.Init(1);
 
-		PositionVertexBuffer.VertexPosition(0) = FVector4(0, 0, 0, 0);
+		Positions.Emplace(0, 0, 0, 0);
 		DeformableMeshVertexBuffer.SetVertexTangents(0, FVector(1, 0, 0), FVector(0, 1, 0), FVector(0, 0, 1));
 		DeformableMeshVertexBuffer.SetVertexUV(0, 0, FVector2D(0, 0));
 		ColorVertexBuffer.VertexColor(0) = FColor(1,1,1,1);
-		PrevPositionVertexBuffer.VertexPosition(0) = FVector4(0, 0, 0, 0);
-
-		float IterDeltaTime = 1.0f / FGridClothParameters::BASE_FREQUENCY;
-		float SqrIterDeltaTime = IterDeltaTime * IterDeltaTime;
-
-		AccelerationMoveVertexBuffer.VertexPosition(0) = FGridClothParameters::GRAVITY * SqrIterDeltaTime;
+		ExternalAccelerations4.Emplace(0, 0, 0, 0);
+		if (bInCPUBackend)
+		{
+			CPUTangents.Add(FPackedNormal(FVector(1, 0, 0)));
+			CPUTangents.Add(FPackedNormal(FVector(0, 0, 1)));
+		}
 		NumTexCoords = 1;
-		LightMapIndex = 0;
+		InLightMapIndex = 0;
 	}
 
+	VertexFactory = InVertexFactory;
+	NumVertex = Positions.Num();
+	LightMapIndex = InLightMapIndex;
+	bCPUBackend = bInCPUBackend;
+
 	FClothVertexBuffers* Self = this;
 	ENQUEUE_RENDER_COMMAND(InitClothVertexBuffers)(
-		[VertexFactory, Self, LightMapIndex](FRHICommandListImmediate& RHICmdList)
+		[Self, Positions = MoveTemp(Positions), ExternalAccelerations4 = MoveTemp(ExternalAccelerations4), CPUTangents = MoveTemp(CPUTangents)](FRHICommandListImmediate& RHICmdList)
 		{
-			InitOrUpdateResourceMacroCloth(&Self->PositionVertexBuffer);
 			InitOrUpdateResourceMacroCloth(&Self->DeformableMeshVertexBuffer);
 			InitOrUpdateResourceMacroCloth(&Self->ColorVertexBuffer);
-			InitOrUpdateResourceMacroCloth(&Self->PrevPositionVertexBuffer);
-			InitOrUpdateResourceMacroCloth(&Self->AccelerationMoveVertexBuffer);
-
-			FLocalVertexFactory::FDataType Data;
-			Self->PositionVertexBuffer.BindPositionVertexBuffer(VertexFactory, Data);
-			Self->DeformableMeshVertexBuffer.BindTangentVertexBuffer(VertexFactory, Data);
-			Self->DeformableMeshVertexBuffer.BindPackedTexCoordVertexBuffer(VertexFactory, Data);
-			Self->DeformableMeshVertexBuffer.BindLightMapVertexBuffer(VertexFactory, Data, LightMapIndex);
-			Self->ColorVertexBuffer.BindColorVertexBuffer(VertexFactory, Data);
-			// PrevPositionVertexBufferAAccelerationMoveVertexBuffer̓V~[Vp̃f[^Ȃ̂LocalVertexFactoryƃoChKv͂Ȃ
-			VertexFactory->SetData(Data);
-
-			InitOrUpdateResourceMacroCloth(VertexFactory);
+
+			if (Self->bCPUBackend)
+			{
+				// CPUバックエンドは毎フレームCPUから位置とタンジェントを書き込むので、プールではなくクロス専用のダイナミックバッファに置く。
+				// シミュレーションの状態はコンポーネントのFClothGridMeshCPUStateにあるので、前フレームの位置と外力のバッファはいらない
+				Self->CPUPositionBuffer.Init(Self->NumVertex, sizeof(FVector4), PF_R32_FLOAT);
+				InitOrUpdateResourceMacroCloth(&Self->CPUPositionBuffer);
+				Self->CPUPositionBuffer.Write(Positions.GetData(), Positions.Num() * sizeof(FVector4));
+
+				Self->CPUTangentBuffer.Init(Self->NumVertex, 2 * sizeof(FPackedNormal), PF_R8G8B8A8_SNORM);
+				InitOrUpdateResourceMacroCloth(&Self->CPUTangentBuffer);
+				Self->CPUTangentBuffer.Write(CPUTangents.GetData(), CPUTangents.Num() * sizeof(FPackedNormal));
+
+				Self->BindVertexFactory();
+				return;
+			}
+
+#if ENGINE_MINOR_VERSION < 26
+			InitOrUpdateResourceMacroCloth(&Self->PositionVertexBuffer);
+#endif
+
+			check(Self->PoolAllocationId == INDEX_NONE);
+#if ENGINE_MINOR_VERSION >= 26
+			// プールの範囲はシミュレーションの直前に決まるので、バーテックスファクトリはそのときにバインドする。
+			// コンパクションで範囲が動いたら、オフセットを変えてバインドし直す
+			Self->PoolAllocationId = GClothVertexPool.Allocate(Self->NumVertex, [Self]() { Self->BindVertexFactory(); });
+#else
+			// 描画するのはクロス専用の位置バッファなので、プールの範囲が決まるのを待たずにバインドできる
+			Self->PoolAllocationId = GClothVertexPool.Allocate(Self->NumVertex, TFunction<void()>());
+			Self->BindVertexFactory();
+#endif
+
+			// 範囲が決まるまではプールが値を持っておき、決まったときにアップロードする
+			GClothVertexPool.WritePositions(Self->PoolAllocationId, Positions);
+			// 前フレームの位置は初期化では現フレームと同じにする
+			GClothVertexPool.WritePrevPositions(Self->PoolAllocationId, Positions);
+			GClothVertexPool.WriteExternalAccelerations(Self->PoolAllocationId, 0, ExternalAccelerations4);
 		});
 }
 
-void FClothVertexBuffers::SetAccelerationMoves(const TArray<FVector>& AccelerationMoves)
+void FClothVertexBuffers::BindVertexFactory()
 {
-	for (int32 i = 0; i < AccelerationMoves.Num(); i++)
+	FLocalVertexFactory::FDataType Data;
+	if (bCPUBackend)
+	{
+		Data.PositionComponent = FVertexStreamComponent(
+			&CPUPositionBuffer,
+			0,
+			sizeof(FVector4),
+			VET_Float4
+		);
+		Data.PositionComponentSRV = CPUPositionBuffer.GetSRV();
+
+		// FDeformableMeshVertexBuffer::BindTangentVertexBuffer()と同じレイアウトでダイナミックバッファを読む
+		Data.TangentsSRV = CPUTangentBuffer.GetSRV();
+		Data.TangentBasisComponents[0] = FVertexStreamComponent(
+			&CPUTangentBuffer,
+			0,
+			CPUTangentBuffer.GetStride(),
+			VET_PackedNormal,
+			EVertexStreamUsage::ManualFetch
+		);
+		Data.TangentBasisComponents[1] = FVertexStreamComponent(
+			&CPUTangentBuffer,
+			sizeof(FPackedNormal),
+			CPUTangentBuffer.GetStride(),
+			VET_PackedNormal,
+			EVertexStreamUsage::ManualFetch
+		);
+	}
+	else
 	{
-		AccelerationMoveVertexBuffer.VertexPosition(i) = AccelerationMoves[i];
+		check(PoolAllocationId != INDEX_NONE);
+#if ENGINE_MINOR_VERSION >= 26
+		const FClothVertexPoolBuffer& PoolPositionBuffer = GClothVertexPool.GetPositionBuffer();
+		const uint32 Offset = GClothVertexPool.GetOffset(PoolAllocationId);
+
+		// プールのバッファの、このクロスの範囲の先頭をストリームオフセットにする
+		Data.PositionComponent = FVertexStreamComponent(
+			&PoolPositionBuffer,
+			Offset * sizeof(FVector4),
+			0,
+			sizeof(FVector4),
+			VET_Float4
+		);
+		// マニュアルバーテックスフェッチも同じ範囲を読むよう、SRVもこのクロスの範囲から始める
+		PositionComponentSRV = RHICreateShaderResourceView(FShaderResourceViewInitializer(PoolPositionBuffer.VertexBufferRHI, PF_R32_FLOAT, Offset * sizeof(FVector4), NumVertex * 4));
+		Data.PositionComponentSRV = PositionComponentSRV;
+#else
+		// 4.25以前はオフセット付きのSRVが作れず、マニュアルバーテックスフェッチがプールの先頭から読んでしまうので、
+		// FClothGridMeshDeformerがシミュレーション後にこのクロスの範囲をコピーする専用の位置バッファを描画に使う
+		PositionVertexBuffer.BindPositionVertexBuffer(VertexFactory, Data);
+#endif
+
+		DeformableMeshVertexBuffer.BindTangentVertexBuffer(VertexFactory, Data);
+	}
+
+	DeformableMeshVertexBuffer.BindPackedTexCoordVertexBuffer(VertexFactory, Data);
+	DeformableMeshVertexBuffer.BindLightMapVertexBuffer(VertexFactory, Data, LightMapIndex);
+	ColorVertexBuffer.BindColorVertexBuffer(VertexFactory, Data);
+	// 前フレームの位置、外力はシミュレーション用のデータなのでLocalVertexFactoryとバインドする必要はない
+	VertexFactory->SetData(Data);
+
+	InitOrUpdateResourceMacroCloth(VertexFactory);
+}
+
+void FClothVertexBuffers::UpdateExternalAccelerations(uint32 FirstVertex, const TArray<FVector>& ExternalAccelerations)
+{
+	check(FirstVertex + ExternalAccelerations.Num() <= NumVertex);
+
+	TArray<FVector4> ExternalAccelerations4;
+	ExternalAccelerations4.Reserve(ExternalAccelerations.Num());
+	for (const FVector& ExternalAcceleration : ExternalAccelerations)
+	{
+		ExternalAccelerations4.Emplace(ExternalAcceleration, 0.0f);
 	}
 
 	FClothVertexBuffers* Self = this;
-	ENQUEUE_RENDER_COMMAND(UpdateAccelerationVertexBuffers)(
-		[Self](FRHICommandListImmediate& RHICmdList)
+	ENQUEUE_RENDER_COMMAND(UpdateExternalAccelerationVertexBuffers)(
+		[Self, FirstVertex, ExternalAccelerations4 = MoveTemp(ExternalAccelerations4)](FRHICommandListImmediate& RHICmdList)
 		{
-			InitOrUpdateResourceMacroCloth(&Self->AccelerationMoveVertexBuffer);
+			if (Self->PoolAllocationId != INDEX_NONE)
+			{
+				GClothVertexPool.WriteExternalAccelerations(Self->PoolAllocationId, FirstVertex, ExternalAccelerations4);
+			}
 		});
 }
 
+void FClothVertexBuffers::WriteCPUResult(TArrayView<const FVector4> Positions, TArrayView<const FPackedNormal> Tangents)
+{
+	check(bCPUBackend);
+	check((uint32)Positions.Num() == NumVertex);
+	check((uint32)Tangents.Num() == NumVertex * 2);
+
+	CPUPositionBuffer.Write(Positions.GetData(), Positions.Num() * sizeof(FVector4));
+	CPUTangentBuffer.Write(Tangents.GetData(), Tangents.Num() * sizeof(FPackedNormal));
+}
+
+void FClothVertexBuffers::ReleaseCPUBackendResources()
+{
+	CPUPositionBuffer.ReleaseResource();
+	CPUTangentBuffer.ReleaseResource();
+}
+
+void FClothVertexBuffers::ReleasePoolRange()
+{
+	check(IsInRenderingThread());
+
+	if (PoolAllocationId != INDEX_NONE)
+	{
+		GClothVertexPool.Free(PoolAllocationId);
+		PoolAllocationId = INDEX_NONE;
+	}
+
+	PositionComponentSRV.SafeRelease();
+}
+
+uint32 FClothVertexBuffers::GetPoolOffset() const
+{
+	check(PoolAllocationId != INDEX_NONE);
+	return GClothVertexPool.GetOffset(PoolAllocationId);
+}
+
+bool FClothVertexBuffers::IsPoolRangePlaced() const
+{
+	return PoolAllocationId != INDEX_NONE && GClothVertexPool.IsPlaced(PoolAllocationId);
+}
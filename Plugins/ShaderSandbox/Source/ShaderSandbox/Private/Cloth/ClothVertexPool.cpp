@@ -0,0 +1,256 @@
+#include "Cloth/ClothVertexPool.h"
+#include "GlobalShader.h"
+#include "RHIResources.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RenderingThread.h"
+#include "HAL/IConsoleManager.h"
+
+TGlobalResource<FClothVertexPool> GClothVertexPool;
+
+class FClothVertexPoolCopyCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FClothVertexPoolCopyCS);
+	SHADER_USE_PARAMETER_STRUCT(FClothVertexPoolCopyCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, SrcVertexIndexOffset)
+		SHADER_PARAMETER(uint32, DstVertexIndexOffset)
+		SHADER_PARAMETER(uint32, NumVertex)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, SrcPositionBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, SrcPrevPositionBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, SrcExternalAccelerationBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, DstPositionBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, DstPrevPositionBuffer)
+		SHADER_PARAMETER_UAV(RWBuffer<float>, DstExternalAccelerationBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FClothVertexPoolCopyCS, "/Plugin/ShaderSandbox/Private/ClothMeshCopy.usf", "CopyRange", SF_Compute);
+
+void FClothVertexPoolBuffer::Reallocate(uint32 InNumVertices)
+{
+	NumVertices = InNumVertices;
+
+	if (!IsInitialized())
+	{
+		InitResource();
+	}
+	else
+	{
+		UpdateRHI();
+	}
+}
+
+void FClothVertexPoolBuffer::InitRHI()
+{
+	if (NumVertices == 0)
+	{
+		return;
+	}
+
+	FRHIResourceCreateInfo CreateInfo;
+	VertexBufferRHI = RHICreateVertexBuffer(NumVertices * sizeof(FVector4), EBufferUsageFlags::BUF_Static | EBufferUsageFlags::BUF_ShaderResource | EBufferUsageFlags::BUF_UnorderedAccess, CreateInfo);
+	UAV = RHICreateUnorderedAccessView(VertexBufferRHI, PF_R32_FLOAT);
+}
+
+void FClothVertexPoolBuffer::ReleaseRHI()
+{
+	UAV.SafeRelease();
+	FVertexBuffer::ReleaseRHI();
+}
+
+int32 FClothVertexPool::Allocate(uint32 NumVertex, TFunction<void()>&& OnRelocated)
+{
+	check(IsInRenderingThread());
+	check(NumVertex > 0);
+
+	// 範囲を決めるのはApplyPendingChanges()。シミュレーションと同じグラフでコピーするためにここではGPUの処理をしない
+	const int32 AllocationId = Ranges.Add(NumVertex);
+
+	// IDはRangesと共通にする。追加と削除を常に両方に行うので同じインデックスが空いている
+	Allocations.Insert(AllocationId, FAllocation());
+	Allocations[AllocationId].OnRelocated = MoveTemp(OnRelocated);
+	return AllocationId;
+}
+
+void FClothVertexPool::Free(int32 AllocationId)
+{
+	check(IsInRenderingThread());
+	check(Allocations.IsValidIndex(AllocationId));
+
+	// 前のシミュレーションがまだ書いているかもしれないので、空いた範囲が再利用されるのは次の次のApplyPendingChanges()から
+	Ranges.Remove(AllocationId);
+	Allocations.RemoveAt(AllocationId);
+}
+
+void FClothVertexPool::ApplyPendingChanges(FRDGBuilder& GraphBuilder)
+{
+	check(IsInRenderingThread());
+
+	// 前回詰め直したときの古いバッファからのコピーは前回のグラフで実行済み
+	RetiredBuffers.Reset();
+	RetiredUAVs.Reset();
+
+	TArray<FClothVertexRanges::FMove> Moves;
+	TArray<int32> PlacedIds;
+	const bool bRebuilt = Ranges.Place(Moves, PlacedIds);
+
+	if (bRebuilt)
+	{
+		FRHIUnorderedAccessView* SrcUAVs[(int32)EStream::Num];
+		for (int32 StreamIdx = 0; StreamIdx < (int32)EStream::Num; StreamIdx++)
+		{
+			// 古いバッファはグラフが実行されてコピーが終わるまで参照を持っておく
+			SrcUAVs[StreamIdx] = Buffers[StreamIdx].GetUAV();
+			if (Buffers[StreamIdx].VertexBufferRHI.IsValid())
+			{
+				RetiredBuffers.Add(Buffers[StreamIdx].VertexBufferRHI);
+				RetiredUAVs.Add(Buffers[StreamIdx].GetUAV());
+			}
+
+			Buffers[StreamIdx].Reallocate(Ranges.GetCapacity());
+		}
+
+#if ENGINE_MINOR_VERSION >= 25
+		FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#else
+		TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#endif
+		TShaderMapRef<FClothVertexPoolCopyCS> ClothVertexPoolCopyCS(ShaderMap);
+
+		// バッファを作り直したので、オフセットが変わらなくてもコピーは必要。
+		// シミュレーションと同じAsyncComputeのパスにして、同じグラフの中でシミュレーションより前に実行されるようにする
+		for (const FClothVertexRanges::FMove& Move : Moves)
+		{
+			FClothVertexPoolCopyCS::FParameters* CopyParams = GraphBuilder.AllocParameters<FClothVertexPoolCopyCS::FParameters>();
+			CopyParams->SrcVertexIndexOffset = Move.SrcOffset;
+			CopyParams->DstVertexIndexOffset = Move.DstOffset;
+			CopyParams->NumVertex = Move.NumVertex;
+			CopyParams->SrcPositionBuffer = SrcUAVs[(int32)EStream::Position];
+			CopyParams->SrcPrevPositionBuffer = SrcUAVs[(int32)EStream::PrevPosition];
+			CopyParams->SrcExternalAccelerationBuffer = SrcUAVs[(int32)EStream::ExternalAcceleration];
+			CopyParams->DstPositionBuffer = Buffers[(int32)EStream::Position].GetUAV();
+			CopyParams->DstPrevPositionBuffer = Buffers[(int32)EStream::PrevPosition].GetUAV();
+			CopyParams->DstExternalAccelerationBuffer = Buffers[(int32)EStream::ExternalAcceleration].GetUAV();
+
+			const uint32 DispatchCount = FMath::DivideAndRoundUp(Move.NumVertex, (uint32)32);
+			check(DispatchCount <= 65535);
+
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("ClothVertexPoolCopy"),
+				ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+				ClothVertexPoolCopyCS,
+#else
+				*ClothVertexPoolCopyCS,
+#endif
+				CopyParams,
+				FIntVector(DispatchCount, 1, 1)
+			);
+		}
+	}
+
+	// 置かれる前に書かれた値をアップロードする。新しく置かれた範囲はコピー先にならないので、コピーのパスとは重ならない
+	for (int32 AllocationId : PlacedIds)
+	{
+		FAllocation& Allocation = Allocations[AllocationId];
+		for (int32 StreamIdx = 0; StreamIdx < (int32)EStream::Num; StreamIdx++)
+		{
+			if (Allocation.PendingValues[StreamIdx].Num() > 0)
+			{
+				Write((EStream)StreamIdx, AllocationId, 0, Allocation.PendingValues[StreamIdx]);
+				Allocation.PendingValues[StreamIdx].Empty();
+			}
+		}
+	}
+
+	// バーテックスファクトリのオフセットやSRVを作り直してもらう
+	if (bRebuilt)
+	{
+		for (TSparseArray<FAllocation>::TIterator It(Allocations); It; ++It)
+		{
+			if (Ranges.IsPlaced(It.GetIndex()) && It->OnRelocated)
+			{
+				It->OnRelocated();
+			}
+		}
+	}
+	else
+	{
+		for (int32 AllocationId : PlacedIds)
+		{
+			if (Allocations[AllocationId].OnRelocated)
+			{
+				Allocations[AllocationId].OnRelocated();
+			}
+		}
+	}
+}
+
+void FClothVertexPool::Write(EStream Stream, int32 AllocationId, uint32 FirstVertex, TArrayView<const FVector4> Values)
+{
+	check(IsInRenderingThread());
+	check(FirstVertex + Values.Num() <= Ranges.GetNumVertex(AllocationId));
+
+	if (Values.Num() == 0)
+	{
+		return;
+	}
+
+	if (!Ranges.IsPlaced(AllocationId))
+	{
+		// まだ範囲が決まっていないので、ApplyPendingChanges()でアップロードするまで持っておく
+		TArray<FVector4>& PendingValues = Allocations[AllocationId].PendingValues[(int32)Stream];
+		if (PendingValues.Num() == 0)
+		{
+			PendingValues.AddZeroed(Ranges.GetNumVertex(AllocationId));
+		}
+		FMemory::Memcpy(&PendingValues[FirstVertex], Values.GetData(), Values.Num() * sizeof(FVector4));
+		return;
+	}
+
+	// 書き換える範囲だけをロックする。ステージングはRHIに任せる
+	const FClothVertexPoolBuffer& Buffer = Buffers[(int32)Stream];
+	const uint32 Size = Values.Num() * sizeof(FVector4);
+	void* Data = RHILockVertexBuffer(Buffer.VertexBufferRHI, (Ranges.GetOffset(AllocationId) + FirstVertex) * sizeof(FVector4), Size, RLM_WriteOnly);
+	FMemory::Memcpy(Data, Values.GetData(), Size);
+	RHIUnlockVertexBuffer(Buffer.VertexBufferRHI);
+}
+
+void FClothVertexPool::ReleaseResource()
+{
+	// バッファはこのクラスが個別にInitResource()しているので、ここでまとめて解放する
+	for (FClothVertexPoolBuffer& Buffer : Buffers)
+	{
+		Buffer.ReleaseResource();
+	}
+	RetiredBuffers.Reset();
+	RetiredUAVs.Reset();
+	FRenderResource::ReleaseResource();
+}
+
+namespace
+{
+void DumpVertexPool()
+{
+	ENQUEUE_RENDER_COMMAND(DumpClothVertexPool)(
+		[](FRHICommandListImmediate& RHICmdList)
+		{
+			GClothVertexPool.Dump();
+		});
+}
+
+FAutoConsoleCommand DumpVertexPoolCommand(
+	TEXT("ShaderSandbox.Cloth.DumpVertexPool"),
+	TEXT("Logs the capacity, the allocated vertex ranges and the free ranges of the pooled vertex buffers of the GPU cloths."),
+	FConsoleCommandDelegate::CreateStatic(&DumpVertexPool)
+);
+} // namespace
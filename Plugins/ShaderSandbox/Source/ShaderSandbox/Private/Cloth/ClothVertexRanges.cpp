@@ -0,0 +1,291 @@
+#include "Cloth/ClothVertexRanges.h"
+#include "Misc/AutomationTest.h"
+
+int32 FClothVertexRanges::Add(uint32 NumVertex)
+{
+	check(NumVertex > 0);
+
+	FRange Range;
+	Range.NumVertex = NumVertex;
+	const int32 Id = Ranges.Add(Range);
+
+	PendingIds.Add(Id);
+	NumAllocatedVertex += NumVertex;
+	return Id;
+}
+
+void FClothVertexRanges::Remove(int32 Id)
+{
+	check(Ranges.IsValidIndex(Id));
+
+	const FRange Range = Ranges[Id];
+	Ranges.RemoveAt(Id);
+	NumAllocatedVertex -= Range.NumVertex;
+
+	if (Range.bPlaced)
+	{
+		// 直前のシミュレーションがまだこの範囲に書いているかもしれないので、すぐには空きに戻さない
+		FFreeRange Freed;
+		Freed.Offset = Range.Offset;
+		Freed.NumVertex = Range.NumVertex;
+		RemovedRanges.Add(Freed);
+	}
+	else
+	{
+		PendingIds.Remove(Id);
+	}
+}
+
+void FClothVertexRanges::AddFreeRange(TArray<FFreeRange>& InOutFreeRanges, const FFreeRange& Freed)
+{
+	// オフセット順を保って挿入し、前後の空きとつながっていればまとめる
+	int32 InsertIdx = InOutFreeRanges.IndexOfByPredicate([&Freed](const FFreeRange& Range) { return Range.Offset > Freed.Offset; });
+	if (InsertIdx == INDEX_NONE)
+	{
+		InsertIdx = InOutFreeRanges.Num();
+	}
+	InOutFreeRanges.Insert(Freed, InsertIdx);
+
+	if (InsertIdx + 1 < InOutFreeRanges.Num() && InOutFreeRanges[InsertIdx].Offset + InOutFreeRanges[InsertIdx].NumVertex == InOutFreeRanges[InsertIdx + 1].Offset)
+	{
+		InOutFreeRanges[InsertIdx].NumVertex += InOutFreeRanges[InsertIdx + 1].NumVertex;
+		InOutFreeRanges.RemoveAt(InsertIdx + 1);
+	}
+
+	if (InsertIdx > 0 && InOutFreeRanges[InsertIdx - 1].Offset + InOutFreeRanges[InsertIdx - 1].NumVertex == InOutFreeRanges[InsertIdx].Offset)
+	{
+		InOutFreeRanges[InsertIdx - 1].NumVertex += InOutFreeRanges[InsertIdx].NumVertex;
+		InOutFreeRanges.RemoveAt(InsertIdx);
+	}
+}
+
+bool FClothVertexRanges::Place(TArray<FMove>& OutMoves, TArray<int32>& OutPlacedIds)
+{
+	OutMoves.Reset();
+	OutPlacedIds.Reset();
+
+	// 使用量が容量の1/4を切ったら半分の容量に詰め直す。増減を繰り返すときに毎回作り直さないよう、倍にするときと閾値をずらしている
+	const bool bShrink = (Capacity > MIN_CAPACITY && NumAllocatedVertex < Capacity / 4);
+
+	if (!bShrink)
+	{
+		// 今の空きに先頭から当てはめてみて、すべて入るならそれで確定する
+		TArray<FFreeRange> NewFreeRanges = FreeRanges;
+		TArray<uint32> Offsets;
+		Offsets.Reserve(PendingIds.Num());
+
+		for (int32 Id : PendingIds)
+		{
+			const uint32 NumVertex = Ranges[Id].NumVertex;
+			const int32 FreeRangeIdx = NewFreeRanges.IndexOfByPredicate([NumVertex](const FFreeRange& Range) { return Range.NumVertex >= NumVertex; });
+			if (FreeRangeIdx == INDEX_NONE)
+			{
+				break;
+			}
+
+			FFreeRange& FreeRange = NewFreeRanges[FreeRangeIdx];
+			Offsets.Add(FreeRange.Offset);
+			FreeRange.Offset += NumVertex;
+			FreeRange.NumVertex -= NumVertex;
+			if (FreeRange.NumVertex == 0)
+			{
+				NewFreeRanges.RemoveAt(FreeRangeIdx);
+			}
+		}
+
+		if (Offsets.Num() == PendingIds.Num())
+		{
+			for (int32 i = 0; i < PendingIds.Num(); i++)
+			{
+				FRange& Range = Ranges[PendingIds[i]];
+				Range.Offset = Offsets[i];
+				Range.bPlaced = true;
+			}
+
+			OutPlacedIds = MoveTemp(PendingIds);
+			PendingIds.Reset();
+
+			FreeRanges = MoveTemp(NewFreeRanges);
+			for (const FFreeRange& Removed : RemovedRanges)
+			{
+				AddFreeRange(FreeRanges, Removed);
+			}
+			RemovedRanges.Reset();
+			return false;
+		}
+	}
+
+	// 入らないときは、空きの合計が足りていれば容量はそのままで詰めて断片化を解消し、足りなければ倍に広げる
+	uint32 NewCapacity = Capacity;
+	if (bShrink)
+	{
+		NewCapacity = FMath::Max(Capacity / 2, (uint32)MIN_CAPACITY);
+	}
+	else if (NumAllocatedVertex > Capacity)
+	{
+		NewCapacity = FMath::Max3(Capacity * 2, NumAllocatedVertex, (uint32)MIN_CAPACITY);
+	}
+	check(NewCapacity >= NumAllocatedVertex);
+
+	// 配置済みの範囲を今のオフセット順に先頭から詰め、そのうしろに追加された範囲を置く
+	TArray<int32> SortedIds;
+	SortedIds.Reserve(Ranges.Num());
+	for (TSparseArray<FRange>::TConstIterator It(Ranges); It; ++It)
+	{
+		if (It->bPlaced)
+		{
+			SortedIds.Add(It.GetIndex());
+		}
+	}
+	SortedIds.Sort([this](int32 A, int32 B) { return Ranges[A].Offset < Ranges[B].Offset; });
+
+	uint32 Offset = 0;
+	OutMoves.Reserve(SortedIds.Num());
+	for (int32 Id : SortedIds)
+	{
+		FRange& Range = Ranges[Id];
+
+		// バッファを作り直すので、オフセットが変わらなくてもコピーは必要
+		FMove Move;
+		Move.Id = Id;
+		Move.SrcOffset = Range.Offset;
+		Move.DstOffset = Offset;
+		Move.NumVertex = Range.NumVertex;
+		OutMoves.Add(Move);
+
+		Range.Offset = Offset;
+		Offset += Range.NumVertex;
+	}
+
+	for (int32 Id : PendingIds)
+	{
+		FRange& Range = Ranges[Id];
+		Range.Offset = Offset;
+		Range.bPlaced = true;
+		Offset += Range.NumVertex;
+	}
+	check(Offset == NumAllocatedVertex);
+
+	OutPlacedIds = MoveTemp(PendingIds);
+	PendingIds.Reset();
+
+	// 削除された範囲は新しいバッファには含まれない
+	Capacity = NewCapacity;
+	FreeRanges.Reset();
+	RemovedRanges.Reset();
+	if (NumAllocatedVertex < Capacity)
+	{
+		FFreeRange FreeRange;
+		FreeRange.Offset = NumAllocatedVertex;
+		FreeRange.NumVertex = Capacity - NumAllocatedVertex;
+		FreeRanges.Add(FreeRange);
+	}
+
+	return true;
+}
+
+void FClothVertexRanges::Dump() const
+{
+	UE_LOG(LogTemp, Log, TEXT("ClothVertexPool: Capacity %u vertices (%u bytes), Allocated %u vertices in %d ranges (%d not placed), Free %d ranges, Removed %d ranges"),
+		Capacity, Capacity * (uint32)sizeof(FVector4) * 3, NumAllocatedVertex, Ranges.Num(), PendingIds.Num(), FreeRanges.Num(), RemovedRanges.Num());
+
+	for (TSparseArray<FRange>::TConstIterator It(Ranges); It; ++It)
+	{
+		if (It->bPlaced)
+		{
+			UE_LOG(LogTemp, Log, TEXT("  Allocation %d: [%u, %u)"), It.GetIndex(), It->Offset, It->Offset + It->NumVertex);
+		}
+		else
+		{
+			UE_LOG(LogTemp, Log, TEXT("  Allocation %d: %u vertices, not placed"), It.GetIndex(), It->NumVertex);
+		}
+	}
+
+	for (const FFreeRange& Range : FreeRanges)
+	{
+		UE_LOG(LogTemp, Log, TEXT("  Free: [%u, %u)"), Range.Offset, Range.Offset + Range.NumVertex);
+	}
+
+	for (const FFreeRange& Range : RemovedRanges)
+	{
+		UE_LOG(LogTemp, Log, TEXT("  Removed: [%u, %u)"), Range.Offset, Range.Offset + Range.NumVertex);
+	}
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FClothVertexRangesTest, "ShaderSandbox.Cloth.VertexRanges", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FClothVertexRangesTest::RunTest(const FString& Parameters)
+{
+	FClothVertexRanges Ranges;
+	TArray<FClothVertexRanges::FMove> Moves;
+	TArray<int32> PlacedIds;
+
+	// 登録。最初のPlace()で最低容量のバッファができる
+	const int32 A = Ranges.Add(1000);
+	const int32 B = Ranges.Add(1000);
+	TestFalse(TEXT("Not placed before Place()"), Ranges.IsPlaced(A));
+	TestTrue(TEXT("First Place() builds the capacity"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Capacity after the first Place()"), (int32)Ranges.GetCapacity(), (int32)FClothVertexRanges::MIN_CAPACITY);
+	TestEqual(TEXT("Offset of A"), (int32)Ranges.GetOffset(A), 0);
+	TestEqual(TEXT("Offset of B"), (int32)Ranges.GetOffset(B), 1000);
+	TestEqual(TEXT("Placed ranges"), PlacedIds.Num(), 2);
+
+	// 空きに入るなら作り直さない
+	const int32 C = Ranges.Add(1000);
+	TestFalse(TEXT("Fitting range doesn't rebuild"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Offset of C"), (int32)Ranges.GetOffset(C), 2000);
+
+	// 登録解除した範囲は次のPlace()ではまだ使わず、その次から使う
+	Ranges.Remove(A);
+	const int32 D = Ranges.Add(500);
+	TestFalse(TEXT("D fits in the tail"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Removed range is not reused by the next Place()"), (int32)Ranges.GetOffset(D), 3000);
+	const int32 E = Ranges.Add(800);
+	TestFalse(TEXT("E fits in the removed range"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Removed range is reused by the Place() after the next one"), (int32)Ranges.GetOffset(E), 0);
+
+	// 拡張。入らなければ倍の容量に詰め直し、配置済みの範囲はすべてコピーする
+	const int32 F = Ranges.Add(3000);
+	TestTrue(TEXT("Range larger than the free ranges rebuilds"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Capacity after growing"), (int32)Ranges.GetCapacity(), 2 * (int32)FClothVertexRanges::MIN_CAPACITY);
+	TestEqual(TEXT("Moves after growing"), Moves.Num(), 4);
+	TestEqual(TEXT("E is packed to the head"), (int32)Ranges.GetOffset(E), 0);
+	TestEqual(TEXT("B follows E"), (int32)Ranges.GetOffset(B), 800);
+	TestEqual(TEXT("F is placed after the packed ranges"), (int32)Ranges.GetOffset(F), 800 + 1000 + 1000 + 500);
+	TestEqual(TEXT("Allocated vertices"), (int32)Ranges.GetNumAllocatedVertex(), 800 + 1000 + 1000 + 500 + 3000);
+
+	// 縮小。使用量が1/4を切ったら半分の容量に詰め直す
+	Ranges.Remove(F);
+	Ranges.Remove(B);
+	Ranges.Remove(C);
+	TestTrue(TEXT("Less than a quarter in use rebuilds"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Capacity after shrinking"), (int32)Ranges.GetCapacity(), (int32)FClothVertexRanges::MIN_CAPACITY);
+	TestEqual(TEXT("E after shrinking"), (int32)Ranges.GetOffset(E), 0);
+	TestEqual(TEXT("D after shrinking"), (int32)Ranges.GetOffset(D), 800);
+	TestFalse(TEXT("Never shrinks below the minimum capacity"), Ranges.Place(Moves, PlacedIds));
+
+	// 断片化。空きの合計が足りていれば容量はそのままで詰め直す
+	const int32 G = Ranges.Add(1000);
+	const int32 H = Ranges.Add(1000);
+	TestFalse(TEXT("G and H fit"), Ranges.Place(Moves, PlacedIds));
+	Ranges.Remove(G);
+	TestFalse(TEXT("Nothing to place"), Ranges.Place(Moves, PlacedIds));
+	const int32 I = Ranges.Add(1700);
+	TestTrue(TEXT("Fragmented free ranges rebuild"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Capacity is kept when the free vertices are enough"), (int32)Ranges.GetCapacity(), (int32)FClothVertexRanges::MIN_CAPACITY);
+	TestEqual(TEXT("I after packing"), (int32)Ranges.GetOffset(I), 800 + 500 + 1000);
+	TestEqual(TEXT("H after packing"), (int32)Ranges.GetOffset(H), 800 + 500);
+
+	// 配置前に削除した範囲は配置されない
+	const int32 J = Ranges.Add(100);
+	Ranges.Remove(J);
+	TestFalse(TEXT("Removed pending range"), Ranges.Place(Moves, PlacedIds));
+	TestEqual(TEXT("Removed pending range is not placed"), PlacedIds.Num(), 0);
+
+	Ranges.Dump();
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -14,7 +14,7 @@ void UDeformableGridMeshComponent::InitGridMeshSetting(int32 NumRow, int32 NumCo
 	_GridHeight = GridHeight;
 	_Vertices.Reset((NumRow + 1) * (NumColumn + 1));
 	_TexCoords.Reset((NumRow + 1) * (NumColumn + 1));
-	_Indices.Reset(NumRow * NumColumn * 2 * 3); // ЂƂ̃Obhɂ3TriangleA6̒_CfbNXw肪
+	_Indices.Reset(NumRow * NumColumn * 2 * 3); // ひとつのグリッドには3つのTriangle、6つの頂点インデックス指定がある
 
 	for (int32 y = 0; y < NumRow + 1; y++)
 	{
@@ -89,6 +89,6 @@ void UDeformableGridMeshComponent::TickComponent(float DeltaTime, enum ELevelTic
 		_AccumulatedTime = 0.0f;
 	}
 
-	// t[SendRenderDynamicData_Concurrent()Ă΂悤ɂ
+	// 毎フレームSendRenderDynamicData_Concurrent()が呼ばれるようにする
 	MarkRenderDynamicDataDirty();
 }
@@ -176,7 +176,7 @@ void FDeformableMeshVertexBuffer::BindTangentVertexBuffer(const FVertexFactory*
 {
 	{
 		Data.TangentsSRV = TangentsSRV;
-		// TODO:ɑUAV͕̏KvȂH
+		// TODO:ここに相当するUAVの処理は必要ない？
 	}
 
 	{
@@ -216,7 +216,7 @@ void FDeformableMeshVertexBuffer::BindPackedTexCoordVertexBuffer(const FVertexFa
 
 	{
 		Data.TextureCoordinatesSRV = TextureCoordinatesSRV;
-		// TODO:ɑUAV͕̏KvȂH
+		// TODO:ここに相当するUAVの処理は必要ない？
 	}
 
 	{
@@ -274,7 +274,7 @@ void FDeformableMeshVertexBuffer::BindLightMapVertexBuffer(const FVertexFactory*
 
 	{
 		Data.TextureCoordinatesSRV = TextureCoordinatesSRV;
-		// TODO:ɑUAV͕̏KvȂH
+		// TODO:ここに相当するUAVの処理は必要ない？
 	}
 
 	{
@@ -403,7 +403,7 @@ void FDeformablePositionVertexBuffer::BindPositionVertexBuffer(const class FVert
 		VET_Float4
 	);
 	StaticMeshData.PositionComponentSRV = PositionComponentSRV;
-	// TODO:ɑUAV͕̏KvȂH
+	// TODO:ここに相当するUAVの処理は必要ない？
 }
 
 /** The implementation of the static mesh color-only vertex data storage type. */
@@ -502,7 +502,7 @@ void FDeformableColorVertexBuffer::BindColorVertexBuffer(const FVertexFactory* V
 	}
 
 	StaticMeshData.ColorComponentsSRV = ColorComponentsSRV;
-	// TODO:ɑUAV͕̏KvȂH
+	// TODO:ここに相当するUAVの処理は必要ない？
 	StaticMeshData.ColorIndexMask = ~0u;
 
 	{	
@@ -519,7 +519,7 @@ void FDeformableColorVertexBuffer::BindColorVertexBuffer(const FVertexFactory* V
 void FDeformableColorVertexBuffer::BindDefaultColorVertexBuffer(const FVertexFactory* VertexFactory, FStaticMeshDataType& StaticMeshData, NullBindStride BindStride)
 {
 	StaticMeshData.ColorComponentsSRV = GNullColorVertexBuffer.VertexBufferSRV;
-	// TODO:ɑUAV͕̏KvȂH
+	// TODO:ここに相当するUAVの処理は必要ない？
 	StaticMeshData.ColorIndexMask = 0;
 
 	{
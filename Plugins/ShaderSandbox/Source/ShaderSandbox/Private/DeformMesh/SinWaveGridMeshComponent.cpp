@@ -36,7 +36,7 @@ public:
 
 		for (int32 VertIdx = 0; VertIdx < Component->GetVertices().Num(); VertIdx++)
 		{
-			// TODO:Tangent͂Ƃ肠FDynamicMeshVertex̃ftHgl܂ɂBColorDynamicMeshVertex̃ftHgl̗pĂ
+			// TODO:TangentはとりあえずFDynamicMeshVertexのデフォルト値まかせにする。ColorはDynamicMeshVertexのデフォルト値を採用している
 			Vertices.Emplace(Component->GetVertices()[VertIdx], Component->GetTexCoords()[VertIdx], FColor(255, 255, 255));
 		}
 		VertexBuffers.InitFromDynamicVertex(&VertexFactory, Vertices);
@@ -41,6 +41,7 @@ class FSinWaveGridMeshTangentCS : public FGlobalShader
 		SHADER_PARAMETER(uint32, NumRow)
 		SHADER_PARAMETER(uint32, NumColumn)
 		SHADER_PARAMETER(uint32, NumVertex)
+		SHADER_PARAMETER(uint32, VertexIndexOffset)
 		SHADER_PARAMETER_UAV(RWBuffer<float>, InPositionVertexBuffer)
 		SHADER_PARAMETER_UAV(RWBuffer<float4>, OutTangentVertexBuffer)
 	END_SHADER_PARAMETER_STRUCT()
@@ -109,6 +110,7 @@ void SinWaveDeformGridMesh(FRHICommandListImmediate& RHICmdList, const FGridSinW
 	GridMeshTangent->NumRow = GridSinWaveParams.NumRow;
 	GridMeshTangent->NumColumn = GridSinWaveParams.NumColumn;
 	GridMeshTangent->NumVertex = GridSinWaveParams.NumVertex;
+	GridMeshTangent->VertexIndexOffset = 0;
 	GridMeshTangent->InPositionVertexBuffer = PositionVertexBufferUAV;
 	GridMeshTangent->OutTangentVertexBuffer = TangentVertexBufferUAV;
 
@@ -1,4 +1,5 @@
 #include "FFT/FFTTexture2D.h"
+#include "FFT/FFTLength.h"
 #include "GlobalShader.h"
 #include "ShaderParameterStruct.h"
 #include "RenderGraphBuilder.h"
@@ -13,6 +14,8 @@ class FHalfPackFFTTexture2DHorizontal : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FHalfPackFFTTexture2DHorizontal);
 	SHADER_USE_PARAMETER_STRUCT(FHalfPackFFTTexture2DHorizontal, FGlobalShader);
 
+	using FPermutationDomain = TShaderPermutationDomain<FFT::FFFTLengthDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, Forward)
 		SHADER_PARAMETER(FIntPoint, SrcRectMin)
@@ -37,6 +40,8 @@ class FFFTTexture2DVertical : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FFFTTexture2DVertical);
 	SHADER_USE_PARAMETER_STRUCT(FFFTTexture2DVertical, FGlobalShader);
 
+	using FPermutationDomain = TShaderPermutationDomain<FFT::FFFTLengthDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, Forward)
 		SHADER_PARAMETER(FIntPoint, SrcRectMin)
@@ -56,17 +61,23 @@ public:
 
 IMPLEMENT_GLOBAL_SHADER(FFFTTexture2DVertical, "/Plugin/ShaderSandbox/Private/FFTTexture2D.usf", "FFTTexture2DVertical", SF_Compute);
 
-void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode, const FTextureRHIRef& SrcTexture, FRHIUnorderedAccessView* DstUAV)
+void DoFFTTexture2D(FRHICommandListImmediate& RHICmdList, EFFTMode Mode, const FTextureRHIRef& SrcTexture, FRHIUnorderedAccessView* DstUAV, uint32 Size)
 {
-	const FIntRect& SrcRect = FIntRect(FIntPoint(0, 0), FIntPoint(512, 512));
+	check(FFT::IsSupportedFFTLength(Size));
+
+	const FIntRect& SrcRect = FIntRect(FIntPoint(0, 0), FIntPoint(Size, Size));
 	const uint32 FREQUENCY_PADDING = 2;
-	const FIntPoint& TmpBufferSize = FIntPoint(512 + FREQUENCY_PADDING, 512);
+	const FIntPoint& TmpBufferSize = FIntPoint(Size + FREQUENCY_PADDING, Size);
 	const FIntRect& TmpRect = FIntRect(FIntPoint(0, 0), TmpBufferSize);
 	const FIntRect& DstRect = SrcRect;
 
-	const FIntPoint& TmpBufferSize2 = FIntPoint(512, 512);
+	const FIntPoint& TmpBufferSize2 = FIntPoint(Size, Size);
 	const FIntRect& TmpRect2 = SrcRect;
 
+	// 行方向も列方向も長さはSizeなので同じパーミュテーションを使う
+	TShaderPermutationDomain<FFT::FFFTLengthDim> PermutationVector;
+	PermutationVector.Set<FFT::FFFTLengthDim>(Size);
+
 	FRDGBuilder GraphBuilder(RHICmdList);
 
 #if ENGINE_MINOR_VERSION >= 25
@@ -85,14 +96,14 @@ void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode,
 			false
 		);
 
-		// TODO:͈ȑORDGTexturȅŏ邩
+		// TODO:これは以前実験したRDGTextureの書き方で書けるかも
 		TRefCountPtr<IPooledRenderTarget> TmpRenderTarget;
 		GRenderTargetPool.FindFreeElement(RHICmdList, Desc, TmpRenderTarget, TEXT("FFTTexture2D Tmp Buffer"));
 
 		TRefCountPtr<IPooledRenderTarget> TmpRenderTarget2;
 		GRenderTargetPool.FindFreeElement(RHICmdList, Desc, TmpRenderTarget2, TEXT("FFTTexture2D Tmp Buffer2"));
 
-		TShaderMapRef<FHalfPackFFTTexture2DHorizontal> HalfPackForwardFFTCS(ShaderMap);
+		TShaderMapRef<FHalfPackFFTTexture2DHorizontal> HalfPackForwardFFTCS(ShaderMap, PermutationVector);
 
 		FHalfPackFFTTexture2DHorizontal::FParameters* HalfPackForwardFFTParams = GraphBuilder.AllocParameters<FHalfPackFFTTexture2DHorizontal::FParameters>();
 		HalfPackForwardFFTParams->Forward = 1;
@@ -113,10 +124,10 @@ void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode,
 			*HalfPackForwardFFTCS,
 #endif
 			HalfPackForwardFFTParams,
-			FIntVector(512, 1, 1)
+			FIntVector(Size, 1, 1)
 		);
 
-		TShaderMapRef<FFFTTexture2DVertical> ForwardFFTCS(ShaderMap);
+		TShaderMapRef<FFFTTexture2DVertical> ForwardFFTCS(ShaderMap, PermutationVector);
 
 		FFFTTexture2DVertical::FParameters* ForwardFFTParams = GraphBuilder.AllocParameters<FFFTTexture2DVertical::FParameters>();
 		ForwardFFTParams->Forward = 1;
@@ -136,11 +147,11 @@ void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode,
 			*ForwardFFTCS,
 #endif
 			ForwardFFTParams,
-			FIntVector(512 + FREQUENCY_PADDING, 1, 1)
+			FIntVector(Size + FREQUENCY_PADDING, 1, 1)
 		);
 
 
-		TShaderMapRef<FFFTTexture2DVertical> InverseFFTCS(ShaderMap);
+		TShaderMapRef<FFFTTexture2DVertical> InverseFFTCS(ShaderMap, PermutationVector);
 
 		FFFTTexture2DVertical::FParameters* InverseFFTParams = GraphBuilder.AllocParameters<FFFTTexture2DVertical::FParameters>();
 		InverseFFTParams->Forward = 0;
@@ -160,10 +171,10 @@ void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode,
 			*InverseFFTCS,
 #endif
 			InverseFFTParams,
-			FIntVector(512 + FREQUENCY_PADDING, 1, 1)
+			FIntVector(Size + FREQUENCY_PADDING, 1, 1)
 		);
 
-		TShaderMapRef<FHalfPackFFTTexture2DHorizontal> HalfPackInverseFFTCS(ShaderMap);
+		TShaderMapRef<FHalfPackFFTTexture2DHorizontal> HalfPackInverseFFTCS(ShaderMap, PermutationVector);
 
 		FHalfPackFFTTexture2DHorizontal::FParameters* HalfPackInverseFFTParams = GraphBuilder.AllocParameters<FHalfPackFFTTexture2DHorizontal::FParameters>();
 		HalfPackInverseFFTParams->Forward = 0;
@@ -183,7 +194,7 @@ void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode,
 			*HalfPackInverseFFTCS,
 #endif
 			HalfPackInverseFFTParams,
-			FIntVector(512 + FREQUENCY_PADDING, 1, 1)
+			FIntVector(Size + FREQUENCY_PADDING, 1, 1)
 		);
 	}
 
@@ -1,4 +1,5 @@
 #include "FFT/FFTTexture2DTestActor.h"
+#include "FFT/FFTLength.h"
 #include "Engine/Texture2D.h"
 #include "Engine/CanvasRenderTarget2D.h"
 #include "RHICommandList.h"
@@ -13,17 +14,19 @@ void AFFTTexture2DTestActor::BeginPlay()
 	_DstUAV = RHICreateUnorderedAccessView(DstTexture->GameThread_GetRenderTargetResource()->TextureRHI);
 	int32 Width, Height;
 	DstTexture->GetSize(Width, Height);
-	if (Width != 512 || Height != 512) // TODO:}WbNio[
+	if (Width != Height || !FFT::IsSupportedFFTLength(Width))
 	{
+		UE_LOG(LogTemp, Error, TEXT("%s: DstTexture must be square with a power of 2 size from %u to %u."), *GetPathName(), FFT::MinFFTLength, FFT::MaxFFTLength);
 		return;
 	}
 
+	const uint32 Size = Width;
 	ENQUEUE_RENDER_COMMAND(FFTTexture2DTestCmmand)(
-		[this](FRHICommandListImmediate& RHICmdList)
+		[this, Size](FRHICommandListImmediate& RHICmdList)
 		{
 			if (_DstUAV.IsValid())
 			{
-				FFTTexture2D::DoFFTTexture2D512x512(RHICmdList, FFTMode, SrcTexture->Resource->TextureRHI, _DstUAV);
+				FFTTexture2D::DoFFTTexture2D(RHICmdList, FFTMode, SrcTexture->Resource->TextureRHI, _DstUAV, Size);
 			}
 		}
 	);
@@ -0,0 +1,393 @@
+#include "Ocean/OceanFlipbook.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Async/MappedFileHandle.h"
+#include "Math/Float16.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Ocean Flipbook Upload Bytes"), STAT_OceanFlipbookUploadBytes, STATGROUP_Ocean);
+
+namespace OceanSimulator
+{
+namespace
+{
+// フォーマットやファイルのレイアウトを変えたら上げる
+const uint32 OceanFlipbookVersion = 1;
+const uint32 OceanFlipbookMagic = 0x4F434E46; // 'OCNF'
+const uint32 NumFlipbookChannels = 6;
+
+/** GenerateGradientFoldingMapCSのCPU版。OutPlanesのDx、Dy、Dzの面から勾配X、勾配Y、折り返しの面を作る */
+void GenerateGradientFoldingPlanes(uint32 MapSize, float PatchLength, float ChoppyScale, float* InOutPlanes)
+{
+	const uint32 NumTexels = MapSize * MapSize;
+	const float* Dx = InOutPlanes;
+	const float* Dy = InOutPlanes + NumTexels;
+	const float* Dz = InOutPlanes + 2 * NumTexels;
+	float* GradientX = InOutPlanes + 3 * NumTexels;
+	float* GradientY = InOutPlanes + 4 * NumTexels;
+	float* Folding = InOutPlanes + 5 * NumTexels;
+	const float JacobianScale = ChoppyScale * MapSize / PatchLength;
+
+	// シェーダと違い、端のテクセルも反対側の端を参照してループさせる
+	for (uint32 y = 0; y < MapSize; y++)
+	{
+		for (uint32 x = 0; x < MapSize; x++)
+		{
+			const uint32 Index = y * MapSize + x;
+			const uint32 Left = y * MapSize + ((x - 1) & (MapSize - 1));
+			const uint32 Right = y * MapSize + ((x + 1) & (MapSize - 1));
+			const uint32 Up = ((y - 1) & (MapSize - 1)) * MapSize + x;
+			const uint32 Down = ((y + 1) & (MapSize - 1)) * MapSize + x;
+
+			GradientX[Index] = -(Dz[Right] - Dz[Left]);
+			GradientY[Index] = -(Dz[Down] - Dz[Up]);
+
+			const float DxX = (Dx[Right] - Dx[Left]) * JacobianScale;
+			const float DxY = (Dy[Right] - Dy[Left]) * JacobianScale;
+			const float DyX = (Dx[Down] - Dx[Up]) * JacobianScale;
+			const float DyY = (Dy[Down] - Dy[Up]) * JacobianScale;
+			const float Jacobian = (1.0f + DxX) * (1.0f + DyY) - DxY * DyX;
+			Folding[Index] = FMath::Max(1.0f - Jacobian, 0.0f);
+		}
+	}
+}
+
+/** 1フレーム分の6面をFormatで符号化する */
+void EncodeFlipbookFrame(uint32 NumTexels, EOceanFlipbookFormat Format, const float* Planes, const float ChannelScales[NumFlipbookChannels], uint8* OutFrame)
+{
+	switch (Format)
+	{
+	case EOceanFlipbookFormat::Float32:
+		FMemory::Memcpy(OutFrame, Planes, NumFlipbookChannels * NumTexels * sizeof(float));
+		break;
+	case EOceanFlipbookFormat::Float16:
+	{
+		// シェーダではuintの下位16bitを偶数番目のテクセルとして読む
+		uint16* Dst = (uint16*)OutFrame;
+		for (uint32 i = 0; i < NumFlipbookChannels * NumTexels; i++)
+		{
+			Dst[i] = FFloat16(Planes[i]).Encoded;
+		}
+		break;
+	}
+	case EOceanFlipbookFormat::Quantized8:
+		for (uint32 Channel = 0; Channel < NumFlipbookChannels; Channel++)
+		{
+			const float InvScale = 1.0f / ChannelScales[Channel];
+			const float* Src = Planes + Channel * NumTexels;
+			uint8* Dst = OutFrame + Channel * NumTexels;
+			for (uint32 i = 0; i < NumTexels; i++)
+			{
+				Dst[i] = (uint8)FMath::Clamp(FMath::RoundToInt((Src[i] * InvScale + 1.0f) * 127.5f), 0, 255);
+			}
+		}
+		break;
+	default:
+		check(false);
+		break;
+	}
+}
+} // namespace
+
+uint32 GetOceanFlipbookFrameBytes(uint32 DispMapDimension, EOceanFlipbookFormat Format)
+{
+	const uint32 NumValues = NumFlipbookChannels * DispMapDimension * DispMapDimension;
+	switch (Format)
+	{
+	case EOceanFlipbookFormat::Float16:
+		return NumValues * sizeof(uint16);
+	case EOceanFlipbookFormat::Quantized8:
+		return NumValues * sizeof(uint8);
+	case EOceanFlipbookFormat::Float32:
+	default:
+		return NumValues * sizeof(float);
+	}
+}
+
+void QuantizeOmegaToPeriod(float LoopTime, TArrayView<float> InOutOmega0)
+{
+	check(LoopTime > 0.0f);
+
+	// 角周波数を2 * PI / LoopTimeの整数倍にすれば、すべての成分がLoopTimeで元の位相に戻る
+	const float BaseOmega = 2.0f * PI / LoopTime;
+	for (float& Omega : InOutOmega0)
+	{
+		Omega = FMath::RoundToFloat(Omega / BaseOmega) * BaseOmega;
+	}
+}
+
+bool BakeOceanFlipbook(const FString& Path, const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, float TimeScale, float Period, uint32 NumFrames, EOceanFlipbookFormat Format, TFunctionRef<void(float)> OnProgress, int64& OutFileBytes)
+{
+	check(Period > 0.0f && NumFrames > 0);
+
+	const uint32 MapSize = Params.DispMapDimension;
+	const uint32 NumTexels = MapSize * MapSize;
+
+	TArray<float> LoopOmega0;
+	LoopOmega0.Append(Omega0, NumTexels);
+	QuantizeOmegaToPeriod(Period * TimeScale, LoopOmega0);
+
+	FOceanFlipbookHeader Header;
+	Header.Magic = OceanFlipbookMagic;
+	Header.Version = OceanFlipbookVersion;
+	Header.DispMapDimension = MapSize;
+	Header.NumFrames = NumFrames;
+	Header.Format = (uint32)Format;
+	Header.FrameBytes = GetOceanFlipbookFrameBytes(MapSize, Format);
+	Header.Period = Period;
+	Header.GradientZ = Params.PatchLength / MapSize * 2.0f;
+
+	FOceanCPUSimulationWork Work;
+	FOceanCPUDisplacement Displacement;
+	TArray<float> Planes;
+	Planes.SetNumUninitialized(NumFlipbookChannels * NumTexels);
+
+	// 8bitの量子化はシミュレーションを2周するので、進捗はシミュレーションしたフレーム数で数える
+	const uint32 NumSimulations = (Format == EOceanFlipbookFormat::Quantized8) ? 2 * NumFrames : NumFrames;
+	uint32 NumSimulated = 0;
+
+	const auto SimulateFrame = [&](uint32 Frame)
+	{
+		FOceanSpectrumParameters FrameParams = Params;
+		FrameParams.AccumulatedTime = Period * Frame / NumFrames * TimeScale;
+		SimulateOceanCPU(FrameParams, H0, LoopOmega0.GetData(), Work, Displacement);
+
+		FMemory::Memcpy(Planes.GetData(), Displacement.Dx.GetData(), NumTexels * sizeof(float));
+		FMemory::Memcpy(Planes.GetData() + NumTexels, Displacement.Dy.GetData(), NumTexels * sizeof(float));
+		FMemory::Memcpy(Planes.GetData() + 2 * NumTexels, Displacement.Dz.GetData(), NumTexels * sizeof(float));
+		GenerateGradientFoldingPlanes(MapSize, Params.PatchLength, Params.ChoppyScale, Planes.GetData());
+
+		NumSimulated++;
+		OnProgress((float)NumSimulated / NumSimulations);
+	};
+
+	// 8bitの量子化のスケールは全フレームの最大値にする。全フレームをメモリに置かずに済むように、シミュレーションを2周する
+	for (float& Scale : Header.ChannelScales)
+	{
+		Scale = SMALL_NUMBER;
+	}
+	if (Format == EOceanFlipbookFormat::Quantized8)
+	{
+		for (uint32 Frame = 0; Frame < NumFrames; Frame++)
+		{
+			SimulateFrame(Frame);
+			for (uint32 Channel = 0; Channel < NumFlipbookChannels; Channel++)
+			{
+				const float* Src = Planes.GetData() + Channel * NumTexels;
+				for (uint32 i = 0; i < NumTexels; i++)
+				{
+					Header.ChannelScales[Channel] = FMath::Max(Header.ChannelScales[Channel], FMath::Abs(Src[i]));
+				}
+			}
+		}
+	}
+
+	// 書きかけのファイルを再生しないように、一時ファイルに書いてから移動する
+	const FString TempPath = FPaths::GetPath(Path) / FGuid::NewGuid().ToString() + TEXT(".tmp");
+
+	bool bWritten = false;
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath, FILEWRITE_Silent));
+		if (!Writer.IsValid())
+		{
+			return false;
+		}
+
+		Writer->Serialize(&Header, sizeof(Header));
+
+		TArray<uint8> FrameData;
+		FrameData.SetNumUninitialized(Header.FrameBytes);
+		for (uint32 Frame = 0; Frame < NumFrames; Frame++)
+		{
+			SimulateFrame(Frame);
+			EncodeFlipbookFrame(NumTexels, Format, Planes.GetData(), Header.ChannelScales, FrameData.GetData());
+			Writer->Serialize(FrameData.GetData(), FrameData.Num());
+		}
+		bWritten = Writer->Close();
+	}
+
+	if (!bWritten || !IFileManager::Get().Move(*Path, *TempPath, true, false, false, true))
+	{
+		IFileManager::Get().Delete(*TempPath, false, false, true);
+		return false;
+	}
+
+	OutFileBytes = sizeof(Header) + (int64)Header.FrameBytes * NumFrames;
+	return true;
+}
+
+TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> FOceanFlipbook::Open(const FString& Path)
+{
+	TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> Ret(new FOceanFlipbook());
+
+	// フレームはそのままアップロードするので、マップできればファイルの内容をメモリにコピーしない
+	Ret->MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+	if (Ret->MappedFile.IsValid() && Ret->MappedFile->GetFileSize() >= (int64)sizeof(FOceanFlipbookHeader))
+	{
+		Ret->MappedRegion.Reset(Ret->MappedFile->MapRegion(0, Ret->MappedFile->GetFileSize()));
+	}
+
+	const uint8* Data = nullptr;
+	int64 DataSize = 0;
+	if (Ret->MappedRegion.IsValid())
+	{
+		Data = Ret->MappedRegion->GetMappedPtr();
+		DataSize = Ret->MappedRegion->GetMappedSize();
+	}
+	else
+	{
+		Ret->MappedRegion.Reset();
+		Ret->MappedFile.Reset();
+		if (!FFileHelper::LoadFileToArray(Ret->FileData, *Path, FILEREAD_Silent))
+		{
+			return nullptr;
+		}
+		Data = Ret->FileData.GetData();
+		DataSize = Ret->FileData.Num();
+	}
+
+	if (DataSize < (int64)sizeof(FOceanFlipbookHeader))
+	{
+		return nullptr;
+	}
+
+	FMemory::Memcpy(&Ret->Header, Data, sizeof(FOceanFlipbookHeader));
+	const FOceanFlipbookHeader& Header = Ret->Header;
+	if (Header.Magic != OceanFlipbookMagic || Header.Version != OceanFlipbookVersion || Header.Format > (uint32)EOceanFlipbookFormat::Quantized8
+		|| Header.NumFrames == 0 || Header.Period <= 0.0f || !FMath::IsPowerOfTwo(Header.DispMapDimension)
+		|| Header.FrameBytes != GetOceanFlipbookFrameBytes(Header.DispMapDimension, (EOceanFlipbookFormat)Header.Format)
+		|| DataSize != Ret->GetFileBytes())
+	{
+		return nullptr;
+	}
+
+	Ret->Frames = Data + sizeof(FOceanFlipbookHeader);
+	return Ret;
+}
+
+// IMappedFileHandleとIMappedFileRegionはヘッダでは前方宣言なので、コンストラクタとデストラクタはここで定義する
+FOceanFlipbook::FOceanFlipbook()
+{
+}
+
+FOceanFlipbook::~FOceanFlipbook()
+{
+	// リージョンはハンドルより先に解放する
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+const uint8* FOceanFlipbook::GetFrame(uint32 FrameIndex) const
+{
+	check(FrameIndex < Header.NumFrames);
+	return Frames + (int64)Header.FrameBytes * FrameIndex;
+}
+
+uint32 FOceanFlipbook::GetFrameIndex(float Time) const
+{
+	const int64 Frame = (int64)FMath::FloorToDouble((double)Time / Header.Period * Header.NumFrames);
+	const int64 NumFrames = Header.NumFrames;
+	return (uint32)(((Frame % NumFrames) + NumFrames) % NumFrames);
+}
+
+class FOceanDecodeFlipbookFrameCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FOceanDecodeFlipbookFrameCS);
+	SHADER_USE_PARAMETER_STRUCT(FOceanDecodeFlipbookFrameCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, MapSize)
+		SHADER_PARAMETER(uint32, FlipbookFormat)
+		SHADER_PARAMETER(FVector4, FlipbookDisplacementScales)
+		SHADER_PARAMETER(FVector4, FlipbookGradientScales)
+		SHADER_PARAMETER(float, FlipbookGradientZ)
+		SHADER_PARAMETER_SRV(StructuredBuffer<uint>, FlipbookFrame)
+		SHADER_PARAMETER_UAV(RWTexture2D<float4>, OutDisplacementMap)
+		SHADER_PARAMETER_UAV(RWTexture2D<float4>, OutGradientFoldingMap)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FOceanDecodeFlipbookFrameCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DecodeFlipbookFrameCS", SF_Compute);
+
+void FOceanFlipbookPlayer::Play(FRHICommandListImmediate& RHICmdList, float Time, FRHIUnorderedAccessView* DisplacementMapUAV, FRHIUnorderedAccessView* GradientFoldingMapUAV)
+{
+	check(IsInRenderingThread());
+
+	const FOceanFlipbookHeader& Header = Flipbook->GetHeader();
+
+	// CPUから毎回全体を書き換えるだけなので、UAVを持たないBUF_Dynamicにする
+	if (!UploadBuffers[0].IsValid())
+	{
+		for (int32 i = 0; i < NumUploadBuffers; i++)
+		{
+			FRHIResourceCreateInfo CreateInfo;
+			UploadBuffers[i] = RHICreateStructuredBuffer(sizeof(uint32), Header.FrameBytes, BUF_Dynamic | BUF_ShaderResource, CreateInfo);
+			UploadBufferSRVs[i] = RHICreateShaderResourceView(UploadBuffers[i]);
+		}
+	}
+
+	const uint32 FrameIndex = Flipbook->GetFrameIndex(Time);
+	if (FrameIndex == LastFrameIndex)
+	{
+		return;
+	}
+	LastFrameIndex = FrameIndex;
+
+	// GPUがまだ前のフレームのデコードで読んでいるかもしれないバッファを上書きしないように、リングで順に使う。
+	// BUF_DynamicのRLM_WriteOnlyのロックで別の領域を割り当てるかはRHIによって違うので、それには頼らない。
+	// アップロードするのは保存されたままのフォーマットなので、転送量はフレームのバイト数になる
+	const int32 UploadBufferIndex = NextUploadBuffer;
+	NextUploadBuffer = (NextUploadBuffer + 1) % NumUploadBuffers;
+	void* UploadData = RHILockStructuredBuffer(UploadBuffers[UploadBufferIndex], 0, Header.FrameBytes, RLM_WriteOnly);
+	FMemory::Memcpy(UploadData, Flipbook->GetFrame(FrameIndex), Header.FrameBytes);
+	RHIUnlockStructuredBuffer(UploadBuffers[UploadBufferIndex]);
+	INC_DWORD_STAT_BY(STAT_OceanFlipbookUploadBytes, Header.FrameBytes);
+
+#if ENGINE_MINOR_VERSION >= 25
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#else
+	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#endif
+
+	FRDGBuilder GraphBuilder(RHICmdList);
+
+	TShaderMapRef<FOceanDecodeFlipbookFrameCS> OceanDecodeFlipbookFrameCS(ShaderMap);
+
+	FOceanDecodeFlipbookFrameCS::FParameters* DecodeParams = GraphBuilder.AllocParameters<FOceanDecodeFlipbookFrameCS::FParameters>();
+	DecodeParams->MapSize = Header.DispMapDimension;
+	DecodeParams->FlipbookFormat = Header.Format;
+	DecodeParams->FlipbookDisplacementScales = FVector4(Header.ChannelScales[0], Header.ChannelScales[1], Header.ChannelScales[2], 0.0f);
+	DecodeParams->FlipbookGradientScales = FVector4(Header.ChannelScales[3], Header.ChannelScales[4], Header.ChannelScales[5], 0.0f);
+	DecodeParams->FlipbookGradientZ = Header.GradientZ;
+	DecodeParams->FlipbookFrame = UploadBufferSRVs[UploadBufferIndex];
+	DecodeParams->OutDisplacementMap = DisplacementMapUAV;
+	DecodeParams->OutGradientFoldingMap = GradientFoldingMapUAV;
+
+	const uint32 DispatchCount = FMath::DivideAndRoundUp(Header.DispMapDimension, (uint32)8);
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("OceanDecodeFlipbookFrameCS"),
+		ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+		OceanDecodeFlipbookFrameCS,
+#else
+		*OceanDecodeFlipbookFrameCS,
+#endif
+		DecodeParams,
+		FIntVector(DispatchCount, DispatchCount, 1)
+	);
+
+	GraphBuilder.Execute();
+}
+} // namespace OceanSimulator
@@ -14,8 +14,8 @@
 #include "Engine/Engine.h"
 #include "DeformMesh/DeformableVertexBuffers.h"
 #include "Ocean/OceanSimulator.h"
+#include "Ocean/OceanSharedSimulation.h"
 #include "Engine/CanvasRenderTarget2D.h"
-#include "Ocean/ResourceArrayStructuredBuffer.h"
 
 using namespace OceanSimulator;
 
@@ -40,7 +40,7 @@ public:
 
 		for (int32 VertIdx = 0; VertIdx < Component->GetVertices().Num(); VertIdx++)
 		{
-			// TODO:Tangent͂Ƃ肠FDynamicMeshVertex̃ftHgl܂ɂBColorDynamicMeshVertex̃ftHgl̗pĂ
+			// TODO:TangentはとりあえずFDynamicMeshVertexのデフォルト値まかせにする。ColorはDynamicMeshVertexのデフォルト値を採用している
 			Vertices.Emplace(Component->GetVertices()[VertIdx], Component->GetTexCoords()[VertIdx], FColor(255, 255, 255));
 		}
 		VertexBuffers.InitFromDynamicVertex(&VertexFactory, Vertices);
@@ -61,20 +61,17 @@ public:
 
 		int32 SizeX, SizeY;
 		Component->GetDisplacementMap()->GetSize(SizeX, SizeY);
-		check(SizeX == SizeY); // `łO
-		check(FMath::IsPowerOfTwo(SizeX)); // 2̗ݏ̃TCYłO
+		check(SizeX == SizeY); // 正方形である前提
+		check(FMath::IsPowerOfTwo(SizeX)); // 2の累乗のサイズである前提
 		uint32 DispMapDimension = SizeX;
-		
-		// Phyllips Spectrumg
-		// Height map H(0)
-		H0Data.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		// FComplex::ZeroVectorƂOiDAZero݂ȐV萔낤Ǝvtypedef FVector2D FComplexł͂łȂ̂ō͑Ë
-
-		Omega0Data.Init(0.0f, DispMapDimension * DispMapDimension);
+		if (!IsSupportedDispMapDimension(DispMapDimension))
+		{
+			UE_LOG(LogTemp, Error, TEXT("%s: DisplacementMap size %u is not supported by the GPU simulation. Use a power of 2 from 64 to 2048."), *Component->GetPathName(), DispMapDimension);
+		}
 
 		FOceanSpectrumParameters Params;
-		Params.DispMapDimension = DispMapDimension; // TODO:`O
-		Params.PatchLength = Component->GetGridWidth() * Component->GetNumColumn(); // ̃R|[lgƃObhbVPatchLengthɍ킹XP[O͍sĂ炸AbVTCYGridWidthNumColumn猈߂ĂB`OɂĂ
+		Params.DispMapDimension = DispMapDimension; // TODO:正方形前提
+		Params.PatchLength = Component->GetGridWidth() * Component->GetNumColumn(); // このコンポーネントだとグリッドメッシュのPatchLengthに合わせたスケーリングは行っておらず、メッシュサイズはGridWidthのNumColumnから決めている。正方形を前提にしている
 		Params.AmplitudeScale = Component->GetAmplitudeScale();
 		Params.WindDirection = Component->GetWindDirection();
 		Params.WindSpeed = Component->GetWindSpeed();
@@ -83,31 +80,22 @@ public:
 		Params.AccumulatedTime = Component->GetAccumulatedTime() * Component->GetTimeScale();
 		Params.DxyzDebugAmplitude = Component->DxyzDebugAmplitude;
 
-		CreateInitialHeightMap(Params, Component->GetWorld()->GetGravityZ(), H0Data, Omega0Data);
-
-		H0Buffer.Initialize(H0Data, sizeof(FComplex));
-		Omega0Buffer.Initialize(Omega0Data, sizeof(float));
-
-		HtZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		HtBuffer.Initialize(HtZeroInitData, sizeof(FComplex));
-
-		DkxZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		DkxBuffer.Initialize(DkxZeroInitData, sizeof(FComplex));
-
-		DkyZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		DkyBuffer.Initialize(DkyZeroInitData, sizeof(FComplex));
-
-		FFTWorkZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		FFTWorkBuffer.Initialize(FFTWorkZeroInitData, sizeof(FComplex));
-
-		DxZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DxBuffer.Initialize(DxZeroInitData, sizeof(float));
+		// 同じスペクトラムのコンポーネントがすでにあれば、シミュレーションとH0を共有して生成もしない
+		const float GravityZ = Component->GetWorld()->GetGravityZ();
+		SharedSimulation = FOceanSharedSimulation::Acquire(FOceanSimulationKey(Params, GravityZ, Component->GetTimeScale()));
+		if (!SharedSimulation->GetInitialSpectrum().IsValid())
+		{
+			// Phyllips Spectrumを使った初期化
+			// Height map H(0)
+			TSharedRef<FOceanInitialSpectrum, ESPMode::ThreadSafe> InitialSpectrum = MakeShared<FOceanInitialSpectrum, ESPMode::ThreadSafe>();
+			InitialSpectrum->H0Data.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
+			// FComplex::ZeroVectorという名前が少し格好悪いが、Zeroみたいな新しい定数を作ろうと思うとtypedef FVector2D FComplexではできないので今は妥協する
 
-		DyZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DyBuffer.Initialize(DyZeroInitData, sizeof(float));
+			InitialSpectrum->Omega0Data.Init(0.0f, DispMapDimension * DispMapDimension);
 
-		DzZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DzBuffer.Initialize(DyZeroInitData, sizeof(float));
+			LoadOrCreateInitialHeightMap(Params, GravityZ, InitialSpectrum->H0Data, InitialSpectrum->Omega0Data);
+			SharedSimulation->SetInitialSpectrum(InitialSpectrum, FGraphEventRef());
+		}
 	}
 
 	virtual ~FOceanGridMeshSceneProxy()
@@ -117,15 +105,6 @@ public:
 		VertexBuffers.ColorVertexBuffer.ReleaseResource();
 		IndexBuffer.ReleaseResource();
 		VertexFactory.ReleaseResource();
-		H0Buffer.ReleaseResource();
-		Omega0Buffer.ReleaseResource();
-		HtBuffer.ReleaseResource();
-		FFTWorkBuffer.ReleaseResource();
-		DkxBuffer.ReleaseResource();
-		DkyBuffer.ReleaseResource();
-		DxBuffer.ReleaseResource();
-		DyBuffer.ReleaseResource();
-		DzBuffer.ReleaseResource();
 	}
 
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override
@@ -213,7 +192,16 @@ public:
 
 	virtual uint32 GetMemoryFootprint( void ) const override { return( sizeof( *this ) + GetAllocatedSize() ); }
 
-	uint32 GetAllocatedSize( void ) const { return( FPrimitiveSceneProxy::GetAllocatedSize() ); }
+	uint32 GetAllocatedSize( void ) const
+	{
+		// 共有シミュレーションは参照しているプロキシの数で按分する
+		SIZE_T SimulationSize = 0;
+		if (SharedSimulation.IsValid())
+		{
+			SimulationSize = SharedSimulation->GetAllocatedSize() / SharedSimulation.GetSharedReferenceCount();
+		}
+		return( FPrimitiveSceneProxy::GetAllocatedSize() + SimulationSize );
+	}
 
 	void EnqueTestSinWaveCommand(FRHICommandListImmediate& RHICmdList, UOceanGridMeshComponent* Component) const
 	{
@@ -246,8 +234,8 @@ public:
 		}
 
 		FOceanSpectrumParameters Params;
-		Params.DispMapDimension = TextureRenderTargetResource->GetSizeX(); // TODO:`OSizeY͌ĂȂ
-		Params.PatchLength = Component->GetGridWidth() * Component->GetNumColumn(); // ̃R|[lgƃbVPatchLengthɍ킹XP[O͍sĂ炸AGridWidthANumColumnȂǂ
+		Params.DispMapDimension = TextureRenderTargetResource->GetSizeX(); // TODO:正方形前提でSizeYは見てない
+		Params.PatchLength = Component->GetGridWidth() * Component->GetNumColumn(); // このコンポーネントだとメッシュのPatchLengthに合わせたスケーリングは行っておらず、GridWidth、NumColumnなどの
 		Params.AmplitudeScale = Component->GetAmplitudeScale();
 		Params.WindDirection = Component->GetWindDirection();
 		Params.WindSpeed = Component->GetWindSpeed();
@@ -256,22 +244,13 @@ public:
 		Params.AccumulatedTime = Component->GetAccumulatedTime() * Component->GetTimeScale();
 		Params.DxyzDebugAmplitude = Component->DxyzDebugAmplitude;
 
+		FTextureRenderTargetResource* GradientFoldingMapResource = Component->GradientFoldingMap->GetRenderTargetResource();
+		if (GradientFoldingMapResource == nullptr)
+		{
+			return;
+		}
+
 		FOceanBufferViews Views;
-		Views.H0SRV = H0Buffer.GetSRV();
-		Views.OmegaSRV = Omega0Buffer.GetSRV();
-		Views.HtSRV = HtBuffer.GetSRV();
-		Views.HtUAV = HtBuffer.GetUAV();
-		Views.DkxSRV = DkxBuffer.GetSRV();
-		Views.DkxUAV = DkxBuffer.GetUAV();
-		Views.DkySRV = DkyBuffer.GetSRV();
-		Views.DkyUAV = DkyBuffer.GetUAV();
-		Views.FFTWorkUAV = FFTWorkBuffer.GetUAV();
-		Views.DxSRV = DxBuffer.GetSRV();
-		Views.DxUAV = DxBuffer.GetUAV();
-		Views.DySRV = DyBuffer.GetSRV();
-		Views.DyUAV = DyBuffer.GetUAV();
-		Views.DzSRV = DzBuffer.GetSRV();
-		Views.DzUAV = DzBuffer.GetUAV();
 		Views.H0DebugViewUAV = Component->GetH0DebugViewUAV();
 		Views.HtDebugViewUAV = Component->GetHtDebugViewUAV();
 		Views.DkxDebugViewUAV = Component->GetDkxDebugViewUAV();
@@ -281,7 +260,7 @@ public:
 		Views.DisplacementMapUAV = Component->GetDisplacementMapUAV();
 		Views.GradientFoldingMapUAV = Component->GetGradientFoldingMapUAV();
 
-		SimulateOcean(RHICmdList, Params, Views);
+		SharedSimulation->Simulate(RHICmdList, Params, Views, TextureRenderTargetResource->TextureRHI, GradientFoldingMapResource->TextureRHI, nullptr);
 	}
 
 private:
@@ -291,24 +270,7 @@ private:
 	FDynamicMeshIndexBuffer32 IndexBuffer;
 	FLocalVertexFactory VertexFactory;
 
-	TResourceArray<FComplex> H0Data;
-	TResourceArray<float> Omega0Data;
-	TResourceArray<FComplex> HtZeroInitData;
-	TResourceArray<FComplex> DkxZeroInitData;
-	TResourceArray<FComplex> DkyZeroInitData;
-	TResourceArray<FComplex> FFTWorkZeroInitData;
-	TResourceArray<float> DxZeroInitData;
-	TResourceArray<float> DyZeroInitData;
-	TResourceArray<float> DzZeroInitData;
-	FResourceArrayStructuredBuffer H0Buffer;
-	FResourceArrayStructuredBuffer Omega0Buffer;
-	FResourceArrayStructuredBuffer HtBuffer;
-	FResourceArrayStructuredBuffer DkxBuffer;
-	FResourceArrayStructuredBuffer DkyBuffer;
-	FResourceArrayStructuredBuffer FFTWorkBuffer;
-	FResourceArrayStructuredBuffer DxBuffer;
-	FResourceArrayStructuredBuffer DyBuffer;
-	FResourceArrayStructuredBuffer DzBuffer;
+	FOceanSharedSimulationPtr SharedSimulation; // 同じスペクトラムのコンポーネント間で共有する
 
 	FMaterialRelevance MaterialRelevance;
 };
@@ -395,7 +357,7 @@ void UOceanGridMeshComponent::SetOceanSpectrumSettings(float TimeScale, float Am
 {
 	_TimeScale = TimeScale;
 	_AmplitudeScale = AmplitudeScale;
-	_WindDirection = WindDirection.GetSafeNormal(); // KĂ
+	_WindDirection = WindDirection.GetSafeNormal(); // 正規化しておく
 	_WindSpeed = WindSpeed;
 	_WindDependency = WindDependency;
 	_ChoppyScale = ChoppyScale;
@@ -13,15 +13,39 @@
 #include "EngineGlobals.h"
 #include "Engine/Engine.h"
 #include "DeformMesh/DeformableVertexBuffers.h"
+#include "Quadtree/QuadNodeInstancedMesh.h"
 #include "Ocean/OceanSimulator.h"
 #include "Engine/CanvasRenderTarget2D.h"
-#include "Ocean/ResourceArrayStructuredBuffer.h"
+#include "Engine/TextureRenderTarget2DArray.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "Materials/MaterialParameterCollectionInstance.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Async/Async.h"
+#include "UObject/UObjectIterator.h"
 
 using namespace Quadtree;
 using namespace OceanSimulator;
 
+/** CompareCPUSimulation()でレンダースレッドに渡す値。UObjectをレンダースレッドで触らないようにゲームスレッドでコンポーネントからコピーしておく */
+struct FOceanCPUComparison
+{
+	FString PathName;
+	FOceanSpectrumParameters Params;
+	FOceanBufferViews Views;
+	// リソースの解放はこの後に積まれるレンダーコマンドで行われるので、比較のコマンドの実行中は有効
+	FTextureRenderTargetResource* DisplacementMapResource = nullptr;
+	FTextureRenderTargetResource* GradientFoldingMapResource = nullptr;
+
+	// 以下はレンダースレッドで書き込む結果
+	float MaxError = 0.0f;
+	float RMSError = 0.0f;
+	float MaxAbsDisplacement = 0.0f;
+};
+
 /** almost all is copy of FCustomMeshSceneProxy. */
 class FOceanQuadtreeMeshSceneProxy final : public FPrimitiveSceneProxy
 {
@@ -36,22 +60,22 @@ public:
 		: FPrimitiveSceneProxy(Component)
 		, VertexFactory(GetScene().GetFeatureLevel(), "FOceanQuadtreeMeshSceneProxy")
 		, MaterialRelevance(Component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
-		, LODMIDList(Component->GetLODMIDList())
+		, QuadNodeMID(Component->GetQuadNodeMID())
 		, MPCInstance(Component->GetMPCInstance())
-		, QuadMeshParams(Component->GetQuadMeshParams())
+		, IndexBuffer(Component->GetQuadMeshIndexBuffer())
 		, NumGridDivision(Component->NumGridDivision)
 		, GridLength(Component->GridLength)
 		, MaxLOD(Component->MaxLOD)
 		, GridMaxPixelCoverage(Component->GridMaxPixelCoverage)
 		, PatchLength(Component->PatchLength)
+		, MaxDisplacement(Component->MaxDisplacement)
 	{
 		TArray<FDynamicMeshVertex> Vertices;
 		Vertices.Reset(Component->GetVertices().Num());
-		IndexBuffer.Indices = Component->GetIndices();
 
 		for (int32 VertIdx = 0; VertIdx < Component->GetVertices().Num(); VertIdx++)
 		{
-			// TODO:Tangent͂Ƃ肠FDynamicMeshVertex̃ftHgl܂ɂBColorDynamicMeshVertex̃ftHgl̗pĂ
+			// TODO:TangentはとりあえずFDynamicMeshVertexのデフォルト値まかせにする。ColorはDynamicMeshVertexのデフォルト値を採用している
 			Vertices.Emplace(Component->GetVertices()[VertIdx], Component->GetTexCoords()[VertIdx], FColor(255, 255, 255));
 		}
 		VertexBuffers.InitFromDynamicVertex(&VertexFactory, Vertices);
@@ -60,7 +84,6 @@ public:
 		BeginInitResource(&VertexBuffers.PositionVertexBuffer);
 		BeginInitResource(&VertexBuffers.DeformableMeshVertexBuffer);
 		BeginInitResource(&VertexBuffers.ColorVertexBuffer);
-		BeginInitResource(&IndexBuffer);
 		BeginInitResource(&VertexFactory);
 
 		// Grab material
@@ -70,60 +93,31 @@ public:
 			Material = UMaterial::GetDefaultMaterial(MD_Surface);
 		}
 
-		// GetDynamicMeshElements()̂ƁAVerifyUsedMaterial()ɂă}eAR|[lgɂ̂`FbN̂
-		// SetUsedMaterialForVerification()œo^邪A_[XbhoȂcheckɂЂ̂
+		// GetDynamicMeshElements()のあと、VerifyUsedMaterial()によってマテリアルがコンポーネントにあったものかチェックされるので
+		// SetUsedMaterialForVerification()で登録する手もあるが、レンダースレッド出ないとcheckにひっかかるので
 		bVerifyUsedMaterials = false;
 
 
-		int32 SizeX, SizeY;
-		Component->GetDisplacementMap()->GetSize(SizeX, SizeY);
-		check(SizeX == SizeY); // `łO
-		check(FMath::IsPowerOfTwo(SizeX)); // 2̗ݏ̃TCYłO
-		uint32 DispMapDimension = SizeX;
-		
-		// Phyllips Spectrumg
-		// Height map H(0)
-		H0Data.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		// FComplex::ZeroVectorƂOiDAZero݂ȐV萔낤Ǝvtypedef FVector2D FComplexł͂łFVector2D܂FComplex\̂˂΂ȂȂ̂ō͑Ë
-
-		Omega0Data.Init(0.0f, DispMapDimension * DispMapDimension);
-
-		FOceanSpectrumParameters Params;
-		Params.DispMapDimension = DispMapDimension;
-		Params.PatchLength = PatchLength;
-		Params.AmplitudeScale = Component->AmplitudeScale;
-		Params.WindDirection = Component->WindDirection.GetSafeNormal();
-		Params.WindSpeed = Component->WindSpeed;
-		Params.WindDependency = Component->WindDependency;
-		Params.ChoppyScale = Component->ChoppyScale;
-		Params.AccumulatedTime = Component->GetAccumulatedTime() * Component->TimeScale;
-		Params.DxyzDebugAmplitude = Component->DxyzDebugAmplitude;
-
-		CreateInitialHeightMap(Params, Component->GetWorld()->GetGravityZ(), H0Data, Omega0Data);
-
-		H0Buffer.Initialize(H0Data, sizeof(FComplex));
-		Omega0Buffer.Initialize(Omega0Data, sizeof(float));
-
-		HtZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		HtBuffer.Initialize(HtZeroInitData, sizeof(FComplex));
-
-		DkxZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		DkxBuffer.Initialize(DkxZeroInitData, sizeof(FComplex));
-
-		DkyZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		DkyBuffer.Initialize(DkyZeroInitData, sizeof(FComplex));
-
-		FFTWorkZeroInitData.Init(FComplex::ZeroVector, DispMapDimension * DispMapDimension);
-		FFTWorkBuffer.Initialize(FFTWorkZeroInitData, sizeof(FComplex));
-
-		DxZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DxBuffer.Initialize(DxZeroInitData, sizeof(float));
+		// カスケードのテクスチャ配列のサイズはコンポーネントの登録時に検証済み
+		if (!Component->UsesCascades())
+		{
+			int32 SizeX, SizeY;
+			Component->GetDisplacementMap()->GetSize(SizeX, SizeY);
+			check(SizeX == SizeY); // 正方形である前提
+			check(FMath::IsPowerOfTwo(SizeX)); // 2の累乗のサイズである前提
+		}
 
-		DyZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DyBuffer.Initialize(DyZeroInitData, sizeof(float));
+		// Phyllips Spectrumを使った初期化はコンポーネントのOnRegister()で非同期に開始している。
+		// シミュレーションのバッファは同じスペクトラムのコンポーネント間で共有し、最初のシミュレーションのときに完了を待って作る
+		SharedSimulation = Component->GetSharedSimulation();
+		check(SharedSimulation.IsValid());
+		SharedSimulation->AddProxyOwner();
 
-		DzZeroInitData.Init(0.0f, DispMapDimension * DispMapDimension);
-		DzBuffer.Initialize(DyZeroInitData, sizeof(float));
+		// フリップブックのアップロード用のバッファは最初の再生のときにレンダースレッドで作る
+		if (Component->GetFlipbook().IsValid())
+		{
+			FlipbookPlayer = MakeUnique<FOceanFlipbookPlayer>(Component->GetFlipbook());
+		}
 	}
 
 	virtual ~FOceanQuadtreeMeshSceneProxy()
@@ -131,17 +125,14 @@ public:
 		VertexBuffers.PositionVertexBuffer.ReleaseResource();
 		VertexBuffers.DeformableMeshVertexBuffer.ReleaseResource();
 		VertexBuffers.ColorVertexBuffer.ReleaseResource();
-		IndexBuffer.ReleaseResource();
 		VertexFactory.ReleaseResource();
-		H0Buffer.ReleaseResource();
-		Omega0Buffer.ReleaseResource();
-		HtBuffer.ReleaseResource();
-		FFTWorkBuffer.ReleaseResource();
-		DkxBuffer.ReleaseResource();
-		DkyBuffer.ReleaseResource();
-		DxBuffer.ReleaseResource();
-		DyBuffer.ReleaseResource();
-		DzBuffer.ReleaseResource();
+
+		// 共有シミュレーションはこのプロキシより長く生きることがあるので、出力の状態を残さない
+		if (SharedSimulation.IsValid())
+		{
+			SharedSimulation->ReleaseFixedRateOutput(this);
+			SharedSimulation->RemoveProxyOwner();
+		}
 	}
 
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override
@@ -163,91 +154,90 @@ public:
 			MaterialProxy = WireframeMaterialInstance;
 		}
 
+		// RootNodeの辺の長さはPatchLengthを2のMaxLOD乗したサイズ
+		FQuadNode RootNode;
+		RootNode.Length = PatchLength * (1 << MaxLOD);
+		RootNode.BottomRight = GetLocalToWorld().GetOrigin() + FVector(-RootNode.Length * 0.5f, -RootNode.Length * 0.5f, 0.0f);
+		RootNode.LOD = MaxLOD;
+
+		// 先にすべてのビューのQuadtreeの構築をタスクで開始しておき、メッシュバッチを作るときにビューごとに完了を待つ
+		FQuadtreeViewBuildTasks BuildTasks;
+
 		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
 		{
 			if (VisibilityMap & (1 << ViewIndex))
 			{
 				const FSceneView* View = Views[ViewIndex];
 
-				// RootNode̕ӂ̒PatchLength2MaxLOD悵TCY
-				FQuadNode RootNode;
-				RootNode.Length = PatchLength * (1 << MaxLOD);
-				RootNode.BottomRight = GetLocalToWorld().GetOrigin() + FVector(-RootNode.Length * 0.5f, -RootNode.Length * 0.5f, 0.0f);
-				RootNode.LOD = MaxLOD;
-
-				// Area()Ƃ֐邪A傫ȐŊĐx𗎂ƂȂ悤2iKŊ
-				float MaxScreenCoverage = (float)GridMaxPixelCoverage * GridMaxPixelCoverage / View->UnscaledViewRect.Width() / View->UnscaledViewRect.Height();
-
-				TArray<FQuadNode> QuadNodeList;
-				QuadNodeList.Reserve(128); //TODO:Ƃ肠̌X128BŖmۂ͏sʂÅ֐constȂ̂łƂ肠
-				TArray<FQuadNode> RenderList;
-				RenderList.Reserve(64); //TODO:Ƃ肠̌X64BŖmۂ͏sʂÅ֐constȂ̂łƂ肠
-
-				Quadtree::BuildQuadtree(MaxLOD, NumGridDivision, MaxScreenCoverage, PatchLength, View->ViewMatrices.GetViewOrigin(), View->ViewMatrices.GetProjectionScale(), View->ViewMatrices.GetViewProjectionMatrix(), RootNode, QuadNodeList, RenderList);
+				FQuadtreeBuildParameters BuildParams;
+				BuildParams.MaxLOD = MaxLOD;
+				BuildParams.NumRowColumn = NumGridDivision;
+				// Area()という関数もあるが、大きな数で割って精度を落とさないように2段階で割る
+				BuildParams.MaxScreenCoverage = (float)GridMaxPixelCoverage * GridMaxPixelCoverage / View->UnscaledViewRect.Width() / View->UnscaledViewRect.Height();
+				BuildParams.PatchLength = PatchLength;
+				BuildParams.MaxDisplacement = MaxDisplacement;
+				BuildParams.CameraPosition = View->ViewMatrices.GetViewOrigin();
+				BuildParams.ProjectionScale = View->ViewMatrices.GetProjectionScale();
+				BuildParams.ViewProjectionMatrix = View->ViewMatrices.GetViewProjectionMatrix();
+				BuildParams.RootNode = RootNode;
+
+				// ビューごとのワークメモリと前フレームのQuadtreeはフレームをまたいで使いまわす。GetDynamicMeshElements()はレンダースレッドからしか呼ばれないのでmutableで持つ
+				BuildTasks.Launch(ViewIndex, FindOrAddViewArena(ViewArenas, *View), BuildParams);
+			}
+		}
 
-				for (const FQuadNode& Node : RenderList)
+		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
+		{
+			if (VisibilityMap & (1 << ViewIndex))
+			{
+				// 同じフレームで同じパラメータのビューやコンポーネントがあれば、その結果を共有している
+				const FQuadtreeBuildResult& BuildResult = BuildTasks.Wait(ViewIndex);
+				if (BuildResult.RenderQuadNodeList.Num() == 0)
 				{
-					if(!bWireframe)
-					{
-						MaterialProxy = LODMIDList[Node.LOD]->GetRenderProxy();
-					}
+					continue;
+				}
 
-					// אڂm[hƂLOD̍Agp郁bVg|W[pӂ̂̂ȂI
-					const FVector2D& RightAdjPos = FVector2D(Node.BottomRight.X - PatchLength * 0.5f, Node.BottomRight.Y + Node.Length * 0.5f);
-					const FVector2D& LeftAdjPos = FVector2D(Node.BottomRight.X + Node.Length + PatchLength * 0.5f, Node.BottomRight.Y + Node.Length * 0.5f);
-					const FVector2D& BottomAdjPos = FVector2D(Node.BottomRight.X + Node.Length * 0.5f, Node.BottomRight.Y - PatchLength * 0.5f);
-					const FVector2D& TopAdjPos = FVector2D(Node.BottomRight.X + Node.Length * 0.5f, Node.BottomRight.Y + Node.Length + PatchLength * 0.5f);
+				// QuadNodeごとにメッシュバッチを作らず、メッシュパターンが同じQuadNodeをまとめてインスタンシングで描画する。LODはインスタンスごとにマテリアルへ渡す
+				// インスタンスのバッファはプロキシがフレームをまたいで持ち、足りなくなったときだけ作り直す
+				FQuadNodeInstancedMesh& InstancedMesh = InstancedMeshes.Allocate(*Views[ViewIndex], GetScene().GetFeatureLevel());
+				InstancedMesh.Init(BuildResult, GetLocalToWorld(), MaxLOD, NumGridDivision * GridLength, VertexBuffers);
 
-					EAdjacentQuadNodeLODDifference RightAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, RightAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference LeftAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, LeftAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference BottomAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, BottomAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference TopAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, TopAdjPos, RenderList);
+				if(!bWireframe)
+				{
+					MaterialProxy = QuadNodeMID->GetRenderProxy();
+				}
 
-					// 3iɂ4̗׃m[h̃^CvƃCfbNXΉ
-					uint32 QuadMeshParamsIndex = 27 * (uint32)RightAdjLODDiff + 9 * (uint32)LeftAdjLODDiff + 3 * (uint32)BottomAdjLODDiff + (uint32)TopAdjLODDiff;
-					const FQuadMeshParameter& MeshParams = QuadMeshParams[QuadMeshParamsIndex];
+				for (const FQuadNodeInstancedMesh::FBucket& Bucket : InstancedMesh.GetBuckets())
+				{
+					uint32 QuadMeshPartIndices[NUM_QUAD_MESH_PARTS];
+					Quadtree::GetQuadMeshPartIndices(Bucket.QuadMeshParamsIndex, QuadMeshPartIndices);
 
 					// Draw the mesh.
 					FMeshBatch& Mesh = Collector.AllocateMesh();
-					FMeshBatchElement& BatchElement = Mesh.Elements[0];
-					BatchElement.IndexBuffer = &IndexBuffer;
 					Mesh.bWireframe = bWireframe;
-					Mesh.VertexFactory = &VertexFactory;
+					Mesh.VertexFactory = InstancedMesh.GetVertexFactory();
 					Mesh.MaterialRenderProxy = MaterialProxy;
 
-					bool bHasPrecomputedVolumetricLightmap;
-					FMatrix PreviousLocalToWorld;
-					int32 SingleCaptureIndex;
-					bool bOutputVelocity;
-					GetScene().GetPrimitiveUniformShaderParameters_RenderThread(GetPrimitiveSceneInfo(), bHasPrecomputedVolumetricLightmap, PreviousLocalToWorld, SingleCaptureIndex, bOutputVelocity);
-
-					// bVTCYQuadNodẽTCYɉăXP[
-					float MeshScale = Node.Length / (NumGridDivision * GridLength);
-
-					FDynamicPrimitiveUniformBuffer& DynamicPrimitiveUniformBuffer = Collector.AllocateOneFrameResource<FDynamicPrimitiveUniformBuffer>();
-					// FPrimitiveSceneProxy::ApplyLateUpdateTransform()Qlɂ
-					const FMatrix& NewLocalToWorld = GetLocalToWorld().ApplyScale(MeshScale).ConcatTranslation(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f));
-					PreviousLocalToWorld = PreviousLocalToWorld.ApplyScale(MeshScale).ConcatTranslation(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f));
-
-					// R|[lgCalcBounds()RootNodẽTCYɍ킹ĎĂ̂ŃXP[B
-					// ۂ͕`悷郁bVQuadtreeۂ̓ƎtX^JOőIĂ̂Boundsׂ͂RootNodeTCYł
-					// \ȂAꉞmȃTCYɂĂ
-					float BoundScale = Node.Length / RootNode.Length;
-
-					FBoxSphereBounds NewBounds = GetBounds();
-					NewBounds = FBoxSphereBounds(NewBounds.Origin + NewLocalToWorld.TransformPosition(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f)), NewBounds.BoxExtent * BoundScale, NewBounds.SphereRadius * BoundScale);
-
-					FBoxSphereBounds NewLocalBounds = GetLocalBounds();
-					NewLocalBounds = FBoxSphereBounds(NewLocalBounds.Origin, NewLocalBounds.BoxExtent * BoundScale, NewLocalBounds.SphereRadius * BoundScale);
-
-					DynamicPrimitiveUniformBuffer.Set(NewLocalToWorld, PreviousLocalToWorld, NewBounds, NewLocalBounds, true, bHasPrecomputedVolumetricLightmap, DrawsVelocity(), false);
-					BatchElement.PrimitiveUniformBufferResource = &DynamicPrimitiveUniformBuffer.UniformBuffer;
+					// 内側のメッシュと4辺の境界メッシュはインデックスバッファ上で連続していないので別々のバッチエレメントにする
+					Mesh.Elements.SetNum(NUM_QUAD_MESH_PARTS);
+					for (uint32 PartIndex = 0; PartIndex < NUM_QUAD_MESH_PARTS; PartIndex++)
+					{
+						const FQuadMeshParameter& MeshParams = IndexBuffer->GetQuadMeshParams()[QuadMeshPartIndices[PartIndex]];
+
+						FMeshBatchElement& BatchElement = Mesh.Elements[PartIndex];
+						BatchElement.IndexBuffer = IndexBuffer.Get();
+						BatchElement.PrimitiveUniformBuffer = GetUniformBuffer();
+						BatchElement.FirstIndex = MeshParams.IndexBufferOffset;
+						BatchElement.NumPrimitives = MeshParams.NumIndices / 3;
+						BatchElement.MinVertexIndex = 0;
+						BatchElement.MaxVertexIndex = VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
+						// FInstancedStaticMeshVertexFactoryはUserIndexをインスタンスのオフセットとして使う
+						BatchElement.NumInstances = Bucket.NumInstances;
+						BatchElement.UserIndex = Bucket.FirstInstance;
+						BatchElement.UserData = nullptr;
+					}
 
-					BatchElement.FirstIndex = MeshParams.IndexBufferOffset;
-					BatchElement.NumPrimitives = MeshParams.NumIndices / 3;
-					BatchElement.MinVertexIndex = 0;
-					BatchElement.MaxVertexIndex = VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
-					Mesh.ReverseCulling = (NewLocalToWorld.Determinant() < 0.0f);
+					Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
 					Mesh.Type = PT_TriangleList;
 					Mesh.DepthPriorityGroup = SDPG_World;
 					Mesh.bCanApplyViewModeOverrides = false;
@@ -283,50 +273,99 @@ public:
 
 	virtual uint32 GetMemoryFootprint( void ) const override { return( sizeof( *this ) + GetAllocatedSize() ); }
 
-	uint32 GetAllocatedSize( void ) const { return( FPrimitiveSceneProxy::GetAllocatedSize() ); }
+	uint32 GetAllocatedSize( void ) const
+	{
+		SIZE_T ArenaSize = ViewArenas.GetAllocatedSize();
+		for (const TPair<uint64, TUniquePtr<FQuadtreeBuildArena>>& Pair : ViewArenas)
+		{
+			ArenaSize += sizeof(FQuadtreeBuildArena) + Pair.Value->GetAllocatedSize();
+		}
+		ArenaSize += InstancedMeshes.GetAllocatedSize();
+		// 共有シミュレーションは参照しているプロキシの数で按分する
+		SIZE_T SimulationSize = 0;
+		if (SharedSimulation.IsValid())
+		{
+			SimulationSize = SharedSimulation->GetAllocatedSize() / FMath::Max(SharedSimulation->GetNumProxyOwners(), 1);
+		}
+		return( FPrimitiveSceneProxy::GetAllocatedSize() + ArenaSize + SimulationSize );
+	}
 
-	void EnqueSimulateOceanCommand(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component) const
+	void EnqueSimulateOceanCommand(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component, const FOceanCPUDisplacement* CPUDisplacement) const
 	{
+		if (FlipbookPlayer.IsValid())
+		{
+			PlayFlipbook(RHICmdList, Component);
+			return;
+		}
+
+		if (Component->UsesFixedRateSimulation())
+		{
+			SimulateSharedOceanFixedRate(RHICmdList, Component);
+			return;
+		}
+
+		if (Component->UsesCascades())
+		{
+			SimulateSharedOceanCascades(RHICmdList, Component);
+			return;
+		}
+
 		FTextureRenderTargetResource* TextureRenderTargetResource = Component->GetDisplacementMap()->GetRenderTargetResource();
 		if (TextureRenderTargetResource == nullptr)
 		{
 			return;
 		}
 
-		FOceanSpectrumParameters Params;
-		Params.DispMapDimension = TextureRenderTargetResource->GetSizeX(); // TODO:`OSizeY͌ĂȂ
-		Params.PatchLength = PatchLength;
-		Params.AmplitudeScale = Component->AmplitudeScale;
-		Params.WindDirection = Component->WindDirection.GetSafeNormal();
-		Params.WindSpeed = Component->WindSpeed;
-		Params.WindDependency = Component->WindDependency;
-		Params.ChoppyScale = Component->ChoppyScale;
-		Params.AccumulatedTime = Component->GetAccumulatedTime() * Component->TimeScale;
-		Params.DxyzDebugAmplitude = Component->DxyzDebugAmplitude;
+		const FOceanSpectrumParameters& Params = Component->CreateSpectrumParameters(TextureRenderTargetResource->GetSizeX()); // TODO:正方形前提でSizeYは見てない
 
-		// _[Xbhł΃R}hL[ɕʂ̃R}h𔭍sɑsĖʂȂ̂łł
-		const FVector2D& PerlinUVOffset = -Params.WindDirection * Params.AccumulatedTime * Component->PerlinUVSpeed; // ̕ƋtɂĂ
-		if (MPCInstance != nullptr)
+		UpdatePerlinUVOffset(Component, Params);
+
+		SimulateSharedOcean(RHICmdList, Component, Params, CPUDisplacement, false);
+	}
+
+	/** GPUシミュレーションの結果をリードバックし、同じH0、Omega0、パラメータでのCPUシミュレーションの結果と比較してComparisonに書き込む。 */
+	void CompareCPUSimulation(FRHICommandListImmediate& RHICmdList, FOceanCPUComparison& Comparison) const
+	{
+		const FOceanSpectrumParameters& Params = Comparison.Params;
+		const uint32 DispMapDimension = Params.DispMapDimension;
+
+		// 同じフレームで別のコンポーネントが異なる時刻でシミュレーション済みかもしれないので、このコンポーネントの時刻でやり直す
+		SharedSimulation->Simulate(RHICmdList, Params, Comparison.Views, Comparison.DisplacementMapResource->TextureRHI, Comparison.GradientFoldingMapResource->TextureRHI, nullptr, true);
+
+		TArray<FLinearColor> GPUDisplacement;
+		RHICmdList.ReadSurfaceData(Comparison.DisplacementMapResource->TextureRHI, FIntRect(0, 0, DispMapDimension, DispMapDimension), GPUDisplacement, FReadSurfaceDataFlags(RCM_MinMax));
+
+		FOceanCPUSimulationWork Work;
+		FOceanCPUDisplacement CPUDisplacement;
+		const FOceanInitialSpectrum& InitialSpectrum = *SharedSimulation->GetInitialSpectrum();
+		// パックしたIFFTの誤差も確認できるように、CPU側は常にパックしない経路で計算する
+		FOceanSpectrumParameters ReferenceParams = Params;
+		ReferenceParams.bPackedIFFT = false;
+		SimulateOceanCPU(ReferenceParams, InitialSpectrum.H0Data.GetData(), InitialSpectrum.Omega0Data.GetData(), Work, CPUDisplacement);
+
+		float MaxError = 0.0f;
+		float MaxAbsDisplacement = 0.0f;
+		double SquaredErrorSum = 0.0;
+		for (uint32 y = 0; y < DispMapDimension; y++)
 		{
-			MPCInstance->SetVectorParameterValue(FName("PerlinUVOffset"), FVector(PerlinUVOffset.X, PerlinUVOffset.Y, 0.0f));
+			for (uint32 x = 0; x < DispMapDimension; x++)
+			{
+				const FLinearColor& GPUTexel = GPUDisplacement[y * DispMapDimension + x];
+				const FVector& Error = CPUDisplacement.GetDisplacement(x, y) - FVector(GPUTexel.R, GPUTexel.G, GPUTexel.B);
+				MaxError = FMath::Max(MaxError, Error.GetAbsMax());
+				MaxAbsDisplacement = FMath::Max(MaxAbsDisplacement, FVector(GPUTexel.R, GPUTexel.G, GPUTexel.B).GetAbsMax());
+				SquaredErrorSum += Error.SizeSquared();
+			}
 		}
 
+		Comparison.MaxError = MaxError;
+		Comparison.RMSError = FMath::Sqrt(SquaredErrorSum / (DispMapDimension * DispMapDimension * 3));
+		Comparison.MaxAbsDisplacement = MaxAbsDisplacement;
+	}
+
+	static FOceanBufferViews GetOutputViews(UOceanQuadtreeMeshComponent* Component)
+	{
 		FOceanBufferViews Views;
-		Views.H0SRV = H0Buffer.GetSRV();
-		Views.OmegaSRV = Omega0Buffer.GetSRV();
-		Views.HtSRV = HtBuffer.GetSRV();
-		Views.HtUAV = HtBuffer.GetUAV();
-		Views.DkxSRV = DkxBuffer.GetSRV();
-		Views.DkxUAV = DkxBuffer.GetUAV();
-		Views.DkySRV = DkyBuffer.GetSRV();
-		Views.DkyUAV = DkyBuffer.GetUAV();
-		Views.FFTWorkUAV = FFTWorkBuffer.GetUAV();
-		Views.DxSRV = DxBuffer.GetSRV();
-		Views.DxUAV = DxBuffer.GetUAV();
-		Views.DySRV = DyBuffer.GetSRV();
-		Views.DyUAV = DyBuffer.GetUAV();
-		Views.DzSRV = DzBuffer.GetSRV();
-		Views.DzUAV = DzBuffer.GetUAV();
 		Views.H0DebugViewUAV = Component->GetH0DebugViewUAV();
 		Views.HtDebugViewUAV = Component->GetHtDebugViewUAV();
 		Views.DkxDebugViewUAV = Component->GetDkxDebugViewUAV();
@@ -335,44 +374,136 @@ public:
 		Views.DisplacementMapSRV = Component->GetDisplacementMapSRV();
 		Views.DisplacementMapUAV = Component->GetDisplacementMapUAV();
 		Views.GradientFoldingMapUAV = Component->GetGradientFoldingMapUAV();
-
-		SimulateOcean(RHICmdList, Params, Views);
+		return Views;
 	}
 
 private:
+	void UpdatePerlinUVOffset(UOceanQuadtreeMeshComponent* Component, const FOceanSpectrumParameters& Params) const
+	{
+		// レンダースレッド内でやればコマンドキューに別のコマンドを発行せずに即実行して無駄がないのでここでやる
+		const FVector2D& PerlinUVOffset = -Params.WindDirection * Params.AccumulatedTime * Component->PerlinUVSpeed; // 風の方向と逆方向にしている
+		if (MPCInstance != nullptr)
+		{
+			MPCInstance->SetVectorParameterValue(FName("PerlinUVOffset"), FVector(PerlinUVOffset.X, PerlinUVOffset.Y, 0.0f));
+		}
+	}
+
+	void SimulateSharedOceanCascades(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component) const
+	{
+		FTextureRenderTargetResource* DisplacementMapsResource = Component->CascadeDisplacementMaps->GetRenderTargetResource();
+		FTextureRenderTargetResource* GradientFoldingMapsResource = Component->CascadeGradientFoldingMaps->GetRenderTargetResource();
+		if (DisplacementMapsResource == nullptr || GradientFoldingMapsResource == nullptr)
+		{
+			return;
+		}
+
+		const TArray<FOceanSpectrumParameters, TInlineAllocator<MaxOceanCascades>>& CascadeParams = Component->CreateCascadeSpectrumParameters(DisplacementMapsResource->GetSizeX());
+		UpdatePerlinUVOffset(Component, CascadeParams[0]);
+
+		SharedSimulation->Simulate(RHICmdList, CascadeParams, GetCascadeOutputViews(Component), DisplacementMapsResource->TextureRHI, GradientFoldingMapsResource->TextureRHI);
+	}
+
+	void PlayFlipbook(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component) const
+	{
+		// フレームのサイズはコンポーネントの登録時にディスプレースメントマップと一致することを確認済み
+		const FOceanSpectrumParameters& Params = Component->CreateSpectrumParameters(FlipbookPlayer->GetDispMapDimension());
+		UpdatePerlinUVOffset(Component, Params);
+
+		FlipbookPlayer->Play(RHICmdList, Component->GetAccumulatedTime(), Component->GetDisplacementMapUAV(), Component->GetGradientFoldingMapUAV());
+	}
+
+	void SimulateSharedOceanFixedRate(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component) const
+	{
+		const bool bCascades = Component->UsesCascades();
+		FTextureRenderTargetResource* DisplacementMapResource = bCascades ? Component->CascadeDisplacementMaps->GetRenderTargetResource() : Component->GetDisplacementMap()->GetRenderTargetResource();
+		if (DisplacementMapResource == nullptr || !Component->GetPreviousDisplacementMapUAV().IsValid())
+		{
+			return;
+		}
+
+		TArray<FOceanSpectrumParameters, TInlineAllocator<MaxOceanCascades>> CascadeParams;
+		if (bCascades)
+		{
+			CascadeParams = Component->CreateCascadeSpectrumParameters(DisplacementMapResource->GetSizeX());
+		}
+		else
+		{
+			CascadeParams.Add(Component->CreateSpectrumParameters(DisplacementMapResource->GetSizeX()));
+		}
+
+		// Perlinノイズのスクロールはステップに丸めず毎フレーム動かす
+		UpdatePerlinUVOffset(Component, CascadeParams[0]);
+
+		// スペクトラムの時刻はステップの境界に丸める
+		const float SimulationRate = Component->SimulationRate;
+		const float StepTime = Component->GetAccumulatedTime() * SimulationRate;
+		const int64 StepIndex = (int64)FMath::FloorToDouble(StepTime);
+		for (FOceanSpectrumParameters& Params : CascadeParams)
+		{
+			Params.AccumulatedTime = (float)(StepIndex / (double)SimulationRate) * Component->TimeScale;
+		}
+
+		// 2組目はPreviousのマップ。デバッグ表示は1組目にだけ書く
+		FOceanBufferViews Views[2];
+		Views[0] = bCascades ? GetCascadeOutputViews(Component) : GetOutputViews(Component);
+		Views[1].DisplacementMapSRV = Component->GetPreviousDisplacementMapSRV();
+		Views[1].DisplacementMapUAV = Component->GetPreviousDisplacementMapUAV();
+		Views[1].GradientFoldingMapUAV = Component->GetPreviousGradientFoldingMapUAV();
+
+		int32 NewestOutput = 0;
+		const int64 HeldStepIndex = SharedSimulation->SimulateFixedRate(RHICmdList, CascadeParams, bCascades, StepIndex, this, Views, DisplacementMapResource->TextureRHI, NewestOutput);
+
+		// 前のステップから最新のステップへの補間の割合。表示は1ステップ遅れる。
+		// 時間分割で新しいステップの完成が1フレーム遅れたときは1に張り付いて止まる。
+		// マテリアルはPreviousのマップからもう一方へSimulationAlphaで補間するので、最新のステップがPreviousのマップにあるときは反転して渡す
+		if (MPCInstance != nullptr && HeldStepIndex != INDEX_NONE)
+		{
+			const float Alpha = FMath::Clamp(StepTime - (float)HeldStepIndex, 0.0f, 1.0f);
+			MPCInstance->SetScalarParameterValue(FName("SimulationAlpha"), (NewestOutput == 0) ? Alpha : 1.0f - Alpha);
+		}
+	}
+
+	static FOceanBufferViews GetCascadeOutputViews(UOceanQuadtreeMeshComponent* Component)
+	{
+		// カスケードではデバッグ表示は行わない
+		FOceanBufferViews Views;
+		Views.DisplacementMapSRV = Component->GetCascadeDisplacementMapsSRV();
+		Views.DisplacementMapUAV = Component->GetCascadeDisplacementMapsUAV();
+		Views.GradientFoldingMapUAV = Component->GetCascadeGradientFoldingMapsUAV();
+		return Views;
+	}
+
+	void SimulateSharedOcean(FRHICommandListImmediate& RHICmdList, UOceanQuadtreeMeshComponent* Component, const FOceanSpectrumParameters& Params, const FOceanCPUDisplacement* CPUDisplacement, bool bForceUpdate) const
+	{
+		FTextureRenderTargetResource* DisplacementMapResource = Component->GetDisplacementMap()->GetRenderTargetResource();
+		FTextureRenderTargetResource* GradientFoldingMapResource = Component->GradientFoldingMap->GetRenderTargetResource();
+		if (DisplacementMapResource == nullptr || GradientFoldingMapResource == nullptr)
+		{
+			return;
+		}
+
+		SharedSimulation->Simulate(RHICmdList, Params, GetOutputViews(Component), DisplacementMapResource->TextureRHI, GradientFoldingMapResource->TextureRHI, CPUDisplacement, bForceUpdate);
+	}
+
 	UMaterialInterface* Material;
 	FDeformableVertexBuffers VertexBuffers;
-	FDynamicMeshIndexBuffer32 IndexBuffer;
-	FLocalVertexFactory VertexFactory;
+	Quadtree::FQuadMeshIndexBufferPtr IndexBuffer; // NumGridDivisionが同じコンポーネント間で共有する
+	FLocalVertexFactory VertexFactory; // 頂点バッファの初期化に使う。描画はFQuadNodeInstancedMeshの頂点ファクトリで行う
 	FMaterialRelevance MaterialRelevance;
 
-	TResourceArray<FComplex> H0Data;
-	TResourceArray<float> Omega0Data;
-	TResourceArray<FComplex> HtZeroInitData;
-	TResourceArray<FComplex> DkxZeroInitData;
-	TResourceArray<FComplex> DkyZeroInitData;
-	TResourceArray<FComplex> FFTWorkZeroInitData;
-	TResourceArray<float> DxZeroInitData;
-	TResourceArray<float> DyZeroInitData;
-	TResourceArray<float> DzZeroInitData;
-	FResourceArrayStructuredBuffer H0Buffer;
-	FResourceArrayStructuredBuffer Omega0Buffer;
-	FResourceArrayStructuredBuffer HtBuffer;
-	FResourceArrayStructuredBuffer DkxBuffer;
-	FResourceArrayStructuredBuffer DkyBuffer;
-	FResourceArrayStructuredBuffer FFTWorkBuffer;
-	FResourceArrayStructuredBuffer DxBuffer;
-	FResourceArrayStructuredBuffer DyBuffer;
-	FResourceArrayStructuredBuffer DzBuffer;
-
-	TArray<UMaterialInstanceDynamic*> LODMIDList; // ComponentUMaterialInstanceDynamic͕ێĂ̂GCŉ͂Ȃ
-	UMaterialParameterCollectionInstance* MPCInstance = nullptr; // ComponentUMaterialInstanceDynamic͕ێĂ̂GCŉ͂Ȃ
-	TArray<Quadtree::FQuadMeshParameter> QuadMeshParams;
+	FOceanSharedSimulationPtr SharedSimulation; // 同じスペクトラムのコンポーネント間で共有する
+	TUniquePtr<FOceanFlipbookPlayer> FlipbookPlayer; // Flipbookバックエンドのときだけ作る
+
+	UMaterialInstanceDynamic* QuadNodeMID = nullptr; // Component側でUMaterialInstanceDynamicは保持されてるのでGCで解放はされない
+	UMaterialParameterCollectionInstance* MPCInstance = nullptr; // Component側でUMaterialInstanceDynamicは保持されてるのでGCで解放はされない
 	int32 NumGridDivision;
 	float GridLength;
 	int32 MaxLOD;
 	int32 GridMaxPixelCoverage;
 	int32 PatchLength;
+	float MaxDisplacement;
+	mutable Quadtree::FQuadtreeViewArenaMap ViewArenas;
+	mutable Quadtree::FQuadNodeInstancedMeshPool InstancedMeshes;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -423,12 +554,42 @@ UOceanQuadtreeMeshComponent::~UOceanQuadtreeMeshComponent()
 	{
 		_DxyzDebugViewUAV.SafeRelease();
 	}
+
+	if (_CascadeDisplacementMapsSRV.IsValid())
+	{
+		_CascadeDisplacementMapsSRV.SafeRelease();
+	}
+
+	if (_CascadeDisplacementMapsUAV.IsValid())
+	{
+		_CascadeDisplacementMapsUAV.SafeRelease();
+	}
+
+	if (_CascadeGradientFoldingMapsUAV.IsValid())
+	{
+		_CascadeGradientFoldingMapsUAV.SafeRelease();
+	}
+
+	if (_PreviousDisplacementMapSRV.IsValid())
+	{
+		_PreviousDisplacementMapSRV.SafeRelease();
+	}
+
+	if (_PreviousDisplacementMapUAV.IsValid())
+	{
+		_PreviousDisplacementMapUAV.SafeRelease();
+	}
+
+	if (_PreviousGradientFoldingMapUAV.IsValid())
+	{
+		_PreviousGradientFoldingMapUAV.SafeRelease();
+	}
 }
 
 FPrimitiveSceneProxy* UOceanQuadtreeMeshComponent::CreateSceneProxy()
 {
 	FPrimitiveSceneProxy* Proxy = NULL;
-	if(_Vertices.Num() > 0 && _Indices.Num() > 0 && DisplacementMap != nullptr && GradientFoldingMap != nullptr)
+	if(_Vertices.Num() > 0 && QuadMeshIndexBuffer.IsValid() && (_bUseCascades || (DisplacementMap != nullptr && GradientFoldingMap != nullptr)))
 	{
 		Proxy = new FOceanQuadtreeMeshSceneProxy(this);
 	}
@@ -439,8 +600,15 @@ void UOceanQuadtreeMeshComponent::OnRegister()
 {
 	Super::OnRegister();
 
-	// ObhbV^VertexBufferTexCoordsBufferpӂ̂UDeformableGridMeshComponent::Ini:tGridMeshSetting()ƓA
-	// ڂQuadNodeLOD̍lĐp^[̃CfbNXzpӂ˂΂ȂȂ̂œƎ̎
+	// グリッドメッシュ型のVertexBufferやTexCoordsBufferを用意するのはUDeformableGridMeshComponent::Ini:tGridMeshSetting()と同じだが、
+	// 接するQuadNodeのLODの差を考慮して数パターンのインデックス配列を用意せねばならないので独自の実装をする
+	// 設定が変わっているかもしれないのでH0は登録のたびに取得し直す。プロキシの作成はOnRegister()の後なのでここで生成を開始しておけば間に合う
+	_bUseCascades = ValidateCascades();
+	_bUseFixedRateSimulation = ValidateFixedRateSimulation();
+	WarnHalfPrecisionTargetFormats();
+	InitSpectrum();
+	OpenFlipbook();
+
 	_NumRow = NumGridDivision;
 	_NumColumn = NumGridDivision;
 	_GridWidth = GridLength;
@@ -448,7 +616,7 @@ void UOceanQuadtreeMeshComponent::OnRegister()
 	_Vertices.Reset((NumGridDivision + 1) * (NumGridDivision + 1));
 	_TexCoords.Reset((NumGridDivision + 1) * (NumGridDivision + 1));
 
-	// ł͐`̒S_ɂ镽sړLODɉXP[͂ȂBۂɃbV`ɓnƂɕsړƃXP[sB
+	// ここでは正方形の中心を原点にする平行移動やLODに応じたスケールはしない。実際にメッシュを描画に渡すときに平行移動とスケールを行う。
 
 	for (int32 y = 0; y < NumGridDivision + 1; y++)
 	{
@@ -466,14 +634,16 @@ void UOceanQuadtreeMeshComponent::OnRegister()
 		}
 	}
 
-	// QuadNode̋E̘AIȕω̂߁ÃObhłȂƓK؂ȃWIgɂłȂ
+	// QuadNodeの境界部分の連続的な変化のため、偶数のグリッド分割でないと適切なジオメトリにできない
 	if (NumGridDivision % 2 == 1)
 	{
 		UE_LOG(LogTemp, Error, TEXT("NumGridDivision must be an even number."));
 		return;
 	}
 
-	Quadtree::CreateQuadMeshes(NumGridDivision, _Indices, QuadMeshParams);
+	// インデックスバッファはNumGridDivisionが同じコンポーネント間で共有する
+	FQuadMeshIndexBuffer::Release(QuadMeshIndexBuffer);
+	QuadMeshIndexBuffer = FQuadMeshIndexBuffer::Acquire(NumGridDivision);
 
 	if (_DisplacementMapSRV.IsValid())
 	{
@@ -550,19 +720,83 @@ void UOceanQuadtreeMeshComponent::OnRegister()
 		_DxyzDebugViewUAV = RHICreateUnorderedAccessView(DxyzDebugView->GameThread_GetRenderTargetResource()->TextureRHI);
 	}
 
+	if (_CascadeDisplacementMapsSRV.IsValid())
+	{
+		_CascadeDisplacementMapsSRV.SafeRelease();
+	}
+
+	if (_CascadeDisplacementMapsUAV.IsValid())
+	{
+		_CascadeDisplacementMapsUAV.SafeRelease();
+	}
+
+	if (_CascadeGradientFoldingMapsUAV.IsValid())
+	{
+		_CascadeGradientFoldingMapsUAV.SafeRelease();
+	}
+
+	// 全スライスを1つのビューで読み書きする
+	if (_bUseCascades)
+	{
+		_CascadeDisplacementMapsSRV = RHICreateShaderResourceView(CascadeDisplacementMaps->GameThread_GetRenderTargetResource()->TextureRHI, 0);
+		_CascadeDisplacementMapsUAV = RHICreateUnorderedAccessView(CascadeDisplacementMaps->GameThread_GetRenderTargetResource()->TextureRHI);
+		_CascadeGradientFoldingMapsUAV = RHICreateUnorderedAccessView(CascadeGradientFoldingMaps->GameThread_GetRenderTargetResource()->TextureRHI);
+	}
+
+	if (_PreviousDisplacementMapSRV.IsValid())
+	{
+		_PreviousDisplacementMapSRV.SafeRelease();
+	}
+
+	if (_PreviousDisplacementMapUAV.IsValid())
+	{
+		_PreviousDisplacementMapUAV.SafeRelease();
+	}
+
+	if (_PreviousGradientFoldingMapUAV.IsValid())
+	{
+		_PreviousGradientFoldingMapUAV.SafeRelease();
+	}
+
+	// SimulationRateではPreviousのマップにもステップごとに交互に書き込む
+	if (_bUseFixedRateSimulation)
+	{
+		UTextureRenderTarget* PreviousDisplacement = _bUseCascades ? (UTextureRenderTarget*)PreviousCascadeDisplacementMaps : (UTextureRenderTarget*)PreviousDisplacementMap;
+		UTextureRenderTarget* PreviousGradientFolding = _bUseCascades ? (UTextureRenderTarget*)PreviousCascadeGradientFoldingMaps : (UTextureRenderTarget*)PreviousGradientFoldingMap;
+		_PreviousDisplacementMapSRV = RHICreateShaderResourceView(PreviousDisplacement->GameThread_GetRenderTargetResource()->TextureRHI, 0);
+		_PreviousDisplacementMapUAV = RHICreateUnorderedAccessView(PreviousDisplacement->GameThread_GetRenderTargetResource()->TextureRHI);
+		_PreviousGradientFoldingMapUAV = RHICreateUnorderedAccessView(PreviousGradientFolding->GameThread_GetRenderTargetResource()->TextureRHI);
+	}
+
 	_MPCInstance = nullptr;
 	if (OceanMPC != nullptr)
 	{
 		_MPCInstance = GetWorld()->GetParameterCollectionInstance(OceanMPC);
 		_MPCInstance->SetScalarParameterValue(FName("PerlinLerpBeginDistance"), PerlinLerpBeginDistance);
 		_MPCInstance->SetScalarParameterValue(FName("PerlinLerpEndDistance"), PerlinLerpEndDistance);
+		_MPCInstance->SetVectorParameterValue(FName("PerlinDisplacement"), PerlinDisplacement);
 		_MPCInstance->SetVectorParameterValue(FName("PerlinGradient"), PerlinGradient);
-		// UVXP[̋tɂȂȂƁA[v\perinmCYgĂȏAEłꂪN邪A
-		// łPerlinmCYuhŎxzIȗ̈PerlinLerpEndDistanceŌ߂ꂽiȂ̂Ōhɂ܂Ŗ𐶂ĂȂB
-		// AJɂ悤ȁAĩbVʓɑ傫Ȋł́ALOD̐؂ւ莞ɂςoB
-		// UVXP[̋tƁAx͉iɃ^COoBł̓^CỎdāA̋tȊOݒł悤ɂĂB
-		// PerlinUVScaleLODUVXP[Ō߂ꂽpb`̒łɃXP[̂łB
+		// UVスケールが整数の逆数にならないと、ループ構造でperinノイズを使っている以上、境界部分でずれが起きるが、
+		// 現状ではPerlinノイズがブレンドで支配的な領域はPerlinLerpEndDistanceで決められた遠景なので見栄えにそこまで問題を生じてない。
+		// だが、カメラが上空にあるような、遠景のメッシュが画面内に大きく見えるよな環境では、LODの切り替わり時にぱかつきが出る。
+		// UVスケールが整数の逆数だと、今度は遠景にタイリング感が出る。ここではタイリング感の回避を重視して、整数の逆数以外も設定できるようにしている。
+		// PerlinUVScaleはLODのUVスケールで決められたパッチの中でさらにスケールさせるものである。
 		_MPCInstance->SetVectorParameterValue(FName("PerlinUVScale"), PerlinUVScale);
+
+		// マテリアルはスライスiをワールドXY / CascadePatchLengths[i]のUVでサンプルして足し合わせる
+		FLinearColor CascadePatchLengths(0.0f, 0.0f, 0.0f, 0.0f);
+		if (_bUseCascades)
+		{
+			for (int32 CascadeIndex = 0; CascadeIndex < Cascades.Num(); CascadeIndex++)
+			{
+				CascadePatchLengths.Component(CascadeIndex) = Cascades[CascadeIndex].PatchLength;
+			}
+		}
+		_MPCInstance->SetScalarParameterValue(FName("NumCascades"), _bUseCascades ? (float)Cascades.Num() : 0.0f);
+		_MPCInstance->SetVectorParameterValue(FName("CascadePatchLengths"), CascadePatchLengths);
+
+		// 固定レートでなければ前のステップのマップは使わない。固定レートならプロキシがシミュレーションのたびに設定する
+		_MPCInstance->SetScalarParameterValue(FName("SimulationAlpha"), 1.0f);
 	}
 
 	UMaterialInterface* Material = GetMaterial(0);
@@ -571,47 +805,223 @@ void UOceanQuadtreeMeshComponent::OnRegister()
 		Material = UMaterial::GetDefaultMaterial(MD_Surface);
 	}
 
-	// QuadNode̐́AMaxLOD-2ŏxȂ̂łׂčŏQuadNodeŕ~l߂
-	// 2^(MaxLOD-2)*2^(MaxLOD-2)
-	// ʏ͂܂łȂBJ牓Ȃɂ2{ɂȂĂ
-	// 2*6=12ɂȂ邾낤B͌_ɃJƂŁAJ̍0ɋ߂ƂȂ̂ŁA
-	// 4{x̐ƌςĂł͂
-
-	float InvMaxLOD = 1.0f / MaxLOD;
-	//LODMIDList.SetNumZeroed(48);
-	//for (int32 i = 0; i < 48; i++)
-	_LODMIDList.SetNumZeroed(MaxLOD + 1);
-	for (int32 LOD = 0; LOD < MaxLOD + 1; LOD++)
+	// QuadNodeはFInstancedStaticMeshVertexFactoryで描画するので、マテリアルにインスタンシング用のシェーダをコンパイルさせる。
+	// クックしたビルドではシェーダを追加できないので、bUsedWithInstancedStaticMeshesが立っていなければ黙ってデフォルトマテリアルで描画されてしまう。気づけるようにログを出しておく
+	if (!Material->CheckMaterialUsage(MATUSAGE_InstancedStaticMeshes))
 	{
-		_LODMIDList[LOD] = UMaterialInstanceDynamic::Create(Material, this);
-		_LODMIDList[LOD]->SetScalarParameterValue(FName("UVScale"), (float)(1 << LOD));
-		_LODMIDList[LOD]->SetVectorParameterValue(FName("LODColor"), FLinearColor((MaxLOD - LOD) * InvMaxLOD, 0.0f, LOD * InvMaxLOD));
+		UE_LOG(LogTemp, Warning, TEXT("%s: Material %s is not usable with instanced static meshes. The default material is used instead. Enable bUsedWithInstancedStaticMeshes on the material."), *GetPathName(), *Material->GetPathName());
+		Material = UMaterial::GetDefaultMaterial(MD_Surface);
 	}
 
+	// QuadNodeの数は、MaxLOD-2が最小レベルなのですべて最小のQuadNodeで敷き詰めると
+	// 2^(MaxLOD-2)*2^(MaxLOD-2)
+	// 通常はそこまでいかない。カメラから遠くなるにつれて2倍になっていけば
+	// 2*6=12になるだろう。それは原点にカメラがあるときで、かつカメラの高さが0に近いときなので、
+	// せいぜその4倍程度の数と見積もってでいいはず
+
+	// 全LODを1つのマテリアルで描く。UVScaleとLODColorはPerInstanceRandomに入っているLOD / MaxLODからマテリアルで求める。QuadtreeLOD.ushを参照
+	_QuadNodeMID = UMaterialInstanceDynamic::Create(Material, this);
+	_QuadNodeMID->SetScalarParameterValue(FName("MaxLOD"), (float)MaxLOD);
+
 	MarkRenderStateDirty();
 	UpdateBounds();
 }
 
+void UOceanQuadtreeMeshComponent::OnUnregister()
+{
+	FQuadMeshIndexBuffer::Release(QuadMeshIndexBuffer);
+	// シーンプロキシが参照を持っている間はシミュレーションは解放されない
+	_SharedSimulation.Reset();
+
+	{
+		FScopeLock Lock(&_DisplacementQuerySnapshotLock);
+		_DisplacementQuerySnapshot.Reset();
+	}
+
+	Super::OnUnregister();
+}
+
+void UOceanQuadtreeMeshComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+
+	// 登録前はInitSpectrum()で公開する
+	if (_InitialSpectrum.IsValid())
+	{
+		PublishDisplacementQuerySnapshot();
+	}
+}
+
 FBoxSphereBounds UOceanQuadtreeMeshComponent::CalcBounds(const FTransform& LocalToWorld) const
 {
-	// QuadtreeRootNodẽTCYɂĂBAN^BPGfB^̃r[|[g\tH[JXȂǂłBoundĝłȂׂmɂ
-	// ܂AQuadNode̊ebVBoundvZTCYƂĂgB
+	// QuadtreeのRootNodeのサイズにしておく。アクタのBPエディタのビューポート表示やフォーカス操作などでこのBoundが使われるのでなるべく正確にする
+	// また、QuadNodeの各メッシュのBoundを計算する基準サイズとしても使う。
+	// 高さ方向は波の変位の振幅ぶん広げる
 	float HalfRootNodeLength = PatchLength * (1 << (MaxLOD - 1));
-	const FVector& Min = LocalToWorld.TransformPosition(FVector(-HalfRootNodeLength, -HalfRootNodeLength, 0.0f));
-	const FVector& Max = LocalToWorld.TransformPosition(FVector(HalfRootNodeLength, HalfRootNodeLength, 0.0f));
+	const FVector& Min = LocalToWorld.TransformPosition(FVector(-HalfRootNodeLength, -HalfRootNodeLength, -MaxDisplacement));
+	const FVector& Max = LocalToWorld.TransformPosition(FVector(HalfRootNodeLength, HalfRootNodeLength, MaxDisplacement));
 	FBox Box(Min, Max);
 
 	const FBoxSphereBounds& Ret = FBoxSphereBounds(Box);
 	return Ret;
 }
 
-void UOceanQuadtreeMeshComponent::SendRenderDynamicData_Concurrent()
+void UOceanQuadtreeMeshComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction)
 {
-	//SCOPE_CYCLE_COUNTER(STAT_OceanQuadtreeMeshCompUpdate);
-	Super::SendRenderDynamicData_Concurrent();
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (SimulationBackend == EOceanSimulationBackend::CPU)
+	{
+		SimulateOnCPU();
+	}
+	else
+	{
+		_CPUDisplacement.Reset();
+		_CPUDisplacementPool.Reset();
+	}
+}
+
+uint32 UOceanQuadtreeMeshComponent::GetDispMapDimension() const
+{
+	if (_bUseCascades)
+	{
+		return CascadeDisplacementMaps->SizeX;
+	}
+
+	// -nullrhiのデディケイテッドサーバでもレンダーターゲットのサイズのプロパティは読める。未設定ならGPU版の前提のサイズにする
+	int32 SizeX = 512;
+	int32 SizeY = 512;
+	if (DisplacementMap != nullptr)
+	{
+		DisplacementMap->GetSize(SizeX, SizeY);
+	}
+	check(SizeX == SizeY); // 正方形である前提
+	check(FMath::IsPowerOfTwo(SizeX)); // 2の累乗のサイズである前提
+	return SizeX;
+}
+
+bool UOceanQuadtreeMeshComponent::ValidateCascades() const
+{
+	if (Cascades.Num() == 0)
+	{
+		return false;
+	}
+
+	// 設定が不正ならカスケードを使わずPatchLengthの単一のスペクトラムでシミュレーションする
+	// カスケードが1つではPatchLengthの単一のスペクトラムをテクスチャ配列に書くだけなので、設定ミスとして扱う
+	if (Cascades.Num() < 2)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Cascades needs at least 2 elements. Use PatchLength for a single spectrum. Cascades are disabled."), *GetPathName());
+		return false;
+	}
+
+	if (Cascades.Num() > MaxOceanCascades)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: %d Cascades exceed the maximum %d. Cascades are disabled."), *GetPathName(), Cascades.Num(), MaxOceanCascades);
+		return false;
+	}
+
+	if (SimulationBackend != EOceanSimulationBackend::GPU)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Cascades are supported only by the GPU backend. Cascades are disabled."), *GetPathName());
+		return false;
+	}
+
+	if (CascadeDisplacementMaps == nullptr || CascadeGradientFoldingMaps == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Cascades need CascadeDisplacementMaps and CascadeGradientFoldingMaps. Cascades are disabled."), *GetPathName());
+		return false;
+	}
+
+	const int32 Size = CascadeDisplacementMaps->SizeX;
+	if (CascadeDisplacementMaps->SizeY != Size || !IsSupportedDispMapDimension(Size)
+		|| CascadeGradientFoldingMaps->SizeX != Size || CascadeGradientFoldingMaps->SizeY != Size
+		|| CascadeDisplacementMaps->Slices < Cascades.Num() || CascadeGradientFoldingMaps->Slices < Cascades.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: CascadeDisplacementMaps and CascadeGradientFoldingMaps must be square of the same size (a power of 2 from 64 to 2048) with at least %d slices. Cascades are disabled."), *GetPathName(), Cascades.Num());
+		return false;
+	}
+
+	return true;
+}
+
+bool UOceanQuadtreeMeshComponent::ValidateFixedRateSimulation() const
+{
+	if (SimulationRate <= 0.0f)
+	{
+		return false;
+	}
+
+	// 設定が不正なら毎フレームシミュレーションする
+	if (SimulationBackend != EOceanSimulationBackend::GPU)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: SimulationRate is supported only by the GPU backend. The ocean is simulated every frame."), *GetPathName());
+		return false;
+	}
+
+	// Previousのマップにも交互に書き込むので、同じサイズ、フォーマットのテクスチャでないといけない
+	bool bValid = false;
+	if (_bUseCascades)
+	{
+		bValid = PreviousCascadeDisplacementMaps != nullptr && PreviousCascadeGradientFoldingMaps != nullptr
+			&& PreviousCascadeDisplacementMaps->SizeX == CascadeDisplacementMaps->SizeX && PreviousCascadeDisplacementMaps->SizeY == CascadeDisplacementMaps->SizeY
+			&& PreviousCascadeDisplacementMaps->Slices == CascadeDisplacementMaps->Slices && PreviousCascadeDisplacementMaps->OverrideFormat == CascadeDisplacementMaps->OverrideFormat
+			&& PreviousCascadeGradientFoldingMaps->SizeX == CascadeGradientFoldingMaps->SizeX && PreviousCascadeGradientFoldingMaps->SizeY == CascadeGradientFoldingMaps->SizeY
+			&& PreviousCascadeGradientFoldingMaps->Slices == CascadeGradientFoldingMaps->Slices && PreviousCascadeGradientFoldingMaps->OverrideFormat == CascadeGradientFoldingMaps->OverrideFormat;
+	}
+	else
+	{
+		bValid = DisplacementMap != nullptr && GradientFoldingMap != nullptr && PreviousDisplacementMap != nullptr && PreviousGradientFoldingMap != nullptr
+			&& PreviousDisplacementMap->SizeX == DisplacementMap->SizeX && PreviousDisplacementMap->SizeY == DisplacementMap->SizeY
+			&& PreviousDisplacementMap->RenderTargetFormat == DisplacementMap->RenderTargetFormat
+			&& PreviousGradientFoldingMap->SizeX == GradientFoldingMap->SizeX && PreviousGradientFoldingMap->SizeY == GradientFoldingMap->SizeY
+			&& PreviousGradientFoldingMap->RenderTargetFormat == GradientFoldingMap->RenderTargetFormat;
+	}
+
+	if (!bValid)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: SimulationRate needs the Previous maps of the same size, format and slices as the simulated maps. The ocean is simulated every frame."), *GetPathName());
+		return false;
+	}
+
+	return true;
+}
+
+void UOceanQuadtreeMeshComponent::WarnHalfPrecisionTargetFormats() const
+{
+	if (!bHalfPrecision || SimulationBackend != EOceanSimulationBackend::GPU)
+	{
+		return;
+	}
 
-	if (SceneProxy != nullptr
-		&& DisplacementMap != nullptr
+	// half精度でもシェーダはfloat4で書き込むのでどのフォーマットでも動くが、fp32のテクスチャでは帯域とメモリが減らない
+	bool bHalfTargets = false;
+	if (_bUseCascades)
+	{
+		bHalfTargets = CascadeDisplacementMaps->OverrideFormat == PF_FloatRGBA && CascadeGradientFoldingMaps->OverrideFormat == PF_FloatRGBA;
+	}
+	else
+	{
+		bHalfTargets = DisplacementMap != nullptr && GradientFoldingMap != nullptr
+			&& DisplacementMap->RenderTargetFormat == RTF_RGBA16f && GradientFoldingMap->RenderTargetFormat == RTF_RGBA16f;
+	}
+
+	if (!bHalfTargets)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: bHalfPrecision expects RTF_RGBA16f DisplacementMap and GradientFoldingMap (PF_FloatRGBA for the cascade arrays). The simulation runs, but the maps keep their format."), *GetPathName());
+	}
+}
+
+bool UOceanQuadtreeMeshComponent::HasSimulationViews() const
+{
+	if (_bUseCascades)
+	{
+		return _CascadeDisplacementMapsSRV.IsValid()
+			&& _CascadeDisplacementMapsUAV.IsValid()
+			&& _CascadeGradientFoldingMapsUAV.IsValid();
+	}
+
+	return DisplacementMap != nullptr
 		&& _DisplacementMapSRV.IsValid()
 		&& _DisplacementMapUAV.IsValid()
 		&& GradientFoldingMap != nullptr
@@ -620,35 +1030,388 @@ void UOceanQuadtreeMeshComponent::SendRenderDynamicData_Concurrent()
 		&& _HtDebugViewUAV.IsValid()
 		&& _DkxDebugViewUAV.IsValid()
 		&& _DkyDebugViewUAV.IsValid()
-		&& _DxyzDebugViewUAV.IsValid()
-	)
+		&& _DxyzDebugViewUAV.IsValid();
+}
+
+void UOceanQuadtreeMeshComponent::InitSpectrum()
+{
+	uint32 DispMapDimension = GetDispMapDimension();
+	if (SimulationBackend == EOceanSimulationBackend::GPU && !IsSupportedDispMapDimension(DispMapDimension))
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: DisplacementMap size %u is not supported by the GPU simulation. Use a power of 2 from 64 to 2048 or the CPU backend."), *GetPathName(), DispMapDimension);
+	}
+
+	// カスケードがなければ要素1つ
+	TArray<FOceanSpectrumParameters, TInlineAllocator<MaxOceanCascades>> CascadeParams;
+	if (_bUseCascades)
+	{
+		CascadeParams = CreateCascadeSpectrumParameters(DispMapDimension);
+	}
+	else
 	{
+		CascadeParams.Add(CreateSpectrumParameters(DispMapDimension));
+	}
+	const float GravityZ = GetWorld()->GetGravityZ();
+	const int32 NumComponents = NumQuerySpectrumComponents;
+
+	_CPUDisplacement.Reset();
+
+	// 同じスペクトラムのコンポーネントがすでにあれば、シミュレーションとH0を共有して生成もしない
+	FOceanSimulationKey Key(CascadeParams, GravityZ, TimeScale);
+	Key.NumQuerySpectrumComponents = NumComponents;
+	Key.bCPUBackend = (SimulationBackend == EOceanSimulationBackend::CPU);
+	// 固定レートのシミュレーションは毎フレームのものと状態を共有できない
+	if (_bUseFixedRateSimulation)
+	{
+		Key.SimulationRate = SimulationRate;
+		Key.bTimeSliced = bTimeSlicedSimulation;
+	}
+	_SharedSimulation = FOceanSharedSimulation::Acquire(Key);
+	if (_SharedSimulation->GetInitialSpectrum().IsValid())
+	{
+		_InitialSpectrum = _SharedSimulation->GetInitialSpectrum();
+		_InitialSpectrumTask = _SharedSimulation->GetInitialSpectrumTask();
+		PublishDisplacementQuerySnapshot();
+		return;
+	}
+
+	// DispMapDimensionが大きいとH0の生成はゲームスレッドのヒッチになるので非同期タスクで行う。
+	// プロキシは最初のシミュレーションのとき、CPUバックエンドとQueryOceanDisplacement()は最初に使うときに完了を待つ。
+	// 前のタスクが実行中でも、そのタスクは古いインスタンスを参照しているので新しいインスタンスに差し替えてよい
+	TSharedRef<FOceanInitialSpectrum, ESPMode::ThreadSafe> InitialSpectrum = MakeShared<FOceanInitialSpectrum, ESPMode::ThreadSafe>();
+	_InitialSpectrumTask = FFunctionGraphTask::CreateAndDispatchWhenReady([InitialSpectrum, CascadeParams, GravityZ, NumComponents]()
+	{
+		const uint32 NumCascadeElements = CascadeParams[0].DispMapDimension * CascadeParams[0].DispMapDimension;
+
+		// Phyllips Spectrumを使った初期化
+		// Height map H(0)。カスケードはそれぞれのH0、Omega0を連続して並べる
+		InitialSpectrum->H0Data.Init(FComplex::ZeroVector, NumCascadeElements * CascadeParams.Num());
+		// FComplex::ZeroVectorという名前が少し格好悪いが、Zeroみたいな新しい定数を作ろうと思うとtypedef FVector2D FComplexではできずFVector2Dを包含したFComplex構造体を作らねばならないので今は妥協する
+
+		InitialSpectrum->Omega0Data.Init(0.0f, NumCascadeElements * CascadeParams.Num());
+		InitialSpectrum->SpectrumComponents.SetNum(CascadeParams.Num());
+
+		if (CascadeParams.Num() == 1)
+		{
+			// 同じパラメータで生成済みならディスクのキャッシュから読み込む
+			LoadOrCreateInitialHeightMap(CascadeParams[0], GravityZ, InitialSpectrum->H0Data, InitialSpectrum->Omega0Data);
+		}
+		else
+		{
+			TResourceArray<FComplex> CascadeH0;
+			TResourceArray<float> CascadeOmega0;
+			CascadeH0.SetNumUninitialized(NumCascadeElements);
+			CascadeOmega0.SetNumUninitialized(NumCascadeElements);
+			for (int32 CascadeIndex = 0; CascadeIndex < CascadeParams.Num(); CascadeIndex++)
+			{
+				LoadOrCreateInitialHeightMap(CascadeParams[CascadeIndex], GravityZ, CascadeH0, CascadeOmega0);
+				FMemory::Memcpy(&InitialSpectrum->H0Data[NumCascadeElements * CascadeIndex], CascadeH0.GetData(), NumCascadeElements * sizeof(FComplex));
+				FMemory::Memcpy(&InitialSpectrum->Omega0Data[NumCascadeElements * CascadeIndex], CascadeOmega0.GetData(), NumCascadeElements * sizeof(float));
+			}
+		}
+
+		// QueryOceanDisplacement()用のエネルギーの大きい成分はH0を作るときに一度だけカスケードごとに選ぶ
+		for (int32 CascadeIndex = 0; CascadeIndex < CascadeParams.Num(); CascadeIndex++)
+		{
+			const uint32 Head = NumCascadeElements * CascadeIndex;
+			SelectSpectrumComponents(CascadeParams[CascadeIndex], &InitialSpectrum->H0Data[Head], &InitialSpectrum->Omega0Data[Head], NumComponents, InitialSpectrum->SpectrumComponents[CascadeIndex]);
+		}
+	}, TStatId(), nullptr, ENamedThreads::AnyBackgroundThreadNormalTask);
+	_InitialSpectrum = InitialSpectrum;
+	_SharedSimulation->SetInitialSpectrum(_InitialSpectrum, _InitialSpectrumTask);
+	PublishDisplacementQuerySnapshot();
+}
+
+void UOceanQuadtreeMeshComponent::PublishDisplacementQuerySnapshot()
+{
+	check(IsInGameThread());
+
+	// QuadNodeのUVはコンポーネントの原点からの平行移動だけで決まり、PatchLengthごとに繰り返す。
+	// プロキシと同様にコンポーネントの回転とスケールは考慮しない
+	TSharedRef<FDisplacementQuerySnapshot, ESPMode::ThreadSafe> Snapshot = MakeShared<FDisplacementQuerySnapshot, ESPMode::ThreadSafe>();
+	Snapshot->InitialSpectrum = _InitialSpectrum;
+	Snapshot->InitialSpectrumTask = _InitialSpectrumTask;
+	Snapshot->Origin = FVector2D(GetComponentLocation());
+	Snapshot->TimeScale = TimeScale;
+	Snapshot->NumInverseIterations = NumQueryInverseIterations;
+
+	FScopeLock Lock(&_DisplacementQuerySnapshotLock);
+	_DisplacementQuerySnapshot = Snapshot;
+}
+
+void UOceanQuadtreeMeshComponent::SimulateOnCPU()
+{
+	if (!_InitialSpectrumTask->IsComplete())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(_InitialSpectrumTask, ENamedThreads::GameThread);
+	}
+
+	uint32 DispMapDimension = GetDispMapDimension();
+	check((uint32)_InitialSpectrum->H0Data.Num() == DispMapDimension * DispMapDimension);
+
+	const FOceanSpectrumParameters& Params = CreateSpectrumParameters(DispMapDimension);
+
+	// レンダースレッドがまだ参照している結果は上書きできないので、プールのほかに参照のないものを使い回す。
+	// プールはレンダースレッドの遅れのぶんだけの数で増えなくなり、配列も前回の容量のまま再利用される
+	TSharedPtr<FOceanCPUDisplacement, ESPMode::ThreadSafe>* FreeDisplacement = _CPUDisplacementPool.FindByPredicate(
+		[](const TSharedPtr<FOceanCPUDisplacement, ESPMode::ThreadSafe>& PooledDisplacement)
+		{
+			return PooledDisplacement.IsUnique();
+		});
+	if (FreeDisplacement != nullptr)
+	{
+		_CPUDisplacement = *FreeDisplacement;
+	}
+	else
+	{
+		_CPUDisplacement = MakeShared<FOceanCPUDisplacement, ESPMode::ThreadSafe>();
+		_CPUDisplacementPool.Add(_CPUDisplacement);
+	}
+
+	SimulateOceanCPU(Params, _InitialSpectrum->H0Data.GetData(), _InitialSpectrum->Omega0Data.GetData(), _CPUSimulationWork, *_CPUDisplacement);
+}
+
+FString UOceanQuadtreeMeshComponent::GetFlipbookPath() const
+{
+	return FPaths::ConvertRelativePathToFull(FPaths::ProjectDir(), FlipbookFile);
+}
+
+void UOceanQuadtreeMeshComponent::OpenFlipbook()
+{
+	_Flipbook.Reset();
+	if (SimulationBackend != EOceanSimulationBackend::Flipbook)
+	{
+		return;
+	}
+
+	_Flipbook = OpenFlipbookFile();
+	if (_Flipbook.IsValid())
+	{
+		const FOceanFlipbookHeader& Header = _Flipbook->GetHeader();
+		UE_LOG(LogTemp, Log, TEXT("%s: Playing %s, %u frames in %.2f, %.2f MB%s, streaming %.2f MB/s."),
+			*GetPathName(), *FlipbookFile, Header.NumFrames, Header.Period, _Flipbook->GetFileBytes() / (1024.0 * 1024.0),
+			_Flipbook->IsMemoryMapped() ? TEXT(" memory-mapped") : TEXT(""), _Flipbook->GetStreamingBytesPerSecond() / (1024.0 * 1024.0));
+		return;
+	}
+
+	// 再生できなければプロキシはFlipbookPlayerを作らず、毎フレームGPUでFFTする。
+	// Flipbookを選ぶのはFFTのコストを避けたいときなので、フォールバックしていることが分かるようにしておく
+	const uint32 DispMapDimension = GetDispMapDimension();
+	if (IsSupportedDispMapDimension(DispMapDimension))
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Falling back to the GPU simulation every frame instead of playing the flipbook."), *GetPathName());
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Falling back to the GPU simulation every frame instead of playing the flipbook, but DisplacementMap size %u is not supported by it."), *GetPathName(), DispMapDimension);
+	}
+}
+
+TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> UOceanQuadtreeMeshComponent::OpenFlipbookFile() const
+{
+	if (FlipbookFile.IsEmpty() || DisplacementMap == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: The Flipbook backend needs FlipbookFile and DisplacementMap."), *GetPathName());
+		return nullptr;
+	}
+
+	TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> Flipbook = FOceanFlipbook::Open(GetFlipbookPath());
+	if (!Flipbook.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: %s is not a valid ocean flipbook. Bake it with ShaderSandbox.Ocean.BakeFlipbook."), *GetPathName(), *FlipbookFile);
+		return nullptr;
+	}
+
+	const FOceanFlipbookHeader& Header = Flipbook->GetHeader();
+	if (Header.DispMapDimension != GetDispMapDimension())
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: %s is %ux%u but DisplacementMap is %ux%u."), *GetPathName(), *FlipbookFile, Header.DispMapDimension, Header.DispMapDimension, GetDispMapDimension(), GetDispMapDimension());
+		return nullptr;
+	}
+
+	return Flipbook;
+}
+
+namespace
+{
+// ベイク中のファイルのパス。同じファイルに並行して書き込まないようにする。ゲームスレッドからだけ触る
+TSet<FString> GBakingFlipbookPaths;
+} // namespace
+
+bool UOceanQuadtreeMeshComponent::BakeFlipbook() const
+{
+	check(IsInGameThread());
+
+	if (FlipbookFile.IsEmpty() || !_InitialSpectrum.IsValid())
+	{
+		return false;
+	}
+
+	// カスケードはCPUシミュレーションが対応しないのでベイクできない
+	if (_bUseCascades)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: Flipbooks do not support Cascades."), *GetPathName());
+		return false;
+	}
+
+	const FString& Path = GetFlipbookPath();
+	if (GBakingFlipbookPaths.Contains(Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: %s is already being baked."), *GetPathName(), *Path);
+		return false;
+	}
+	GBakingFlipbookPaths.Add(Path);
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+
+	// 数百フレームのシミュレーションはゲームスレッドを長く止めるので、バックグラウンドのタスクで行う。
+	// H0の生成タスクを前提にするので、ゲームスレッドで完了を待つ必要もない。タスクはコンポーネントを参照せず、必要な値をコピーして持つ
+	const uint32 DispMapDimension = GetDispMapDimension();
+	const FOceanSpectrumParameters& Params = CreateSpectrumParameters(DispMapDimension);
+	TSharedPtr<const FOceanInitialSpectrum, ESPMode::ThreadSafe> InitialSpectrum = _InitialSpectrum;
+	const FString& Name = GetPathName();
+	const float Period = FlipbookPeriod;
+	const int32 NumFrames = FlipbookNumFrames;
+	const EOceanFlipbookFormat Format = FlipbookFormat;
+	const float SpectrumTimeScale = TimeScale;
+
+	FGraphEventArray Prerequisites;
+	Prerequisites.Add(_InitialSpectrumTask);
+
+	FFunctionGraphTask::CreateAndDispatchWhenReady([Path, Params, InitialSpectrum, Name, Period, NumFrames, Format, SpectrumTimeScale, DispMapDimension]()
+	{
+		check((uint32)InitialSpectrum->H0Data.Num() == DispMapDimension * DispMapDimension);
+
+		const double StartTime = FPlatformTime::Seconds();
+		UE_LOG(LogTemp, Log, TEXT("%s: Baking %d frames of %ux%u to %s."), *Name, NumFrames, DispMapDimension, DispMapDimension, *Path);
+
+		// 進捗は10%ごとにログに出す
+		int32 LoggedPercent = 0;
+		const auto OnProgress = [&Name, &LoggedPercent](float Progress)
+		{
+			const int32 Percent = FMath::FloorToInt(Progress * 10.0f) * 10;
+			if (Percent > LoggedPercent && Percent < 100)
+			{
+				LoggedPercent = Percent;
+				UE_LOG(LogTemp, Log, TEXT("%s: Baking flipbook %d%%."), *Name, Percent);
+			}
+		};
+
+		int64 FileBytes = 0;
+		if (BakeOceanFlipbook(Path, Params, InitialSpectrum->H0Data.GetData(), InitialSpectrum->Omega0Data.GetData(), SpectrumTimeScale, Period, NumFrames, Format, OnProgress, FileBytes))
+		{
+			const uint32 FrameBytes = GetOceanFlipbookFrameBytes(DispMapDimension, Format);
+			UE_LOG(LogTemp, Log, TEXT("%s: Baked %d frames of %ux%u to %s in %.1f s. %.2f MB (%.1f KB per frame), streaming %.2f MB/s."),
+				*Name, NumFrames, DispMapDimension, DispMapDimension, *Path, FPlatformTime::Seconds() - StartTime,
+				FileBytes / (1024.0 * 1024.0), FrameBytes / 1024.0, (double)FrameBytes * NumFrames / Period / (1024.0 * 1024.0));
+		}
+		else
+		{
+			UE_LOG(LogTemp, Error, TEXT("%s: Failed to write %s."), *Name, *Path);
+		}
+
+		AsyncTask(ENamedThreads::GameThread, [Path]()
+		{
+			GBakingFlipbookPaths.Remove(Path);
+		});
+	}, TStatId(), &Prerequisites, ENamedThreads::AnyBackgroundThreadNormalTask);
+
+	return true;
+}
+
+void UOceanQuadtreeMeshComponent::QueryOceanDisplacement(TArrayView<const FVector2D> Positions, float Time, TArrayView<FVector> OutDisplacements) const
+{
+	check(Positions.Num() == OutDisplacements.Num());
+
+	// ゲームスレッドの状態は直接読まず、公開されたスナップショットだけを使う。
+	// 評価中にゲームスレッドでInitSpectrum()やトランスフォームの更新があっても差し替えられるだけなので、参照を持っておけば一貫した状態で評価できる
+	TSharedPtr<const FDisplacementQuerySnapshot, ESPMode::ThreadSafe> Snapshot;
+	{
+		FScopeLock Lock(&_DisplacementQuerySnapshotLock);
+		Snapshot = _DisplacementQuerySnapshot;
+	}
+
+	if (!Snapshot.IsValid() || !Snapshot->InitialSpectrum.IsValid())
+	{
+		for (FVector& Displacement : OutDisplacements)
+		{
+			Displacement = FVector::ZeroVector;
+		}
+		return;
+	}
+
+	if (!Snapshot->InitialSpectrumTask->IsComplete())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(Snapshot->InitialSpectrumTask);
+	}
+
+	TArray<FVector2D> LocalPositions;
+	LocalPositions.SetNumUninitialized(Positions.Num());
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		LocalPositions[i] = Positions[i] - Snapshot->Origin;
+	}
+
+	EvaluateSpectrumComponents(Snapshot->InitialSpectrum->SpectrumComponents, Time * Snapshot->TimeScale, Snapshot->NumInverseIterations, LocalPositions, OutDisplacements);
+}
+
+FOceanSpectrumParameters UOceanQuadtreeMeshComponent::CreateSpectrumParameters(uint32 DispMapDimension) const
+{
+	FOceanSpectrumParameters Params;
+	Params.DispMapDimension = DispMapDimension;
+	Params.PatchLength = PatchLength;
+	Params.AmplitudeScale = AmplitudeScale;
+	Params.WindDirection = WindDirection.GetSafeNormal();
+	Params.WindSpeed = WindSpeed;
+	Params.WindDependency = WindDependency;
+	Params.ChoppyScale = ChoppyScale;
+	Params.Seed = (uint32)Seed;
+	Params.bPackedIFFT = bPackedIFFT;
+	Params.bHalfPrecision = bHalfPrecision;
+	Params.AccumulatedTime = GetAccumulatedTime() * TimeScale;
+	Params.DxyzDebugAmplitude = DxyzDebugAmplitude;
+	return Params;
+}
+
+TArray<FOceanSpectrumParameters, TInlineAllocator<MaxOceanCascades>> UOceanQuadtreeMeshComponent::CreateCascadeSpectrumParameters(uint32 DispMapDimension) const
+{
+	TArray<FOceanSpectrumParameters, TInlineAllocator<MaxOceanCascades>> Ret;
+	for (int32 CascadeIndex = 0; CascadeIndex < Cascades.Num(); CascadeIndex++)
+	{
+		// 同じ乱数のカスケードが重なって見えないようにシードをずらす
+		FOceanSpectrumParameters& Params = Ret.Add_GetRef(CreateSpectrumParameters(DispMapDimension));
+		Params.PatchLength = Cascades[CascadeIndex].PatchLength;
+		Params.MinWaveLength = Cascades[CascadeIndex].MinWaveLength;
+		Params.MaxWaveLength = Cascades[CascadeIndex].MaxWaveLength;
+		Params.ChoppyScale = Cascades[CascadeIndex].ChoppyScale;
+		Params.Seed = (uint32)Seed + CascadeIndex;
+	}
+	return Ret;
+}
+
+void UOceanQuadtreeMeshComponent::SendRenderDynamicData_Concurrent()
+{
+	//SCOPE_CYCLE_COUNTER(STAT_OceanQuadtreeMeshCompUpdate);
+	Super::SendRenderDynamicData_Concurrent();
+
+	if (SceneProxy != nullptr && HasSimulationViews())
+	{
+		TSharedPtr<FOceanCPUDisplacement, ESPMode::ThreadSafe> CPUDisplacement = _CPUDisplacement;
+
 		ENQUEUE_RENDER_COMMAND(OceanDeformGridMeshCommand)(
-			[this](FRHICommandListImmediate& RHICmdList)
+			[this, CPUDisplacement](FRHICommandListImmediate& RHICmdList)
 			{
-				if (SceneProxy != nullptr
-					&& DisplacementMap != nullptr
-					&& _DisplacementMapSRV.IsValid()
-					&& _DisplacementMapUAV.IsValid()
-					&& GradientFoldingMap != nullptr
-					&& _GradientFoldingMapUAV.IsValid()
-					&& _H0DebugViewUAV.IsValid()
-					&& _HtDebugViewUAV.IsValid()
-					&& _DkxDebugViewUAV.IsValid()
-					&& _DkyDebugViewUAV.IsValid()
-					&& _DxyzDebugViewUAV.IsValid()
-					)
+				if (SceneProxy != nullptr && HasSimulationViews())
 				{
-					((const FOceanQuadtreeMeshSceneProxy*)SceneProxy)->EnqueSimulateOceanCommand(RHICmdList, this);
+					((const FOceanQuadtreeMeshSceneProxy*)SceneProxy)->EnqueSimulateOceanCommand(RHICmdList, this, CPUDisplacement.Get());
 				}
 			}
 		);
 	}
 }
 
-const TArray<class UMaterialInstanceDynamic*>& UOceanQuadtreeMeshComponent::GetLODMIDList() const
+UMaterialInstanceDynamic* UOceanQuadtreeMeshComponent::GetQuadNodeMID() const
 {
-	return _LODMIDList;
+	return _QuadNodeMID;
 }
 
 UMaterialParameterCollectionInstance* UOceanQuadtreeMeshComponent::GetMPCInstance() const
@@ -656,8 +1419,117 @@ UMaterialParameterCollectionInstance* UOceanQuadtreeMeshComponent::GetMPCInstanc
 	return _MPCInstance;
 }
 
-const TArray<Quadtree::FQuadMeshParameter>& UOceanQuadtreeMeshComponent::GetQuadMeshParams() const
+const Quadtree::FQuadMeshIndexBufferPtr& UOceanQuadtreeMeshComponent::GetQuadMeshIndexBuffer() const
+{
+	return QuadMeshIndexBuffer;
+}
+
+namespace
+{
+void BakeFlipbooks()
+{
+	for (TObjectIterator<UOceanQuadtreeMeshComponent> It; It; ++It)
+	{
+		UOceanQuadtreeMeshComponent* Component = *It;
+		if (!Component->IsRegistered() || Component->FlipbookFile.IsEmpty())
+		{
+			continue;
+		}
+
+		Component->BakeFlipbook();
+	}
+}
+
+FAutoConsoleCommand BakeFlipbooksCommand(
+	TEXT("ShaderSandbox.Ocean.BakeFlipbook"),
+	TEXT("Bakes FlipbookNumFrames frames of one FlipbookPeriod of each registered OceanQuadtreeMeshComponent with FlipbookFile, for the Flipbook backend, on background tasks. Logs the progress, the file size and the streaming bandwidth. Re-register the components to play the new file after the bake completes."),
+	FConsoleCommandDelegate::CreateStatic(&BakeFlipbooks)
+);
+} // namespace
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FOceanCompareCPUSimulationTest, "ShaderSandbox.Ocean.CompareCPUSimulation", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FOceanCompareCPUSimulationTest::RunTest(const FString& Parameters)
 {
-	return QuadMeshParams;
+	// 最大誤差の最大変位に対する許容値。GPUとCPUの差はShaderSandbox.Ocean.FFTLengthsのテストと同じ1e-3、
+	// bHalfPrecisionではそれにShaderSandbox.Ocean.HalfPrecisionのテストの2e-3を足す。どちらもGPUで計測していない見積もり
+	const float Tolerance = 1e-3f;
+	const float HalfPrecisionTolerance = 3e-3f;
+
+	// 開いているワールドの登録済みのコンポーネントを比較する。CPU側は常にパックしないIFFTなので、GPUのbPackedIFFTの確認にもなる
+	TArray<FOceanCPUComparison> Comparisons;
+	TArray<const FOceanQuadtreeMeshSceneProxy*> SceneProxies;
+	for (TObjectIterator<UOceanQuadtreeMeshComponent> It; It; ++It)
+	{
+		UOceanQuadtreeMeshComponent* Component = *It;
+		if (Component->SceneProxy == nullptr || Component->GetDisplacementMap() == nullptr || !Component->GetDisplacementMapUAV().IsValid())
+		{
+			continue;
+		}
+
+		// CPUバックエンドはカスケードに対応しないので比較できない
+		if (Component->UsesCascades())
+		{
+			AddInfo(FString::Printf(TEXT("%s: Skipped because the CPU simulation does not support Cascades."), *Component->GetPathName()));
+			continue;
+		}
+
+		// 固定レートのシミュレーションの状態を強制的な再計算で崩さない
+		if (Component->UsesFixedRateSimulation())
+		{
+			AddInfo(FString::Printf(TEXT("%s: Skipped because SimulationRate is set."), *Component->GetPathName()));
+			continue;
+		}
+
+		FTextureRenderTargetResource* DisplacementMapResource = Component->GetDisplacementMap()->GameThread_GetRenderTargetResource();
+		FTextureRenderTargetResource* GradientFoldingMapResource = (Component->GradientFoldingMap != nullptr) ? Component->GradientFoldingMap->GameThread_GetRenderTargetResource() : nullptr;
+		if (DisplacementMapResource == nullptr || GradientFoldingMapResource == nullptr)
+		{
+			continue;
+		}
+
+		// レンダースレッドではコンポーネントに触らず、ここでコピーした値とプロキシだけを使う。
+		// プロキシの破棄はこの後に積まれるレンダーコマンドで行われるので、このコマンドの実行中は有効
+		FOceanCPUComparison& Comparison = Comparisons.AddDefaulted_GetRef();
+		Comparison.PathName = Component->GetPathName();
+		Comparison.Params = Component->CreateSpectrumParameters(Component->GetDisplacementMap()->SizeX); // TODO:正方形前提でSizeYは見てない
+		Comparison.Views = FOceanQuadtreeMeshSceneProxy::GetOutputViews(Component);
+		Comparison.DisplacementMapResource = DisplacementMapResource;
+		Comparison.GradientFoldingMapResource = GradientFoldingMapResource;
+		SceneProxies.Add((const FOceanQuadtreeMeshSceneProxy*)Component->SceneProxy);
+	}
+
+	// レンダースレッドで比較してゲームスレッドで判定する。Comparisonsはここから判定までゲームスレッドでは触らない
+	TArray<FOceanCPUComparison>* ComparisonsPtr = &Comparisons;
+	ENQUEUE_RENDER_COMMAND(OceanCompareCPUSimulationCommand)(
+		[SceneProxies, ComparisonsPtr](FRHICommandListImmediate& RHICmdList)
+		{
+			for (int32 Idx = 0; Idx < SceneProxies.Num(); Idx++)
+			{
+				SceneProxies[Idx]->CompareCPUSimulation(RHICmdList, (*ComparisonsPtr)[Idx]);
+			}
+		}
+	);
+	FlushRenderingCommands();
+
+	if (Comparisons.Num() == 0)
+	{
+		AddInfo(TEXT("No OceanQuadtreeMeshComponent to compare. Open a level with one that uses the GPU backend without Cascades and SimulationRate."));
+	}
+
+	for (const FOceanCPUComparison& Comparison : Comparisons)
+	{
+		const uint32 DispMapDimension = Comparison.Params.DispMapDimension;
+		const float RelativeError = Comparison.MaxError / FMath::Max(Comparison.MaxAbsDisplacement, SMALL_NUMBER);
+		const float ComparisonTolerance = Comparison.Params.bHalfPrecision ? HalfPrecisionTolerance : Tolerance;
+		AddInfo(FString::Printf(TEXT("%s: CPU/GPU%s%s ocean displacement %ux%u max error %f (relative %g), RMS error %f, max displacement %f"),
+			*Comparison.PathName, Comparison.Params.bPackedIFFT ? TEXT(" (packed IFFT)") : TEXT(""), Comparison.Params.bHalfPrecision ? TEXT(" (half precision)") : TEXT(""), DispMapDimension, DispMapDimension, Comparison.MaxError, RelativeError, Comparison.RMSError, Comparison.MaxAbsDisplacement));
+		TestTrue(FString::Printf(TEXT("%s relative error within %g"), *Comparison.PathName, ComparisonTolerance), RelativeError <= ComparisonTolerance);
+	}
+
+	return true;
 }
 
+#endif // WITH_DEV_AUTOMATION_TESTS
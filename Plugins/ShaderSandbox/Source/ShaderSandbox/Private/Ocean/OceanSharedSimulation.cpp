@@ -0,0 +1,429 @@
+#include "Ocean/OceanSharedSimulation.h"
+#include "RenderingThread.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Ocean Simulations"), STAT_OceanSimulations, STATGROUP_Ocean);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Ocean Simulation Outputs"), STAT_OceanSimulationOutputs, STATGROUP_Ocean);
+
+namespace
+{
+using namespace OceanSimulator;
+
+// FOceanSimulationKeyごとの共有シミュレーション。ゲームスレッドからのみアクセスする。
+// 最後の参照はシーンプロキシのデストラクタでレンダースレッドから外れることもあるのでTWeakPtrで持ち、Pin()できなくなったものはAcquire()で削除する。
+// キーは海のパラメータすべてなので、エディタでパラメータを変えるたびに新しいキーが増える
+TMap<FOceanSimulationKey, TWeakPtr<FOceanSharedSimulation, ESPMode::ThreadSafe>> GOceanSharedSimulations;
+
+void RemoveExpiredOceanSharedSimulations()
+{
+	for (TMap<FOceanSimulationKey, TWeakPtr<FOceanSharedSimulation, ESPMode::ThreadSafe>>::TIterator It(GOceanSharedSimulations); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+} // namespace
+
+namespace OceanSimulator
+{
+FOceanSimulationKey::FOceanSimulationKey(const FOceanSpectrumParameters& Params, float InGravityZ, float InTimeScale)
+	: FOceanSimulationKey(MakeArrayView(&Params, 1), InGravityZ, InTimeScale)
+{
+}
+
+FOceanSimulationKey::FOceanSimulationKey(TArrayView<const FOceanSpectrumParameters> CascadeParams, float InGravityZ, float InTimeScale)
+	: DispMapDimension(CascadeParams[0].DispMapDimension)
+	, AmplitudeScale(CascadeParams[0].AmplitudeScale)
+	, WindDirection(CascadeParams[0].WindDirection)
+	, WindSpeed(CascadeParams[0].WindSpeed)
+	, WindDependency(CascadeParams[0].WindDependency)
+	, Seed(CascadeParams[0].Seed)
+	, GravityZ(InGravityZ)
+	, TimeScale(InTimeScale)
+	, bHalfPrecision(CascadeParams[0].bHalfPrecision)
+{
+	for (const FOceanSpectrumParameters& Params : CascadeParams)
+	{
+		FOceanCascadeBand& Band = Cascades.AddDefaulted_GetRef();
+		Band.PatchLength = Params.PatchLength;
+		Band.MinWaveLength = Params.MinWaveLength;
+		Band.MaxWaveLength = Params.MaxWaveLength;
+		Band.ChoppyScale = Params.ChoppyScale;
+	}
+}
+
+bool FOceanSimulationKey::operator==(const FOceanSimulationKey& Other) const
+{
+	return DispMapDimension == Other.DispMapDimension
+		&& Cascades == Other.Cascades
+		&& AmplitudeScale == Other.AmplitudeScale
+		&& WindDirection == Other.WindDirection
+		&& WindSpeed == Other.WindSpeed
+		&& WindDependency == Other.WindDependency
+		&& Seed == Other.Seed
+		&& GravityZ == Other.GravityZ
+		&& TimeScale == Other.TimeScale
+		&& NumQuerySpectrumComponents == Other.NumQuerySpectrumComponents
+		&& bCPUBackend == Other.bCPUBackend
+		&& SimulationRate == Other.SimulationRate
+		&& bTimeSliced == Other.bTimeSliced
+		&& bHalfPrecision == Other.bHalfPrecision;
+}
+
+uint32 GetTypeHash(const FOceanSimulationKey& Key)
+{
+	uint32 Hash = ::GetTypeHash(Key.DispMapDimension);
+	for (const FOceanCascadeBand& Band : Key.Cascades)
+	{
+		Hash = HashCombine(Hash, ::GetTypeHash(Band.PatchLength));
+		Hash = HashCombine(Hash, ::GetTypeHash(Band.MinWaveLength));
+		Hash = HashCombine(Hash, ::GetTypeHash(Band.MaxWaveLength));
+		Hash = HashCombine(Hash, ::GetTypeHash(Band.ChoppyScale));
+	}
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.AmplitudeScale));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.WindDirection));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.WindSpeed));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.WindDependency));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.Seed));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.GravityZ));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.TimeScale));
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.NumQuerySpectrumComponents));
+	Hash = HashCombine(Hash, (uint32)Key.bCPUBackend);
+	Hash = HashCombine(Hash, ::GetTypeHash(Key.SimulationRate));
+	Hash = HashCombine(Hash, (uint32)Key.bTimeSliced);
+	return HashCombine(Hash, (uint32)Key.bHalfPrecision);
+}
+
+FOceanSharedSimulationPtr FOceanSharedSimulation::Acquire(const FOceanSimulationKey& Key)
+{
+	check(IsInGameThread());
+
+	RemoveExpiredOceanSharedSimulations();
+
+	FOceanSharedSimulationPtr Ret;
+	if (TWeakPtr<FOceanSharedSimulation, ESPMode::ThreadSafe>* Found = GOceanSharedSimulations.Find(Key))
+	{
+		Ret = Found->Pin();
+	}
+
+	if (!Ret.IsValid())
+	{
+		// 参照がすべて外れたらレンダースレッドでリソースを解放してから削除する。
+		// レンダースレッドから呼ばれた場合はENQUEUE_RENDER_COMMANDはその場で実行される
+		Ret = FOceanSharedSimulationPtr(new FOceanSharedSimulation(), [](FOceanSharedSimulation* Simulation)
+		{
+			ENQUEUE_RENDER_COMMAND(ReleaseOceanSharedSimulation)(
+				[Simulation](FRHICommandListImmediate& RHICmdList)
+				{
+					Simulation->ReleaseBuffers();
+					delete Simulation;
+				});
+		});
+		Ret->Key = Key;
+
+		GOceanSharedSimulations.Add(Key, Ret);
+	}
+
+	return Ret;
+}
+
+void FOceanSharedSimulation::SetInitialSpectrum(const TSharedPtr<FOceanInitialSpectrum, ESPMode::ThreadSafe>& InInitialSpectrum, const FGraphEventRef& InTask)
+{
+	check(IsInGameThread());
+	check(!InitialSpectrum.IsValid()); // 同じキーなら同じスペクトラムになるので差し替えることはない
+
+	InitialSpectrum = InInitialSpectrum;
+	InitialSpectrumTask = InTask;
+}
+
+void FOceanSharedSimulation::InitBuffers(uint32 DispMapDimension)
+{
+	// H0の生成は最初に取得したコンポーネントが非同期に開始している。最初のシミュレーションまでに終わっていなければここで待つ
+	if (InitialSpectrumTask.IsValid() && !InitialSpectrumTask->IsComplete())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(InitialSpectrumTask, ENamedThreads::GetRenderThread_Local());
+	}
+
+	// カスケードがあればH0、Omega0、Dx、Dy、Dzはカスケードの数だけ連続して並べる
+	const uint32 NumElements = DispMapDimension * DispMapDimension * Key.Cascades.Num();
+	check(InitialSpectrum.IsValid());
+	check((uint32)InitialSpectrum->H0Data.Num() == NumElements);
+	check((uint32)InitialSpectrum->Omega0Data.Num() == NumElements);
+
+	// レンダースレッドから呼ぶとInitialize()のレンダーコマンドはその場で実行される。
+	// half精度ではhalf2に詰めたH0をアップロードする。InitialSpectrumのH0DataはCPUのクエリでも使うのでfloatのまま残す
+	if (Key.bHalfPrecision)
+	{
+		TResourceArray<uint32> PackedH0Data;
+		PackOceanComplexToHalf(InitialSpectrum->H0Data, PackedH0Data);
+		H0Buffer.Initialize(PackedH0Data, GetOceanComplexStride(true));
+	}
+	else
+	{
+		H0Buffer.Initialize(InitialSpectrum->H0Data, sizeof(FComplex));
+	}
+	Omega0Buffer.Initialize(InitialSpectrum->Omega0Data, sizeof(float));
+
+	// Dx、Dy、Dzは読まれる前に必ずIFFTかCPUの結果のアップロードで書き込まれるので初期データは与えない
+	DxBuffer.Initialize(sizeof(float), NumElements);
+	DyBuffer.Initialize(sizeof(float), NumElements);
+	DzBuffer.Initialize(sizeof(float), NumElements);
+
+	bBuffersInitialized = true;
+}
+
+void FOceanSharedSimulation::ReleaseBuffers()
+{
+	check(IsInRenderingThread());
+
+	H0Buffer.ReleaseResource();
+	Omega0Buffer.ReleaseResource();
+	DxBuffer.ReleaseResource();
+	DyBuffer.ReleaseResource();
+	DzBuffer.ReleaseResource();
+	TimeSlicedState.Reset();
+}
+
+SIZE_T FOceanSharedSimulation::GetAllocatedSize() const
+{
+	SIZE_T Ret = WrittenOutputTextures.GetAllocatedSize() + FixedRateOutputs.GetAllocatedSize();
+	if (InitialSpectrum.IsValid())
+	{
+		Ret += sizeof(FOceanInitialSpectrum) + InitialSpectrum->H0Data.GetAllocatedSize() + InitialSpectrum->Omega0Data.GetAllocatedSize()
+			+ InitialSpectrum->SpectrumComponents.GetAllocatedSize();
+		for (const FOceanSpectrumComponents& Components : InitialSpectrum->SpectrumComponents)
+		{
+			Ret += Components.GetAllocatedSize();
+		}
+	}
+	return Ret;
+}
+
+void FOceanSharedSimulation::Simulate(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, const FOceanCPUDisplacement* CPUDisplacement, bool bForceUpdate)
+{
+	SimulateInternal(RHICmdList, MakeArrayView(&Params, 1), false, OutputViews, DisplacementMapTexture, GradientFoldingMapTexture, CPUDisplacement, bForceUpdate);
+}
+
+void FOceanSharedSimulation::Simulate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, bool bForceUpdate)
+{
+	SimulateInternal(RHICmdList, CascadeParams, true, OutputViews, DisplacementMapTexture, GradientFoldingMapTexture, nullptr, bForceUpdate);
+}
+
+void FOceanSharedSimulation::SimulateInternal(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, const FOceanCPUDisplacement* CPUDisplacement, bool bForceUpdate)
+{
+	check(IsInRenderingThread());
+	check(CascadeParams.Num() == Key.Cascades.Num());
+	check(bCascades || CascadeParams.Num() == 1);
+
+	const FOceanSpectrumParameters& Params = CascadeParams[0];
+	check(Params.DispMapDimension == Key.DispMapDimension);
+
+	if (!bBuffersInitialized)
+	{
+		InitBuffers(Params.DispMapDimension);
+	}
+
+	// 同じフレームの2回目以降の呼び出しでは、スペクトラムの更新とIFFTの結果のDx、Dy、Dzを使いまわす。
+	// 同じレンダーターゲットを参照するコンポーネントのためにはディスプレースメントマップの生成も行わない
+	const TPair<FRHITexture*, FRHITexture*> OutputTextures(DisplacementMapTexture, GradientFoldingMapTexture);
+	const bool bFirstInFrame = (LastSimulatedFrameNumber != GFrameNumberRenderThread);
+	if (bFirstInFrame)
+	{
+		LastSimulatedFrameNumber = GFrameNumberRenderThread;
+		WrittenOutputTextures.Reset();
+	}
+	else if (!bForceUpdate && WrittenOutputTextures.Contains(OutputTextures))
+	{
+		return;
+	}
+
+	const bool bUpdateSpectrum = bFirstInFrame || bForceUpdate;
+	bool bDisplacementReady = !bUpdateSpectrum;
+
+	// CPUバックエンドのときは計算済みのDx、Dy、DzをアップロードしてGPU側はディスプレースメントマップの生成以降だけを行う
+	if (bUpdateSpectrum && CPUDisplacement != nullptr && CPUDisplacement->DispMapDimension == Params.DispMapDimension)
+	{
+		const uint32 NumBytes = Params.DispMapDimension * Params.DispMapDimension * sizeof(float);
+		DxBuffer.Update(CPUDisplacement->Dx.GetData(), NumBytes);
+		DyBuffer.Update(CPUDisplacement->Dy.GetData(), NumBytes);
+		DzBuffer.Update(CPUDisplacement->Dz.GetData(), NumBytes);
+		bDisplacementReady = true;
+	}
+
+	// GPUのIFFTに対応しないサイズはコンポーネントの登録時にエラーを出しているので、ここではシミュレーションしない
+	if (!bDisplacementReady && !IsSupportedDispMapDimension(Params.DispMapDimension))
+	{
+		return;
+	}
+
+	const FOceanBufferViews& Views = GetSimulationViews(OutputViews);
+
+	if (bCascades)
+	{
+		SimulateOceanCascades(RHICmdList, CascadeParams, Views, bDisplacementReady);
+	}
+	else
+	{
+		SimulateOcean(RHICmdList, Params, Views, bDisplacementReady);
+	}
+
+	if (bUpdateSpectrum)
+	{
+		INC_DWORD_STAT(STAT_OceanSimulations);
+	}
+	INC_DWORD_STAT(STAT_OceanSimulationOutputs);
+	WrittenOutputTextures.AddUnique(OutputTextures);
+}
+
+FOceanBufferViews FOceanSharedSimulation::GetSimulationViews(const FOceanBufferViews& OutputViews) const
+{
+	FOceanBufferViews Views = OutputViews;
+	Views.H0SRV = H0Buffer.GetSRV();
+	Views.OmegaSRV = Omega0Buffer.GetSRV();
+	Views.DxSRV = DxBuffer.GetSRV();
+	Views.DxUAV = DxBuffer.GetUAV();
+	Views.DySRV = DyBuffer.GetSRV();
+	Views.DyUAV = DyBuffer.GetUAV();
+	Views.DzSRV = DzBuffer.GetSRV();
+	Views.DzUAV = DzBuffer.GetUAV();
+	return Views;
+}
+
+void FOceanSharedSimulation::AdvanceFixedRate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, int64 StepIndex, const FOceanBufferViews& Views)
+{
+	const auto Run = [&](EOceanSimulationPasses Passes)
+	{
+		if (bCascades)
+		{
+			SimulateOceanCascades(RHICmdList, CascadeParams, Views, false, Passes, &TimeSlicedState);
+		}
+		else
+		{
+			SimulateOcean(RHICmdList, CascadeParams[0], Views, false, Passes, &TimeSlicedState);
+		}
+	};
+
+	// 前のフレームで行方向のIFFTまで済ませたステップがあれば、その続きだけを行う
+	if (TimeSlicedState.IsPending())
+	{
+		Run(EOceanSimulationPasses::VerticalIFFT);
+		SimulatedStepIndex = PendingStepIndex;
+		PendingStepIndex = INDEX_NONE;
+		INC_DWORD_STAT(STAT_OceanSimulations);
+		return;
+	}
+
+	if (StepIndex == SimulatedStepIndex)
+	{
+		return;
+	}
+
+	// 最初のステップは表示するものがないので分割しない
+	if (Key.bTimeSliced && SimulatedStepIndex != INDEX_NONE)
+	{
+		Run(EOceanSimulationPasses::SpectrumAndHorizontalIFFT);
+		PendingStepIndex = StepIndex;
+		return;
+	}
+
+	Run(EOceanSimulationPasses::SpectrumAndIFFT);
+	SimulatedStepIndex = StepIndex;
+	INC_DWORD_STAT(STAT_OceanSimulations);
+}
+
+int64 FOceanSharedSimulation::SimulateFixedRate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, int64 StepIndex, const void* Owner, const FOceanBufferViews (&OutputViews)[2], FRHITexture* DisplacementMapTexture, int32& OutNewestOutput)
+{
+	check(IsInRenderingThread());
+	check(Key.SimulationRate > 0.0f && !Key.bCPUBackend);
+	check(CascadeParams.Num() == Key.Cascades.Num());
+	check(bCascades || CascadeParams.Num() == 1);
+
+	const FOceanSpectrumParameters& Params = CascadeParams[0];
+	check(Params.DispMapDimension == Key.DispMapDimension);
+
+	if (!bBuffersInitialized)
+	{
+		InitBuffers(Params.DispMapDimension);
+	}
+
+	if (!IsSupportedDispMapDimension(Params.DispMapDimension))
+	{
+		return INDEX_NONE;
+	}
+
+	// ステップを進めるのはフレームの最初の呼び出しだけ。時刻は最初に呼んだコンポーネントのものになる
+	if (LastSimulatedFrameNumber != GFrameNumberRenderThread)
+	{
+		LastSimulatedFrameNumber = GFrameNumberRenderThread;
+		AdvanceFixedRate(RHICmdList, CascadeParams, bCascades, StepIndex, GetSimulationViews(OutputViews[0]));
+	}
+
+	if (SimulatedStepIndex == INDEX_NONE)
+	{
+		return INDEX_NONE;
+	}
+
+	// レンダーターゲットが作り直されていたら前のステップはないものとして扱う
+	FFixedRateOutput& Output = FixedRateOutputs.FindOrAdd(Owner);
+	if (Output.DisplacementMapTexture != DisplacementMapTexture)
+	{
+		Output = FFixedRateOutput();
+		Output.DisplacementMapTexture = DisplacementMapTexture;
+	}
+
+	if (Output.StepIndices[0] != SimulatedStepIndex && Output.StepIndices[1] != SimulatedStepIndex)
+	{
+		// 同じレンダーターゲットに書く他の呼び出し元がこのステップを書き込み済みなら、それを使う
+		bool bWritten = false;
+		for (const TPair<const void*, FFixedRateOutput>& Other : FixedRateOutputs)
+		{
+			if (Other.Key != Owner && Other.Value.DisplacementMapTexture == DisplacementMapTexture
+				&& (Other.Value.StepIndices[0] == SimulatedStepIndex || Other.Value.StepIndices[1] == SimulatedStepIndex))
+			{
+				Output = Other.Value;
+				bWritten = true;
+				break;
+			}
+		}
+
+		if (!bWritten)
+		{
+			// 古いステップを持つ方の組に書き込み、もう一方は前のステップとしてそのまま残す。
+			// 初めて書き込むときは前のステップがないので両方に書き込む
+			const bool bFirstWrite = (Output.StepIndices[0] == INDEX_NONE && Output.StepIndices[1] == INDEX_NONE);
+			const int32 Target = (Output.StepIndices[0] <= Output.StepIndices[1]) ? 0 : 1;
+			for (int32 Index = 0; Index < 2; Index++)
+			{
+				if (Index != Target && !bFirstWrite)
+				{
+					continue;
+				}
+
+				const FOceanBufferViews& Views = GetSimulationViews(OutputViews[Index]);
+				if (bCascades)
+				{
+					SimulateOceanCascades(RHICmdList, CascadeParams, Views, true);
+				}
+				else
+				{
+					SimulateOcean(RHICmdList, Params, Views, true);
+				}
+
+				Output.StepIndices[Index] = SimulatedStepIndex;
+			}
+
+			INC_DWORD_STAT(STAT_OceanSimulationOutputs);
+		}
+	}
+
+	OutNewestOutput = (Output.StepIndices[1] > Output.StepIndices[0]) ? 1 : 0;
+	return SimulatedStepIndex;
+}
+
+void FOceanSharedSimulation::ReleaseFixedRateOutput(const void* Owner)
+{
+	check(IsInRenderingThread());
+	FixedRateOutputs.Remove(Owner);
+}
+} // namespace OceanSimulator
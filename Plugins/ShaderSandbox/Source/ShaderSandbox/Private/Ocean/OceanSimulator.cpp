@@ -1,88 +1,380 @@
 #include "Ocean/OceanSimulator.h"
+#include "FFT/FFTLength.h"
+#include "Ocean/ResourceArrayStructuredBuffer.h"
 #include "Containers/DynamicRHIResourceArray.h"
 #include "GlobalShader.h"
 #include "RHIResources.h"
 #include "RenderGraphBuilder.h"
 #include "RenderGraphUtils.h"
+#include "RenderingThread.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "Math/Float16.h"
+#include "Misc/App.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
 
 namespace OceanSimulator
 {
+namespace
+{
 /**
- * 0AW΍1̃KEVAzŃ_l𐶐B
+ * カウンタベースの乱数Philox4x32-10。同じSeedとCounterからは常に同じ値が得られるので、
+ * 生成順序やスレッド数によらずテクセルごとに独立に乱数を得られる。
  */
-float GaussianRand()
+void Philox4x32(uint32 Seed, uint32 Counter0, uint32 Counter1, uint32 OutRand[4])
+{
+	const uint32 M0 = 0xD2511F53;
+	const uint32 M1 = 0xCD9E8D57;
+	const uint32 W0 = 0x9E3779B9;
+	const uint32 W1 = 0xBB67AE85;
+
+	uint32 C0 = Counter0;
+	uint32 C1 = Counter1;
+	uint32 C2 = 0;
+	uint32 C3 = 0;
+	uint32 K0 = Seed;
+	uint32 K1 = 0;
+
+	for (int32 Round = 0; Round < 10; Round++)
+	{
+		const uint64 Product0 = (uint64)M0 * C0;
+		const uint64 Product1 = (uint64)M1 * C2;
+		const uint32 NewC0 = (uint32)(Product1 >> 32) ^ C1 ^ K0;
+		const uint32 NewC2 = (uint32)(Product0 >> 32) ^ C3 ^ K1;
+		C1 = (uint32)Product1;
+		C3 = (uint32)Product0;
+		C0 = NewC0;
+		C2 = NewC2;
+		K0 += W0;
+		K1 += W1;
+	}
+
+	OutRand[0] = C0;
+	OutRand[1] = C1;
+	OutRand[2] = C2;
+	OutRand[3] = C3;
+}
+
+/** 上位24bitを使って(0, 1]の一様乱数にする。Box-Mullerでlog(0)にならないように0は含めない。 */
+float UintToUniformFloat(uint32 Rand)
 {
-	float U1 = FMath::FRand();
-	float U2 = FMath::FRand();
+	return ((Rand >> 8) + 1) * (1.0f / 16777216.0f);
+}
 
-	if (U1 < SMALL_NUMBER)
+/** 波長2 * PI / |K|がParamsのMinWaveLength以上MaxWaveLength未満か。0の制限は無効 */
+bool IsInWaveLengthBand(const FVector2D& K, const FOceanSpectrumParameters& Params)
+{
+	if (Params.MinWaveLength <= 0.0f && Params.MaxWaveLength <= 0.0f)
 	{
-		U1 = SMALL_NUMBER;
+		return true;
 	}
 
-	// TODO:vZ̗𒲂ׂ
-	return FMath::Sqrt(-2.0f * FMath::Loge(U1)) * FMath::Cos(2.0f * PI * U2);
+	const float WaveLength = 2 * PI / K.Size();
+	return (Params.MinWaveLength <= 0.0f || WaveLength >= Params.MinWaveLength)
+		&& (Params.MaxWaveLength <= 0.0f || WaveLength < Params.MaxWaveLength);
+}
+
+/**
+ * H0とOmega0の1行分を計算する。
+ * Box-Muller法のcos、sinの2つの出力をH0の実部、虚部の平均0、標準偏差1のガウシアン分布の乱数として使う。sincosは4テクセルずつSIMDで行う。
+ * 各テクセルの値はSeedと(i, j)だけで決まるので、どの行をどのスレッドで計算しても結果はビット単位で一致する。
+ */
+void CreateInitialHeightMapRow(const FOceanSpectrumParameters& Params, float GravityConstant, uint32 i, FComplex* OutH0Row, float* OutOmega0Row)
+{
+	const uint32 Dimension = Params.DispMapDimension;
+
+	// Kは正規化された波数ベクトル
+	FVector2D K;
+	K.Y = (-(int32)Dimension / 2.0f + i) * (2 * PI / Params.PatchLength);
+
+	MS_ALIGN(16) float Radius[4] GCC_ALIGN(16);
+	MS_ALIGN(16) float Angle[4] GCC_ALIGN(16);
+	MS_ALIGN(16) float GaussX[4] GCC_ALIGN(16);
+	MS_ALIGN(16) float GaussY[4] GCC_ALIGN(16);
+
+	for (uint32 j = 0; j < Dimension; j += 4)
+	{
+		// DispMapDimensionは2の累乗なので4未満のときだけ端数が出る
+		const uint32 NumLanes = FMath::Min(4u, Dimension - j);
+
+		for (uint32 Lane = 0; Lane < 4; Lane++)
+		{
+			uint32 Rand[4] = {0, 0, 0, 0};
+			if (Lane < NumLanes)
+			{
+				Philox4x32(Params.Seed, i, j + Lane, Rand);
+			}
+
+			// logは各レーンで行う。UE4のVectorRegisterにはlogのSIMD実装がない
+			Radius[Lane] = FMath::Sqrt(-2.0f * FMath::Loge(UintToUniformFloat(Rand[0])));
+			Angle[Lane] = 2.0f * PI * UintToUniformFloat(Rand[1]);
+		}
+
+		const VectorRegister AngleV = VectorLoadAligned(Angle);
+		const VectorRegister RadiusV = VectorLoadAligned(Radius);
+		VectorRegister Sin, Cos;
+		VectorSinCos(&Sin, &Cos, &AngleV);
+		VectorStoreAligned(VectorMultiply(RadiusV, Cos), GaussX);
+		VectorStoreAligned(VectorMultiply(RadiusV, Sin), GaussY);
+
+		for (uint32 Lane = 0; Lane < NumLanes; Lane++)
+		{
+			K.X = (-(int32)Dimension / 2.0f + j + Lane) * (2 * PI / Params.PatchLength);
+
+			float PhillipsCoef = CalculatePhillipsCoefficient(K, GravityConstant, Params);
+			float PhillipsSqrt = (K.X == 0 || K.Y == 0 || !IsInWaveLengthBand(K, Params)) ? 0.0f : FMath::Sqrt(PhillipsCoef);
+			OutH0Row[j + Lane].X = PhillipsSqrt * GaussX[Lane] * UE_HALF_SQRT_2;
+			OutH0Row[j + Lane].Y = PhillipsSqrt * GaussY[Lane] * UE_HALF_SQRT_2;
+
+			// 周波数分布についてはdispersion relation、omega_0^2 = g * kを用いる
+			OutOmega0Row[j + Lane] = FMath::Sqrt(GravityConstant * K.Size());
+		}
+	}
 }
+} // namespace
 
 /**
- * PhillipsXyNgzgɑ΂l擾B
- * K: KꂽgxNg
+ * Phillipsスペクトラム分布から波数に対する値を取得する。
+ * K: 正規化された波数ベクトル
  */
 float CalculatePhillipsCoefficient(const FVector2D& K, float Gravity, const FOceanSpectrumParameters& Params)
 {
-	float Amplitude = Params.AmplitudeScale * 1.0e-7f; // ̌hɂ邽߂̒l
+	float Amplitude = Params.AmplitudeScale * 1.0e-7f; // いい感じの見栄えにするための調整値
 
-	// ̕ɂčő̔g̔gB
+	// この風速において最大の波長の波。
 	float MaxLength = Params.WindSpeed * Params.WindSpeed / Gravity;
 
 	float KSqr = K.X * K.X + K.Y * K.Y;
 	float KCos = K.X * Params.WindDirection.X + K.Y * Params.WindDirection.Y;
 	float Phillips = Amplitude * FMath::Exp(-1.0f / (MaxLength * MaxLength * KSqr)) / (KSqr * KSqr * KSqr) * (KCos * KCos);
 
-	// t̔g͎キ
+	// 逆方向の波は弱くする
 	if (KCos < 0)
 	{
 		Phillips *= (1.0f - Params.WindDependency);
 	}
 
-	// őgƏg͍팸BƂ肠p[^1/1000JbgItl
+	// 最大波長よりもずっと小さい波は削減する。とりあえずパラメータ化せずに1/1000をカットオフ値に
 	float CutLength = MaxLength / 1000;
 	return Phillips * FMath::Exp(-KSqr * CutLength * CutLength);
 }
 
+DECLARE_CYCLE_STAT(TEXT("Create Initial Height Map"), STAT_CreateInitialHeightMap, STATGROUP_Ocean);
+
 void CreateInitialHeightMap(const FOceanSpectrumParameters& Params, float GravityZ, TResourceArray<FComplex>& OutH0, TResourceArray<float>& OutOmega0)
 {
-	// CSŎĂAɂȂȂ̂ŃfobO₷̂߂CPUɂĂ
-	FVector2D K;
+	SCOPE_CYCLE_COUNTER(STAT_CreateInitialHeightMap);
+
+	// CSで実装してもいいが、初期化時にしか走らない処理なのでデバッグしやすさのためにCPU実装にしておく
+	// 乱数はカウンタベースなので行ごとに並列に計算しても結果はスレッド数によらず同じになる
+	check((uint32)OutH0.Num() == Params.DispMapDimension * Params.DispMapDimension);
+	check((uint32)OutOmega0.Num() == Params.DispMapDimension * Params.DispMapDimension);
+
 	float GravityConstant = FMath::Abs(GravityZ);
+	FComplex* H0 = OutH0.GetData();
+	float* Omega0 = OutOmega0.GetData();
+
+	ParallelFor(Params.DispMapDimension, [&Params, GravityConstant, H0, Omega0](int32 i)
+	{
+		CreateInitialHeightMapRow(Params, GravityConstant, i, &H0[i * Params.DispMapDimension], &Omega0[i * Params.DispMapDimension]);
+	});
+}
+
+namespace
+{
+// 生成アルゴリズムやファイルのレイアウトを変えたら上げる
+const uint32 InitialHeightMapCacheVersion = 1;
+const uint32 InitialHeightMapCacheMagic = 0x4F434E48; // 'OCNH'
+
+TAutoConsoleVariable<int32> CVarInitialHeightMapCache(
+	TEXT("ShaderSandbox.Ocean.InitialHeightMapCache"),
+	1,
+	TEXT("Caches H0 and Omega0 of the ocean under Saved/OceanSpectrumCache.\n")
+	TEXT(" 0: Always generate\n")
+	TEXT(" 1: Load from the cache if exists (default)"));
+
+TAutoConsoleVariable<int32> CVarInitialHeightMapCacheMaxMB(
+	TEXT("ShaderSandbox.Ocean.InitialHeightMapCacheMaxMB"),
+	256,
+	TEXT("Max total size in MB of Saved/OceanSpectrumCache. When a new file exceeds it, the least recently used files are deleted.\n")
+	TEXT(" 0: Unlimited"));
+
+/** H0とOmega0に影響するパラメータだけのハッシュをファイル名にする。ChoppyScaleや時刻はH0に影響しないのでキーに含めない。 */
+FString GetInitialHeightMapCachePath(const FOceanSpectrumParameters& Params, float GravityConstant)
+{
+	FSHA1 Hash;
+	Hash.Update((const uint8*)&InitialHeightMapCacheVersion, sizeof(InitialHeightMapCacheVersion));
+	Hash.Update((const uint8*)&Params.DispMapDimension, sizeof(Params.DispMapDimension));
+	Hash.Update((const uint8*)&Params.PatchLength, sizeof(Params.PatchLength));
+	Hash.Update((const uint8*)&Params.AmplitudeScale, sizeof(Params.AmplitudeScale));
+	Hash.Update((const uint8*)&Params.WindDirection.X, sizeof(Params.WindDirection.X));
+	Hash.Update((const uint8*)&Params.WindDirection.Y, sizeof(Params.WindDirection.Y));
+	Hash.Update((const uint8*)&Params.WindSpeed, sizeof(Params.WindSpeed));
+	Hash.Update((const uint8*)&Params.WindDependency, sizeof(Params.WindDependency));
+	Hash.Update((const uint8*)&GravityConstant, sizeof(GravityConstant));
+	Hash.Update((const uint8*)&Params.Seed, sizeof(Params.Seed));
+	Hash.Update((const uint8*)&Params.MinWaveLength, sizeof(Params.MinWaveLength));
+	Hash.Update((const uint8*)&Params.MaxWaveLength, sizeof(Params.MaxWaveLength));
+	Hash.Final();
+
+	uint8 Digest[FSHA1::DigestSize];
+	Hash.GetHash(Digest);
+	return FPaths::ProjectSavedDir() / TEXT("OceanSpectrumCache") / BytesToHex(Digest, FSHA1::DigestSize) + TEXT(".bin");
+}
+
+bool LoadInitialHeightMapCache(const FString& Path, uint32 DispMapDimension, TResourceArray<FComplex>& OutH0, TResourceArray<float>& OutOmega0)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Path, FILEREAD_Silent));
+	if (!Reader.IsValid())
+	{
+		return false;
+	}
 
-	FMath::RandInit(FPlatformTime::Cycles());
+	const int64 H0Bytes = OutH0.GetResourceDataSize();
+	const int64 Omega0Bytes = OutOmega0.GetResourceDataSize();
+	uint32 Header[3];
+	if (Reader->TotalSize() != sizeof(Header) + H0Bytes + Omega0Bytes)
+	{
+		return false;
+	}
 
-	for (uint32 i = 0; i < Params.DispMapDimension; i++)
+	Reader->Serialize(Header, sizeof(Header));
+	if (Header[0] != InitialHeightMapCacheMagic || Header[1] != InitialHeightMapCacheVersion || Header[2] != DispMapDimension)
 	{
-		// K͐KꂽgxNg
-		K.Y = (-(int32)Params.DispMapDimension / 2.0f + i) * (2 * PI / Params.PatchLength);
+		return false;
+	}
 
-		for (uint32 j = 0; j < Params.DispMapDimension; j++)
+	// 中間バッファを経由せずにTResourceArrayに直接読み込む。RHIのバッファはここから直接作られる
+	Reader->Serialize(OutH0.GetData(), H0Bytes);
+	Reader->Serialize(OutOmega0.GetData(), Omega0Bytes);
+	return !Reader->IsError();
+}
+
+void SaveInitialHeightMapCache(const FString& Path, uint32 DispMapDimension, const TResourceArray<FComplex>& H0, const TResourceArray<float>& Omega0)
+{
+	// 同じキーのファイルを別のコンポーネントが同時に読み書きしても書きかけのファイルが見えないように、一時ファイルに書いてから移動する
+	const FString TempPath = FPaths::GetPath(Path) / FGuid::NewGuid().ToString() + TEXT(".tmp");
+
+	bool bWritten = false;
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath, FILEWRITE_Silent));
+		if (!Writer.IsValid())
 		{
-			K.X = (-(int32)Params.DispMapDimension / 2.0f + j) * (2 * PI / Params.PatchLength);
+			return;
+		}
 
-			float PhillipsCoef = CalculatePhillipsCoefficient(K, GravityConstant, Params);
-			float PhillipsSqrt = (K.X == 0 || K.Y == 0) ? 0.0f : FMath::Sqrt(PhillipsCoef);
-			OutH0[i * (Params.DispMapDimension) + j].X = PhillipsSqrt * GaussianRand() * UE_HALF_SQRT_2;
-			OutH0[i * (Params.DispMapDimension) + j].Y = PhillipsSqrt * GaussianRand() * UE_HALF_SQRT_2;
+		uint32 Header[3] = {InitialHeightMapCacheMagic, InitialHeightMapCacheVersion, DispMapDimension};
+		Writer->Serialize(Header, sizeof(Header));
+		Writer->Serialize(const_cast<FComplex*>(H0.GetData()), H0.GetResourceDataSize());
+		Writer->Serialize(const_cast<float*>(Omega0.GetData()), Omega0.GetResourceDataSize());
+		bWritten = Writer->Close();
+	}
+
+	if (!bWritten || !IFileManager::Get().Move(*Path, *TempPath, true, false, false, true))
+	{
+		IFileManager::Get().Delete(*TempPath, false, false, true);
+	}
+}
+
+/** 合計サイズが上限を超えていたら、最後に使われたのが古いファイルから消す。読み込むたびに更新日時を更新しているので更新日時の順がLRUになる */
+void TrimInitialHeightMapCache(const FString& KeepPath)
+{
+	const int64 MaxBytes = (int64)CVarInitialHeightMapCacheMaxMB.GetValueOnAnyThread() * 1024 * 1024;
+	if (MaxBytes <= 0)
+	{
+		return;
+	}
 
-			// gzɂĂdispersion relationAomega_0^2 = g * kp
-			OutOmega0[i * (Params.DispMapDimension) + j] = FMath::Sqrt(GravityConstant * K.Size());
+	struct FCacheFile
+	{
+		FString Path;
+		FDateTime ModificationTime;
+		int64 Size;
+	};
+	TArray<FCacheFile> Files;
+	int64 TotalBytes = 0;
+
+	// 一時ファイルは書き込み中のものなので対象にしない
+	IFileManager::Get().IterateDirectoryStat(*FPaths::GetPath(KeepPath), [&Files, &TotalBytes](const TCHAR* Path, const FFileStatData& StatData)
+	{
+		if (!StatData.bIsDirectory && FPaths::GetExtension(Path) == TEXT("bin"))
+		{
+			Files.Add({Path, StatData.ModificationTime, StatData.FileSize});
+			TotalBytes += StatData.FileSize;
+		}
+		return true;
+	});
+
+	if (TotalBytes <= MaxBytes)
+	{
+		return;
+	}
+
+	Files.Sort([](const FCacheFile& A, const FCacheFile& B) { return A.ModificationTime < B.ModificationTime; });
+	for (const FCacheFile& File : Files)
+	{
+		if (TotalBytes <= MaxBytes)
+		{
+			break;
+		}
+
+		// 他のスレッドが読んでいて消せなかったものは次の機会に消す
+		if (!FPaths::IsSamePath(File.Path, KeepPath) && IFileManager::Get().Delete(*File.Path, false, false, true))
+		{
+			TotalBytes -= File.Size;
+			UE_LOG(LogTemp, Verbose, TEXT("Ocean initial height map cache evicted %s (%lld bytes)"), *File.Path, File.Size);
+		}
+	}
+}
+} // namespace
+
+bool LoadOrCreateInitialHeightMap(const FOceanSpectrumParameters& Params, float GravityZ, TResourceArray<FComplex>& OutH0, TResourceArray<float>& OutOmega0)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const bool bUseCache = (CVarInitialHeightMapCache.GetValueOnAnyThread() != 0);
+	const FString& CachePath = GetInitialHeightMapCachePath(Params, FMath::Abs(GravityZ));
+
+	const bool bLoaded = bUseCache && LoadInitialHeightMapCache(CachePath, Params.DispMapDimension, OutH0, OutOmega0);
+	if (bLoaded)
+	{
+		// LRUで消す順番のために使った時刻を残す
+		IFileManager::Get().SetTimeStamp(*CachePath, FDateTime::UtcNow());
+	}
+	else
+	{
+		CreateInitialHeightMap(Params, GravityZ, OutH0, OutOmega0);
+
+		if (bUseCache)
+		{
+			SaveInitialHeightMapCache(CachePath, Params.DispMapDimension, OutH0, OutOmega0);
+			TrimInitialHeightMapCache(CachePath);
 		}
 	}
+
+	if (bUseCache)
+	{
+		UE_LOG(LogTemp, Verbose, TEXT("Ocean initial height map cache %s: %s"), bLoaded ? TEXT("hit") : TEXT("miss"), *CachePath);
+	}
+	UE_LOG(LogTemp, Log, TEXT("Ocean initial height map %ux%u %s in %.2f ms"), Params.DispMapDimension, Params.DispMapDimension, bLoaded ? TEXT("loaded from cache") : TEXT("generated"), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	return bLoaded;
 }
 
+/** FOceanSpectrumParameters::bHalfPrecision。スペクトラムとFFTのワークバッファを読み書きするシェーダが持つ */
+class FOceanHalfPrecisionDim : SHADER_PERMUTATION_BOOL("OCEAN_HALF_PRECISION");
+typedef TShaderPermutationDomain<FOceanHalfPrecisionDim> FOceanSpectrumPermutationDomain;
+typedef TShaderPermutationDomain<FFT::FFFTLengthDim, FOceanHalfPrecisionDim> FOceanIFFTPermutationDomain;
+
 class FOceanDebugH0CS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanDebugH0CS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDebugH0CS, FGlobalShader);
 
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, MapSize)
 		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, H0Buffer)
@@ -103,9 +395,11 @@ class FOceanDebugHtCS : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FOceanDebugHtCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDebugHtCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, MapSize)
-		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, HtBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FComplex>, HtBuffer)
 		SHADER_PARAMETER_UAV(RWTexture2D<float4>, HtDebugTexture)
 	END_SHADER_PARAMETER_STRUCT()
 
@@ -123,9 +417,11 @@ class FOceanDebugDkxCS : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FOceanDebugDkxCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDebugDkxCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, MapSize)
-		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, DkxBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FComplex>, DkxBuffer)
 		SHADER_PARAMETER_UAV(RWTexture2D<float4>, DkxDebugTexture)
 	END_SHADER_PARAMETER_STRUCT()
 
@@ -143,9 +439,11 @@ class FOceanDebugDkyCS : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FOceanDebugDkyCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDebugDkyCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, MapSize)
-		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, DkyBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FComplex>, DkyBuffer)
 		SHADER_PARAMETER_UAV(RWTexture2D<float4>, DkyDebugTexture)
 	END_SHADER_PARAMETER_STRUCT()
 
@@ -184,14 +482,16 @@ class FOceanUpdateSpectrumCS : public FGlobalShader
 	DECLARE_GLOBAL_SHADER(FOceanUpdateSpectrumCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanUpdateSpectrumCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(uint32, MapSize)
 		SHADER_PARAMETER(float, Time)
 		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, H0Buffer)
 		SHADER_PARAMETER_SRV(StructuredBuffer<float>, OmegaBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, OutHtBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, OutDkxBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, OutDkyBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, OutHtBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, OutDkxBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, OutDkyBuffer)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -203,14 +503,41 @@ public:
 
 IMPLEMENT_GLOBAL_SHADER(FOceanUpdateSpectrumCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "UpdateSpectrumCS", SF_Compute);
 
+class FOceanUpdateHalfSpectrumCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FOceanUpdateHalfSpectrumCS);
+	SHADER_USE_PARAMETER_STRUCT(FOceanUpdateHalfSpectrumCS, FGlobalShader);
+
+	using FPermutationDomain = FOceanSpectrumPermutationDomain;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, MapSize)
+		SHADER_PARAMETER(float, Time)
+		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, H0Buffer)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float>, OmegaBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, OutHalfSpectrumBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FOceanUpdateHalfSpectrumCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "UpdateHalfSpectrumCS", SF_Compute);
+
 class FOceanHorizontalIFFTCS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanHorizontalIFFTCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanHorizontalIFFTCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanIFFTPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER_SRV(StructuredBuffer<FComplex>, InDkBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FComplex>, InDkBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER(uint32, CascadeStride)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -220,17 +547,19 @@ public:
 	}
 };
 
-IMPLEMENT_GLOBAL_SHADER(FOceanHorizontalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "HorizontalIFFT512x512CS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FOceanHorizontalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "HorizontalIFFTCS", SF_Compute);
 
 class FOceanDkxVerticalIFFTCS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanDkxVerticalIFFTCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDkxVerticalIFFTCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanIFFTPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDxBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
-		SHADER_PARAMETER(float, ChoppyScale)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER(FVector4, CascadeChoppyScales)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -240,17 +569,19 @@ public:
 	}
 };
 
-IMPLEMENT_GLOBAL_SHADER(FOceanDkxVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkxVerticalIFFT512x512CS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FOceanDkxVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkxVerticalIFFTCS", SF_Compute);
 
 class FOceanDkyVerticalIFFTCS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanDkyVerticalIFFTCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDkyVerticalIFFTCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanIFFTPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDyBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
-		SHADER_PARAMETER(float, ChoppyScale)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER(FVector4, CascadeChoppyScales)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -260,16 +591,42 @@ public:
 	}
 };
 
-IMPLEMENT_GLOBAL_SHADER(FOceanDkyVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkyVerticalIFFT512x512CS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FOceanDkyVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkyVerticalIFFTCS", SF_Compute);
 
 class FOceanDkzVerticalIFFTCS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanDkzVerticalIFFTCS);
 	SHADER_USE_PARAMETER_STRUCT(FOceanDkzVerticalIFFTCS, FGlobalShader);
 
+	using FPermutationDomain = FOceanIFFTPermutationDomain;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDzBuffer)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FOceanDkzVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkzVerticalIFFTCS", SF_Compute);
+
+class FOceanPackedVerticalIFFTCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FOceanPackedVerticalIFFTCS);
+	SHADER_USE_PARAMETER_STRUCT(FOceanPackedVerticalIFFTCS, FGlobalShader);
+
+	using FPermutationDomain = FOceanIFFTPermutationDomain;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDxBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDyBuffer)
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, OutDzBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FComplex>, FFTWorkBufferUAV)
+		SHADER_PARAMETER(FVector4, CascadeChoppyScales)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -279,7 +636,7 @@ public:
 	}
 };
 
-IMPLEMENT_GLOBAL_SHADER(FOceanDkzVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "DkzVerticalIFFT512x512CS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FOceanPackedVerticalIFFTCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "PackedVerticalIFFTCS", SF_Compute);
 
 class FOceanUpdateDisplacementMapCS : public FGlobalShader
 {
@@ -291,7 +648,7 @@ class FOceanUpdateDisplacementMapCS : public FGlobalShader
 		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDxBuffer)
 		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDyBuffer)
 		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDzBuffer)
-		SHADER_PARAMETER_UAV(RWTexture2D<float4>, OutDisplacementMap) // TODO:Ȃ<float4>ƂővH
+		SHADER_PARAMETER_UAV(RWTexture2D<float4>, OutDisplacementMap) // TODO:なぜ<float4>という書き方で大丈夫？
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -325,12 +682,85 @@ public:
 
 IMPLEMENT_GLOBAL_SHADER(FOceanGenerateGradientFoldingMapCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "GenerateGradientFoldingMapCS", SF_Compute);
 
-void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& Views)
+class FOceanUpdateDisplacementMapArrayCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FOceanUpdateDisplacementMapArrayCS);
+	SHADER_USE_PARAMETER_STRUCT(FOceanUpdateDisplacementMapArrayCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, MapSize)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDxBuffer)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDyBuffer)
+		SHADER_PARAMETER_SRV(StructuredBuffer<float>, InDzBuffer)
+		SHADER_PARAMETER_UAV(RWTexture2DArray<float4>, OutDisplacementMapArray)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FOceanUpdateDisplacementMapArrayCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "UpdateDisplacementMapArrayCS", SF_Compute);
+
+class FOceanGenerateGradientFoldingMapArrayCS : public FGlobalShader
+{
+	DECLARE_GLOBAL_SHADER(FOceanGenerateGradientFoldingMapArrayCS);
+	SHADER_USE_PARAMETER_STRUCT(FOceanGenerateGradientFoldingMapArrayCS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, MapSize)
+		SHADER_PARAMETER(FVector4, CascadePatchLengths)
+		SHADER_PARAMETER(FVector4, CascadeChoppyScales)
+		SHADER_PARAMETER_SRV(Texture2DArray<float4>, InDisplacementMapArray)
+		SHADER_PARAMETER_UAV(RWTexture2DArray<float4>, OutGradientFoldingMapArray)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FOceanGenerateGradientFoldingMapArrayCS, "/Plugin/ShaderSandbox/Private/OceanSimulation.usf", "GenerateGradientFoldingMapArrayCS", SF_Compute);
+
+bool IsSupportedDispMapDimension(uint32 DispMapDimension)
+{
+	return FFT::IsSupportedFFTLength(DispMapDimension);
+}
+
+void PackOceanComplexToHalf(TArrayView<const FComplex> Src, TResourceArray<uint32>& Dst)
+{
+	Dst.SetNumUninitialized(Src.Num());
+	for (int32 i = 0; i < Src.Num(); i++)
+	{
+		// シェーダのLoadComplex()でf16tof32(uint2(Value, Value >> 16))として読む
+		const FFloat16 Re(Src[i].X);
+		const FFloat16 Im(Src[i].Y);
+		Dst[i] = (uint32)Re.Encoded | ((uint32)Im.Encoded << 16);
+	}
+}
+
+namespace
+{
+/** 行方向のIFFTの結果。通常の経路ではDkx、Dky、Htの順に1フィールドずつ、パックしたIFFTでは[0]に3フィールドぶんが入る */
+struct FHorizontalIFFTBuffers
+{
+	FRDGBufferRef Buffers[3] = {nullptr, nullptr, nullptr};
+};
+
+/**
+ * スペクトラムの更新と行方向のIFFTのパスを追加する。
+ * NumCascades個のカスケードのH0、Omega、Dx、Dy、DzはそれぞれDispMapDimension * DispMapDimension要素ずつ連続して並び、
+ * 全カスケードをグループ数のZで1回のディスパッチにまとめる。デバッグ用のHt、Dkx、Dkyの表示は最初のカスケードのもの
+ */
+FHorizontalIFFTBuffers AddSpectrumAndHorizontalIFFTPasses(FRDGBuilder& GraphBuilder, const FOceanSpectrumParameters& Params, const FOceanBufferViews& Views, uint32 NumCascades)
 {
 	uint32 DispatchCountX = FMath::DivideAndRoundUp((Params.DispMapDimension), (uint32)8);
 	uint32 DispatchCountY = FMath::DivideAndRoundUp(Params.DispMapDimension, (uint32)8);
-	check(DispatchCountX <= 65535);
-	check(DispatchCountY <= 65535);
+	check(NumCascades > 0 && NumCascades <= 65535);
 
 #if ENGINE_MINOR_VERSION >= 25
 	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
@@ -338,43 +768,95 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
 #endif
 
-	FRDGBuilder GraphBuilder(RHICmdList);
+	// IFFTのシェーダはマップのサイズに合わせた基数の組み合わせのパーミュテーションを使う
+	FOceanIFFTPermutationDomain FFTPermutationVector;
+	FFTPermutationVector.Set<FFT::FFFTLengthDim>(Params.DispMapDimension);
+	FFTPermutationVector.Set<FOceanHalfPrecisionDim>(Params.bHalfPrecision);
+	FOceanSpectrumPermutationDomain SpectrumPermutationVector;
+	SpectrumPermutationVector.Set<FOceanHalfPrecisionDim>(Params.bHalfPrecision);
+	const uint32 ComplexStride = GetOceanComplexStride(Params.bHalfPrecision);
 
-	// TODO:ubN֐
-	if (Views.H0DebugViewUAV != nullptr)
+	FHorizontalIFFTBuffers HorizontalIFFTBuffers;
+
+	// パックしたIFFTでは、Dkx、Dky、Htのエルミート対称成分の上半分の行だけを行方向に逆変換し、列方向は2列ずつまとめて逆変換する。
+	// スペクトラムの書き込みとIFFTのグループ数は通常の経路の半分程度になる。デバッグ用のHt、Dkx、Dkyの表示は行わない
+	if (Params.bPackedIFFT)
 	{
-		TShaderMapRef<FOceanDebugH0CS> OceanDebugH0CS(ShaderMap);
+		const uint32 PackedFieldRows = Params.DispMapDimension / 2 + 1;
+		const FRDGBufferDesc PackedBufferDesc = FRDGBufferDesc::CreateStructuredDesc(ComplexStride, 3 * PackedFieldRows * Params.DispMapDimension * NumCascades);
+		FRDGBufferRef HalfSpectrumBuffer = GraphBuilder.CreateBuffer(PackedBufferDesc, TEXT("OceanHalfSpectrum"));
+		HorizontalIFFTBuffers.Buffers[0] = GraphBuilder.CreateBuffer(PackedBufferDesc, TEXT("OceanPackedFFTWork"));
 
-		FOceanDebugH0CS::FParameters* OceanDebugH0Params = GraphBuilder.AllocParameters<FOceanDebugH0CS::FParameters>();
-		OceanDebugH0Params->MapSize = Params.DispMapDimension;
-		OceanDebugH0Params->H0Buffer = Views.H0SRV;
-		OceanDebugH0Params->H0DebugTexture = Views.H0DebugViewUAV;
+		{
+			TShaderMapRef<FOceanUpdateHalfSpectrumCS> OceanUpdateHalfSpectrumCS(ShaderMap, SpectrumPermutationVector);
+
+			FOceanUpdateHalfSpectrumCS::FParameters* UpdateHalfSpectrumParams = GraphBuilder.AllocParameters<FOceanUpdateHalfSpectrumCS::FParameters>();
+			UpdateHalfSpectrumParams->MapSize = Params.DispMapDimension;
+			UpdateHalfSpectrumParams->Time = Params.AccumulatedTime;
+			UpdateHalfSpectrumParams->H0Buffer = Views.H0SRV;
+			UpdateHalfSpectrumParams->OmegaBuffer = Views.OmegaSRV;
+			UpdateHalfSpectrumParams->OutHalfSpectrumBuffer = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HalfSpectrumBuffer));
+
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("OceanUpdateHalfSpectrumCS"),
+				ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+				OceanUpdateHalfSpectrumCS,
+#else
+				*OceanUpdateHalfSpectrumCS,
+#endif
+				UpdateHalfSpectrumParams,
+				FIntVector(DispatchCountX, FMath::DivideAndRoundUp(PackedFieldRows, (uint32)8), NumCascades)
+			);
+		}
 
-		FComputeShaderUtils::AddPass(
-			GraphBuilder,
-			RDG_EVENT_NAME("OceanDebugH0CS"),
-			ERDGPassFlags::AsyncCompute,
+		{
+			TShaderMapRef<FOceanHorizontalIFFTCS> OceanHorizIFFTCS(ShaderMap, FFTPermutationVector);
+
+			FOceanHorizontalIFFTCS::FParameters* HorizIFFTParams = GraphBuilder.AllocParameters<FOceanHorizontalIFFTCS::FParameters>();
+			HorizIFFTParams->InDkBuffer = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(HalfSpectrumBuffer));
+			HorizIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[0]));
+			HorizIFFTParams->CascadeStride = 3 * PackedFieldRows * Params.DispMapDimension;
+
+			// 3フィールドぶんの行を1回で処理する
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("OceanPackedHorizontalIFFTCS"),
+				ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
-			OceanDebugH0CS,
+				OceanHorizIFFTCS,
 #else
-			*OceanDebugH0CS,
+				*OceanHorizIFFTCS,
 #endif
-			OceanDebugH0Params,
-			FIntVector(DispatchCountX, DispatchCountY, 1)
-		);
+				HorizIFFTParams,
+				FIntVector(3 * PackedFieldRows, 1, NumCascades)
+			);
+		}
+
+		return HorizontalIFFTBuffers;
 	}
 
+	// Ht、Dkx、Dky、FFTのワークバッファはIFFTが終われば不要なので、永続的には持たずグラフのプールからフレームごとに借りる。
+	// 初期値は使わないのでゼロ初期化用のCPU側の配列も不要
+	const uint32 NumElements = Params.DispMapDimension * Params.DispMapDimension * NumCascades;
+	const FRDGBufferDesc ComplexBufferDesc = FRDGBufferDesc::CreateStructuredDesc(ComplexStride, NumElements);
+
+	FRDGBufferRef HtBuffer = GraphBuilder.CreateBuffer(ComplexBufferDesc, TEXT("OceanHt"));
+	FRDGBufferRef DkxBuffer = GraphBuilder.CreateBuffer(ComplexBufferDesc, TEXT("OceanDkx"));
+	FRDGBufferRef DkyBuffer = GraphBuilder.CreateBuffer(ComplexBufferDesc, TEXT("OceanDky"));
+
 	{
-		TShaderMapRef<FOceanUpdateSpectrumCS> OceanUpdateSpectrumCS(ShaderMap);
+		TShaderMapRef<FOceanUpdateSpectrumCS> OceanUpdateSpectrumCS(ShaderMap, SpectrumPermutationVector);
 
 		FOceanUpdateSpectrumCS::FParameters* UpdateSpectrumParams = GraphBuilder.AllocParameters<FOceanUpdateSpectrumCS::FParameters>();
 		UpdateSpectrumParams->MapSize = Params.DispMapDimension;
 		UpdateSpectrumParams->Time = Params.AccumulatedTime;
 		UpdateSpectrumParams->H0Buffer = Views.H0SRV;
 		UpdateSpectrumParams->OmegaBuffer = Views.OmegaSRV;
-		UpdateSpectrumParams->OutHtBuffer = Views.HtUAV;
-		UpdateSpectrumParams->OutDkxBuffer = Views.DkxUAV;
-		UpdateSpectrumParams->OutDkyBuffer = Views.DkyUAV;
+		UpdateSpectrumParams->OutHtBuffer = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HtBuffer));
+		UpdateSpectrumParams->OutDkxBuffer = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(DkxBuffer));
+		UpdateSpectrumParams->OutDkyBuffer = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(DkyBuffer));
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
@@ -386,17 +868,17 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 			*OceanUpdateSpectrumCS,
 #endif
 			UpdateSpectrumParams,
-			FIntVector(DispatchCountX, DispatchCountY, 1)
+			FIntVector(DispatchCountX, DispatchCountY, NumCascades)
 		);
 	}
 
 	if (Views.HtDebugViewUAV != nullptr)
 	{
-		TShaderMapRef<FOceanDebugHtCS> OceanDebugHtCS(ShaderMap);
+		TShaderMapRef<FOceanDebugHtCS> OceanDebugHtCS(ShaderMap, SpectrumPermutationVector);
 
 		FOceanDebugHtCS::FParameters* OceanDebugHtParams = GraphBuilder.AllocParameters<FOceanDebugHtCS::FParameters>();
 		OceanDebugHtParams->MapSize = Params.DispMapDimension;
-		OceanDebugHtParams->HtBuffer = Views.HtSRV;
+		OceanDebugHtParams->HtBuffer = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(HtBuffer));
 		OceanDebugHtParams->HtDebugTexture = Views.HtDebugViewUAV;
 
 		FComputeShaderUtils::AddPass(
@@ -415,11 +897,11 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 
 	if (Views.DkxDebugViewUAV != nullptr)
 	{
-		TShaderMapRef<FOceanDebugDkxCS> OceanDebugDkxCS(ShaderMap);
+		TShaderMapRef<FOceanDebugDkxCS> OceanDebugDkxCS(ShaderMap, SpectrumPermutationVector);
 
 		FOceanDebugDkxCS::FParameters* OceanDebugDkxParams = GraphBuilder.AllocParameters<FOceanDebugDkxCS::FParameters>();
 		OceanDebugDkxParams->MapSize = Params.DispMapDimension;
-		OceanDebugDkxParams->DkxBuffer = Views.DkxSRV;
+		OceanDebugDkxParams->DkxBuffer = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(DkxBuffer));
 		OceanDebugDkxParams->DkxDebugTexture = Views.DkxDebugViewUAV;
 
 		FComputeShaderUtils::AddPass(
@@ -438,11 +920,11 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 
 	if (Views.DkyDebugViewUAV != nullptr)
 	{
-		TShaderMapRef<FOceanDebugDkyCS> OceanDebugDkyCS(ShaderMap);
+		TShaderMapRef<FOceanDebugDkyCS> OceanDebugDkyCS(ShaderMap, SpectrumPermutationVector);
 
 		FOceanDebugDkyCS::FParameters* OceanDebugDkyParams = GraphBuilder.AllocParameters<FOceanDebugDkyCS::FParameters>();
 		OceanDebugDkyParams->MapSize = Params.DispMapDimension;
-		OceanDebugDkyParams->DkyBuffer = Views.DkySRV;
+		OceanDebugDkyParams->DkyBuffer = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(DkyBuffer));
 		OceanDebugDkyParams->DkyDebugTexture = Views.DkyDebugViewUAV;
 
 		FComputeShaderUtils::AddPass(
@@ -459,16 +941,27 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 		);
 	}
 
+	// 行方向と列方向のIFFTを別のフレームに分けられるように、行方向の結果はフィールドごとに別のバッファに残す。
+	// 新しく確保するのはDkxの結果のぶんだけで、Dky、Htの結果はそれぞれ行方向のIFFTで読み終えたDkx、Dkyのバッファに書く。
+	// そのため3フィールドの行方向のIFFTは順に実行される
+	const FRDGBufferRef SpectrumBuffers[3] = {DkxBuffer, DkyBuffer, HtBuffer};
+	HorizontalIFFTBuffers.Buffers[0] = GraphBuilder.CreateBuffer(ComplexBufferDesc, TEXT("OceanFFTWork"));
+	HorizontalIFFTBuffers.Buffers[1] = DkxBuffer;
+	HorizontalIFFTBuffers.Buffers[2] = DkyBuffer;
+	static const TCHAR* FieldNames[3] = {TEXT("Dkx"), TEXT("Dky"), TEXT("Ht")};
+
+	for (int32 Field = 0; Field < 3; Field++)
 	{
-		TShaderMapRef<FOceanHorizontalIFFTCS> OceanHorizIFFTCS(ShaderMap);
+		TShaderMapRef<FOceanHorizontalIFFTCS> OceanHorizIFFTCS(ShaderMap, FFTPermutationVector);
 
 		FOceanHorizontalIFFTCS::FParameters* HorizIFFTParams = GraphBuilder.AllocParameters<FOceanHorizontalIFFTCS::FParameters>();
-		HorizIFFTParams->InDkBuffer = Views.DkxSRV;
-		HorizIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
+		HorizIFFTParams->InDkBuffer = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(SpectrumBuffers[Field]));
+		HorizIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[Field]));
+		HorizIFFTParams->CascadeStride = Params.DispMapDimension * Params.DispMapDimension;
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
-			RDG_EVENT_NAME("OceanDkxHorizontalIFFTCS"),
+			RDG_EVENT_NAME("Ocean%sHorizontalIFFTCS", FieldNames[Field]),
 			ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
 			OceanHorizIFFTCS,
@@ -476,64 +969,63 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 			*OceanHorizIFFTCS,
 #endif
 			HorizIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
+			FIntVector(Params.DispMapDimension, 1, NumCascades)
 		);
 	}
 
-	{
-		TShaderMapRef<FOceanDkxVerticalIFFTCS> OceanVertIFFTCS(ShaderMap);
-
-		FOceanDkxVerticalIFFTCS::FParameters* VertIFFTParams = GraphBuilder.AllocParameters<FOceanDkxVerticalIFFTCS::FParameters>();
-		VertIFFTParams->OutDxBuffer = Views.DxUAV;
-		VertIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
-		VertIFFTParams->ChoppyScale = Params.ChoppyScale;
+	return HorizontalIFFTBuffers;
+}
 
-		FComputeShaderUtils::AddPass(
-			GraphBuilder,
-			RDG_EVENT_NAME("OceanDkxVerticalIFFTCS"),
-			ERDGPassFlags::AsyncCompute,
+/** 列方向のIFFTのパスを追加し、結果をViewsのDx、Dy、Dzに書き込む。CascadeChoppyScalesはカスケードごとのChoppyScale */
+void AddVerticalIFFTPasses(FRDGBuilder& GraphBuilder, const FOceanSpectrumParameters& Params, const FVector4& CascadeChoppyScales, const FOceanBufferViews& Views, uint32 NumCascades, const FHorizontalIFFTBuffers& HorizontalIFFTBuffers)
+{
 #if ENGINE_MINOR_VERSION >= 25
-			OceanVertIFFTCS,
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
 #else
-			*OceanVertIFFTCS,
+	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
 #endif
-			VertIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
-		);
-	}
 
+	FOceanIFFTPermutationDomain FFTPermutationVector;
+	FFTPermutationVector.Set<FFT::FFFTLengthDim>(Params.DispMapDimension);
+	FFTPermutationVector.Set<FOceanHalfPrecisionDim>(Params.bHalfPrecision);
+
+	if (Params.bPackedIFFT)
 	{
-		TShaderMapRef<FOceanHorizontalIFFTCS> OceanHorizIFFTCS(ShaderMap);
+		TShaderMapRef<FOceanPackedVerticalIFFTCS> OceanPackedVertIFFTCS(ShaderMap, FFTPermutationVector);
 
-		FOceanHorizontalIFFTCS::FParameters* HorizIFFTParams = GraphBuilder.AllocParameters<FOceanHorizontalIFFTCS::FParameters>();
-		HorizIFFTParams->InDkBuffer = Views.DkySRV;
-		HorizIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
+		FOceanPackedVerticalIFFTCS::FParameters* PackedVertIFFTParams = GraphBuilder.AllocParameters<FOceanPackedVerticalIFFTCS::FParameters>();
+		PackedVertIFFTParams->OutDxBuffer = Views.DxUAV;
+		PackedVertIFFTParams->OutDyBuffer = Views.DyUAV;
+		PackedVertIFFTParams->OutDzBuffer = Views.DzUAV;
+		PackedVertIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[0]));
+		PackedVertIFFTParams->CascadeChoppyScales = CascadeChoppyScales;
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
-			RDG_EVENT_NAME("OceanDkyHorizontalIFFTCS"),
+			RDG_EVENT_NAME("OceanPackedVerticalIFFTCS"),
 			ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
-			OceanHorizIFFTCS,
+			OceanPackedVertIFFTCS,
 #else
-			*OceanHorizIFFTCS,
+			*OceanPackedVertIFFTCS,
 #endif
-			HorizIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
+			PackedVertIFFTParams,
+			FIntVector(3 * Params.DispMapDimension / 2, 1, NumCascades)
 		);
+		return;
 	}
 
 	{
-		TShaderMapRef<FOceanDkyVerticalIFFTCS> OceanVertIFFTCS(ShaderMap);
+		TShaderMapRef<FOceanDkxVerticalIFFTCS> OceanVertIFFTCS(ShaderMap, FFTPermutationVector);
 
-		FOceanDkyVerticalIFFTCS::FParameters* VertIFFTParams = GraphBuilder.AllocParameters<FOceanDkyVerticalIFFTCS::FParameters>();
-		VertIFFTParams->OutDyBuffer = Views.DyUAV;
-		VertIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
-		VertIFFTParams->ChoppyScale = Params.ChoppyScale;
+		FOceanDkxVerticalIFFTCS::FParameters* VertIFFTParams = GraphBuilder.AllocParameters<FOceanDkxVerticalIFFTCS::FParameters>();
+		VertIFFTParams->OutDxBuffer = Views.DxUAV;
+		VertIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[0]));
+		VertIFFTParams->CascadeChoppyScales = CascadeChoppyScales;
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
-			RDG_EVENT_NAME("OceanDkyVerticalIFFTCS"),
+			RDG_EVENT_NAME("OceanDkxVerticalIFFTCS"),
 			ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
 			OceanVertIFFTCS,
@@ -541,37 +1033,38 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 			*OceanVertIFFTCS,
 #endif
 			VertIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
+			FIntVector(Params.DispMapDimension, 1, NumCascades)
 		);
 	}
 
 	{
-		TShaderMapRef<FOceanHorizontalIFFTCS> OceanHorizIFFTCS(ShaderMap);
+		TShaderMapRef<FOceanDkyVerticalIFFTCS> OceanVertIFFTCS(ShaderMap, FFTPermutationVector);
 
-		FOceanHorizontalIFFTCS::FParameters* HorizIFFTParams = GraphBuilder.AllocParameters<FOceanHorizontalIFFTCS::FParameters>();
-		HorizIFFTParams->InDkBuffer = Views.HtSRV;
-		HorizIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
+		FOceanDkyVerticalIFFTCS::FParameters* VertIFFTParams = GraphBuilder.AllocParameters<FOceanDkyVerticalIFFTCS::FParameters>();
+		VertIFFTParams->OutDyBuffer = Views.DyUAV;
+		VertIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[1]));
+		VertIFFTParams->CascadeChoppyScales = CascadeChoppyScales;
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
-			RDG_EVENT_NAME("OceanDkzHorizontalIFFTCS"),
+			RDG_EVENT_NAME("OceanDkyVerticalIFFTCS"),
 			ERDGPassFlags::AsyncCompute,
 #if ENGINE_MINOR_VERSION >= 25
-			OceanHorizIFFTCS,
+			OceanVertIFFTCS,
 #else
-			*OceanHorizIFFTCS,
+			*OceanVertIFFTCS,
 #endif
-			HorizIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
+			VertIFFTParams,
+			FIntVector(Params.DispMapDimension, 1, NumCascades)
 		);
 	}
 
 	{
-		TShaderMapRef<FOceanDkzVerticalIFFTCS> OceanVertIFFTCS(ShaderMap);
+		TShaderMapRef<FOceanDkzVerticalIFFTCS> OceanVertIFFTCS(ShaderMap, FFTPermutationVector);
 
 		FOceanDkzVerticalIFFTCS::FParameters* VertIFFTParams = GraphBuilder.AllocParameters<FOceanDkzVerticalIFFTCS::FParameters>();
 		VertIFFTParams->OutDzBuffer = Views.DzUAV;
-		VertIFFTParams->FFTWorkBufferUAV = Views.FFTWorkUAV;
+		VertIFFTParams->FFTWorkBufferUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(HorizontalIFFTBuffers.Buffers[2]));
 
 		FComputeShaderUtils::AddPass(
 			GraphBuilder,
@@ -583,14 +1076,138 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 			*OceanVertIFFTCS,
 #endif
 			VertIFFTParams,
-			FIntVector(Params.DispMapDimension, 1, 1)
+			FIntVector(Params.DispMapDimension, 1, NumCascades)
 		);
 	}
+}
 
+/**
+ * Passesに応じてスペクトラムの更新とIFFTのパスを追加する。
+ * SpectrumAndHorizontalIFFTでは行方向のIFFTの結果をグラフの外に取り出してTimeSlicedStateに保持し、VerticalIFFTでそれを外部バッファとして登録して続きを行う
+ */
+void AddSpectrumAndIFFTPasses(FRDGBuilder& GraphBuilder, const FOceanSpectrumParameters& Params, const FVector4& CascadeChoppyScales, const FOceanBufferViews& Views, uint32 NumCascades, EOceanSimulationPasses Passes, FOceanTimeSlicedState* TimeSlicedState)
+{
+	if (Passes == EOceanSimulationPasses::VerticalIFFT)
 	{
-		TShaderMapRef<FOceanUpdateDisplacementMapCS> OceanUpdateDisplacementMapCS(ShaderMap);
+		check(TimeSlicedState != nullptr && TimeSlicedState->IsPending());
 
-		FOceanUpdateDisplacementMapCS::FParameters* UpdateDisplacementMapParams = GraphBuilder.AllocParameters<FOceanUpdateDisplacementMapCS::FParameters>();
+		// 前半を行ったときとパックしたIFFTや格納精度の設定が変わっていてもバッファのレイアウトは前半に合わせる
+		FOceanSpectrumParameters SlicedParams = Params;
+		SlicedParams.bPackedIFFT = TimeSlicedState->bPackedIFFT;
+		SlicedParams.bHalfPrecision = TimeSlicedState->bHalfPrecision;
+
+		FHorizontalIFFTBuffers HorizontalIFFTBuffers;
+		for (int32 Field = 0; Field < 3; Field++)
+		{
+			if (TimeSlicedState->HorizontalIFFTBuffers[Field].IsValid())
+			{
+				HorizontalIFFTBuffers.Buffers[Field] = GraphBuilder.RegisterExternalBuffer(TimeSlicedState->HorizontalIFFTBuffers[Field]);
+			}
+		}
+
+		AddVerticalIFFTPasses(GraphBuilder, SlicedParams, CascadeChoppyScales, Views, NumCascades, HorizontalIFFTBuffers);
+		return;
+	}
+
+	const FHorizontalIFFTBuffers HorizontalIFFTBuffers = AddSpectrumAndHorizontalIFFTPasses(GraphBuilder, Params, Views, NumCascades);
+
+	if (Passes == EOceanSimulationPasses::SpectrumAndHorizontalIFFT)
+	{
+		check(TimeSlicedState != nullptr);
+		TimeSlicedState->Reset();
+		TimeSlicedState->bPackedIFFT = Params.bPackedIFFT;
+		TimeSlicedState->bHalfPrecision = Params.bHalfPrecision;
+
+		for (int32 Field = 0; Field < 3; Field++)
+		{
+			if (HorizontalIFFTBuffers.Buffers[Field] != nullptr)
+			{
+				GraphBuilder.QueueBufferExtraction(HorizontalIFFTBuffers.Buffers[Field], &TimeSlicedState->HorizontalIFFTBuffers[Field]);
+			}
+		}
+		return;
+	}
+
+	AddVerticalIFFTPasses(GraphBuilder, Params, CascadeChoppyScales, Views, NumCascades, HorizontalIFFTBuffers);
+}
+
+/** グラフの実行後に呼ぶ。VerticalIFFTで使い終わった行方向のIFFTの結果をプールに返す */
+void FinishTimeSlicedPasses(EOceanSimulationPasses Passes, FOceanTimeSlicedState* TimeSlicedState)
+{
+	if (Passes == EOceanSimulationPasses::VerticalIFFT)
+	{
+		TimeSlicedState->Reset();
+	}
+}
+} // namespace
+
+void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& Views, bool bDisplacementReady, EOceanSimulationPasses Passes, FOceanTimeSlicedState* TimeSlicedState)
+{
+	uint32 DispatchCountX = FMath::DivideAndRoundUp((Params.DispMapDimension), (uint32)8);
+	uint32 DispatchCountY = FMath::DivideAndRoundUp(Params.DispMapDimension, (uint32)8);
+	check(DispatchCountX <= 65535);
+	check(DispatchCountY <= 65535);
+
+#if ENGINE_MINOR_VERSION >= 25
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#else
+	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#endif
+
+	// IFFTのシェーダはFFT_LENGTHのパーミュテーションがあるサイズしか扱えない
+	if (!bDisplacementReady && !ensureMsgf(IsSupportedDispMapDimension(Params.DispMapDimension), TEXT("DispMapDimension %u is not supported by the GPU ocean simulation."), Params.DispMapDimension))
+	{
+		return;
+	}
+
+	check(Passes == EOceanSimulationPasses::All || !bDisplacementReady);
+
+	FRDGBuilder GraphBuilder(RHICmdList);
+
+	// TODO:ブロックより関数化
+	if (Passes == EOceanSimulationPasses::All && Views.H0DebugViewUAV != nullptr)
+	{
+		FOceanSpectrumPermutationDomain SpectrumPermutationVector;
+		SpectrumPermutationVector.Set<FOceanHalfPrecisionDim>(Params.bHalfPrecision);
+		TShaderMapRef<FOceanDebugH0CS> OceanDebugH0CS(ShaderMap, SpectrumPermutationVector);
+
+		FOceanDebugH0CS::FParameters* OceanDebugH0Params = GraphBuilder.AllocParameters<FOceanDebugH0CS::FParameters>();
+		OceanDebugH0Params->MapSize = Params.DispMapDimension;
+		OceanDebugH0Params->H0Buffer = Views.H0SRV;
+		OceanDebugH0Params->H0DebugTexture = Views.H0DebugViewUAV;
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("OceanDebugH0CS"),
+			ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+			OceanDebugH0CS,
+#else
+			*OceanDebugH0CS,
+#endif
+			OceanDebugH0Params,
+			FIntVector(DispatchCountX, DispatchCountY, 1)
+		);
+	}
+
+	// CPUシミュレーションの結果や同じフレームで計算済みの結果がDx、Dy、Dzのバッファに入っているときはスペクトラムの更新とIFFTのパスは行わない
+	if (!bDisplacementReady)
+	{
+		AddSpectrumAndIFFTPasses(GraphBuilder, Params, FVector4(Params.ChoppyScale, 0.0f, 0.0f, 0.0f), Views, 1, Passes, TimeSlicedState);
+	}
+
+	// 時間分割したシミュレーションの途中やDx、Dy、Dzだけの更新ではディスプレースメントマップは書き込まない
+	if (Passes != EOceanSimulationPasses::All)
+	{
+		GraphBuilder.Execute();
+		FinishTimeSlicedPasses(Passes, TimeSlicedState);
+		return;
+	}
+
+	{
+		TShaderMapRef<FOceanUpdateDisplacementMapCS> OceanUpdateDisplacementMapCS(ShaderMap);
+
+		FOceanUpdateDisplacementMapCS::FParameters* UpdateDisplacementMapParams = GraphBuilder.AllocParameters<FOceanUpdateDisplacementMapCS::FParameters>();
 		UpdateDisplacementMapParams->MapSize = Params.DispMapDimension;
 		UpdateDisplacementMapParams->InDxBuffer = Views.DxSRV;
 		UpdateDisplacementMapParams->InDyBuffer = Views.DySRV;
@@ -662,6 +1279,107 @@ void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumPar
 	GraphBuilder.Execute();
 }
 
+void SimulateOceanCascades(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, const FOceanBufferViews& Views, bool bDisplacementReady, EOceanSimulationPasses Passes, FOceanTimeSlicedState* TimeSlicedState)
+{
+	const int32 NumCascades = CascadeParams.Num();
+	if (!ensureMsgf(NumCascades > 0 && NumCascades <= MaxOceanCascades, TEXT("The number of ocean cascades %d must be from 1 to %d."), NumCascades, MaxOceanCascades))
+	{
+		return;
+	}
+
+	// 時刻やIFFTの経路は全カスケードで共通なので最初のカスケードのものを使う。ChoppyScaleとPatchLengthはカスケードごとに渡す
+	const FOceanSpectrumParameters& Params = CascadeParams[0];
+	FVector4 CascadeChoppyScales(0.0f, 0.0f, 0.0f, 0.0f);
+	FVector4 CascadePatchLengths(0.0f, 0.0f, 0.0f, 0.0f);
+	for (int32 CascadeIndex = 0; CascadeIndex < NumCascades; CascadeIndex++)
+	{
+		check(CascadeParams[CascadeIndex].DispMapDimension == Params.DispMapDimension);
+		CascadeChoppyScales[CascadeIndex] = CascadeParams[CascadeIndex].ChoppyScale;
+		CascadePatchLengths[CascadeIndex] = CascadeParams[CascadeIndex].PatchLength;
+	}
+
+	if (!bDisplacementReady && !ensureMsgf(IsSupportedDispMapDimension(Params.DispMapDimension), TEXT("DispMapDimension %u is not supported by the GPU ocean simulation."), Params.DispMapDimension))
+	{
+		return;
+	}
+
+	uint32 DispatchCountX = FMath::DivideAndRoundUp((Params.DispMapDimension), (uint32)8);
+	uint32 DispatchCountY = FMath::DivideAndRoundUp(Params.DispMapDimension, (uint32)8);
+
+#if ENGINE_MINOR_VERSION >= 25
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#else
+	TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(ERHIFeatureLevel::SM5);
+#endif
+
+	check(Passes == EOceanSimulationPasses::All || !bDisplacementReady);
+
+	FRDGBuilder GraphBuilder(RHICmdList);
+
+	// スペクトラムごとにグラフを作るのでなく、全カスケードのスペクトラムの更新とIFFTをグループ数のZでまとめてディスパッチする
+	if (!bDisplacementReady)
+	{
+		AddSpectrumAndIFFTPasses(GraphBuilder, Params, CascadeChoppyScales, Views, NumCascades, Passes, TimeSlicedState);
+	}
+
+	if (Passes != EOceanSimulationPasses::All)
+	{
+		GraphBuilder.Execute();
+		FinishTimeSlicedPasses(Passes, TimeSlicedState);
+		return;
+	}
+
+	{
+		TShaderMapRef<FOceanUpdateDisplacementMapArrayCS> OceanUpdateDisplacementMapArrayCS(ShaderMap);
+
+		FOceanUpdateDisplacementMapArrayCS::FParameters* UpdateDisplacementMapArrayParams = GraphBuilder.AllocParameters<FOceanUpdateDisplacementMapArrayCS::FParameters>();
+		UpdateDisplacementMapArrayParams->MapSize = Params.DispMapDimension;
+		UpdateDisplacementMapArrayParams->InDxBuffer = Views.DxSRV;
+		UpdateDisplacementMapArrayParams->InDyBuffer = Views.DySRV;
+		UpdateDisplacementMapArrayParams->InDzBuffer = Views.DzSRV;
+		UpdateDisplacementMapArrayParams->OutDisplacementMapArray = Views.DisplacementMapUAV;
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("OceanUpdateDisplacementMapArrayCS"),
+			ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+			OceanUpdateDisplacementMapArrayCS,
+#else
+			*OceanUpdateDisplacementMapArrayCS,
+#endif
+			UpdateDisplacementMapArrayParams,
+			FIntVector(DispatchCountX, DispatchCountY, NumCascades)
+		);
+	}
+
+	{
+		TShaderMapRef<FOceanGenerateGradientFoldingMapArrayCS> OceanGenerateGradientFoldingMapArrayCS(ShaderMap);
+
+		FOceanGenerateGradientFoldingMapArrayCS::FParameters* GenerateGradientFoldingMapArrayParams = GraphBuilder.AllocParameters<FOceanGenerateGradientFoldingMapArrayCS::FParameters>();
+		GenerateGradientFoldingMapArrayParams->MapSize = Params.DispMapDimension;
+		GenerateGradientFoldingMapArrayParams->CascadePatchLengths = CascadePatchLengths;
+		GenerateGradientFoldingMapArrayParams->CascadeChoppyScales = CascadeChoppyScales;
+		GenerateGradientFoldingMapArrayParams->InDisplacementMapArray = Views.DisplacementMapSRV;
+		GenerateGradientFoldingMapArrayParams->OutGradientFoldingMapArray = Views.GradientFoldingMapUAV;
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("OceanGenerateGradientFoldingMapArrayCS"),
+			ERDGPassFlags::AsyncCompute,
+#if ENGINE_MINOR_VERSION >= 25
+			OceanGenerateGradientFoldingMapArrayCS,
+#else
+			*OceanGenerateGradientFoldingMapArrayCS,
+#endif
+			GenerateGradientFoldingMapArrayParams,
+			FIntVector(DispatchCountX, DispatchCountY, NumCascades)
+		);
+	}
+
+	GraphBuilder.Execute();
+}
+
 class FOceanSinWaveCS : public FGlobalShader
 {
 	DECLARE_GLOBAL_SHADER(FOceanSinWaveCS);
@@ -734,5 +1452,1068 @@ void TestSinWave(FRHICommandListImmediate& RHICmdList, const FOceanSinWaveParame
 
 	GraphBuilder.Execute();
 }
+
+DECLARE_CYCLE_STAT(TEXT("Simulate Ocean CPU"), STAT_SimulateOceanCPU, STATGROUP_Ocean);
+
+namespace
+{
+/** bPackedIFFTでの1フィールドぶんの行数。0行目からMapSize / 2行目までを使い、残りはSIMDの4行単位に揃えるための0埋め。 */
+uint32 GetPackedFieldRows(uint32 MapSize)
+{
+	return Align(MapSize / 2 + 1, 4);
+}
+} // namespace
+
+void FOceanCPUSimulationWork::Init(uint32 InDispMapDimension, bool bInPackedIFFT)
+{
+	// SIMDの4レーン単位で処理するので4以上の2の累乗である前提
+	check(FMath::IsPowerOfTwo(InDispMapDimension) && InDispMapDimension >= 4);
+	// パックしたIFFTでは列方向に対にする2列を4レーンぶん、8列単位で読み書きする
+	check(!bInPackedIFFT || InDispMapDimension >= 8);
+	DispMapDimension = InDispMapDimension;
+	bPackedIFFT = bInPackedIFFT;
+
+	uint32 NumTexels = DispMapDimension * DispMapDimension;
+	if (bPackedIFFT)
+	{
+		HtRe.Empty();
+		HtIm.Empty();
+		DkxRe.Empty();
+		DkxIm.Empty();
+		DkyRe.Empty();
+		DkyIm.Empty();
+
+		// 0埋めの行は書き込まれないので0で初期化しておく
+		const uint32 NumPackedTexels = 3 * GetPackedFieldRows(DispMapDimension) * DispMapDimension;
+		PackedRe.SetNumZeroed(NumPackedTexels);
+		PackedIm.SetNumZeroed(NumPackedTexels);
+	}
+	else
+	{
+		HtRe.SetNumUninitialized(NumTexels);
+		HtIm.SetNumUninitialized(NumTexels);
+		DkxRe.SetNumUninitialized(NumTexels);
+		DkxIm.SetNumUninitialized(NumTexels);
+		DkyRe.SetNumUninitialized(NumTexels);
+		DkyIm.SetNumUninitialized(NumTexels);
+
+		PackedRe.Empty();
+		PackedIm.Empty();
+	}
+
+	// FFT.ushの逆変換と同じ符号のひねり係数
+	Twiddles.SetNumUninitialized(DispMapDimension / 2);
+	for (uint32 k = 0; k < DispMapDimension / 2; k++)
+	{
+		float Sin, Cos;
+		FMath::SinCos(&Sin, &Cos, -2.0f * PI * k / DispMapDimension);
+		Twiddles[k] = FComplex(Cos, Sin);
+	}
+}
+
+void FOceanCPUDisplacement::Init(uint32 InDispMapDimension)
+{
+	DispMapDimension = InDispMapDimension;
+
+	uint32 NumTexels = DispMapDimension * DispMapDimension;
+	Dx.SetNumUninitialized(NumTexels);
+	Dy.SetNumUninitialized(NumTexels);
+	Dz.SetNumUninitialized(NumTexels);
+}
+
+namespace
+{
+/** UpdateSpectrumCSの1行分。4テクセルずつSIMDで処理する。出力先はそれぞれMapSize要素の16バイト境界の配列。 */
+void UpdateSpectrumRow(uint32 Row, uint32 MapSize, float Time, const FComplex* H0, const float* Omega0, float* OutHtRe, float* OutHtIm, float* OutDkxRe, float* OutDkxIm, float* OutDkyRe, float* OutDkyIm)
+{
+	const uint32 MinusRow = MapSize - Row - 1;
+	const VectorRegister TimeV = VectorSetFloat1(Time);
+	const float Ky = (float)Row - MapSize * 0.5f;
+	const VectorRegister KyV = VectorSetFloat1(Ky);
+	const VectorRegister KySqr = VectorSetFloat1(Ky * Ky);
+	const VectorRegister LaneOffset = MakeVectorRegister(0.0f, 1.0f, 2.0f, 3.0f);
+
+	for (uint32 x = 0; x < MapSize; x += 4)
+	{
+		const uint32 Index = Row * MapSize + x;
+		// -kはxについて逆順に並ぶので、4要素まとめて読んでから並べ替える
+		const uint32 MinusIndex = MinusRow * MapSize + (MapSize - x - 4);
+
+		const VectorRegister Hk0Lo = VectorLoad(&H0[Index].X);
+		const VectorRegister Hk0Hi = VectorLoad(&H0[Index + 2].X);
+		const VectorRegister Hk0Re = VectorShuffle(Hk0Lo, Hk0Hi, 0, 2, 0, 2);
+		const VectorRegister Hk0Im = VectorShuffle(Hk0Lo, Hk0Hi, 1, 3, 1, 3);
+
+		const VectorRegister Hminusk0Lo = VectorLoad(&H0[MinusIndex].X);
+		const VectorRegister Hminusk0Hi = VectorLoad(&H0[MinusIndex + 2].X);
+		const VectorRegister Hminusk0Re = VectorShuffle(Hminusk0Hi, Hminusk0Lo, 2, 0, 2, 0);
+		const VectorRegister Hminusk0Im = VectorShuffle(Hminusk0Hi, Hminusk0Lo, 3, 1, 3, 1);
+
+		// H(k, t) = H(k, 0) * e^(i * omega * t) + Conj(H(-k, 0)) * e^(-i * omega * t)
+		const VectorRegister Angle = VectorMultiply(VectorLoad(&Omega0[Index]), TimeV);
+		VectorRegister SinOmega, CosOmega;
+		VectorSinCos(&SinOmega, &CosOmega, &Angle);
+
+		const VectorRegister HktRe = VectorSubtract(VectorMultiply(VectorAdd(Hk0Re, Hminusk0Re), CosOmega), VectorMultiply(VectorAdd(Hk0Im, Hminusk0Im), SinOmega));
+		const VectorRegister HktIm = VectorAdd(VectorMultiply(VectorSubtract(Hk0Re, Hminusk0Re), SinOmega), VectorMultiply(VectorSubtract(Hk0Im, Hminusk0Im), CosOmega));
+
+		// D(k, t) = i * k / |k| * H(k, t)。k = 0では0にする
+		const VectorRegister Kx = VectorAdd(VectorSetFloat1((float)x - MapSize * 0.5f), LaneOffset);
+		const VectorRegister KLenSqr = VectorMultiplyAdd(Kx, Kx, KySqr);
+		const VectorRegister InvKLen = VectorSelect(VectorCompareGT(KLenSqr, VectorZero()), VectorReciprocalSqrtAccurate(KLenSqr), VectorZero());
+		const VectorRegister KxNorm = VectorMultiply(Kx, InvKLen);
+		const VectorRegister KyNorm = VectorMultiply(KyV, InvKLen);
+
+		VectorStoreAligned(HktRe, &OutHtRe[x]);
+		VectorStoreAligned(HktIm, &OutHtIm[x]);
+		VectorStoreAligned(VectorMultiply(KxNorm, HktIm), &OutDkxRe[x]);
+		VectorStoreAligned(VectorNegate(VectorMultiply(KxNorm, HktRe)), &OutDkxIm[x]);
+		VectorStoreAligned(VectorMultiply(KyNorm, HktIm), &OutDkyRe[x]);
+		VectorStoreAligned(VectorNegate(VectorMultiply(KyNorm, HktRe)), &OutDkyIm[x]);
+	}
+}
+
+/**
+ * UpdateHalfSpectrumCSの1行分。IFFTの実数部だけを使うので、スペクトラムAをエルミート対称成分(A(k) + Conj(A(-k))) / 2に置き換えても結果は変わらず、
+ * 逆変換の結果は実数になる。kの行と-kの行を計算してエルミート対称成分を作り、Dkx、Dky、Htのフィールドの順にWork.PackedRe、Work.PackedImに書き込む。
+ * Rowは0からMapSize / 2まで。Scratchは12 * MapSize要素の16バイト境界の配列。
+ */
+void UpdatePackedSpectrumRow(uint32 Row, float Time, const FComplex* H0, const float* Omega0, FOceanCPUSimulationWork& Work, float* Scratch)
+{
+	const uint32 MapSize = Work.DispMapDimension;
+	const uint32 MinusRow = (MapSize - Row) & (MapSize - 1);
+
+	// HtRe、HtIm、DkxRe、DkxIm、DkyRe、DkyImの順にMapSize要素ずつ並べる
+	float* RowValues = Scratch;
+	float* MinusRowValues = Scratch + 6 * MapSize;
+	UpdateSpectrumRow(Row, MapSize, Time, H0, Omega0, RowValues, RowValues + MapSize, RowValues + 2 * MapSize, RowValues + 3 * MapSize, RowValues + 4 * MapSize, RowValues + 5 * MapSize);
+	UpdateSpectrumRow(MinusRow, MapSize, Time, H0, Omega0, MinusRowValues, MinusRowValues + MapSize, MinusRowValues + 2 * MapSize, MinusRowValues + 3 * MapSize, MinusRowValues + 4 * MapSize, MinusRowValues + 5 * MapSize);
+
+	const uint32 FieldOffsets[3] = {2 * MapSize, 4 * MapSize, 0}; // Dkx、Dky、Ht
+	const uint32 FieldStride = GetPackedFieldRows(MapSize) * MapSize;
+
+	for (uint32 Field = 0; Field < 3; Field++)
+	{
+		const float* SrcRe = RowValues + FieldOffsets[Field];
+		const float* SrcIm = SrcRe + MapSize;
+		const float* MinusRe = MinusRowValues + FieldOffsets[Field];
+		const float* MinusIm = MinusRe + MapSize;
+		float* DstRe = &Work.PackedRe[Field * FieldStride + Row * MapSize];
+		float* DstIm = &Work.PackedIm[Field * FieldStride + Row * MapSize];
+
+		for (uint32 x = 0; x < MapSize; x++)
+		{
+			const uint32 MinusX = (MapSize - x) & (MapSize - 1);
+			DstRe[x] = 0.5f * (SrcRe[x] + MinusRe[MinusX]);
+			DstIm[x] = 0.5f * (SrcIm[x] - MinusIm[MinusX]);
+		}
+	}
+}
+
+/**
+ * 4系列を同時に扱うFFTの作業バッファ。要素kの4系列ぶんが1つのVectorRegisterに入る。
+ * 実体はFOceanCPUSimulationWork::ChunkScratchのチャンクごとの領域で、フレームをまたいで使い回す。
+ */
+struct FLaneFFTScratch
+{
+	static uint32 GetNumFloats(uint32 Length) { return 4 * 4 * Length; }
+
+	VectorRegister* Re;
+	VectorRegister* Im;
+	VectorRegister* WorkRe;
+	VectorRegister* WorkIm;
+
+	FLaneFFTScratch(float* Chunk, uint32 Length)
+		: Re(reinterpret_cast<VectorRegister*>(Chunk))
+		, Im(Re + Length)
+		, WorkRe(Im + Length)
+		, WorkIm(WorkRe + Length)
+	{
+	}
+};
+
+/** UpdatePackedSpectrumRow()の作業バッファ。FLaneFFTScratchと同じくChunkScratchの領域を指す。 */
+struct FPackedSpectrumScratch
+{
+	static uint32 GetNumFloats(uint32 Length) { return 12 * Length; }
+
+	float* Values;
+
+	FPackedSpectrumScratch(float* Chunk, uint32 Length)
+		: Values(Chunk)
+	{
+	}
+};
+
+/**
+ * 基数2のStockham FFTを4系列同時に行う。GroupSharedStockhamFFT(false, ...)と同じく1/Nのスケールはかけない。
+ * 結果はScratch.ReとScratch.Imに入る。
+ */
+void LaneStockhamFFT(FLaneFFTScratch& Scratch, uint32 Length, const FComplex* Twiddles)
+{
+	VectorRegister* SrcRe = Scratch.Re;
+	VectorRegister* SrcIm = Scratch.Im;
+	VectorRegister* DstRe = Scratch.WorkRe;
+	VectorRegister* DstIm = Scratch.WorkIm;
+
+	for (uint32 SubLength = Length, Stride = 1; SubLength > 1; SubLength /= 2, Stride *= 2)
+	{
+		const uint32 HalfLength = SubLength / 2;
+		const uint32 TwiddleStep = Length / SubLength;
+
+		for (uint32 p = 0; p < HalfLength; p++)
+		{
+			const VectorRegister TwiddleRe = VectorSetFloat1(Twiddles[p * TwiddleStep].X);
+			const VectorRegister TwiddleIm = VectorSetFloat1(Twiddles[p * TwiddleStep].Y);
+
+			for (uint32 q = 0; q < Stride; q++)
+			{
+				const uint32 A = q + Stride * p;
+				const uint32 B = A + Stride * HalfLength;
+				const uint32 Dst = q + Stride * 2 * p;
+
+				const VectorRegister DiffRe = VectorSubtract(SrcRe[A], SrcRe[B]);
+				const VectorRegister DiffIm = VectorSubtract(SrcIm[A], SrcIm[B]);
+
+				DstRe[Dst] = VectorAdd(SrcRe[A], SrcRe[B]);
+				DstIm[Dst] = VectorAdd(SrcIm[A], SrcIm[B]);
+				DstRe[Dst + Stride] = VectorSubtract(VectorMultiply(DiffRe, TwiddleRe), VectorMultiply(DiffIm, TwiddleIm));
+				DstIm[Dst + Stride] = VectorMultiplyAdd(DiffRe, TwiddleIm, VectorMultiply(DiffIm, TwiddleRe));
+			}
+		}
+
+		Swap(SrcRe, DstRe);
+		Swap(SrcIm, DstIm);
+	}
+
+	if (SrcRe != Scratch.Re)
+	{
+		FMemory::Memcpy(Scratch.Re, SrcRe, Length * sizeof(VectorRegister));
+		FMemory::Memcpy(Scratch.Im, SrcIm, Length * sizeof(VectorRegister));
+	}
+}
+
+void TransposeVectors4x4(VectorRegister& V0, VectorRegister& V1, VectorRegister& V2, VectorRegister& V3)
+{
+	const VectorRegister T0 = VectorShuffle(V0, V1, 0, 1, 0, 1);
+	const VectorRegister T1 = VectorShuffle(V0, V1, 2, 3, 2, 3);
+	const VectorRegister T2 = VectorShuffle(V2, V3, 0, 1, 0, 1);
+	const VectorRegister T3 = VectorShuffle(V2, V3, 2, 3, 2, 3);
+	V0 = VectorShuffle(T0, T2, 0, 2, 0, 2);
+	V1 = VectorShuffle(T0, T2, 1, 3, 1, 3);
+	V2 = VectorShuffle(T1, T3, 0, 2, 0, 2);
+	V3 = VectorShuffle(T1, T3, 1, 3, 1, 3);
+}
+
+/** HorizontalIFFTCSに相当する。FirstRowから4行をSIMDの各レーンに割り当ててIFFTし、その場に書き戻す。 */
+void HorizontalIFFT4Rows(float* Re, float* Im, uint32 FirstRow, const FOceanCPUSimulationWork& Work, FLaneFFTScratch& Scratch)
+{
+	const uint32 MapSize = Work.DispMapDimension;
+	float* RowRe = &Re[FirstRow * MapSize];
+	float* RowIm = &Im[FirstRow * MapSize];
+
+	for (uint32 x = 0; x < MapSize; x += 4)
+	{
+		VectorRegister R0 = VectorLoadAligned(&RowRe[x]);
+		VectorRegister R1 = VectorLoadAligned(&RowRe[MapSize + x]);
+		VectorRegister R2 = VectorLoadAligned(&RowRe[MapSize * 2 + x]);
+		VectorRegister R3 = VectorLoadAligned(&RowRe[MapSize * 3 + x]);
+		TransposeVectors4x4(R0, R1, R2, R3);
+		Scratch.Re[x] = R0;
+		Scratch.Re[x + 1] = R1;
+		Scratch.Re[x + 2] = R2;
+		Scratch.Re[x + 3] = R3;
+
+		VectorRegister I0 = VectorLoadAligned(&RowIm[x]);
+		VectorRegister I1 = VectorLoadAligned(&RowIm[MapSize + x]);
+		VectorRegister I2 = VectorLoadAligned(&RowIm[MapSize * 2 + x]);
+		VectorRegister I3 = VectorLoadAligned(&RowIm[MapSize * 3 + x]);
+		TransposeVectors4x4(I0, I1, I2, I3);
+		Scratch.Im[x] = I0;
+		Scratch.Im[x + 1] = I1;
+		Scratch.Im[x + 2] = I2;
+		Scratch.Im[x + 3] = I3;
+	}
+
+	LaneStockhamFFT(Scratch, MapSize, Work.Twiddles.GetData());
+
+	for (uint32 x = 0; x < MapSize; x += 4)
+	{
+		VectorRegister R0 = Scratch.Re[x];
+		VectorRegister R1 = Scratch.Re[x + 1];
+		VectorRegister R2 = Scratch.Re[x + 2];
+		VectorRegister R3 = Scratch.Re[x + 3];
+		TransposeVectors4x4(R0, R1, R2, R3);
+		VectorStoreAligned(R0, &RowRe[x]);
+		VectorStoreAligned(R1, &RowRe[MapSize + x]);
+		VectorStoreAligned(R2, &RowRe[MapSize * 2 + x]);
+		VectorStoreAligned(R3, &RowRe[MapSize * 3 + x]);
+
+		VectorRegister I0 = Scratch.Im[x];
+		VectorRegister I1 = Scratch.Im[x + 1];
+		VectorRegister I2 = Scratch.Im[x + 2];
+		VectorRegister I3 = Scratch.Im[x + 3];
+		TransposeVectors4x4(I0, I1, I2, I3);
+		VectorStoreAligned(I0, &RowIm[x]);
+		VectorStoreAligned(I1, &RowIm[MapSize + x]);
+		VectorStoreAligned(I2, &RowIm[MapSize * 2 + x]);
+		VectorStoreAligned(I3, &RowIm[MapSize * 3 + x]);
+	}
+}
+
+/**
+ * Dk*VerticalIFFTCSとUpdateDisplacementMapCSに相当する。FirstColumnから4列をSIMDの各レーンに割り当ててIFFTし、
+ * 実数部に符号補正cos(pi * (m1 + m2))とScaleをかけてOutに書き込む。
+ */
+void VerticalIFFT4Columns(const float* Re, const float* Im, uint32 FirstColumn, float Scale, const FOceanCPUSimulationWork& Work, FLaneFFTScratch& Scratch, float* Out)
+{
+	const uint32 MapSize = Work.DispMapDimension;
+
+	for (uint32 y = 0; y < MapSize; y++)
+	{
+		Scratch.Re[y] = VectorLoadAligned(&Re[y * MapSize + FirstColumn]);
+		Scratch.Im[y] = VectorLoadAligned(&Im[y * MapSize + FirstColumn]);
+	}
+
+	LaneStockhamFFT(Scratch, MapSize, Work.Twiddles.GetData());
+
+	// FirstColumnは4の倍数なので、符号は行の偶奇とレーンの偶奇で決まる
+	const VectorRegister EvenRowSign = MakeVectorRegister(Scale, -Scale, Scale, -Scale);
+	const VectorRegister OddRowSign = VectorNegate(EvenRowSign);
+
+	for (uint32 y = 0; y < MapSize; y++)
+	{
+		VectorStoreAligned(VectorMultiply(Scratch.Re[y], (y & 1) ? OddRowSign : EvenRowSign), &Out[y * MapSize + FirstColumn]);
+	}
+}
+
+/**
+ * PackedVerticalIFFTCSに相当する。FirstColumnから8列を隣り合う2列ずつ対にしてSIMDの各レーンに割り当てる。
+ * 行方向のIFFTの後も各列はエルミート対称なので、対の列A、BをA + iBとして1回でIFFTすると実数部がA、虚数部がBの結果になる。
+ * ReとImは1フィールドの先頭で、MapSize / 2行目より下の行は上半分の行の共役で得る。
+ */
+void PackedVerticalIFFT8Columns(const float* Re, const float* Im, uint32 FirstColumn, float Scale, const FOceanCPUSimulationWork& Work, FLaneFFTScratch& Scratch, float* Out)
+{
+	const uint32 MapSize = Work.DispMapDimension;
+
+	for (uint32 y = 0; y < MapSize; y++)
+	{
+		const bool bMirrored = (y > MapSize / 2);
+		const uint32 SrcRow = bMirrored ? (MapSize - y) : y;
+		const float* RowRe = &Re[SrcRow * MapSize + FirstColumn];
+		const float* RowIm = &Im[SrcRow * MapSize + FirstColumn];
+
+		const VectorRegister ReLo = VectorLoadAligned(RowRe);
+		const VectorRegister ReHi = VectorLoadAligned(RowRe + 4);
+		VectorRegister ImLo = VectorLoadAligned(RowIm);
+		VectorRegister ImHi = VectorLoadAligned(RowIm + 4);
+		if (bMirrored)
+		{
+			ImLo = VectorNegate(ImLo);
+			ImHi = VectorNegate(ImHi);
+		}
+
+		// 偶数列をA、奇数列をBとしてA + iB
+		const VectorRegister ARe = VectorShuffle(ReLo, ReHi, 0, 2, 0, 2);
+		const VectorRegister AIm = VectorShuffle(ImLo, ImHi, 0, 2, 0, 2);
+		const VectorRegister BRe = VectorShuffle(ReLo, ReHi, 1, 3, 1, 3);
+		const VectorRegister BIm = VectorShuffle(ImLo, ImHi, 1, 3, 1, 3);
+		Scratch.Re[y] = VectorSubtract(ARe, BIm);
+		Scratch.Im[y] = VectorAdd(AIm, BRe);
+	}
+
+	LaneStockhamFFT(Scratch, MapSize, Work.Twiddles.GetData());
+
+	// FirstColumnは8の倍数なので、符号は行の偶奇と列の偶奇で決まる
+	const VectorRegister EvenRowSign = MakeVectorRegister(Scale, -Scale, Scale, -Scale);
+	const VectorRegister OddRowSign = VectorNegate(EvenRowSign);
+
+	for (uint32 y = 0; y < MapSize; y++)
+	{
+		// 実数部が偶数列、虚数部が奇数列の結果なので交互に並べ直す
+		const VectorRegister Lo = VectorSwizzle(VectorShuffle(Scratch.Re[y], Scratch.Im[y], 0, 1, 0, 1), 0, 2, 1, 3);
+		const VectorRegister Hi = VectorSwizzle(VectorShuffle(Scratch.Re[y], Scratch.Im[y], 2, 3, 2, 3), 0, 2, 1, 3);
+		const VectorRegister Sign = (y & 1) ? OddRowSign : EvenRowSign;
+		VectorStoreAligned(VectorMultiply(Lo, Sign), &Out[y * MapSize + FirstColumn]);
+		VectorStoreAligned(VectorMultiply(Hi, Sign), &Out[y * MapSize + FirstColumn + 4]);
+	}
+}
+
+/**
+ * NumGroups個のグループ（通常は4系列のIFFT）をワーカースレッド数程度のチャンクに分けて並列処理する。
+ * 作業バッファScratchTypeはWork.ChunkScratchをチャンク数で分けたもので、足りないときだけ広げるので毎フレームの確保はない。
+ */
+template<typename ScratchType = FLaneFFTScratch, typename FunctionType>
+void ParallelForLaneGroups(FOceanCPUSimulationWork& Work, uint32 NumGroups, uint32 Length, const FunctionType& Function)
+{
+	const int32 NumChunks = FMath::Min<int32>(NumGroups, FTaskGraphInterface::Get().GetNumWorkerThreads() + 1);
+
+	// VectorRegisterの16バイト境界はチャンクの大きさが4の倍数なので保たれる
+	const uint32 ChunkFloats = ScratchType::GetNumFloats(Length);
+	if ((uint32)Work.ChunkScratch.Num() < NumChunks * ChunkFloats)
+	{
+		Work.ChunkScratch.SetNumUninitialized(NumChunks * ChunkFloats);
+	}
+	float* ScratchData = Work.ChunkScratch.GetData();
+
+	ParallelFor(NumChunks, [NumGroups, NumChunks, Length, ChunkFloats, ScratchData, &Function](int32 Chunk)
+	{
+		ScratchType Scratch(ScratchData + Chunk * ChunkFloats, Length);
+
+		const uint32 BeginGroup = (uint32)((uint64)NumGroups * Chunk / NumChunks);
+		const uint32 EndGroup = (uint32)((uint64)NumGroups * (Chunk + 1) / NumChunks);
+		for (uint32 Group = BeginGroup; Group < EndGroup; Group++)
+		{
+			Function(Group, Scratch);
+		}
+	});
+}
+
+/** SimulateOcean()のパックしたIFFTのパスに相当する。 */
+void SimulateOceanCPUPacked(const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, FOceanCPUSimulationWork& Work, FOceanCPUDisplacement& OutDisplacement)
+{
+	const uint32 MapSize = Params.DispMapDimension;
+	const uint32 HalfRows = MapSize / 2 + 1;
+	const uint32 FieldStride = GetPackedFieldRows(MapSize) * MapSize;
+
+	ParallelForLaneGroups<FPackedSpectrumScratch>(Work, HalfRows, MapSize, [&Params, H0, Omega0, &Work](uint32 Row, FPackedSpectrumScratch& Scratch)
+	{
+		UpdatePackedSpectrumRow(Row, Params.AccumulatedTime, H0, Omega0, Work, Scratch.Values);
+	});
+
+	// 3フィールドぶんの行をまとめて行方向にIFFTする。0埋めの行は0のまま
+	ParallelForLaneGroups(Work, 3 * FieldStride / MapSize / 4, MapSize, [&Work](uint32 Group, FLaneFFTScratch& Scratch)
+	{
+		HorizontalIFFT4Rows(Work.PackedRe.GetData(), Work.PackedIm.GetData(), Group * 4, Work, Scratch);
+	});
+
+	float* const Outputs[3] = {OutDisplacement.Dx.GetData(), OutDisplacement.Dy.GetData(), OutDisplacement.Dz.GetData()};
+	const float Scales[3] = {Params.ChoppyScale, Params.ChoppyScale, 1.0f};
+	const uint32 GroupsPerField = MapSize / 8;
+
+	ParallelForLaneGroups(Work, 3 * GroupsPerField, MapSize, [&Work, &Outputs, &Scales, FieldStride, GroupsPerField](uint32 Group, FLaneFFTScratch& Scratch)
+	{
+		const uint32 Field = Group / GroupsPerField;
+		const uint32 FirstColumn = (Group % GroupsPerField) * 8;
+		PackedVerticalIFFT8Columns(&Work.PackedRe[Field * FieldStride], &Work.PackedIm[Field * FieldStride], FirstColumn, Scales[Field], Work, Scratch, Outputs[Field]);
+	});
+}
+} // namespace
+
+void SimulateOceanCPU(const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, FOceanCPUSimulationWork& Work, FOceanCPUDisplacement& OutDisplacement)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SimulateOceanCPU);
+
+	const uint32 MapSize = Params.DispMapDimension;
+	if (Work.DispMapDimension != MapSize || Work.bPackedIFFT != Params.bPackedIFFT)
+	{
+		Work.Init(MapSize, Params.bPackedIFFT);
+	}
+
+	if (OutDisplacement.DispMapDimension != MapSize)
+	{
+		OutDisplacement.Init(MapSize);
+	}
+
+	if (Params.bPackedIFFT)
+	{
+		SimulateOceanCPUPacked(Params, H0, Omega0, Work, OutDisplacement);
+		return;
+	}
+
+	ParallelFor(MapSize, [&Params, H0, Omega0, &Work, MapSize](int32 Row)
+	{
+		const uint32 Offset = Row * MapSize;
+		UpdateSpectrumRow(Row, MapSize, Params.AccumulatedTime, H0, Omega0, &Work.HtRe[Offset], &Work.HtIm[Offset], &Work.DkxRe[Offset], &Work.DkxIm[Offset], &Work.DkyRe[Offset], &Work.DkyIm[Offset]);
+	});
+
+	// 2次元IFFTは行方向、列方向の順に1次元IFFTを行う。どちらも4行（4列）をSIMDの4レーンでまとめて処理する
+	ParallelForLaneGroups(Work, MapSize / 4, MapSize, [&Work](uint32 Group, FLaneFFTScratch& Scratch)
+	{
+		HorizontalIFFT4Rows(Work.DkxRe.GetData(), Work.DkxIm.GetData(), Group * 4, Work, Scratch);
+		HorizontalIFFT4Rows(Work.DkyRe.GetData(), Work.DkyIm.GetData(), Group * 4, Work, Scratch);
+		HorizontalIFFT4Rows(Work.HtRe.GetData(), Work.HtIm.GetData(), Group * 4, Work, Scratch);
+	});
+
+	ParallelForLaneGroups(Work, MapSize / 4, MapSize, [&Params, &Work, &OutDisplacement](uint32 Group, FLaneFFTScratch& Scratch)
+	{
+		VerticalIFFT4Columns(Work.DkxRe.GetData(), Work.DkxIm.GetData(), Group * 4, Params.ChoppyScale, Work, Scratch, OutDisplacement.Dx.GetData());
+		VerticalIFFT4Columns(Work.DkyRe.GetData(), Work.DkyIm.GetData(), Group * 4, Params.ChoppyScale, Work, Scratch, OutDisplacement.Dy.GetData());
+		VerticalIFFT4Columns(Work.HtRe.GetData(), Work.HtIm.GetData(), Group * 4, 1.0f, Work, Scratch, OutDisplacement.Dz.GetData());
+	});
+}
+
+void SelectSpectrumComponents(const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, int32 NumComponents, FOceanSpectrumComponents& OutComponents)
+{
+	const uint32 MapSize = Params.DispMapDimension;
+	const int32 NumTexels = MapSize * MapSize;
+	NumComponents = FMath::Clamp(NumComponents, 0, NumTexels);
+
+	// エネルギーの小さい順のヒープで上位NumComponents個を保持する。
+	// H(k, t)はH(k, 0)とH(-k, 0)の両方から作られるので、その2つのエネルギーの和で比べる
+	typedef TPair<float, int32> FEnergyIndex;
+	const auto EnergyLess = [](const FEnergyIndex& A, const FEnergyIndex& B) { return A.Key < B.Key; };
+
+	TArray<FEnergyIndex> Heap;
+	Heap.Reserve(NumComponents + 1);
+
+	for (int32 Index = 0; Index < NumTexels && NumComponents > 0; Index++)
+	{
+		const uint32 x = Index % MapSize;
+		const uint32 y = Index / MapSize;
+		const uint32 MinusIndex = (MapSize - y - 1) * MapSize + (MapSize - x - 1);
+		const float Energy = H0[Index].SizeSquared() + H0[MinusIndex].SizeSquared();
+		if (Energy <= 0.0f)
+		{
+			continue;
+		}
+
+		if (Heap.Num() < NumComponents)
+		{
+			Heap.HeapPush(FEnergyIndex(Energy, Index), EnergyLess);
+		}
+		else if (Energy > Heap.HeapTop().Key)
+		{
+			Heap.HeapPopDiscard(EnergyLess, false);
+			Heap.HeapPush(FEnergyIndex(Energy, Index), EnergyLess);
+		}
+	}
+
+	OutComponents.DispMapDimension = MapSize;
+	OutComponents.PatchLength = Params.PatchLength;
+	OutComponents.ChoppyScale = Params.ChoppyScale;
+
+	// SIMDで4成分ずつ処理するので、振幅0の成分で4の倍数に埋める
+	const int32 NumPadded = Align(Heap.Num(), 4);
+	OutComponents.Kx.SetNumZeroed(NumPadded);
+	OutComponents.Ky.SetNumZeroed(NumPadded);
+	OutComponents.KxNorm.SetNumZeroed(NumPadded);
+	OutComponents.KyNorm.SetNumZeroed(NumPadded);
+	OutComponents.H0Re.SetNumZeroed(NumPadded);
+	OutComponents.H0Im.SetNumZeroed(NumPadded);
+	OutComponents.H0MinusRe.SetNumZeroed(NumPadded);
+	OutComponents.H0MinusIm.SetNumZeroed(NumPadded);
+	OutComponents.Omega.SetNumZeroed(NumPadded);
+
+	for (int32 i = 0; i < Heap.Num(); i++)
+	{
+		const int32 Index = Heap[i].Value;
+		const uint32 x = Index % MapSize;
+		const uint32 y = Index / MapSize;
+		const uint32 MinusIndex = (MapSize - y - 1) * MapSize + (MapSize - x - 1);
+
+		// UpdateSpectrumCSと同じく、インデックスの中心をk = 0とする
+		const FVector2D KIndex((float)x - MapSize * 0.5f, (float)y - MapSize * 0.5f);
+		const FVector2D& K = KIndex * (2.0f * PI / Params.PatchLength);
+		const FVector2D& KNorm = KIndex.GetSafeNormal();
+
+		OutComponents.Kx[i] = K.X;
+		OutComponents.Ky[i] = K.Y;
+		OutComponents.KxNorm[i] = KNorm.X;
+		OutComponents.KyNorm[i] = KNorm.Y;
+		OutComponents.H0Re[i] = H0[Index].X;
+		OutComponents.H0Im[i] = H0[Index].Y;
+		OutComponents.H0MinusRe[i] = H0[MinusIndex].X;
+		OutComponents.H0MinusIm[i] = H0[MinusIndex].Y;
+		OutComponents.Omega[i] = Omega0[Index];
+	}
+}
+
+namespace
+{
+float HorizontalSum(const VectorRegister& Vec)
+{
+	float Components[4];
+	VectorStore(Vec, Components);
+	return Components[0] + Components[1] + Components[2] + Components[3];
+}
+
+/** 1点の変位をスペクトラム成分の和で求める。Dx、Dy、DzはSimulateOceanCPU()のIFFTの結果をテクセル間で連続に補間したものになる。 */
+FVector EvaluateSpectrumComponentsAt(const FOceanSpectrumComponents& Components, const float* HtRe, const float* HtIm, const FVector2D& Position)
+{
+	const float PatchLength = Components.PatchLength;
+
+	// テクセル(x, y)の中心はUVの((x + 0.5) / DispMapDimension, (y + 0.5) / DispMapDimension)にある。
+	// また変位はPatchLengthの周期を持つので、sincosの引数が大きくならないように折り返しておく
+	const float TexelOffset = 0.5f * PatchLength / Components.DispMapDimension;
+	float X = Position.X - TexelOffset;
+	float Y = Position.Y - TexelOffset;
+	X -= PatchLength * FMath::FloorToFloat(X / PatchLength);
+	Y -= PatchLength * FMath::FloorToFloat(Y / PatchLength);
+
+	const VectorRegister PositionX = VectorSetFloat1(X);
+	const VectorRegister PositionY = VectorSetFloat1(Y);
+	VectorRegister SumX = VectorZero();
+	VectorRegister SumY = VectorZero();
+	VectorRegister SumZ = VectorZero();
+
+	for (int32 c = 0; c < Components.Num(); c += 4)
+	{
+		// Z = H(k, t) * e^(-i * k・x)。IFFT後の符号補正cos(pi * (m1 + m2))はkの中心をずらすことに相当するので、ここでは不要
+		const VectorRegister Phase = VectorNegate(VectorMultiplyAdd(VectorLoadAligned(&Components.Kx[c]), PositionX, VectorMultiply(VectorLoadAligned(&Components.Ky[c]), PositionY)));
+		VectorRegister Sin, Cos;
+		VectorSinCos(&Sin, &Cos, &Phase);
+
+		const VectorRegister Re = VectorLoadAligned(&HtRe[c]);
+		const VectorRegister Im = VectorLoadAligned(&HtIm[c]);
+		const VectorRegister ZRe = VectorSubtract(VectorMultiply(Re, Cos), VectorMultiply(Im, Sin));
+		const VectorRegister ZIm = VectorMultiplyAdd(Re, Sin, VectorMultiply(Im, Cos));
+
+		// Dz = Re(Z)、D(k, t) = -i * k / |k| * H(k, t)なのでDx = Re(-i * kx / |k| * Z) = kx / |k| * Im(Z)
+		SumZ = VectorAdd(SumZ, ZRe);
+		SumX = VectorMultiplyAdd(VectorLoadAligned(&Components.KxNorm[c]), ZIm, SumX);
+		SumY = VectorMultiplyAdd(VectorLoadAligned(&Components.KyNorm[c]), ZIm, SumY);
+	}
+
+	return FVector(HorizontalSum(SumX) * Components.ChoppyScale, HorizontalSum(SumY) * Components.ChoppyScale, HorizontalSum(SumZ));
+}
+} // namespace
+
+void EvaluateSpectrumComponents(const FOceanSpectrumComponents& Components, float Time, int32 NumInverseIterations, TArrayView<const FVector2D> Positions, TArrayView<FVector> OutDisplacements)
+{
+	EvaluateSpectrumComponents(MakeArrayView(&Components, 1), Time, NumInverseIterations, Positions, OutDisplacements);
+}
+
+void EvaluateSpectrumComponents(TArrayView<const FOceanSpectrumComponents> Cascades, float Time, int32 NumInverseIterations, TArrayView<const FVector2D> Positions, TArrayView<FVector> OutDisplacements)
+{
+	check(Positions.Num() == OutDisplacements.Num());
+
+	// H(k, t)は全点で共通なので先に計算しておく。各カスケードのものを連続して並べる。
+	// 各カスケードの成分数は4の倍数なので、カスケードの先頭も16バイト境界に揃う
+	int32 TotalComponents = 0;
+	for (const FOceanSpectrumComponents& Components : Cascades)
+	{
+		TotalComponents += Components.Num();
+	}
+
+	TArray<float, TAlignedHeapAllocator<16>> HtRe;
+	TArray<float, TAlignedHeapAllocator<16>> HtIm;
+	HtRe.SetNumUninitialized(TotalComponents);
+	HtIm.SetNumUninitialized(TotalComponents);
+
+	const VectorRegister TimeV = VectorSetFloat1(Time);
+	int32 CascadeHead = 0;
+	for (const FOceanSpectrumComponents& Components : Cascades)
+	{
+		for (int32 c = 0; c < Components.Num(); c += 4)
+		{
+			const VectorRegister Hk0Re = VectorLoadAligned(&Components.H0Re[c]);
+			const VectorRegister Hk0Im = VectorLoadAligned(&Components.H0Im[c]);
+			const VectorRegister Hminusk0Re = VectorLoadAligned(&Components.H0MinusRe[c]);
+			const VectorRegister Hminusk0Im = VectorLoadAligned(&Components.H0MinusIm[c]);
+
+			const VectorRegister Angle = VectorMultiply(VectorLoadAligned(&Components.Omega[c]), TimeV);
+			VectorRegister SinOmega, CosOmega;
+			VectorSinCos(&SinOmega, &CosOmega, &Angle);
+
+			VectorStoreAligned(VectorSubtract(VectorMultiply(VectorAdd(Hk0Re, Hminusk0Re), CosOmega), VectorMultiply(VectorAdd(Hk0Im, Hminusk0Im), SinOmega)), &HtRe[CascadeHead + c]);
+			VectorStoreAligned(VectorAdd(VectorMultiply(VectorSubtract(Hk0Re, Hminusk0Re), SinOmega), VectorMultiply(VectorSubtract(Hk0Im, Hminusk0Im), CosOmega)), &HtIm[CascadeHead + c]);
+		}
+		CascadeHead += Components.Num();
+	}
+
+	// 描画される面の変位は全カスケードの変位の和
+	auto EvaluateCascadesAt = [&Cascades, &HtRe, &HtIm](const FVector2D& Position)
+	{
+		FVector Sum = FVector::ZeroVector;
+		int32 Head = 0;
+		for (const FOceanSpectrumComponents& Components : Cascades)
+		{
+			Sum += EvaluateSpectrumComponentsAt(Components, HtRe.GetData() + Head, HtIm.GetData() + Head, Position);
+			Head += Components.Num();
+		}
+		return Sum;
+	};
+
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		// 描画される面はグリッド点PをP + D(P)に動かしたものなので、P + D(P).XY = Positionとなる点Pを不動点反復で探す
+		const FVector2D& Position = Positions[i];
+		FVector Displacement = EvaluateCascadesAt(Position);
+		for (int32 Iteration = 0; Iteration < NumInverseIterations; Iteration++)
+		{
+			Displacement = EvaluateCascadesAt(Position - FVector2D(Displacement.X, Displacement.Y));
+		}
+
+		OutDisplacements[i] = Displacement;
+	}
+}
+
+namespace
+{
+void BenchmarkCPUSimulation(const TArray<FString>& Args)
+{
+	const int32 NumFrames = (Args.Num() > 0) ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 60;
+	const uint32 Dimensions[] = {128, 256, 512};
+
+	for (uint32 Dimension : Dimensions)
+	{
+		FOceanSpectrumParameters Params;
+		Params.DispMapDimension = Dimension;
+
+		TResourceArray<FComplex> H0Data;
+		H0Data.Init(FComplex::ZeroVector, Dimension * Dimension);
+		TResourceArray<float> Omega0Data;
+		Omega0Data.Init(0.0f, Dimension * Dimension);
+		CreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+
+		double ElapsedMs[2];
+		for (int32 Packed = 0; Packed < 2; Packed++)
+		{
+			Params.bPackedIFFT = (Packed != 0);
+			Params.AccumulatedTime = 0.0f;
+
+			FOceanCPUSimulationWork Work;
+			FOceanCPUDisplacement Displacement;
+			// 作業バッファの確保を計測に含めないように1回空回しする
+			SimulateOceanCPU(Params, H0Data.GetData(), Omega0Data.GetData(), Work, Displacement);
+
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				Params.AccumulatedTime += 1.0f / 60.0f;
+				SimulateOceanCPU(Params, H0Data.GetData(), Omega0Data.GetData(), Work, Displacement);
+			}
+			ElapsedMs[Packed] = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+		}
+
+		UE_LOG(LogTemp, Log, TEXT("Ocean CPU simulation %ux%u: %.3f ms/frame, packed IFFT %.3f ms/frame (%d frames)"), Dimension, Dimension, ElapsedMs[0] / NumFrames, ElapsedMs[1] / NumFrames, NumFrames);
+	}
+}
+
+void BenchmarkInitialHeightMapCache(const TArray<FString>& Args)
+{
+	const uint32 Dimensions[] = {256, 512, 1024};
+
+	for (uint32 Dimension : Dimensions)
+	{
+		FOceanSpectrumParameters Params;
+		Params.DispMapDimension = Dimension;
+
+		TResourceArray<FComplex> H0Data;
+		H0Data.Init(FComplex::ZeroVector, Dimension * Dimension);
+		TResourceArray<float> Omega0Data;
+		Omega0Data.Init(0.0f, Dimension * Dimension);
+
+		double StartTime = FPlatformTime::Seconds();
+		CreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+		const double GenerateMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+		// 1回目でキャッシュが無ければ作られるので、2回目を計測する
+		LoadOrCreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+		StartTime = FPlatformTime::Seconds();
+		const bool bLoaded = LoadOrCreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+		const double LoadMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+		UE_LOG(LogTemp, Log, TEXT("Ocean initial height map %ux%u: generate %.2f ms, %s %.2f ms"), Dimension, Dimension, GenerateMs, bLoaded ? TEXT("cache load") : TEXT("cache disabled or unwritable, regenerate"), LoadMs);
+	}
+}
+
+FAutoConsoleCommand BenchmarkInitialHeightMapCacheCommand(
+	TEXT("ShaderSandbox.Ocean.BenchmarkInitialHeightMapCache"),
+	TEXT("Compares the time to generate H0 and Omega0 with the time to load them from the cache at 256, 512 and 1024."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkInitialHeightMapCache)
+);
+
+FAutoConsoleCommand BenchmarkCPUSimulationCommand(
+	TEXT("ShaderSandbox.Ocean.BenchmarkCPUSimulation"),
+	TEXT("Measures ms/frame of SimulateOceanCPU() with and without bPackedIFFT at 128, 256 and 512. Optional argument is the number of frames (default 60)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkCPUSimulation)
+);
+} // namespace
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FOceanPackedIFFTTest, "ShaderSandbox.Ocean.PackedIFFT", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FOceanPackedIFFTTest::RunTest(const FString& Parameters)
+{
+	// 相対誤差の許容値。単精度のFFTの丸め誤差の蓄積よりは十分大きく、スペクトラムの取り違えよりは十分小さい値。
+	// 速度はShaderSandbox.Ocean.BenchmarkCPUSimulationで測る
+	const float Tolerance = 1e-5f;
+	const uint32 Dimensions[] = {8, 64, 256, 512};
+	const float Times[] = {0.0f, 1.7f, 37.3f};
+
+	for (uint32 Dimension : Dimensions)
+	{
+		FOceanSpectrumParameters Params;
+		Params.DispMapDimension = Dimension;
+
+		TResourceArray<FComplex> H0Data;
+		H0Data.Init(FComplex::ZeroVector, Dimension * Dimension);
+		TResourceArray<float> Omega0Data;
+		Omega0Data.Init(0.0f, Dimension * Dimension);
+		CreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+
+		FOceanCPUSimulationWork Work;
+		FOceanCPUSimulationWork PackedWork;
+		FOceanCPUDisplacement Displacement;
+		FOceanCPUDisplacement PackedDisplacement;
+
+		float MaxError = 0.0f;
+		float MaxAbsDisplacement = 0.0f;
+		for (float Time : Times)
+		{
+			Params.AccumulatedTime = Time;
+			Params.bPackedIFFT = false;
+			SimulateOceanCPU(Params, H0Data.GetData(), Omega0Data.GetData(), Work, Displacement);
+			Params.bPackedIFFT = true;
+			SimulateOceanCPU(Params, H0Data.GetData(), Omega0Data.GetData(), PackedWork, PackedDisplacement);
+
+			for (uint32 i = 0; i < Dimension * Dimension; i++)
+			{
+				MaxError = FMath::Max3(MaxError, FMath::Abs(PackedDisplacement.Dx[i] - Displacement.Dx[i]), FMath::Max(FMath::Abs(PackedDisplacement.Dy[i] - Displacement.Dy[i]), FMath::Abs(PackedDisplacement.Dz[i] - Displacement.Dz[i])));
+				MaxAbsDisplacement = FMath::Max(MaxAbsDisplacement, Displacement.GetDisplacement(i % Dimension, i / Dimension).GetAbsMax());
+			}
+		}
+
+		const float RelativeError = MaxError / FMath::Max(MaxAbsDisplacement, SMALL_NUMBER);
+		AddInfo(FString::Printf(TEXT("%ux%u: max error %g (relative %g)"), Dimension, Dimension, MaxError, RelativeError));
+		TestTrue(FString::Printf(TEXT("%ux%u relative error within %g"), Dimension, Dimension, Tolerance), RelativeError <= Tolerance);
+	}
+
+	return true;
+}
+
+namespace
+{
+/** Error of one GPU path measured on the render thread and checked on the game thread. */
+struct FOceanGPUErrorResult
+{
+	uint32 Dimension = 0;
+	bool bPackedIFFT = false;
+	float MaxError = 0.0f;
+	float RelativeError = 0.0f;
+	double RelativeRMSError = 0.0;
+};
+
+/** Spectrum of the GPU tests at FFTLength. */
+FOceanSpectrumParameters MakeGPUTestSpectrumParameters(uint32 FFTLength, bool bHalfPrecision, bool bPackedIFFT)
+{
+	FOceanSpectrumParameters Params;
+	Params.DispMapDimension = FFTLength;
+	Params.AccumulatedTime = 1.7f;
+	Params.bHalfPrecision = bHalfPrecision;
+	Params.bPackedIFFT = bPackedIFFT;
+	return Params;
+}
+
+/**
+ * Runs SimulateOcean() once on the spectrum of MakeGPUTestSpectrumParameters() and reads the displacement map back as Y * FFTLength + X. Render thread only.
+ * The map is PF_FloatRGBA with bHalfPrecision, the format it is meant to be paired with, otherwise PF_A32B32G32R32F.
+ */
+void SimulateOceanGPUForTest(FRHICommandListImmediate& RHICmdList, uint32 FFTLength, bool bHalfPrecision, bool bPackedIFFT, TArray<FVector>& OutDisplacement)
+{
+	const FOceanSpectrumParameters Params = MakeGPUTestSpectrumParameters(FFTLength, bHalfPrecision, bPackedIFFT);
+
+	TResourceArray<FComplex> H0Data;
+	H0Data.Init(FComplex::ZeroVector, FFTLength * FFTLength);
+	TResourceArray<float> Omega0Data;
+	Omega0Data.Init(0.0f, FFTLength * FFTLength);
+	CreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+
+	TResourceArray<uint32> PackedH0Data;
+	if (bHalfPrecision)
+	{
+		PackOceanComplexToHalf(H0Data, PackedH0Data);
+	}
+
+	// レンダースレッドから呼ぶとInitialize()のレンダーコマンドはその場で実行される
+	FResourceArrayStructuredBuffer H0Buffer;
+	FResourceArrayStructuredBuffer Omega0Buffer;
+	FResourceArrayStructuredBuffer DxBuffer;
+	FResourceArrayStructuredBuffer DyBuffer;
+	FResourceArrayStructuredBuffer DzBuffer;
+	if (bHalfPrecision)
+	{
+		H0Buffer.Initialize(PackedH0Data, GetOceanComplexStride(true));
+	}
+	else
+	{
+		H0Buffer.Initialize(H0Data, sizeof(FComplex));
+	}
+	Omega0Buffer.Initialize(Omega0Data, sizeof(float));
+	DxBuffer.Initialize(sizeof(float), FFTLength * FFTLength);
+	DyBuffer.Initialize(sizeof(float), FFTLength * FFTLength);
+	DzBuffer.Initialize(sizeof(float), FFTLength * FFTLength);
+
+	const EPixelFormat Format = bHalfPrecision ? PF_FloatRGBA : PF_A32B32G32R32F;
+	FRHIResourceCreateInfo CreateInfo;
+	FTexture2DRHIRef DisplacementMap = RHICreateTexture2D(FFTLength, FFTLength, Format, 1, 1, TexCreate_ShaderResource | TexCreate_UAV, CreateInfo);
+	FTexture2DRHIRef GradientFoldingMap = RHICreateTexture2D(FFTLength, FFTLength, Format, 1, 1, TexCreate_ShaderResource | TexCreate_UAV, CreateInfo);
+	FShaderResourceViewRHIRef DisplacementMapSRV = RHICreateShaderResourceView(DisplacementMap, 0);
+	FUnorderedAccessViewRHIRef DisplacementMapUAV = RHICreateUnorderedAccessView(DisplacementMap);
+	FUnorderedAccessViewRHIRef GradientFoldingMapUAV = RHICreateUnorderedAccessView(GradientFoldingMap);
+
+	FOceanBufferViews Views;
+	Views.H0SRV = H0Buffer.GetSRV();
+	Views.OmegaSRV = Omega0Buffer.GetSRV();
+	Views.DxSRV = DxBuffer.GetSRV();
+	Views.DxUAV = DxBuffer.GetUAV();
+	Views.DySRV = DyBuffer.GetSRV();
+	Views.DyUAV = DyBuffer.GetUAV();
+	Views.DzSRV = DzBuffer.GetSRV();
+	Views.DzUAV = DzBuffer.GetUAV();
+	Views.DisplacementMapSRV = DisplacementMapSRV;
+	Views.DisplacementMapUAV = DisplacementMapUAV;
+	Views.GradientFoldingMapUAV = GradientFoldingMapUAV;
+
+	SimulateOcean(RHICmdList, Params, Views);
+
+	TArray<FLinearColor> Texels;
+	RHICmdList.ReadSurfaceData(DisplacementMap, FIntRect(0, 0, FFTLength, FFTLength), Texels, FReadSurfaceDataFlags(RCM_MinMax));
+	OutDisplacement.Reset(Texels.Num());
+	for (const FLinearColor& Texel : Texels)
+	{
+		OutDisplacement.Emplace(Texel.R, Texel.G, Texel.B);
+	}
+
+	H0Buffer.ReleaseResource();
+	Omega0Buffer.ReleaseResource();
+	DxBuffer.ReleaseResource();
+	DyBuffer.ReleaseResource();
+	DzBuffer.ReleaseResource();
+}
+
+/** Max and RMS error of Displacement against Reference, relative to the max and RMS of Reference. */
+FOceanGPUErrorResult MeasureOceanGPUError(uint32 Dimension, bool bPackedIFFT, const TArray<FVector>& Reference, const TArray<FVector>& Displacement)
+{
+	check(Reference.Num() == Displacement.Num());
+
+	float MaxError = 0.0f;
+	float MaxAbsDisplacement = 0.0f;
+	double SquaredErrorSum = 0.0;
+	double SquaredDisplacementSum = 0.0;
+	for (int32 i = 0; i < Reference.Num(); i++)
+	{
+		const FVector Error = Reference[i] - Displacement[i];
+		MaxError = FMath::Max(MaxError, Error.GetAbsMax());
+		MaxAbsDisplacement = FMath::Max(MaxAbsDisplacement, Reference[i].GetAbsMax());
+		SquaredErrorSum += Error.SizeSquared();
+		SquaredDisplacementSum += Reference[i].SizeSquared();
+	}
+
+	FOceanGPUErrorResult Result;
+	Result.Dimension = Dimension;
+	Result.bPackedIFFT = bPackedIFFT;
+	Result.MaxError = MaxError;
+	Result.RelativeError = MaxError / FMath::Max(MaxAbsDisplacement, SMALL_NUMBER);
+	Result.RelativeRMSError = FMath::Sqrt(SquaredErrorSum / FMath::Max(SquaredDisplacementSum, (double)SMALL_NUMBER));
+	return Result;
+}
+} // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FOceanFFTLengthsTest, "ShaderSandbox.Ocean.FFTLengths", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FOceanFFTLengthsTest::RunTest(const FString& Parameters)
+{
+	if (!FApp::CanEverRender() || !IsFeatureLevelSupported(GMaxRHIShaderPlatform, ERHIFeatureLevel::SM5))
+	{
+		AddInfo(TEXT("Skipped: SimulateOcean() needs an SM5 RHI."));
+		return true;
+	}
+
+	// 相対誤差の許容値。GPUとCPUでは演算順序もsin、cosの精度も異なるのでShaderSandbox.Ocean.PackedIFFTのテストより緩くする
+	const float Tolerance = 1e-3f;
+
+	// レンダースレッドで計測してゲームスレッドで判定する
+	TArray<FOceanGPUErrorResult> Results;
+	TArray<FOceanGPUErrorResult>* ResultsPtr = &Results;
+	ENQUEUE_RENDER_COMMAND(VerifyOceanFFTLengths)(
+		[ResultsPtr](FRHICommandListImmediate& RHICmdList)
+		{
+			for (uint32 Dimension = FFT::MinFFTLength; Dimension <= FFT::MaxFFTLength; Dimension *= 2)
+			{
+				// CPU版を参照実装とし、GPUのパックしない経路とパックした経路の両方と比較する
+				const FOceanSpectrumParameters Params = MakeGPUTestSpectrumParameters(Dimension, false, false);
+				TResourceArray<FComplex> H0Data;
+				H0Data.Init(FComplex::ZeroVector, Dimension * Dimension);
+				TResourceArray<float> Omega0Data;
+				Omega0Data.Init(0.0f, Dimension * Dimension);
+				CreateInitialHeightMap(Params, -980.0f, H0Data, Omega0Data);
+
+				FOceanCPUSimulationWork Work;
+				FOceanCPUDisplacement CPUDisplacement;
+				SimulateOceanCPU(Params, H0Data.GetData(), Omega0Data.GetData(), Work, CPUDisplacement);
+
+				TArray<FVector> Reference;
+				Reference.Reserve(Dimension * Dimension);
+				for (uint32 y = 0; y < Dimension; y++)
+				{
+					for (uint32 x = 0; x < Dimension; x++)
+					{
+						Reference.Add(CPUDisplacement.GetDisplacement(x, y));
+					}
+				}
+
+				for (bool bPackedIFFT : {false, true})
+				{
+					TArray<FVector> GPUDisplacement;
+					SimulateOceanGPUForTest(RHICmdList, Dimension, false, bPackedIFFT, GPUDisplacement);
+					ResultsPtr->Add(MeasureOceanGPUError(Dimension, bPackedIFFT, Reference, GPUDisplacement));
+				}
+			}
+		});
+	FlushRenderingCommands();
+
+	for (const FOceanGPUErrorResult& Result : Results)
+	{
+		const TCHAR* PathName = Result.bPackedIFFT ? TEXT(" (packed)") : TEXT("");
+		AddInfo(FString::Printf(TEXT("%ux%u%s: max error %g (relative %g)"), Result.Dimension, Result.Dimension, PathName, Result.MaxError, Result.RelativeError));
+		TestTrue(FString::Printf(TEXT("%ux%u%s relative error within %g"), Result.Dimension, Result.Dimension, PathName, Tolerance), Result.RelativeError <= Tolerance);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FOceanHalfPrecisionTest, "ShaderSandbox.Ocean.HalfPrecision", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FOceanHalfPrecisionTest::RunTest(const FString& Parameters)
+{
+	if (!FApp::CanEverRender() || !IsFeatureLevelSupported(GMaxRHIShaderPlatform, ERHIFeatureLevel::SM5))
+	{
+		AddInfo(TEXT("Skipped: SimulateOcean() needs an SM5 RHI."));
+		return true;
+	}
+
+	// 最大誤差の最大変位に対する許容値とRMS誤差のRMS変位に対する許容値。
+	// 512、デフォルトのスペクトラムでシェーダのhalfの丸めをCPUで再現して計測した誤差は、最大7.4e-4、RMS 5.2e-4（パックしたIFFTでは7.4e-4、5.1e-4）。
+	// H0のFFloat16への変換が切り捨てだった場合でも最大9.3e-4、RMS 6.5e-4だったので、それに余裕を持たせた値にする
+	const float Tolerance = 1.5e-3f;
+	const float RMSTolerance = 1e-3f;
+
+	// レンダースレッドで計測してゲームスレッドで判定する
+	TArray<FOceanGPUErrorResult> Results;
+	TArray<FOceanGPUErrorResult>* ResultsPtr = &Results;
+	ENQUEUE_RENDER_COMMAND(VerifyOceanHalfPrecision)(
+		[ResultsPtr](FRHICommandListImmediate& RHICmdList)
+		{
+			const uint32 Dimension = 512;
+
+			// fp32の経路を参照とし、half精度の経路と比較する
+			for (bool bPackedIFFT : {false, true})
+			{
+				TArray<FVector> Reference;
+				SimulateOceanGPUForTest(RHICmdList, Dimension, false, bPackedIFFT, Reference);
+				TArray<FVector> HalfDisplacement;
+				SimulateOceanGPUForTest(RHICmdList, Dimension, true, bPackedIFFT, HalfDisplacement);
+				ResultsPtr->Add(MeasureOceanGPUError(Dimension, bPackedIFFT, Reference, HalfDisplacement));
+			}
+		});
+	FlushRenderingCommands();
+
+	for (const FOceanGPUErrorResult& Result : Results)
+	{
+		const TCHAR* PathName = Result.bPackedIFFT ? TEXT(" (packed)") : TEXT("");
+		AddInfo(FString::Printf(TEXT("%ux%u%s: max error %g (relative %g), relative RMS error %g"), Result.Dimension, Result.Dimension, PathName, Result.MaxError, Result.RelativeError, Result.RelativeRMSError));
+		TestTrue(FString::Printf(TEXT("%ux%u%s relative error within %g"), Result.Dimension, Result.Dimension, PathName, Tolerance), Result.RelativeError <= Tolerance);
+		TestTrue(FString::Printf(TEXT("%ux%u%s relative RMS error within %g"), Result.Dimension, Result.Dimension, PathName, RMSTolerance), Result.RelativeRMSError <= RMSTolerance);
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
+
 } // namespace OceanSimulator
 
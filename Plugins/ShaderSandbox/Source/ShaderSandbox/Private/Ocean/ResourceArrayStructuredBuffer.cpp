@@ -25,6 +25,37 @@ void FResourceArrayStructuredBuffer::Initialize(FResourceArrayInterface& Data, u
 		});
 }
 
+void FResourceArrayStructuredBuffer::Initialize(uint32 ByteStride, uint32 NumElements)
+{
+	ENQUEUE_RENDER_COMMAND(InitializeResourceArrayStructuredBuffer)(
+		[ByteStride, NumElements, this](FRHICommandListImmediate& RHICmdList)
+		{
+			if (IsInitialized())
+			{
+				ReleaseResource();
+			}
+
+			InitResource();
+
+			// 初期データを渡さないのでCPU側に配列を持たずに済む。中身は不定
+			FRHIResourceCreateInfo ResourceCreateInfo;
+
+			StructuredBuffer = RHICreateStructuredBuffer(ByteStride, ByteStride * NumElements, EBufferUsageFlags::BUF_Static | EBufferUsageFlags::BUF_ShaderResource | EBufferUsageFlags::BUF_UnorderedAccess, ResourceCreateInfo);
+			SRV = RHICreateShaderResourceView(StructuredBuffer);
+			UAV = RHICreateUnorderedAccessView(StructuredBuffer, false, false);
+		});
+}
+
+void FResourceArrayStructuredBuffer::Update(const void* Data, uint32 NumBytes)
+{
+	check(IsInRenderingThread());
+	check(StructuredBuffer.IsValid());
+
+	void* BufferData = RHILockStructuredBuffer(StructuredBuffer, 0, NumBytes, RLM_WriteOnly);
+	FMemory::Memcpy(BufferData, Data, NumBytes);
+	RHIUnlockStructuredBuffer(StructuredBuffer);
+}
+
 void FResourceArrayStructuredBuffer::ReleaseDynamicRHI()
 {
 	UAV.SafeRelease();
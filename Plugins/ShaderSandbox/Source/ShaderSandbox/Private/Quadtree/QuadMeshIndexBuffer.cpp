@@ -0,0 +1,101 @@
+#include "Quadtree/QuadMeshIndexBuffer.h"
+#include "RenderingThread.h"
+
+DEFINE_STAT(STAT_QuadMeshIndexBytesSaved);
+
+namespace
+{
+using namespace Quadtree;
+
+// NumGridDivisionごとの共有インデックスバッファ。ゲームスレッドからのみアクセスする。
+// 最後の参照はシーンプロキシのデストラクタでレンダースレッドから外れることもあるのでTWeakPtrで持ち、Pin()できなくなったものはAcquire()とRelease()で削除する
+TMap<int32, TWeakPtr<FQuadMeshIndexBuffer, ESPMode::ThreadSafe>> GQuadMeshIndexBuffers;
+
+void RemoveExpiredQuadMeshIndexBuffers()
+{
+	for (TMap<int32, TWeakPtr<FQuadMeshIndexBuffer, ESPMode::ThreadSafe>>::TIterator It(GQuadMeshIndexBuffers); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void UpdateBytesSavedStat()
+{
+	int64 BytesSaved = 0;
+
+	for (const TPair<int32, TWeakPtr<FQuadMeshIndexBuffer, ESPMode::ThreadSafe>>& Pair : GQuadMeshIndexBuffers)
+	{
+		const FQuadMeshIndexBufferPtr& Buffer = Pair.Value.Pin();
+		if (Buffer.IsValid() && Buffer->GetNumComponents() > 0)
+		{
+			// 81パターンを丸ごと持つインデックスバッファを各コンポーネントが持っていた場合との差
+			const int64 UndedupedBytes = (int64)CalculateUndedupedQuadMeshIndexCount(Buffer->GetQuadMeshParams()) * sizeof(uint32);
+			BytesSaved += UndedupedBytes * Buffer->GetNumComponents() - Buffer->Indices.GetAllocatedSize();
+		}
+	}
+
+	SET_MEMORY_STAT(STAT_QuadMeshIndexBytesSaved, BytesSaved);
+}
+} // namespace
+
+namespace Quadtree
+{
+FQuadMeshIndexBufferPtr FQuadMeshIndexBuffer::Acquire(int32 NumGridDivision)
+{
+	check(IsInGameThread());
+
+	RemoveExpiredQuadMeshIndexBuffers();
+
+	FQuadMeshIndexBufferPtr Ret;
+	if (TWeakPtr<FQuadMeshIndexBuffer, ESPMode::ThreadSafe>* Found = GQuadMeshIndexBuffers.Find(NumGridDivision))
+	{
+		Ret = Found->Pin();
+	}
+
+	if (!Ret.IsValid())
+	{
+		// 参照がすべて外れたらレンダースレッドでリソースを解放してから削除する。
+		// レンダースレッドから呼ばれた場合はENQUEUE_RENDER_COMMANDはその場で実行される
+		Ret = FQuadMeshIndexBufferPtr(new FQuadMeshIndexBuffer(), [](FQuadMeshIndexBuffer* Buffer)
+		{
+			ENQUEUE_RENDER_COMMAND(ReleaseQuadMeshIndexBuffer)(
+				[Buffer](FRHICommandListImmediate& RHICmdList)
+				{
+					Buffer->ReleaseResource();
+					delete Buffer;
+				});
+		});
+
+		CreateQuadMeshes(NumGridDivision, Ret->Indices, Ret->QuadMeshParams);
+		BeginInitResource(Ret.Get());
+
+		GQuadMeshIndexBuffers.Add(NumGridDivision, Ret);
+	}
+
+	Ret->NumComponents++;
+	UpdateBytesSavedStat();
+	return Ret;
+}
+
+void FQuadMeshIndexBuffer::Release(FQuadMeshIndexBufferPtr& Buffer)
+{
+	check(IsInGameThread());
+
+	if (!Buffer.IsValid())
+	{
+		return;
+	}
+
+	// GQuadMeshIndexBuffersからはここでは削除しない。シーンプロキシが参照を持っている間は次のAcquire()で再利用できるように。
+	// プロキシがすでに解放されていて最後の参照だったら、ここで削除される
+	Buffer->NumComponents--;
+	check(Buffer->NumComponents >= 0);
+	Buffer.Reset();
+	RemoveExpiredQuadMeshIndexBuffers();
+	UpdateBytesSavedStat();
+}
+} // namespace Quadtree
+
@@ -0,0 +1,196 @@
+#include "Quadtree/QuadNodeInstancedMesh.h"
+#include "DeformMesh/DeformableVertexBuffers.h"
+
+namespace Quadtree
+{
+FVector4* FQuadNodeInstanceVertexBuffer::Lock(uint32 NumElements, bool& bOutReallocated)
+{
+	check(IsInRenderingThread());
+	check(NumElements > 0);
+
+	bOutReallocated = false;
+	if (NumElements > Capacity)
+	{
+		// QuadNodeの数はカメラの移動で毎フレーム少しずつ変わるので、2のべき乗に切り上げて作り直しの回数を抑える
+		Capacity = FMath::RoundUpToPowerOfTwo(FMath::Max(NumElements, 64u));
+		if (IsInitialized())
+		{
+			ReleaseResource();
+		}
+		InitResource();
+		bOutReallocated = true;
+	}
+
+	// 毎フレーム全体を書き直すのでRLM_WriteOnlyでロックし、前フレームの描画が参照している内容とは別の領域をRHIに用意させる
+	return (FVector4*)RHILockVertexBuffer(VertexBufferRHI, 0, NumElements * sizeof(FVector4), RLM_WriteOnly);
+}
+
+void FQuadNodeInstanceVertexBuffer::Unlock()
+{
+	check(IsInRenderingThread());
+	RHIUnlockVertexBuffer(VertexBufferRHI);
+}
+
+void FQuadNodeInstanceVertexBuffer::InitRHI()
+{
+	check(Capacity > 0);
+
+	FRHIResourceCreateInfo CreateInfo;
+	VertexBufferRHI = RHICreateVertexBuffer(Capacity * sizeof(FVector4), BUF_Dynamic | BUF_ShaderResource, CreateInfo);
+	SRV = RHICreateShaderResourceView(VertexBufferRHI, sizeof(FVector4), PF_A32B32G32R32F);
+}
+
+void FQuadNodeInstanceVertexBuffer::ReleaseRHI()
+{
+	SRV.SafeRelease();
+	FVertexBuffer::ReleaseRHI();
+}
+
+FQuadNodeInstancedMesh::FQuadNodeInstancedMesh(ERHIFeatureLevel::Type InFeatureLevel)
+	: VertexFactory(InFeatureLevel)
+{
+}
+
+FQuadNodeInstancedMesh::~FQuadNodeInstancedMesh()
+{
+	VertexFactory.ReleaseResource();
+	InstanceOriginBuffer.ReleaseResource();
+	InstanceTransformBuffer.ReleaseResource();
+	InstanceLightmapBuffer.ReleaseResource();
+}
+
+void FQuadNodeInstancedMesh::Init(const FQuadtreeBuildResult& Result, const FMatrix& LocalToWorld, int32 MaxLOD, float MeshLength, const FDeformableVertexBuffers& VertexBuffers)
+{
+	check(IsInRenderingThread());
+
+	const TArray<FQuadNode>& RenderList = Result.RenderQuadNodeList;
+	const uint32 NumInstances = RenderList.Num();
+	check(NumInstances > 0);
+	check(Result.QuadMeshParamsIndices.Num() == RenderList.Num());
+
+	// メッシュパターンをキーにしてカウントソートでバケットにまとめる。LODはインスタンスごとにマテリアルへ渡すのでキーに含めず、バケットは高々81
+	uint32 KeyOffsets[NUM_QUAD_MESH_PATTERNS] = {};
+
+	for (int32 NodeIndex = 0; NodeIndex < RenderList.Num(); NodeIndex++)
+	{
+		KeyOffsets[Result.QuadMeshParamsIndices[NodeIndex]]++;
+	}
+
+	Buckets.Reset();
+	uint32 FirstInstance = 0;
+	for (uint32 Key = 0; Key < NUM_QUAD_MESH_PATTERNS; Key++)
+	{
+		const uint32 NumKeyInstances = KeyOffsets[Key];
+		KeyOffsets[Key] = FirstInstance;
+
+		if (NumKeyInstances > 0)
+		{
+			FBucket& Bucket = Buckets.AddDefaulted_GetRef();
+			Bucket.QuadMeshParamsIndex = Key;
+			Bucket.FirstInstance = FirstInstance;
+			Bucket.NumInstances = NumKeyInstances;
+			FirstInstance += NumKeyInstances;
+		}
+	}
+
+	// レイアウトはFInstancedStaticMeshVertexFactoryが読むFInstanceStreamと同じ。
+	// Originのwは本来PerInstanceRandomだが、LODを[0,1]に正規化したものを入れる。1つのマテリアルで全LODを描くので、マテリアルはLODColorやUVScaleをここから求める
+	bool bOriginReallocated, bTransformReallocated, bLightmapReallocated;
+	FVector4* OriginData = InstanceOriginBuffer.Lock(NumInstances, bOriginReallocated);
+	FVector4* TransformData = InstanceTransformBuffer.Lock(3 * NumInstances, bTransformReallocated);
+	FVector4* LightmapData = InstanceLightmapBuffer.Lock(NumInstances, bLightmapReallocated);
+
+	const float InvMaxLOD = 1.0f / MaxLOD;
+	for (int32 NodeIndex = 0; NodeIndex < RenderList.Num(); NodeIndex++)
+	{
+		const FQuadNode& Node = RenderList[NodeIndex];
+		const uint32 InstanceIndex = KeyOffsets[Result.QuadMeshParamsIndices[NodeIndex]]++;
+
+		// メッシュサイズをQuadNodeのサイズに応じてスケールさせる
+		const float MeshScale = Node.Length / MeshLength;
+		// インスタンスのトランスフォームはLocalToWorldの前にかかるので、ワールド空間でのQuadNodeの位置をローカル空間の位置に戻しておく。
+		// BottomRightはコンポーネントの位置を含んだワールド座標なので、回転とスケールだけでなく平行移動も戻す必要がありInverseTransformPosition()を使う
+		const FVector& LocalOffset = LocalToWorld.InverseTransformPosition(Node.BottomRight);
+
+		OriginData[InstanceIndex] = FVector4(LocalOffset, Node.LOD * InvMaxLOD);
+		TransformData[3 * InstanceIndex + 0] = FVector4(MeshScale, 0.0f, 0.0f, 0.0f);
+		TransformData[3 * InstanceIndex + 1] = FVector4(0.0f, MeshScale, 0.0f, 0.0f);
+		TransformData[3 * InstanceIndex + 2] = FVector4(0.0f, 0.0f, MeshScale, 0.0f);
+		LightmapData[InstanceIndex] = FVector4(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+
+	InstanceOriginBuffer.Unlock();
+	InstanceTransformBuffer.Unlock();
+	InstanceLightmapBuffer.Unlock();
+
+	// 頂点ファクトリが参照するSRVと頂点バッファはバッファを作り直したときだけ差し替える
+	if (VertexFactory.IsInitialized() && !bOriginReallocated && !bTransformReallocated && !bLightmapReallocated)
+	{
+		return;
+	}
+
+	FInstancedStaticMeshVertexFactory::FDataType Data;
+	VertexBuffers.PositionVertexBuffer.BindPositionVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.DeformableMeshVertexBuffer.BindTangentVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.DeformableMeshVertexBuffer.BindPackedTexCoordVertexBuffer(&VertexFactory, Data);
+	VertexBuffers.DeformableMeshVertexBuffer.BindLightMapVertexBuffer(&VertexFactory, Data, 0);
+	VertexBuffers.ColorVertexBuffer.BindColorVertexBuffer(&VertexFactory, Data);
+
+	Data.InstanceOriginSRV = InstanceOriginBuffer.SRV;
+	Data.InstanceTransformSRV = InstanceTransformBuffer.SRV;
+	Data.InstanceLightmapSRV = InstanceLightmapBuffer.SRV;
+#if ENGINE_MINOR_VERSION >= 25
+	Data.InstanceCustomDataSRV = GNullVertexBuffer.VertexBufferSRV;
+#endif
+
+	Data.InstanceOriginComponent = FVertexStreamComponent(&InstanceOriginBuffer, 0, sizeof(FVector4), VET_Float4, EVertexStreamUsage::ManualFetch | EVertexStreamUsage::Instancing);
+	for (uint32 i = 0; i < 3; i++)
+	{
+		Data.InstanceTransformComponent[i] = FVertexStreamComponent(&InstanceTransformBuffer, i * sizeof(FVector4), 3 * sizeof(FVector4), VET_Float4, EVertexStreamUsage::ManualFetch | EVertexStreamUsage::Instancing);
+	}
+	Data.InstanceLightmapAndShadowMapUVBiasComponent = FVertexStreamComponent(&InstanceLightmapBuffer, 0, sizeof(FVector4), VET_Float4, EVertexStreamUsage::ManualFetch | EVertexStreamUsage::Instancing);
+
+	// 初期化済みならSetData()の中でUpdateRHI()される
+	VertexFactory.SetData(Data);
+	if (!VertexFactory.IsInitialized())
+	{
+		VertexFactory.InitResource();
+	}
+}
+
+SIZE_T FQuadNodeInstancedMesh::GetAllocatedSize() const
+{
+	return Buckets.GetAllocatedSize();
+}
+
+FQuadNodeInstancedMesh& FQuadNodeInstancedMeshPool::Allocate(const FSceneView& View, ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+
+	// フレームが変わったら前フレームのビューが使っていたものを先頭から使いまわす。
+	// 同じフレームで複数のビューファミリーが描画されても、FrameNumberが同じなので別のものが割り当てられる
+	if (View.Family->FrameNumber != FrameNumber)
+	{
+		FrameNumber = View.Family->FrameNumber;
+		NumAllocated = 0;
+	}
+
+	if (NumAllocated == Meshes.Num())
+	{
+		Meshes.Add(MakeUnique<FQuadNodeInstancedMesh>(FeatureLevel));
+	}
+
+	return *Meshes[NumAllocated++];
+}
+
+SIZE_T FQuadNodeInstancedMeshPool::GetAllocatedSize() const
+{
+	SIZE_T Size = Meshes.GetAllocatedSize();
+	for (const TUniquePtr<FQuadNodeInstancedMesh>& Mesh : Meshes)
+	{
+		Size += sizeof(FQuadNodeInstancedMesh) + Mesh->GetAllocatedSize();
+	}
+	return Size;
+}
+} // namespace Quadtree
+
@@ -1,151 +1,608 @@
 #include "Quadtree/Quadtree.h"
+#include "ConvexVolume.h"
+#include "SceneManagement.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+#include "Algo/BinarySearch.h"
+
+DEFINE_STAT(STAT_QuadtreeBuildArenaAllocations);
+DEFINE_STAT(STAT_QuadtreeEvaluatedSplitDecisions);
+DEFINE_STAT(STAT_QuadtreeResultCacheLookups);
+DEFINE_STAT(STAT_QuadtreeResultCacheHits);
+DEFINE_STAT(STAT_QuadtreeResultCacheTimeSaved);
+DECLARE_CYCLE_STAT(TEXT("Build Quadtree"), STAT_BuildQuadtree, STATGROUP_Quadtree);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeAsyncBuild(
+	TEXT("r.ShaderSandbox.QuadtreeAsyncBuild"),
+	1,
+	TEXT("0: Build quadtree of each view on the render thread one after another.\n")
+	TEXT("1: Build quadtree of each view in a task, and build 4 subtrees of the root node in parallel."),
+	ECVF_RenderThreadSafe);
 
 namespace
 {
 using namespace Quadtree;
 
-// tX^JOBr[tX^̒QuadNodeꕔłĂtrueBłȂfalseB
-bool IsQuadNodeFrustumCulled(const FMatrix& ViewProjectionMatrix, const FQuadNode& Node)
+// フラスタムカリング用のビューフラスタムの平面。SIMDで4平面ずつ同時に判定できるようにX、Y、Z、Wごとに並べ替えて持つ。
+// 平面は外向きで、PlaneDot()が正なら外側
+struct FQuadNodeCullingFrustum
 {
-	//FSceneView::ProjectWorldToScreen()QlɂĂ
-
-	const FVector4& BottomRightProjSpace = ViewProjectionMatrix.TransformFVector4(FVector4(Node.BottomRight.X, Node.BottomRight.Y, Node.BottomRight.Z, 1.0f));
-	const FVector4& BottomLeftProjSpace = ViewProjectionMatrix.TransformFVector4(FVector4(Node.BottomRight.X + Node.Length, Node.BottomRight.Y, Node.BottomRight.Z, 1.0f));
-	const FVector4& TopRightProjSpace = ViewProjectionMatrix.TransformFVector4(FVector4(Node.BottomRight.X, Node.BottomRight.Y + Node.Length, Node.BottomRight.Z, 1.0f));
-	const FVector4& TopLeftProjSpace = ViewProjectionMatrix.TransformFVector4(FVector4(Node.BottomRight.X + Node.Length, Node.BottomRight.Y + Node.Length, Node.BottomRight.Z, 1.0f));
+	// 平面はニア、左右上下、ファーの高々6枚なので2グループ
+	static constexpr int32 MAX_PLANE_GROUPS = 2;
+
+	VectorRegister PlanesX[MAX_PLANE_GROUPS];
+	VectorRegister PlanesY[MAX_PLANE_GROUPS];
+	VectorRegister PlanesZ[MAX_PLANE_GROUPS];
+	VectorRegister PlanesW[MAX_PLANE_GROUPS];
+	int32 NumPlaneGroups = 0;
+	// すべての平面の内側にあるときのFQuadNode::FrustumInsideMask
+	uint8 AllInsideMask = 0;
+};
+
+// ビューごとに一度だけ平面を抽出する
+void InitCullingFrustum(const FMatrix& ViewProjectionMatrix, FQuadNodeCullingFrustum& OutFrustum)
+{
+	// リバースZで無限遠のファー平面は作られないので、そのときは5枚になる
+	FConvexVolume ViewFrustum;
+	GetViewFrustumBounds(ViewFrustum, ViewProjectionMatrix, true);
 
-	// NDCւ̕ϊWŏẐW0ɋ߂ꍇKINDA_SMALL_NUMBERŊB̏ꍇ͖{茋ʂlɂȂ̂őJOȂ
-	const FVector4& BottomRightNDC = BottomRightProjSpace / FMath::Max(FMath::Abs(BottomRightProjSpace.W), KINDA_SMALL_NUMBER);
-	const FVector4& BottomLeftNDC = BottomLeftProjSpace / FMath::Max(FMath::Abs(BottomLeftProjSpace.W), KINDA_SMALL_NUMBER);
-	const FVector4& TopRightNDC = TopRightProjSpace / FMath::Max(FMath::Abs(TopRightProjSpace.W), KINDA_SMALL_NUMBER);
-	const FVector4& TopLeftNDC = TopLeftProjSpace / FMath::Max(FMath::Abs(TopLeftProjSpace.W), KINDA_SMALL_NUMBER);
+	const int32 NumPlanes = FMath::Min(ViewFrustum.Planes.Num(), FQuadNodeCullingFrustum::MAX_PLANE_GROUPS * 4);
+	check(NumPlanes > 0);
+	OutFrustum.NumPlaneGroups = (NumPlanes + 3) / 4;
+	OutFrustum.AllInsideMask = (uint8)((1 << (OutFrustum.NumPlaneGroups * 4)) - 1);
 
-	// tX^OɂƂ́A4R[i[ׂāANDCL[u6ʂ̂ꂩ̖ʂ̊OɂƂɂȂĂ
-	if (BottomRightNDC.X < -1.0f && BottomLeftNDC.X < -1.0f && TopRightNDC.X < -1.0f && TopLeftNDC.X < -1.0f)
-	{
-		return true;
-	}
-	if (BottomRightNDC.X > 1.0f && BottomLeftNDC.X > 1.0f && TopRightNDC.X > 1.0f && TopLeftNDC.X > 1.0f)
-	{
-		return true;
-	}
-	if (BottomRightNDC.Y < -1.0f && BottomLeftNDC.Y < -1.0f && TopRightNDC.Y < -1.0f && TopLeftNDC.Y < -1.0f)
-	{
-		return true;
-	}
-	if (BottomRightNDC.Y > 1.0f && BottomLeftNDC.Y > 1.0f && TopRightNDC.Y > 1.0f && TopLeftNDC.Y > 1.0f)
+	for (int32 Group = 0; Group < OutFrustum.NumPlaneGroups; Group++)
 	{
-		return true;
+		// 4枚に満たないグループは最後の平面を重複させて埋める。同じ判定になるだけなので結果は変わらない
+		const FPlane& Plane0 = ViewFrustum.Planes[FMath::Min(Group * 4 + 0, NumPlanes - 1)];
+		const FPlane& Plane1 = ViewFrustum.Planes[FMath::Min(Group * 4 + 1, NumPlanes - 1)];
+		const FPlane& Plane2 = ViewFrustum.Planes[FMath::Min(Group * 4 + 2, NumPlanes - 1)];
+		const FPlane& Plane3 = ViewFrustum.Planes[FMath::Min(Group * 4 + 3, NumPlanes - 1)];
+
+		OutFrustum.PlanesX[Group] = MakeVectorRegister(Plane0.X, Plane1.X, Plane2.X, Plane3.X);
+		OutFrustum.PlanesY[Group] = MakeVectorRegister(Plane0.Y, Plane1.Y, Plane2.Y, Plane3.Y);
+		OutFrustum.PlanesZ[Group] = MakeVectorRegister(Plane0.Z, Plane1.Z, Plane2.Z, Plane3.Z);
+		OutFrustum.PlanesW[Group] = MakeVectorRegister(Plane0.W, Plane1.W, Plane2.W, Plane3.W);
 	}
-	// ZUE4NDCł[0,1]łB
-	if (BottomRightNDC.Z < 0.0f && BottomLeftNDC.Z < 0.0f && TopRightNDC.Z < 0.0f && TopLeftNDC.Z < 0.0f)
-	{
-		return true;
-	}
-	if (BottomRightNDC.Z > 1.0f && BottomLeftNDC.Z > 1.0f && TopRightNDC.Z > 1.0f && TopLeftNDC.Z > 1.0f)
+}
+
+// フラスタムカリング。QuadNodeのAABBがビューフラスタムの外にあればtrue。一部でも入っていたらfalse。
+// AABBはXY平面上のQuadNodeを変位の振幅ぶん広げたもの。チョッピーな波はXY方向にも頂点を動かすのでXYも広げる。
+// InOutInsideMaskは完全に内側にある平面のビットで、親で内側と判定された平面は子も内側なので判定を省く
+bool IsQuadNodeFrustumCulled(const FQuadNodeCullingFrustum& Frustum, float MaxDisplacement, const FQuadNode& Node, uint8& InOutInsideMask)
+{
+	//FConvexVolume::IntersectBox()を参考にしている
+
+	const float HalfLength = Node.Length * 0.5f;
+	const VectorRegister OriginX = VectorSetFloat1(Node.BottomRight.X + HalfLength);
+	const VectorRegister OriginY = VectorSetFloat1(Node.BottomRight.Y + HalfLength);
+	const VectorRegister OriginZ = VectorSetFloat1(Node.BottomRight.Z);
+	const VectorRegister ExtentX = VectorSetFloat1(HalfLength + MaxDisplacement);
+	const VectorRegister ExtentY = ExtentX;
+	const VectorRegister ExtentZ = VectorSetFloat1(MaxDisplacement);
+
+	for (int32 Group = 0; Group < Frustum.NumPlaneGroups; Group++)
 	{
-		return true;
+		const uint8 GroupMask = 0xF << (Group * 4);
+		if ((InOutInsideMask & GroupMask) == GroupMask)
+		{
+			continue;
+		}
+
+		// AABB中心の平面からの距離
+		VectorRegister Distance = VectorMultiply(OriginX, Frustum.PlanesX[Group]);
+		Distance = VectorMultiplyAdd(OriginY, Frustum.PlanesY[Group], Distance);
+		Distance = VectorMultiplyAdd(OriginZ, Frustum.PlanesZ[Group], Distance);
+		Distance = VectorSubtract(Distance, Frustum.PlanesW[Group]);
+
+		// 平面の法線方向へのAABBの半径
+		VectorRegister PushOut = VectorMultiply(ExtentX, VectorAbs(Frustum.PlanesX[Group]));
+		PushOut = VectorMultiplyAdd(ExtentY, VectorAbs(Frustum.PlanesY[Group]), PushOut);
+		PushOut = VectorMultiplyAdd(ExtentZ, VectorAbs(Frustum.PlanesZ[Group]), PushOut);
+
+		// いずれかの平面の完全に外側にあればカリング
+		if (VectorMaskBits(VectorCompareGT(Distance, PushOut)) != 0)
+		{
+			return true;
+		}
+
+		// 完全に内側にある平面のビットを立てる
+		InOutInsideMask |= (uint8)(VectorMaskBits(VectorCompareGT(VectorNegate(PushOut), Distance)) << (Group * 4));
 	}
 
 	return false;
 }
 
-// QuadNodẽbṼObh̒łƂJɋ߂̂̃XN[\ʐϗ擾
+// QuadNodeのメッシュのグリッドの中でもっともカメラに近いもののスクリーン表示面積率を取得する
 float EstimateGridScreenCoverage(int32 NumRowColumn, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, const FQuadNode& Node, FIntPoint& OutNearestGrid)
 {
-	// \ʐςő̃Obh𒲂ׂ̂ŁAJɍł߂Obh𒲂ׂB
-	// Obh̒ɂ͕\ĂȂ̂肤邪AɓnQuadNode̓tX^JO͂ĂȂOȂ̂
-	// Jɍł߂Obh͕\Ă͂B
+	// 表示面積が最大のグリッドを調べたいので、カメラに最も近いグリッドを調べる。
+	// グリッドの中には表示されていないものもありうるが、ここに渡されるQuadNodeはフラスタムカリングはされてない前提なので
+	// カメラに最も近いグリッドは表示されているはず。
 
-	// QuadNodebṼObhւ̏c͓łAbV͐`łƂO񂪂
+	// QuadNodeメッシュのグリッドへの縦横分割数は同じであり、メッシュは正方形であるという前提がある
 	float GridLength = Node.Length / NumRowColumn;
 	FVector NearestGridBottomRight;
 
-	// J̐^ɃObh΂BȂClamp
-	int32 Row = FMath::Clamp<int32>((CameraPosition.X - Node.BottomRight.X) / GridLength, 0, NumRowColumn - 1); // floatint32LXgŐ؂̂
-	int32 Column = FMath::Clamp<int32>((CameraPosition.Y - Node.BottomRight.Y) / GridLength, 0, NumRowColumn - 1); // floatint32LXgŐ؂̂
+	// カメラの真下にグリッドがあればそれ。なければClampする
+	int32 Row = FMath::Clamp<int32>((CameraPosition.X - Node.BottomRight.X) / GridLength, 0, NumRowColumn - 1); // floatはint32キャストで切り捨て
+	int32 Column = FMath::Clamp<int32>((CameraPosition.Y - Node.BottomRight.Y) / GridLength, 0, NumRowColumn - 1); // floatはint32キャストで切り捨て
 	OutNearestGrid = FIntPoint(Row, Column);
 	NearestGridBottomRight.X = Node.BottomRight.X + Row * GridLength;
 	NearestGridBottomRight.Y = Node.BottomRight.Y + Column * GridLength;
 	NearestGridBottomRight.Z = Node.BottomRight.Z;
 
-	// ObhɃJ͐΂ĂȂA΂ĂƑz肵Ƃ̃XN[\ʐςԂB
-	// ۂ̐΂ĂȂXN[\ʐςgƁAȂ`䂪ނ߂ɁA䂪݂ƂƂƂJ̓Ŗʐς傫ς肵ȂȂB
-	// NDC[-1,1]Ȃ̂XYʂʐς4Ȃ̂ŁA\ʐϗƂĂ1/4ẐɂȂ
+	// グリッドにカメラは正対していないが、正対してると想定したときのスクリーン表示面積を返す。
+	// 実際の正対してないスクリーン表示面積を使うと、かなり矩形がゆがむために、ゆがみが激しいときだとちょっとしたカメラの動きで面積が大きく変わり安定しなくなる。
+	// NDCは[-1,1]なのでXY面も面積は4なので、表示面積率としては1/4を乗算したものになる
 	float CameraDistanceSquare = (CameraPosition - NearestGridBottomRight).SizeSquared();
 	float Ret = GridLength * ProjectionScale.X * GridLength * ProjectionScale.Y * 0.25f / CameraDistanceSquare;
 	return Ret;
 }
 
-int32 BuildQuadtreeRecursively(int32 MaxLOD, int32 NumRowColumn, float MaxScreenCoverage, float PatchLength, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, FQuadNode& Node, TArray<FQuadNode>& OutQuadNodeList)
+// 分割の判定にヒステリシスを持たせる幅。分割されていないノードはMaxScreenCoverageの(1+h)倍を超えたら分割し、
+// 分割されているノードは(1-h)倍を下回ったら統合する。しきい値付近でカメラが揺れても分割と統合を毎フレーム繰り返さないように
+constexpr float SPLIT_HYSTERESIS = 0.1f;
+
+// BuildQuadtree()の引数のうち、ノードの評価に使うもの
+struct FQuadtreeBuildContext
 {
-	bool bCulled = IsQuadNodeFrustumCulled(ViewProjectionMatrix, Node);
-	if (bCulled)
+	int32 NumRowColumn;
+	float MaxScreenCoverage;
+	float PatchLength;
+	float MaxDisplacement;
+	FVector CameraPosition;
+	FVector2D ProjectionScale;
+	const FMatrix* ViewProjectionMatrix;
+	FQuadNodeCullingFrustum CullingFrustum;
+};
+
+// 分割判定に使う、QuadNodeの全グリッドのスクリーン表示面積率の中で最大のもの。
+// パッチサイズ以下の縦横長さのノードやLOD0のノードは、カメラの位置によらずそれ以上分割しないので負を返す
+float CalculateSplitCoverage(const FQuadtreeBuildContext& Context, const FQuadNode& Node)
+{
+	// パッチサイズの条件がないと、カメラが近いといくらでも小さく分割してしまう
+	if (Node.Length <= Context.PatchLength || Node.LOD == 0)
 	{
-		return INDEX_NONE;
+		return -1.0f;
 	}
 
-	// QuadNodeɋeXN[\ʐϗ̏B
-	//float MaxScreenCoverage = MaxPixelCoverage / View.SceneViewInitOptions.GetConstrainedViewRect().Size().X / View.SceneViewInitOptions.GetConstrainedViewRect().Size().Y;
+	INC_DWORD_STAT(STAT_QuadtreeEvaluatedSplitDecisions);
 
-	// QuadNodȇSObh̃XN[\ʐϗ̒ōő̂́B
 	FIntPoint NearestGrid;
-	float GridCoverage = EstimateGridScreenCoverage(NumRowColumn, CameraPosition, ProjectionScale, ViewProjectionMatrix, Node, NearestGrid);
-
-	if (GridCoverage > MaxScreenCoverage // Obh\ʐϗ傫ΎqɕB`悵Ȃ̂̓Xg̎gpIsLeafŔ肷B
-		&& Node.Length > PatchLength // pb`TCYȉ̏cł΂ȏ㕪ȂB̏ƃJ߂ƂłĂ܂̂
-		&& Node.LOD > 0) // LOD0̂̂͂ȏ㕪Ȃ
-	{
-		// LODchildListIndices͏lʂ
-		FQuadNode ChildNodeBottomRight;
-		ChildNodeBottomRight.BottomRight = Node.BottomRight;
-		ChildNodeBottomRight.Length = Node.Length * 0.5f;
-		ChildNodeBottomRight.LOD = Node.LOD - 1;
-		Node.ChildNodeIndices[0] = BuildQuadtreeRecursively(MaxLOD, NumRowColumn, MaxScreenCoverage, PatchLength, CameraPosition, ProjectionScale, ViewProjectionMatrix, ChildNodeBottomRight, OutQuadNodeList);
-
-		FQuadNode ChildNodeBottomLeft;
-		ChildNodeBottomLeft.BottomRight = Node.BottomRight + FVector(Node.Length * 0.5f, 0.0f, 0.0f);
-		ChildNodeBottomLeft.Length = Node.Length * 0.5f;
-		ChildNodeBottomLeft.LOD = Node.LOD - 1;
-		Node.ChildNodeIndices[1] = BuildQuadtreeRecursively(MaxLOD, NumRowColumn, MaxScreenCoverage, PatchLength, CameraPosition, ProjectionScale, ViewProjectionMatrix, ChildNodeBottomLeft, OutQuadNodeList);
-
-		FQuadNode ChildNodeTopRight;
-		ChildNodeTopRight.BottomRight = Node.BottomRight + FVector(0.0f, Node.Length * 0.5f, 0.0f);
-		ChildNodeTopRight.Length = Node.Length * 0.5f;
-		ChildNodeTopRight.LOD = Node.LOD - 1;
-		Node.ChildNodeIndices[2] = BuildQuadtreeRecursively(MaxLOD, NumRowColumn, MaxScreenCoverage, PatchLength, CameraPosition, ProjectionScale, ViewProjectionMatrix, ChildNodeTopRight, OutQuadNodeList);
-
-		FQuadNode ChildNodeTopLeft;
-		ChildNodeTopLeft.BottomRight = Node.BottomRight + FVector(Node.Length * 0.5f, Node.Length * 0.5f, 0.0f);
-		ChildNodeTopLeft.Length = Node.Length * 0.5f;
-		ChildNodeTopLeft.LOD = Node.LOD - 1;
-		Node.ChildNodeIndices[3] = BuildQuadtreeRecursively(MaxLOD, NumRowColumn, MaxScreenCoverage, PatchLength, CameraPosition, ProjectionScale, ViewProjectionMatrix, ChildNodeTopLeft, OutQuadNodeList);
-
-		// ׂĂ̎qm[htX^JOΏۂAsȂ͂ŁAJOvZŘRꂽƂׂ݂Ȃ̂ŃJO
-		if (Node.IsLeaf())
+	return EstimateGridScreenCoverage(Context.NumRowColumn, Context.CameraPosition, Context.ProjectionScale, *Context.ViewProjectionMatrix, Node, NearestGrid);
+}
+
+// カメラがこの距離より動かなければ、GridCoverageとThresholdの大小関係が変わらないという距離を求める
+float CalculateDecisionMargin(const FQuadtreeBuildContext& Context, const FQuadNode& Node, float GridCoverage, float Threshold)
+{
+	if (GridCoverage < 0.0f)
+	{
+		return MAX_flt;
+	}
+
+	// 表示面積率はK/(最も近いグリッドまでの距離)^2なので、しきい値に対応する距離は解析的に求まる
+	const float GridLength = Node.Length / Context.NumRowColumn;
+	const float K = GridLength * Context.ProjectionScale.X * GridLength * Context.ProjectionScale.Y * 0.25f;
+	const float Distance = FMath::Sqrt(K / FMath::Max(GridCoverage, SMALL_NUMBER));
+	const float ThresholdDistance = FMath::Sqrt(K / Threshold);
+
+	// カメラがdだけ動くと、最も近いグリッドまでの距離はカメラ自身の移動で高々d、最も近いグリッドの切り替わりで高々d+グリッドの対角線長だけ変わる
+	return FMath::Max((FMath::Abs(Distance - ThresholdDistance) - GridLength * 1.5f) * 0.5f, 0.0f);
+}
+
+// 前回評価したときのカメラ位置からマージン以上動いていなければ前回の判定をそのまま使える
+bool IsDecisionValid(const FVector& EvaluatedCameraPosition, float DecisionMargin, const FVector& CameraPosition)
+{
+	return DecisionMargin >= 0.0f && FVector::DistSquared(EvaluatedCameraPosition, CameraPosition) < FMath::Square(DecisionMargin);
+}
+
+// 子ノードのインデックスは深さ優先でリーフが並ぶ順に、BottomRight、BottomLeft、TopRight、TopLeft
+FQuadNode MakeChildNode(const FQuadNode& ParentNode, int32 ChildIndex)
+{
+	const float HalfLength = ParentNode.Length * 0.5f;
+
+	// ChildNodeIndicesは初期値通り
+	FQuadNode ChildNode;
+	ChildNode.BottomRight = ParentNode.BottomRight + FVector((ChildIndex & 1) * HalfLength, (ChildIndex >> 1) * HalfLength, 0.0f);
+	ChildNode.Length = HalfLength;
+	ChildNode.LOD = ParentNode.LOD - 1;
+	ChildNode.FrustumInsideMask = ParentNode.FrustumInsideMask;
+	return ChildNode;
+}
+
+// StartNodeを根とする部分木を分割判定しながらたどり、リーフをOutLeavesに深さ優先順に追加する。
+// フラスタムカリングされたノードは分割しないがリーフとして残す。カメラが回ってフラスタムに入ったときにそこから再分割するため
+void RefineQuadNode(const FQuadtreeBuildContext& Context, const FQuadNode& StartNode, const FVector& ParentEvaluatedCameraPosition, float ParentDecisionMargin, TArray<FQuadNode>& NodeStack, TArray<FTemporalQuadNode>& OutLeaves)
+{
+	// 深さ優先でたどると1段下がるごとにスタックに残る兄弟ノードは3つずつ増えるので、スタックの最大長は3*LOD+1
+	NodeStack.Reset(3 * StartNode.LOD + 1);
+	NodeStack.Add(StartNode);
+
+	// スタックと同じ順で、各ノードの親の分割判定の有効範囲を積む。兄弟4つで同じ値なので、子を積むたびに1つずつ持つのではなく親のノードのLODで引く
+	float ParentMargins[32];
+	check(StartNode.LOD < 32);
+	ParentMargins[StartNode.LOD] = ParentDecisionMargin;
+
+	while (NodeStack.Num() > 0)
+	{
+		FQuadNode Node = NodeStack.Pop(false);
+		const bool bIsStartNode = (Node.LOD == StartNode.LOD);
+
+		if (IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Node, Node.FrustumInsideMask))
+		{
+			FTemporalQuadNode& Leaf = OutLeaves.AddDefaulted_GetRef();
+			Leaf.Node = Node;
+			Leaf.ParentEvaluatedCameraPosition = bIsStartNode ? ParentEvaluatedCameraPosition : Context.CameraPosition;
+			Leaf.ParentDecisionMargin = ParentMargins[Node.LOD];
+			Leaf.bCulled = true;
+			continue;
+		}
+
+		// まだ分割されていないノードなので分割側のしきい値で判定する
+		const float GridCoverage = CalculateSplitCoverage(Context, Node);
+		if (GridCoverage > Context.MaxScreenCoverage * (1.0f + SPLIT_HYSTERESIS))
+		{
+			// 子ノードにとっての親の判定は、分割済みのノードとして統合側のしきい値を使う
+			ParentMargins[Node.LOD - 1] = CalculateDecisionMargin(Context, Node, GridCoverage, Context.MaxScreenCoverage * (1.0f - SPLIT_HYSTERESIS));
+
+			// BottomRight、BottomLeft、TopRight、TopLeftの順にリーフが並ぶように逆順に積む
+			for (int32 ChildIndex = 3; ChildIndex >= 0; ChildIndex--)
+			{
+				NodeStack.Add(MakeChildNode(Node, ChildIndex));
+			}
+		}
+		else
+		{
+			FTemporalQuadNode& Leaf = OutLeaves.AddDefaulted_GetRef();
+			Leaf.Node = Node;
+			Leaf.EvaluatedCameraPosition = Context.CameraPosition;
+			Leaf.DecisionMargin = CalculateDecisionMargin(Context, Node, GridCoverage, Context.MaxScreenCoverage * (1.0f + SPLIT_HYSTERESIS));
+			Leaf.ParentEvaluatedCameraPosition = bIsStartNode ? ParentEvaluatedCameraPosition : Context.CameraPosition;
+			Leaf.ParentDecisionMargin = ParentMargins[Node.LOD];
+			Leaf.bCulled = false;
+		}
+	}
+}
+
+// LOD0のノードの辺の長さを単位とした、RootNode内での整数座標
+FIntPoint CalculateLOD0Coordinate(const FQuadtreeBuildArena& Arena, const FQuadNode& Node)
+{
+	return FIntPoint(FMath::RoundToInt((Node.BottomRight.X - Arena.RootBottomRight.X) / Arena.LOD0Length), FMath::RoundToInt((Node.BottomRight.Y - Arena.RootBottomRight.Y) / Arena.LOD0Length));
+}
+
+// ParentLODの祖先ノードの4つの子のうち、どれにNodeが含まれるか。子のインデックスと同じで、深さ優先順に並んだリーフでは昇順になる
+int32 GetChildIndex(const FQuadtreeBuildArena& Arena, int32 ParentLOD, const FQuadNode& Node)
+{
+	const FIntPoint& Coord = CalculateLOD0Coordinate(Arena, Node);
+	const int32 Shift = ParentLOD - 1;
+	return ((Coord.X >> Shift) & 1) + 2 * ((Coord.Y >> Shift) & 1);
+}
+
+// LODとそのLODのノード単位でのセル座標からLeafIndexMapのキーを作る。MaxLODは10までなのでセル座標は24bitに収まる
+uint64 MakeLeafKey(int32 LOD, int32 CellX, int32 CellY)
+{
+	return ((uint64)LOD << 48) | ((uint64)CellX << 24) | (uint64)CellY;
+}
+
+// AdjacentCoordはLOD0単位の整数座標。隣接ノードがNodeより粗いLODのときだけLODの差が意味を持つので、Node.LOD+1からRootLODまでのセルをハッシュで引く
+EAdjacentQuadNodeLODDifference QueryAdjacentNodeType(const FQuadtreeBuildArena& Arena, const FQuadNode& Node, const FIntPoint& AdjacentCoord)
+{
+	const int32 NumLOD0PerRow = 1 << Arena.RootLOD;
+	if (AdjacentCoord.X < 0 || AdjacentCoord.X >= NumLOD0PerRow || AdjacentCoord.Y < 0 || AdjacentCoord.Y >= NumLOD0PerRow)
+	{
+		return EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST;
+	}
+
+	for (int32 AdjNodeLOD = Node.LOD + 1; AdjNodeLOD <= Arena.RootLOD; AdjNodeLOD++)
+	{
+		if (Arena.LeafIndexMap.Contains(MakeLeafKey(AdjNodeLOD, AdjacentCoord.X >> AdjNodeLOD, AdjacentCoord.Y >> AdjNodeLOD)))
+		{
+			return (AdjNodeLOD == Node.LOD + 1) ? EAdjacentQuadNodeLODDifference::GREATER_BY_1 : EAdjacentQuadNodeLODDifference::GREATER_BY_MORE_THAN_2;
+		}
+	}
+
+	return EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST;
+}
+
+// 全リーフノードについて、隣接するノードとのLODの差から使用するメッシュトポロジーのインデックスを決める。リーフ数Nに対してO(N)
+void CalculateQuadMeshParamsIndices(FQuadtreeBuildArena& Arena)
+{
+	Arena.LeafIndexMap.Reset();
+	for (int32 NodeIndex = 0; NodeIndex < Arena.RenderQuadNodeList.Num(); NodeIndex++)
+	{
+		const FQuadNode& Node = Arena.RenderQuadNodeList[NodeIndex];
+		const FIntPoint& Coord = CalculateLOD0Coordinate(Arena, Node);
+		Arena.LeafIndexMap.Add(MakeLeafKey(Node.LOD, Coord.X >> Node.LOD, Coord.Y >> Node.LOD), NodeIndex);
+	}
+
+	Arena.QuadMeshParamsIndices.Reset(Arena.RenderQuadNodeList.Num());
+	for (const FQuadNode& Node : Arena.RenderQuadNodeList)
+	{
+		const FIntPoint& Coord = CalculateLOD0Coordinate(Arena, Node);
+		const int32 HalfNodeSize = (1 << Node.LOD) >> 1;
+		const int32 NodeSize = 1 << Node.LOD;
+
+		// 辺の中点のすぐ外側のLOD0セルを隣接ノードの探索に使う
+		EAdjacentQuadNodeLODDifference RightAdjLODDiff = QueryAdjacentNodeType(Arena, Node, FIntPoint(Coord.X - 1, Coord.Y + HalfNodeSize));
+		EAdjacentQuadNodeLODDifference LeftAdjLODDiff = QueryAdjacentNodeType(Arena, Node, FIntPoint(Coord.X + NodeSize, Coord.Y + HalfNodeSize));
+		EAdjacentQuadNodeLODDifference BottomAdjLODDiff = QueryAdjacentNodeType(Arena, Node, FIntPoint(Coord.X + HalfNodeSize, Coord.Y - 1));
+		EAdjacentQuadNodeLODDifference TopAdjLODDiff = QueryAdjacentNodeType(Arena, Node, FIntPoint(Coord.X + HalfNodeSize, Coord.Y + NodeSize));
+
+		// 3進数によって4つの隣ノードのタイプとインデックスを対応させる
+		Arena.QuadMeshParamsIndices.Add(27 * (uint32)RightAdjLODDiff + 9 * (uint32)LeftAdjLODDiff + 3 * (uint32)BottomAdjLODDiff + (uint32)TopAdjLODDiff);
+	}
+}
+
+// Leaves[Index]から4つが、同じ親を持つ兄弟のリーフであるか。
+// リーフは深さ優先順に並んでいるので、LODと親のセルが同じ4つが連続していれば兄弟がすべてリーフになっており、先頭がBottomRightである
+bool IsSiblingLeaves(const FQuadtreeBuildArena& Arena, const TArray<FTemporalQuadNode>& Leaves, int32 Index)
+{
+	if (Index + 3 >= Leaves.Num())
+	{
+		return false;
+	}
+
+	const int32 LOD = Leaves[Index].Node.LOD;
+	if (LOD >= Arena.RootLOD || Leaves[Index + 1].Node.LOD != LOD || Leaves[Index + 2].Node.LOD != LOD || Leaves[Index + 3].Node.LOD != LOD)
+	{
+		return false;
+	}
+
+	const FIntPoint& Coord = CalculateLOD0Coordinate(Arena, Leaves[Index].Node);
+	const int32 ParentShift = LOD + 1;
+	for (int32 SiblingIndex = Index + 1; SiblingIndex < Index + 4; SiblingIndex++)
+	{
+		const FIntPoint& SiblingCoord = CalculateLOD0Coordinate(Arena, Leaves[SiblingIndex].Node);
+		if ((SiblingCoord.X >> ParentShift) != (Coord.X >> ParentShift) || (SiblingCoord.Y >> ParentShift) != (Coord.Y >> ParentShift))
 		{
-			return INDEX_NONE;
+			return false;
 		}
 	}
 
-	int32 Index = OutQuadNodeList.Add(Node);
-	return Index;
+	return true;
+}
+
+// 前フレームのリーフを、カメラの移動で分割の判定が変わりうるときと、フラスタムの外から中に入ったときだけ評価し直して分割する。
+// ParentInsideMaskは祖先のノードで完全に内側と判定済みの平面
+void SplitTemporalLeaf(const FQuadtreeBuildContext& Context, const FTemporalQuadNode& Leaf, uint8 ParentInsideMask, TArray<FQuadNode>& NodeStack, TArray<FTemporalQuadNode>& OutLeaves)
+{
+	FQuadNode Node = Leaf.Node;
+	Node.FrustumInsideMask = ParentInsideMask;
+
+	if (IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Node, Node.FrustumInsideMask))
+	{
+		OutLeaves.Add_GetRef(Leaf).bCulled = true;
+	}
+	else if (!Leaf.bCulled && IsDecisionValid(Leaf.EvaluatedCameraPosition, Leaf.DecisionMargin, Context.CameraPosition))
+	{
+		OutLeaves.Add(Leaf);
+	}
+	else
+	{
+		RefineQuadNode(Context, Node, Leaf.ParentEvaluatedCameraPosition, Leaf.ParentDecisionMargin, NodeStack, OutLeaves);
+	}
+}
+
+// Nodeの部分木のリーフを深さ優先順に並べたLeavesをSplitTemporalLeaf()に渡す。フラスタムの判定はNodeから下りながら行い、
+// Nodeが完全に外側なら部分木のリーフはすべてカリングし、完全に内側ならリーフの判定を省く。平面をまたぐノードの子だけを判定し直す。
+// 再帰の深さはNodeのLOD以下
+void SplitTemporalLeavesInNode(const FQuadtreeBuildContext& Context, const FQuadtreeBuildArena& Arena, FQuadNode Node, const FTemporalQuadNode* Leaves, int32 NumLeaves, TArray<FQuadNode>& NodeStack, TArray<FTemporalQuadNode>& OutLeaves)
+{
+	// リーフでないノードの部分木には必ず4つ以上のリーフがある
+	if (NumLeaves == 1)
+	{
+		check(Leaves[0].Node.LOD == Node.LOD);
+		SplitTemporalLeaf(Context, Leaves[0], Node.FrustumInsideMask, NodeStack, OutLeaves);
+		return;
+	}
+
+	if (IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Node, Node.FrustumInsideMask))
+	{
+		for (int32 LeafIndex = 0; LeafIndex < NumLeaves; LeafIndex++)
+		{
+			OutLeaves.Add_GetRef(Leaves[LeafIndex]).bCulled = true;
+		}
+		return;
+	}
+
+	if (Node.FrustumInsideMask == Context.CullingFrustum.AllInsideMask)
+	{
+		for (int32 LeafIndex = 0; LeafIndex < NumLeaves; LeafIndex++)
+		{
+			SplitTemporalLeaf(Context, Leaves[LeafIndex], Node.FrustumInsideMask, NodeStack, OutLeaves);
+		}
+		return;
+	}
+
+	// 子ノードごとのリーフの範囲は連続しているので二分探索で求まる
+	const TArrayView<const FTemporalQuadNode> LeafView(Leaves, NumLeaves);
+	int32 ChildBegins[5];
+	for (int32 ChildIndex = 0; ChildIndex < 4; ChildIndex++)
+	{
+		ChildBegins[ChildIndex] = Algo::LowerBoundBy(LeafView, ChildIndex, [&Arena, &Node](const FTemporalQuadNode& Leaf) { return GetChildIndex(Arena, Node.LOD, Leaf.Node); });
+	}
+	ChildBegins[4] = NumLeaves;
+
+	for (int32 ChildIndex = 0; ChildIndex < 4; ChildIndex++)
+	{
+		SplitTemporalLeavesInNode(Context, Arena, MakeChildNode(Node, ChildIndex), Leaves + ChildBegins[ChildIndex], ChildBegins[ChildIndex + 1] - ChildBegins[ChildIndex], NodeStack, OutLeaves);
+	}
 }
 
-int32 SearchLeafContainsPosition2D(const TArray<FQuadNode>& RenderQuadNodeList, const FVector2D& Position2D)
+// 兄弟4つがすべてリーフであるものについて、親が分割されたままでよいかを判定し、そうでなければ親に統合する。
+// 1回のパスで1段階しか統合できないので、統合が起きなくなるまで繰り返す
+void MergeTemporalLeaves(const FQuadtreeBuildContext& Context, const FQuadtreeBuildArena& Arena, TArray<FTemporalQuadNode>& Leaves, TArray<FTemporalQuadNode>& LeavesBack)
 {
-	// AllQuadNodeList؂ǂĒTĂAWbNGɂȂ邵AIɂȂɏɑ債͂łȂ̂RenderQuadNodeList烋[vŒT
-	for (int32 i = 0; i < RenderQuadNodeList.Num(); i++)
+	const float MergeThreshold = Context.MaxScreenCoverage * (1.0f - SPLIT_HYSTERESIS);
+	const float SplitThreshold = Context.MaxScreenCoverage * (1.0f + SPLIT_HYSTERESIS);
+
+	bool bMerged = true;
+	while (bMerged)
 	{
-		if (RenderQuadNodeList[i].ContainsPosition2D(Position2D))
+		bMerged = false;
+		LeavesBack.Reset();
+
+		int32 Index = 0;
+		while (Index < Leaves.Num())
 		{
-			return i;
+			if (!IsSiblingLeaves(Arena, Leaves, Index))
+			{
+				LeavesBack.Add(Leaves[Index]);
+				Index++;
+				continue;
+			}
+
+			FTemporalQuadNode* Siblings = &Leaves[Index];
+
+			// 先頭はBottomRightの子なので、親とBottomRightが一致する
+			FQuadNode Parent;
+			Parent.BottomRight = Siblings[0].Node.BottomRight;
+			Parent.Length = Siblings[0].Node.Length * 2.0f;
+			Parent.LOD = Siblings[0].Node.LOD + 1;
+
+			// 親ごとフラスタムの外にあれば分割しておく必要はない
+			const bool bParentCulled = IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Parent, Parent.FrustumInsideMask);
+			bool bMerge = bParentCulled;
+			float GridCoverage = -1.0f;
+
+			if (!bParentCulled && !IsDecisionValid(Siblings[0].ParentEvaluatedCameraPosition, Siblings[0].ParentDecisionMargin, Context.CameraPosition))
+			{
+				GridCoverage = CalculateSplitCoverage(Context, Parent);
+				if (GridCoverage > MergeThreshold)
+				{
+					const float ParentDecisionMargin = CalculateDecisionMargin(Context, Parent, GridCoverage, MergeThreshold);
+					for (int32 SiblingIndex = 0; SiblingIndex < 4; SiblingIndex++)
+					{
+						Siblings[SiblingIndex].ParentEvaluatedCameraPosition = Context.CameraPosition;
+						Siblings[SiblingIndex].ParentDecisionMargin = ParentDecisionMargin;
+					}
+				}
+				else
+				{
+					bMerge = true;
+				}
+			}
+
+			if (bMerge)
+			{
+				FTemporalQuadNode& Merged = LeavesBack.AddDefaulted_GetRef();
+				Merged.Node = Parent;
+				Merged.Node.FrustumInsideMask = 0;
+				Merged.bCulled = bParentCulled;
+				if (!bParentCulled)
+				{
+					Merged.EvaluatedCameraPosition = Context.CameraPosition;
+					Merged.DecisionMargin = CalculateDecisionMargin(Context, Parent, GridCoverage, SplitThreshold);
+				}
+				// 親の親の判定はまだしていないので、次のパスで評価させる
+				Merged.ParentDecisionMargin = -1.0f;
+				bMerged = true;
+			}
+			else
+			{
+				LeavesBack.Append(Siblings, 4);
+			}
+
+			Index += 4;
 		}
+
+		Swap(Leaves, LeavesBack);
 	}
+}
 
-	return INDEX_NONE;
+// ルートノードの4つの子のうち、どの部分木に含まれるか
+int32 GetRootChildIndex(const FQuadtreeBuildArena& Arena, const FQuadNode& Node)
+{
+	return GetChildIndex(Arena, Arena.RootLOD, Node);
 }
 
+// RootNodeから作り直す。RootNodeを分割する場合は4つの部分木を並列に作る
+void BuildFromRootNode(const FQuadtreeBuildContext& Context, const FQuadNode& RootNode, bool bParallel, FQuadtreeBuildArena& Arena)
+{
+	Arena.TemporalLeaves.Reset();
+
+	FQuadNode Root = RootNode;
+	Root.FrustumInsideMask = 0;
+
+	const bool bCulled = IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Root, Root.FrustumInsideMask);
+	const float GridCoverage = bCulled ? -1.0f : CalculateSplitCoverage(Context, Root);
+	if (GridCoverage <= Context.MaxScreenCoverage * (1.0f + SPLIT_HYSTERESIS))
+	{
+		// RootNodeがそのままリーフになる
+		RefineQuadNode(Context, Root, Context.CameraPosition, -1.0f, Arena.NodeStack, Arena.TemporalLeaves);
+		return;
+	}
+
+	const float ChildParentDecisionMargin = CalculateDecisionMargin(Context, Root, GridCoverage, Context.MaxScreenCoverage * (1.0f - SPLIT_HYSTERESIS));
+
+	ParallelFor(4, [&Context, &Root, ChildParentDecisionMargin, &Arena](int32 ChildIndex)
+	{
+		FQuadtreeBuildArena::FSubtree& Subtree = Arena.Subtrees[ChildIndex];
+		Subtree.Leaves.Reset();
+		RefineQuadNode(Context, MakeChildNode(Root, ChildIndex), Context.CameraPosition, ChildParentDecisionMargin, Subtree.NodeStack, Subtree.Leaves);
+	}, !bParallel);
+
+	for (const FQuadtreeBuildArena::FSubtree& Subtree : Arena.Subtrees)
+	{
+		Arena.TemporalLeaves.Append(Subtree.Leaves);
+	}
+}
+
+// 前フレームのQuadtreeから、判定が変わりうるノードだけ分割と統合をする。RootNodeの4つの部分木は独立に並列に処理する
+void RefineTemporalLeaves(const FQuadtreeBuildContext& Context, const FQuadNode& RootNode, bool bParallel, FQuadtreeBuildArena& Arena)
+{
+	if (Arena.TemporalLeaves.Num() == 1 && Arena.TemporalLeaves[0].Node.LOD == Arena.RootLOD)
+	{
+		// RootNodeがリーフのとき。判定が変わりうるときだけ作り直す
+		FTemporalQuadNode& Leaf = Arena.TemporalLeaves[0];
+		FQuadNode Node = Leaf.Node;
+		Node.FrustumInsideMask = 0;
+
+		const bool bCulled = IsQuadNodeFrustumCulled(Context.CullingFrustum, Context.MaxDisplacement, Node, Node.FrustumInsideMask);
+		if (bCulled || (!Leaf.bCulled && IsDecisionValid(Leaf.EvaluatedCameraPosition, Leaf.DecisionMargin, Context.CameraPosition)))
+		{
+			Leaf.bCulled = bCulled;
+		}
+		else
+		{
+			BuildFromRootNode(Context, RootNode, bParallel, Arena);
+		}
+		return;
+	}
+
+	// リーフは深さ優先順に並んでいるので、各部分木のリーフは連続しており、その範囲は二分探索で求まる
+	int32 SubtreeBegins[5];
+	for (int32 ChildIndex = 0; ChildIndex < 4; ChildIndex++)
+	{
+		SubtreeBegins[ChildIndex] = Algo::LowerBoundBy(Arena.TemporalLeaves, ChildIndex, [&Arena](const FTemporalQuadNode& Leaf) { return GetRootChildIndex(Arena, Leaf.Node); });
+	}
+	SubtreeBegins[4] = Arena.TemporalLeaves.Num();
+
+	FQuadNode Root = RootNode;
+	Root.FrustumInsideMask = 0;
+
+	// 兄弟4つのグループは部分木をまたがないので、統合も部分木ごとに独立にできる
+	ParallelFor(4, [&Context, &Arena, &SubtreeBegins, &Root](int32 ChildIndex)
+	{
+		FQuadtreeBuildArena::FSubtree& Subtree = Arena.Subtrees[ChildIndex];
+		Subtree.Leaves.Reset();
+		SplitTemporalLeavesInNode(Context, Arena, MakeChildNode(Root, ChildIndex), Arena.TemporalLeaves.GetData() + SubtreeBegins[ChildIndex], SubtreeBegins[ChildIndex + 1] - SubtreeBegins[ChildIndex], Subtree.NodeStack, Subtree.Leaves);
+		MergeTemporalLeaves(Context, Arena, Subtree.Leaves, Subtree.LeavesBack);
+	}, !bParallel);
+
+	Arena.TemporalLeaves.Reset();
+	for (const FQuadtreeBuildArena::FSubtree& Subtree : Arena.Subtrees)
+	{
+		Arena.TemporalLeaves.Append(Subtree.Leaves);
+	}
+
+	// 4つの部分木がすべてリーフ1つになったときだけ、RootNodeへの統合がありうる
+	if (Arena.TemporalLeaves.Num() == 4)
+	{
+		MergeTemporalLeaves(Context, Arena, Arena.TemporalLeaves, Arena.TemporalLeavesBack);
+	}
+}
 
 int32 GetGridMeshIndex(int32 Row, int32 Column, int32 NumColumn)
 {
@@ -156,16 +613,16 @@ uint32 CreateInnerMesh(int32 NumRowColumn, TArray<uint32>& OutIndices)
 {
 	check(NumRowColumn % 2 == 0);
 
-	// ͂̕ǂ̃bVp^[łAׂē̂쐬Bh[R[ŃCfbNXobt@̕sAANZX͂łȂ̂
+	// 内側の部分はどのメッシュパターンでも同じなので1つだけ作る。描画時は内側と4辺の境界部分を別々のバッチエレメントで描く
 	for (int32 Row = 1; Row < NumRowColumn - 1; Row++)
 	{
 		for (int32 Column = 1; Column < NumRowColumn - 1; Column++)
 		{
-			// 4̃ObhgCAO2ɕΊṕAbVŜ̑Ίp̕ɂȂĂA
-			// 4̕ň̕ӂLODȂ̕ӂLODꍇɁAẼWIĝ₷B
-			// ăCfbNX̃ObhƊ̃ObhőΊptɂB
-			// TRIANGLE_STRIPƓB
-			// NumRowColumnł邱ƂOɂĂ
+			// 4隅のグリッドをトライアングル2つに分割する対角線は、メッシュ全体の対角線の方向になっている方が、
+			// もし4隅の部分で一方の辺がLOD差がなく一方の辺がLOD差がある場合に、境界のジオメトリを作るのが扱いやすい。
+			// よってインデックスが偶数のグリッドと奇数のグリッドで対角線を逆にする。
+			// TRIANGLE_STRIPと同じ。
+			// NumRowColumnが偶数であることを前提にしている
 
 			if ((Row + Column) % 2 == 0)
 			{
@@ -193,348 +650,360 @@ uint32 CreateInnerMesh(int32 NumRowColumn, TArray<uint32>& OutIndices)
 	return 6 * (NumRowColumn - 2) * (NumRowColumn - 2);
 }
 
-uint32 CreateBoundaryMesh(EAdjacentQuadNodeLODDifference RightAdjLODDiff, EAdjacentQuadNodeLODDifference LeftAdjLODDiff, EAdjacentQuadNodeLODDifference BottomAdjLODDiff, EAdjacentQuadNodeLODDifference TopAdjLODDiff, int32 NumRowColumn, TArray<uint32>& OutIndices, TArray<Quadtree::FQuadMeshParameter>& OutQuadMeshParams)
+// 境界部分は、LODの差に合わせて隣と接する部分のトライアングルの辺を2倍あるいは4倍にする
+// 隣と接する辺の長いトライアングル単位でインデックスを追加していくため、LODの差が1ならグリッドをたどるループのステップを2、2以上なら4単位で行う
+// 4辺はそれぞれ隣接ノードとのLODの差だけで決まり、4隅のトライアングルが重複しないようにどの辺に含めるかも固定なので、辺ごとに独立して作れる
+uint32 CreateRightBoundaryMesh(EAdjacentQuadNodeLODDifference RightAdjLODDiff, int32 NumRowColumn, TArray<uint32>& OutIndices)
 {
 	check(NumRowColumn % 2 == 0);
 	uint32 NumIndices = 0;
 
-	// ÉALOD̍ɍ킹ėׂƐڂ镔̃gCAO̕ӂ2{邢4{ɂ
-	// ׂƐڂӂ̒gCAOPʂŃCfbNXǉĂ߁ALOD̍1ȂObhǂ郋[ṽXebv2A2ȏȂ4Pʂōs
-
-	// Right
+	if (RightAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
 	{
-		if (RightAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
+		for (int32 Row = 0; Row < NumRowColumn; Row++)
 		{
-			for (int32 Row = 0; Row < NumRowColumn; Row++)
+			if (Row % 2 == 0)
 			{
-				if (Row % 2 == 0)
+				if (Row > 0) // Bottomと重複しないように
 				{
-					if (Row > 0) // BottomƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row, 1, NumRowColumn));
-						NumIndices += 3;
-					}
-
 					OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + 1, 0, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row + 1, 1, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(Row, 1, NumRowColumn));
 					NumIndices += 3;
 				}
-				else
+
+				OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, 0, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, 1, NumRowColumn));
+				NumIndices += 3;
+			}
+			else
+			{
+				OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, 0, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row, 1, NumRowColumn));
+				NumIndices += 3;
+
+				if (Row < NumRowColumn) // Topと重複しないように
 				{
-					OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row + 1, 0, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(Row + 1, 1, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row, 1, NumRowColumn));
 					NumIndices += 3;
-
-					if (Row < NumRowColumn) // TopƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, 0, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row, 1, NumRowColumn));
-						NumIndices += 3;
-					}
 				}
 			}
 		}
-		else
-		{
-			int32 Step = 1 << (int32)RightAdjLODDiff;
+	}
+	else
+	{
+		int32 Step = 1 << (int32)RightAdjLODDiff;
 
-			for (int32 Row = 0; Row < NumRowColumn; Row += Step)
+		for (int32 Row = 0; Row < NumRowColumn; Row += Step)
+		{
+			// 接する部分の辺の長いトライアングル
+			OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(Row + Step, 0, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(Row + (Step >> 1), 1, NumRowColumn));
+			NumIndices += 3;
+
+			// 辺の長いトライアングルの山の下側を埋めるトライアングル
+			for (int32 i = 0; i < (Step >> 1); i++)
 			{
-				// ڂ镔̕ӂ̒gCAO
+				if (Row == 0 && i == 0)
+				{
+					// Bottomと重複しないように4隅のトライアングルの分は作らない
+					continue;
+				}
+
 				OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(Row + Step, 0, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(Row + (Step >> 1), 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i, 1, NumRowColumn));
 				NumIndices += 3;
+			}
 
-				// ӂ̒gCAO̎R̉𖄂߂gCAO
-				for (int32 i = 0; i < (Step >> 1); i++)
+			// 辺の長いトライアングルの山の上側を埋めるトライアングル
+			for (int32 i = (Step >> 1); i < Step; i++)
+			{
+				if (Row == (NumRowColumn - Step) && i == (Step - 1))
 				{
-					if (Row == 0 && i == 0)
-					{
-						// BottomƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(Row, 0, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i, 1, NumRowColumn));
-					NumIndices += 3;
+					// Topと重複しないように4隅のトライアングルの分は作らない
+					continue;
 				}
 
-				// ӂ̒gCAO̎Ȑ㑤𖄂߂gCAO
-				for (int32 i = (Step >> 1); i < Step; i++)
-				{
-					if (Row == (NumRowColumn - Step) && i == (Step - 1))
-					{
-						// TopƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(Row + Step, 0, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i, 1, NumRowColumn));
-					NumIndices += 3;
-				}
+				OutIndices.Emplace(GetGridMeshIndex(Row + Step, 0, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i, 1, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
 	}
 
-	// Left
+	return NumIndices;
+}
+
+uint32 CreateLeftBoundaryMesh(EAdjacentQuadNodeLODDifference LeftAdjLODDiff, int32 NumRowColumn, TArray<uint32>& OutIndices)
+{
+	check(NumRowColumn % 2 == 0);
+	uint32 NumIndices = 0;
+
+	if (LeftAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
 	{
-		if (LeftAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
+		for (int32 Row = 0; Row < NumRowColumn; Row++)
 		{
-			for (int32 Row = 0; Row < NumRowColumn; Row++)
+			if ((Row + NumRowColumn - 1) % 2 == 0)
 			{
-				if ((Row + NumRowColumn - 1) % 2 == 0)
+				OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn - 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
+				NumIndices += 3;
+
+				if (Row < (NumRowColumn - 1)) // Topと重複しないように
 				{
 					OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn - 1, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn - 1, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
 					NumIndices += 3;
-
-					if (Row < (NumRowColumn - 1)) // TopƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn - 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn - 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn, NumRowColumn));
-						NumIndices += 3;
-					}
 				}
-				else
+			}
+			else
+			{
+				if (Row > 0) // Bottomと重複しないように
 				{
-					if (Row > 0) // BottomƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn - 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn - 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
-						NumIndices += 3;
-					}
-
+					OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn - 1, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn - 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
 					NumIndices += 3;
 				}
+
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn - 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + 1, NumRowColumn, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
-		else
-		{
-			int32 Step = 1 << (int32)LeftAdjLODDiff;
+	}
+	else
+	{
+		int32 Step = 1 << (int32)LeftAdjLODDiff;
 
-			for (int32 Row = 0; Row < NumRowColumn; Row += Step)
+		for (int32 Row = 0; Row < NumRowColumn; Row += Step)
+		{
+			// 接する部分の辺の長いトライアングル
+			OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(Row + (Step >> 1), NumRowColumn - 1, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(Row + Step, NumRowColumn, NumRowColumn));
+			NumIndices += 3;
+
+			// 辺の長いトライアングルの山の下側を埋めるトライアングル
+			for (int32 i = 0; i < (Step >> 1); i++)
 			{
-				// ڂ镔̕ӂ̒gCAO
+				if (Row == 0 && i == 0)
+				{
+					// Bottomと重複しないように4隅のトライアングルの分は作らない
+					continue;
+				}
+
 				OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(Row + (Step >> 1), NumRowColumn - 1, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(Row + Step, NumRowColumn, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i, NumRowColumn - 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, NumRowColumn - 1, NumRowColumn));
 				NumIndices += 3;
+			}
 
-				// ӂ̒gCAO̎R̉𖄂߂gCAO
-				for (int32 i = 0; i < (Step >> 1); i++)
+			// 辺の長いトライアングルの山の上側を埋めるトライアングル
+			for (int32 i = (Step >> 1); i < Step; i++)
+			{
+				if (Row == (NumRowColumn - Step) && i == (Step - 1))
 				{
-					if (Row == 0 && i == 0)
-					{
-						// BottomƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(Row, NumRowColumn, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i, NumRowColumn - 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, NumRowColumn - 1, NumRowColumn));
-					NumIndices += 3;
+					// Topと重複しないように4隅のトライアングルの分は作らない
+					continue;
 				}
 
-				// ӂ̒gCAO̎Ȑ㑤𖄂߂gCAO
-				for (int32 i = (Step >> 1); i < Step; i++)
-				{
-					if (Row == (NumRowColumn - Step) && i == (Step - 1))
-					{
-						// TopƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(Row + Step, NumRowColumn, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i, NumRowColumn - 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, NumRowColumn - 1, NumRowColumn));
-					NumIndices += 3;
-				}
+				OutIndices.Emplace(GetGridMeshIndex(Row + Step, NumRowColumn, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i, NumRowColumn - 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(Row + i + 1, NumRowColumn - 1, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
 	}
 
-	// Bottom
+	return NumIndices;
+}
+
+uint32 CreateBottomBoundaryMesh(EAdjacentQuadNodeLODDifference BottomAdjLODDiff, int32 NumRowColumn, TArray<uint32>& OutIndices)
+{
+	check(NumRowColumn % 2 == 0);
+	uint32 NumIndices = 0;
+
+	if (BottomAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
 	{
-		if (BottomAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
+		for (int32 Column = 0; Column < NumRowColumn; Column++)
 		{
-			for (int32 Column = 0; Column < NumRowColumn; Column++)
+			if (Column % 2 == 0)
 			{
-				if (Column % 2 == 0)
+				OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column + 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(0, Column + 1, NumRowColumn));
+				NumIndices += 3;
+
+				if (Column > 0) // Rightと重複しないように
 				{
 					OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(1, Column, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(1, Column + 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(0, Column + 1, NumRowColumn));
 					NumIndices += 3;
-
-					if (Column > 0) // RightƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(1, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(1, Column + 1, NumRowColumn));
-						NumIndices += 3;
-					}
 				}
-				else
+			}
+			else
+			{
+				OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(0, Column + 1, NumRowColumn));
+				NumIndices += 3;
+
+				if (Column < NumRowColumn - 1) // Leftと重複しないように
 				{
-					OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(1, Column, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(1, Column + 1, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(0, Column + 1, NumRowColumn));
 					NumIndices += 3;
-
-					if (Column < NumRowColumn - 1) // LeftƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(1, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(1, Column + 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(0, Column + 1, NumRowColumn));
-						NumIndices += 3;
-					}
 				}
 			}
 		}
-		else
-		{
-			int32 Step = 1 << (int32)BottomAdjLODDiff;
+	}
+	else
+	{
+		int32 Step = 1 << (int32)BottomAdjLODDiff;
 
-			for (int32 Column = 0; Column < NumRowColumn; Column += Step)
+		for (int32 Column = 0; Column < NumRowColumn; Column += Step)
+		{
+			// 接する部分の辺の長いトライアングル
+			OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(1, Column + (Step >> 1), NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(0, Column + Step, NumRowColumn));
+			NumIndices += 3;
+
+			// 辺の長いトライアングルの山の右側を埋めるトライアングル
+			for (int32 i = 0; i < (Step >> 1); i++)
 			{
-				// ڂ镔̕ӂ̒gCAO
+				if (Column == 0 && i == 0)
+				{
+					// Bottomと重複しないように4隅のトライアングルの分は作らない
+					continue;
+				}
+
 				OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(1, Column + (Step >> 1), NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(0, Column + Step, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column + i, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column + i + 1, NumRowColumn));
 				NumIndices += 3;
+			}
 
-				// ӂ̒gCAO̎R̉E𖄂߂gCAO
-				for (int32 i = 0; i < (Step >> 1); i++)
+			// 辺の長いトライアングルの山の左側を埋めるトライアングル
+			for (int32 i = (Step >> 1); i < Step; i++)
+			{
+				if (Column == (NumRowColumn - Step) && i == (Step - 1))
 				{
-					if (Column == 0 && i == 0)
-					{
-						// BottomƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(0, Column, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(1, Column + i, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(1, Column + i + 1, NumRowColumn));
-					NumIndices += 3;
+					// Topと重複しないように4隅のトライアングルの分は作らない
+					continue;
 				}
 
-				// ӂ̒gCAO̎R̍𖄂߂gCAO
-				for (int32 i = (Step >> 1); i < Step; i++)
-				{
-					if (Column == (NumRowColumn - Step) && i == (Step - 1))
-					{
-						// TopƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(0, Column + Step, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(1, Column + i, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(1, Column + i + 1, NumRowColumn));
-					NumIndices += 3;
-				}
+				OutIndices.Emplace(GetGridMeshIndex(0, Column + Step, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column + i, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(1, Column + i + 1, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
 	}
 
-	// Top
+	return NumIndices;
+}
+
+uint32 CreateTopBoundaryMesh(EAdjacentQuadNodeLODDifference TopAdjLODDiff, int32 NumRowColumn, TArray<uint32>& OutIndices)
+{
+	check(NumRowColumn % 2 == 0);
+	uint32 NumIndices = 0;
+
+	if (TopAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
 	{
-		if (TopAdjLODDiff == EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST)
+		for (int32 Column = 0; Column < NumRowColumn; Column++)
 		{
-			for (int32 Column = 0; Column < NumRowColumn; Column++)
-			{
-				// 4̃ObhgCAO2ɕΊṕAbVŜ̑Ίp̕ɂȂĂA
-				// 4̕ň̕ӂLODȂ̕ӂLODꍇɁAẼWIĝ₷B
-				// ăCfbNX̃ObhƊ̃ObhőΊptɂB
-				// TRIANGLE_STRIPƓB
-				// NumRowColumnł邱ƂOɂĂ
+			// 4隅のグリッドをトライアングル2つに分割する対角線は、メッシュ全体の対角線の方向になっている方が、
+			// もし4隅の部分で一方の辺がLOD差がなく一方の辺がLOD差がある場合に、境界のジオメトリを作るのが扱いやすい。
+			// よってインデックスが偶数のグリッドと奇数のグリッドで対角線を逆にする。
+			// TRIANGLE_STRIPと同じ。
+			// NumRowColumnが偶数であることを前提にしている
 
-				if ((NumRowColumn - 1 + Column) % 2 == 0)
+			if ((NumRowColumn - 1 + Column) % 2 == 0)
+			{
+				if (Column < NumRowColumn - 1) // Leftと重複しないように
 				{
-					if (Column < NumRowColumn - 1) // LeftƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + 1, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + 1, NumRowColumn));
-						NumIndices += 3;
-					}
-
 					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + 1, NumRowColumn));
+					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + 1, NumRowColumn));
 					NumIndices += 3;
 				}
-				else
-				{
-					if (Column > 0) // RightƏdȂ悤
-					{
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
-						OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + 1, NumRowColumn));
-						NumIndices += 3;
-					}
 
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + 1, NumRowColumn));
+				NumIndices += 3;
+			}
+			else
+			{
+				if (Column > 0) // Rightと重複しないように
+				{
+					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + 1, NumRowColumn));
 					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + 1, NumRowColumn));
 					NumIndices += 3;
 				}
+
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + 1, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
-		else
-		{
-			int32 Step = 1 << (int32)TopAdjLODDiff;
+	}
+	else
+	{
+		int32 Step = 1 << (int32)TopAdjLODDiff;
 
-			for (int32 Column = 0; Column < NumRowColumn; Column += Step)
+		for (int32 Column = 0; Column < NumRowColumn; Column += Step)
+		{
+			// 接する部分の辺の長いトライアングル
+			OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + Step, NumRowColumn));
+			OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + (Step >> 1), NumRowColumn));
+			NumIndices += 3;
+
+			// 辺の長いトライアングルの山の右側を埋めるトライアングル
+			for (int32 i = 0; i < (Step >> 1); i++)
 			{
-				// ڂ镔̕ӂ̒gCAO
+				if (Column == 0 && i == 0)
+				{
+					// Bottomと重複しないように4隅のトライアングルの分は作らない
+					continue;
+				}
+
 				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + Step, NumRowColumn));
-				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + (Step >> 1), NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i + 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i, NumRowColumn));
 				NumIndices += 3;
+			}
 
-				// ӂ̒gCAO̎R̉E𖄂߂gCAO
-				for (int32 i = 0; i < (Step >> 1); i++)
+			// 辺の長いトライアングルの山の左側を埋めるトライアングル
+			for (int32 i = (Step >> 1); i < Step; i++)
+			{
+				if (Column == (NumRowColumn - Step) && i == (Step - 1))
 				{
-					if (Column == 0 && i == 0)
-					{
-						// BottomƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i + 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i, NumRowColumn));
-					NumIndices += 3;
+					// Topと重複しないように4隅のトライアングルの分は作らない
+					continue;
 				}
 
-				// ӂ̒gCAO̎R̍𖄂߂gCAO
-				for (int32 i = (Step >> 1); i < Step; i++)
-				{
-					if (Column == (NumRowColumn - Step) && i == (Step - 1))
-					{
-						// TopƏdȂ悤4̃gCAO͍̕Ȃ
-						continue;
-					}
-
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + Step, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i + 1, NumRowColumn));
-					OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i, NumRowColumn));
-					NumIndices += 3;
-				}
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn, Column + Step, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i + 1, NumRowColumn));
+				OutIndices.Emplace(GetGridMeshIndex(NumRowColumn - 1, Column + i, NumRowColumn));
+				NumIndices += 3;
 			}
 		}
 	}
@@ -555,38 +1024,330 @@ bool FQuadNode::ContainsPosition2D(const FVector2D& Position2D) const
 	return (BottomRight.X <= Position2D.X && Position2D.X <= (BottomRight.X + Length) && BottomRight.Y <= Position2D.Y && Position2D.Y <= (BottomRight.Y + Length));
 }
 
-void BuildQuadtree(int32 MaxLOD, int32 NumRowColumn, float MaxScreenCoverage, float PatchLength, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, FQuadNode& RootNode, TArray<FQuadNode>& OutAllQuadNodeList, TArray<FQuadNode>& OutRenderQuadNodeList)
+bool FQuadtreeShapeParameters::operator==(const FQuadtreeShapeParameters& Other) const
+{
+	return RootBottomRight == Other.RootBottomRight
+		&& RootLength == Other.RootLength
+		&& RootLOD == Other.RootLOD
+		&& NumRowColumn == Other.NumRowColumn
+		&& MaxScreenCoverage == Other.MaxScreenCoverage
+		&& PatchLength == Other.PatchLength
+		&& ProjectionScale == Other.ProjectionScale;
+}
+
+void FQuadtreeBuildArena::Reset()
+{
+	NodeStack.Reset();
+	RenderQuadNodeList.Reset();
+	QuadMeshParamsIndices.Reset();
+	LeafIndexMap.Reset();
+}
+
+SIZE_T FQuadtreeBuildArena::GetAllocatedSize() const
+{
+	SIZE_T Ret = NodeStack.GetAllocatedSize() + RenderQuadNodeList.GetAllocatedSize() + QuadMeshParamsIndices.GetAllocatedSize() + LeafIndexMap.GetAllocatedSize()
+		+ TemporalLeaves.GetAllocatedSize() + TemporalLeavesBack.GetAllocatedSize();
+
+	for (const FSubtree& Subtree : Subtrees)
+	{
+		Ret += Subtree.NodeStack.GetAllocatedSize() + Subtree.Leaves.GetAllocatedSize() + Subtree.LeavesBack.GetAllocatedSize();
+	}
+
+	return Ret;
+}
+
+FQuadtreeBuildArena& FindOrAddViewArena(FQuadtreeViewArenaMap& ViewArenas, const FSceneView& View)
 {
-	BuildQuadtreeRecursively(MaxLOD, NumRowColumn, MaxScreenCoverage, PatchLength, CameraPosition, ProjectionScale, ViewProjectionMatrix, RootNode, OutAllQuadNodeList);
+	check(IsInRenderingThread());
+
+	// この数のフレームの間描画されなかったビューのアリーナは捨てる
+	static constexpr uint32 NUM_FRAMES_TO_KEEP_UNUSED_ARENA = 60;
+
+	// ビューのインデックスはフレームごとに変わりうるので、前フレームのQuadtreeを引き継ぐためにフレームをまたいで変わらないIDで引く。
+	// ステートを持たないビューは描画先とその中の矩形、ステレオのパスで区別し、ビューキーと重ならないように上位32ビットを立てる。
+	// ハッシュが衝突してもアリーナを共有するだけで、前フレームのQuadtreeを使うかどうかはカメラの移動量で判定するので結果は正しい
+	uint64 ViewId = 0;
+	if (View.State != nullptr)
+	{
+		ViewId = View.State->GetViewKey();
+	}
+	else
+	{
+		uint32 Hash = PointerHash(View.Family->RenderTarget);
+		Hash = HashCombine(Hash, GetTypeHash(View.UnscaledViewRect.Min));
+		Hash = HashCombine(Hash, GetTypeHash(View.UnscaledViewRect.Max));
+		Hash = HashCombine(Hash, ::GetTypeHash((int32)View.StereoPass));
+		ViewId = (1ull << 32) | Hash;
+	}
+	const uint32 FrameNumber = View.Family->FrameNumber;
+
+	for (FQuadtreeViewArenaMap::TIterator It(ViewArenas); It; ++It)
+	{
+		if (It.Key() != ViewId && FrameNumber - It.Value()->LastUsedFrameNumber > NUM_FRAMES_TO_KEEP_UNUSED_ARENA)
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	// 構築タスクが参照している間に他のビューのアリーナが追加されてもアドレスが変わらないように、アリーナは個別に確保する
+	TUniquePtr<FQuadtreeBuildArena>& Arena = ViewArenas.FindOrAdd(ViewId);
+	if (!Arena.IsValid())
+	{
+		Arena = MakeUnique<FQuadtreeBuildArena>();
+		INC_DWORD_STAT(STAT_QuadtreeBuildArenaAllocations);
+	}
+
+	Arena->LastUsedFrameNumber = FrameNumber;
+	return *Arena;
+}
+
+bool FQuadtreeBuildParameters::operator==(const FQuadtreeBuildParameters& Other) const
+{
+	return MaxLOD == Other.MaxLOD
+		&& NumRowColumn == Other.NumRowColumn
+		&& MaxScreenCoverage == Other.MaxScreenCoverage
+		&& PatchLength == Other.PatchLength
+		&& MaxDisplacement == Other.MaxDisplacement
+		&& CameraPosition == Other.CameraPosition
+		&& ProjectionScale == Other.ProjectionScale
+		&& ViewProjectionMatrix.Equals(Other.ViewProjectionMatrix, 0.0f)
+		&& RootNode.BottomRight == Other.RootNode.BottomRight
+		&& RootNode.Length == Other.RootNode.Length
+		&& RootNode.LOD == Other.RootNode.LOD;
+}
+
+uint32 GetTypeHash(const FQuadtreeBuildParameters& Parameters)
+{
+	// 行列は全要素のビット列でハッシュする。一致判定はoperator==で全パラメータを比較する
+	uint32 Hash = FCrc::MemCrc32(&Parameters.ViewProjectionMatrix.M[0][0], sizeof(Parameters.ViewProjectionMatrix.M));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.RootNode.BottomRight));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.RootNode.Length));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.MaxLOD));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.NumRowColumn));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.MaxScreenCoverage));
+	Hash = HashCombine(Hash, GetTypeHash(Parameters.PatchLength));
+	return Hash;
+}
+
+struct FQuadtreeViewBuildTasks::FCachedResult : public FQuadtreeBuildResult
+{
+	/** Valid while a task is building this. */
+	FGraphEventRef Event;
+	/** Arena to build this in the first Wait() if the build is not launched as a task. */
+	FQuadtreeBuildArena* DeferredArena = nullptr;
+	bool bBuilt = false;
+
+	/** Prepare to be built again. The arrays keep their allocations. */
+	void Reset()
+	{
+		RenderQuadNodeList.Reset();
+		QuadMeshParamsIndices.Reset();
+		BuildTimeMs = 0.0f;
+		Event = nullptr;
+		DeferredArena = nullptr;
+		bBuilt = false;
+	}
+};
+
+namespace
+{
+// 1フレームの間だけ、ビューやコンポーネントをまたいでBuildQuadtree()の結果を共有するキャッシュ。レンダースレッドからのみアクセスする
+TMap<FQuadtreeBuildParameters, TSharedPtr<FQuadtreeViewBuildTasks::FCachedResult, ESPMode::ThreadSafe>> GQuadtreeResultCache;
+uint32 GQuadtreeResultCacheFrameNumber = 0;
+// 1フレームにキャッシュする結果の数の上限。ビューとコンポーネントが多くてもキャッシュと再利用する結果のメモリがこれ以上増えないように、
+// 超えた分はキャッシュせずに構築する
+constexpr int32 MAX_CACHED_QUADTREE_RESULTS = 64;
+// 前のフレームの結果。配列の確保を使いまわすため、このフレームの結果に再利用する。使われなかったものは次のフレームで捨てる
+TArray<TSharedPtr<FQuadtreeViewBuildTasks::FCachedResult, ESPMode::ThreadSafe>> GQuadtreeFreeResults;
+
+TSharedPtr<FQuadtreeViewBuildTasks::FCachedResult, ESPMode::ThreadSafe> AllocateCachedResult()
+{
+	if (GQuadtreeFreeResults.Num() > 0)
+	{
+		TSharedPtr<FQuadtreeViewBuildTasks::FCachedResult, ESPMode::ThreadSafe> Result = GQuadtreeFreeResults.Pop(false);
+		Result->Reset();
+		return Result;
+	}
+
+	return MakeShared<FQuadtreeViewBuildTasks::FCachedResult, ESPMode::ThreadSafe>();
+}
+
+void BuildCachedResult(FQuadtreeBuildArena& Arena, const FQuadtreeBuildParameters& Parameters, FQuadtreeViewBuildTasks::FCachedResult& Result)
+{
+	const uint32 StartCycles = FPlatformTime::Cycles();
+
+	BuildQuadtree(Parameters.MaxLOD, Parameters.NumRowColumn, Parameters.MaxScreenCoverage, Parameters.PatchLength, Parameters.MaxDisplacement, Parameters.CameraPosition, Parameters.ProjectionScale, Parameters.ViewProjectionMatrix, Parameters.RootNode, Arena);
+
+	// アリーナは次のフレームや、アリーナを共有する他のビューで上書きされるので結果に移す。
+	// 入れ替わりにアリーナに入るのは再利用した結果の配列で、次の構築でResetされて確保が使いまわされる
+	Swap(Result.RenderQuadNodeList, Arena.RenderQuadNodeList);
+	Swap(Result.QuadMeshParamsIndices, Arena.QuadMeshParamsIndices);
+	Result.BuildTimeMs = FPlatformTime::ToMilliseconds(FPlatformTime::Cycles() - StartCycles);
+	Result.bBuilt = true;
+}
+} // namespace
 
-	for (const FQuadNode& Node : OutAllQuadNodeList)
+FQuadtreeViewBuildTasks::~FQuadtreeViewBuildTasks()
+{
+	// 構築タスクはアリーナを参照しているので、Wait()されなかったものもここで完了を待つ
+	for (FViewTask& ViewTask : ViewTasks)
 	{
-		if (Node.IsLeaf())
+		if (ViewTask.Result.IsValid() && ViewTask.Result->Event.IsValid())
 		{
-			OutRenderQuadNodeList.Add(Node);
+			FTaskGraphInterface::Get().WaitUntilTaskCompletes(ViewTask.Result->Event, ENamedThreads::GetRenderThread_Local());
+			ViewTask.Result->Event = nullptr;
 		}
 	}
 }
 
-EAdjacentQuadNodeLODDifference QueryAdjacentNodeType(const FQuadNode& Node, const FVector2D& AdjacentPosition, const TArray<FQuadNode>& RenderQuadNodeList)
+void FQuadtreeViewBuildTasks::Launch(int32 ViewIndex, FQuadtreeBuildArena& Arena, const FQuadtreeBuildParameters& Parameters)
 {
-	int32 AdjNodeIndex = SearchLeafContainsPosition2D(RenderQuadNodeList, AdjacentPosition);
+	check(IsInRenderingThread());
 
-	EAdjacentQuadNodeLODDifference Ret = EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST;
-	if (AdjNodeIndex != INDEX_NONE)
+	// 前のフレームの結果は再利用に回す。タスクはすべてGetDynamicMeshElements()の中で完了しているので参照は残っていない
+	if (GQuadtreeResultCacheFrameNumber != GFrameNumberRenderThread)
 	{
-		int32 AdjNodeLOD = RenderQuadNodeList[AdjNodeIndex].LOD;
-		if (Node.LOD + 2 <= AdjNodeLOD)
+		GQuadtreeFreeResults.Reset();
+		for (TPair<FQuadtreeBuildParameters, TSharedPtr<FCachedResult, ESPMode::ThreadSafe>>& Pair : GQuadtreeResultCache)
 		{
-			Ret = EAdjacentQuadNodeLODDifference::GREATER_BY_MORE_THAN_2;
+			if (Pair.Value.IsUnique())
+			{
+				GQuadtreeFreeResults.Add(MoveTemp(Pair.Value));
+			}
 		}
-		else if (Node.LOD + 1 <= AdjNodeLOD)
+		GQuadtreeResultCache.Reset();
+		GQuadtreeResultCacheFrameNumber = GFrameNumberRenderThread;
+	}
+
+	if (ViewTasks.Num() <= ViewIndex)
+	{
+		ViewTasks.SetNum(ViewIndex + 1);
+	}
+
+	FViewTask& ViewTask = ViewTasks[ViewIndex];
+	check(!ViewTask.Result.IsValid());
+	ViewTask.Parameters = Parameters;
+
+	INC_DWORD_STAT(STAT_QuadtreeResultCacheLookups);
+
+	// 影のビューとメインのビューや、同じパラメータのコンポーネントどうしは同じQuadtreeになるので、このフレームですでに構築したものを使う
+	if (const TSharedPtr<FCachedResult, ESPMode::ThreadSafe>* CachedResult = GQuadtreeResultCache.Find(Parameters))
+	{
+		INC_DWORD_STAT(STAT_QuadtreeResultCacheHits);
+		ViewTask.Result = *CachedResult;
+		ViewTask.bCacheHit = true;
+		return;
+	}
+
+	ViewTask.Result = AllocateCachedResult();
+	ViewTask.bCacheHit = false;
+	if (GQuadtreeResultCache.Num() < MAX_CACHED_QUADTREE_RESULTS)
+	{
+		GQuadtreeResultCache.Add(Parameters, ViewTask.Result);
+	}
+
+	// アリーナを共有するビューは、先のビューの結果を使い終わったあとで、Wait()の中で構築する
+	if (CVarQuadtreeAsyncBuild.GetValueOnRenderThread() == 0 || LaunchedArenas.Contains(&Arena))
+	{
+		ViewTask.Result->DeferredArena = &Arena;
+		return;
+	}
+
+	LaunchedArenas.Add(&Arena);
+	FCachedResult* Result = ViewTask.Result.Get();
+	Result->Event = FFunctionGraphTask::CreateAndDispatchWhenReady([&Arena, Parameters, Result]()
+	{
+		BuildCachedResult(Arena, Parameters, *Result);
+	}, GET_STATID(STAT_BuildQuadtree), nullptr, ENamedThreads::AnyHiPriThreadHiPriTask);
+}
+
+const FQuadtreeBuildResult& FQuadtreeViewBuildTasks::Wait(int32 ViewIndex)
+{
+	check(IsInRenderingThread());
+
+	FViewTask& ViewTask = ViewTasks[ViewIndex];
+	FCachedResult& Result = *ViewTask.Result;
+
+	if (Result.Event.IsValid())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(Result.Event, ENamedThreads::GetRenderThread_Local());
+		Result.Event = nullptr;
+	}
+	else if (!Result.bBuilt)
+	{
+		check(Result.DeferredArena != nullptr);
+		BuildCachedResult(*Result.DeferredArena, ViewTask.Parameters, Result);
+		Result.DeferredArena = nullptr;
+	}
+
+	check(Result.bBuilt);
+	if (ViewTask.bCacheHit)
+	{
+		INC_FLOAT_STAT_BY(STAT_QuadtreeResultCacheTimeSaved, Result.BuildTimeMs);
+	}
+
+	return Result;
+}
+
+void BuildQuadtree(int32 MaxLOD, int32 NumRowColumn, float MaxScreenCoverage, float PatchLength, float MaxDisplacement, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, const FQuadNode& RootNode, FQuadtreeBuildArena& Arena)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BuildQuadtree);
+
+	const SIZE_T PrevAllocatedSize = Arena.GetAllocatedSize();
+
+	Arena.Reset();
+	Arena.RootBottomRight = FVector2D(RootNode.BottomRight.X, RootNode.BottomRight.Y);
+	Arena.LOD0Length = RootNode.Length / (1 << RootNode.LOD);
+	Arena.RootLOD = RootNode.LOD;
+
+	FQuadtreeBuildContext Context;
+	Context.NumRowColumn = NumRowColumn;
+	Context.MaxScreenCoverage = MaxScreenCoverage;
+	Context.PatchLength = PatchLength;
+	Context.MaxDisplacement = MaxDisplacement;
+	Context.CameraPosition = CameraPosition;
+	Context.ProjectionScale = ProjectionScale;
+	Context.ViewProjectionMatrix = &ViewProjectionMatrix;
+	InitCullingFrustum(ViewProjectionMatrix, Context.CullingFrustum);
+
+	FQuadtreeShapeParameters Shape;
+	Shape.RootBottomRight = RootNode.BottomRight;
+	Shape.RootLength = RootNode.Length;
+	Shape.RootLOD = RootNode.LOD;
+	Shape.NumRowColumn = NumRowColumn;
+	Shape.MaxScreenCoverage = MaxScreenCoverage;
+	Shape.PatchLength = PatchLength;
+	Shape.ProjectionScale = ProjectionScale;
+
+	const bool bParallel = (CVarQuadtreeAsyncBuild.GetValueOnAnyThread() != 0);
+
+	if (Arena.TemporalLeaves.Num() == 0 || Arena.TemporalShape != Shape)
+	{
+		// 前フレームのQuadtreeが使えないのでRootNodeから作る
+		Arena.TemporalShape = Shape;
+		BuildFromRootNode(Context, RootNode, bParallel, Arena);
+	}
+	else
+	{
+		// カメラがほとんど動かなければほぼ評価しない
+		RefineTemporalLeaves(Context, RootNode, bParallel, Arena);
+	}
+
+	for (const FTemporalQuadNode& Leaf : Arena.TemporalLeaves)
+	{
+		if (!Leaf.bCulled)
 		{
-			Ret = EAdjacentQuadNodeLODDifference::GREATER_BY_1;
+			Arena.RenderQuadNodeList.Add(Leaf.Node);
 		}
 	}
 
-	return Ret;
+	CalculateQuadMeshParamsIndices(Arena);
+
+	// 定常状態では0になるはず。カメラが大きく動いてリーフ数が過去最大を超えたときだけ確保が起きる
+	if (Arena.GetAllocatedSize() != PrevAllocatedSize)
+	{
+		INC_DWORD_STAT(STAT_QuadtreeBuildArenaAllocations);
+	}
 }
 
 void CreateQuadMeshes(int32 NumRowColumn, TArray<uint32>& OutIndices, TArray<Quadtree::FQuadMeshParameter>& OutQuadMeshParams)
@@ -594,31 +1355,57 @@ void CreateQuadMeshes(int32 NumRowColumn, TArray<uint32>& OutIndices, TArray<Qua
 	check((uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST == 0);
 	check((uint32)EAdjacentQuadNodeLODDifference::MAX == 3);
 
-	// Obhׂ2̃gCAOŕꍇ̃bV81p^[ŊmۂĂBmɂ͋E傫ȃgCAO
-	// p^[܂ނ̂łƏȂAGɂȂ̂ő傫߂ɊmۂĂ
-	OutIndices.Reset(81 * 2 * 3 * NumRowColumn * NumRowColumn);
-
-	// EׂLODȉȂ̂ƁAiKȂ̂ƁAiKȏȂ̂3p^[BׁAׁAׂł3p^[ł̑gݍ킹3*3*3*3p^[B
-	OutQuadMeshParams.Reset(81);
+	// 内側のメッシュ1つと、4辺それぞれについて隣がLODが自分以下なのと、一段階上なのと、二段階以上なのの3パターンの境界メッシュ。
+	// 境界部分は大きめに1辺あたり2*3*NumRowColumnで確保しておく
+	OutIndices.Reset(6 * (NumRowColumn - 2) * (NumRowColumn - 2) + NUM_QUAD_MESH_BOUNDARY_PARAMS * 2 * 3 * NumRowColumn);
+	OutQuadMeshParams.Reset(NUM_QUAD_MESH_PARAMS);
 
 	uint32 IndexOffset = 0;
-	for (uint32 RightType = (uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST; RightType < (uint32)EAdjacentQuadNodeLODDifference::MAX; RightType++)
+	uint32 NumInnerMeshIndices = CreateInnerMesh(NumRowColumn, OutIndices);
+	OutQuadMeshParams.Emplace(IndexOffset, NumInnerMeshIndices);
+	IndexOffset += NumInnerMeshIndices;
+
+	typedef uint32 (*CreateBoundaryMeshFunc)(EAdjacentQuadNodeLODDifference, int32, TArray<uint32>&);
+	// TArrayのインデックスは、1 + 辺 * 3 + LODの差 となる。辺の順番はRight、Left、Bottom、Top
+	const CreateBoundaryMeshFunc CreateBoundaryMeshFuncs[4] = {CreateRightBoundaryMesh, CreateLeftBoundaryMesh, CreateBottomBoundaryMesh, CreateTopBoundaryMesh};
+	for (CreateBoundaryMeshFunc CreateBoundaryMesh : CreateBoundaryMeshFuncs)
 	{
-		for (uint32 LeftType = (uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST; LeftType < (uint32)EAdjacentQuadNodeLODDifference::MAX; LeftType++)
+		for (uint32 LODDiff = (uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST; LODDiff < (uint32)EAdjacentQuadNodeLODDifference::MAX; LODDiff++)
 		{
-			for (uint32 BottomType = (uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST; BottomType < (uint32)EAdjacentQuadNodeLODDifference::MAX; BottomType++)
-			{
-				for (uint32 TopType = (uint32)EAdjacentQuadNodeLODDifference::LESS_OR_EQUAL_OR_NOT_EXIST; TopType < (uint32)EAdjacentQuadNodeLODDifference::MAX; TopType++)
-				{
-					uint32 NumInnerMeshIndices = CreateInnerMesh(NumRowColumn, OutIndices);
-					uint32 NumBoundaryMeshIndices = CreateBoundaryMesh((EAdjacentQuadNodeLODDifference)RightType, (EAdjacentQuadNodeLODDifference)LeftType, (EAdjacentQuadNodeLODDifference)BottomType, (EAdjacentQuadNodeLODDifference)TopType, NumRowColumn, OutIndices, OutQuadMeshParams);
-					// TArraỹCfbNX́ARightType * 3^3 + LeftType * 3^2 + BottomType * 3^1 + TopType * 3^0ƂȂ
-					OutQuadMeshParams.Emplace(IndexOffset, NumInnerMeshIndices + NumBoundaryMeshIndices);
-					IndexOffset += NumInnerMeshIndices + NumBoundaryMeshIndices;
-				}
-			}
+			uint32 NumBoundaryMeshIndices = CreateBoundaryMesh((EAdjacentQuadNodeLODDifference)LODDiff, NumRowColumn, OutIndices);
+			OutQuadMeshParams.Emplace(IndexOffset, NumBoundaryMeshIndices);
+			IndexOffset += NumBoundaryMeshIndices;
 		}
 	}
 }
-} // namespace Quadtree
 
+void GetQuadMeshPartIndices(uint32 QuadMeshParamsIndex, uint32 OutPartIndices[NUM_QUAD_MESH_PARTS])
+{
+	check(QuadMeshParamsIndex < NUM_QUAD_MESH_PATTERNS);
+
+	// QuadMeshParamsIndexはRightType * 3^3 + LeftType * 3^2 + BottomType * 3^1 + TopType * 3^0
+	const uint32 RightType = QuadMeshParamsIndex / 27;
+	const uint32 LeftType = (QuadMeshParamsIndex / 9) % 3;
+	const uint32 BottomType = (QuadMeshParamsIndex / 3) % 3;
+	const uint32 TopType = QuadMeshParamsIndex % 3;
+
+	OutPartIndices[0] = 0;
+	OutPartIndices[1] = 1 + 0 * 3 + RightType;
+	OutPartIndices[2] = 1 + 1 * 3 + LeftType;
+	OutPartIndices[3] = 1 + 2 * 3 + BottomType;
+	OutPartIndices[4] = 1 + 3 * 3 + TopType;
+}
+
+uint32 CalculateUndedupedQuadMeshIndexCount(const TArray<Quadtree::FQuadMeshParameter>& QuadMeshParams)
+{
+	check(QuadMeshParams.Num() == NUM_QUAD_MESH_PARAMS);
+
+	// 81パターンそれぞれに内側のメッシュを持ち、各辺の各パターンは81パターン中27パターンに現れる
+	uint32 NumBoundaryMeshIndices = 0;
+	for (uint32 i = 1; i < NUM_QUAD_MESH_PARAMS; i++)
+	{
+		NumBoundaryMeshIndices += QuadMeshParams[i].NumIndices;
+	}
+	return NUM_QUAD_MESH_PATTERNS * QuadMeshParams[0].NumIndices + 27 * NumBoundaryMeshIndices;
+}
+} // namespace Quadtree
@@ -14,6 +14,7 @@
 #include "Engine/Engine.h"
 #include "Materials/MaterialInstanceDynamic.h"
 #include "DeformMesh/DeformableVertexBuffers.h"
+#include "Quadtree/QuadNodeInstancedMesh.h"
 
 using namespace Quadtree;
 
@@ -31,8 +32,8 @@ public:
 		: FPrimitiveSceneProxy(Component)
 		, VertexFactory(GetScene().GetFeatureLevel(), "FQuadtreeMeshSceneProxy")
 		, MaterialRelevance(Component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
-		, LODMIDList(Component->GetLODMIDList())
-		, QuadMeshParams(Component->GetQuadMeshParams())
+		, QuadNodeMID(Component->GetQuadNodeMID())
+		, IndexBuffer(Component->GetQuadMeshIndexBuffer())
 		, NumGridDivision(Component->NumGridDivision)
 		, GridLength(Component->GridLength)
 		, MaxLOD(Component->MaxLOD)
@@ -41,11 +42,10 @@ public:
 	{
 		TArray<FDynamicMeshVertex> Vertices;
 		Vertices.Reset(Component->GetVertices().Num());
-		IndexBuffer.Indices = Component->GetIndices();
 
 		for (int32 VertIdx = 0; VertIdx < Component->GetVertices().Num(); VertIdx++)
 		{
-			// TODO:Tangent͂Ƃ肠FDynamicMeshVertex̃ftHgl܂ɂBColorDynamicMeshVertex̃ftHgl̗pĂ
+			// TODO:TangentはとりあえずFDynamicMeshVertexのデフォルト値まかせにする。ColorはDynamicMeshVertexのデフォルト値を採用している
 			Vertices.Emplace(Component->GetVertices()[VertIdx], Component->GetTexCoords()[VertIdx], FColor(255, 255, 255));
 		}
 		VertexBuffers.InitFromDynamicVertex(&VertexFactory, Vertices);
@@ -54,7 +54,6 @@ public:
 		BeginInitResource(&VertexBuffers.PositionVertexBuffer);
 		BeginInitResource(&VertexBuffers.DeformableMeshVertexBuffer);
 		BeginInitResource(&VertexBuffers.ColorVertexBuffer);
-		BeginInitResource(&IndexBuffer);
 		BeginInitResource(&VertexFactory);
 
 		// Grab material
@@ -64,8 +63,8 @@ public:
 			Material = UMaterial::GetDefaultMaterial(MD_Surface);
 		}
 
-		// GetDynamicMeshElements()̂ƁAVerifyUsedMaterial()ɂă}eAR|[lgɂ̂`FbN̂
-		// SetUsedMaterialForVerification()œo^邪A_[XbhoȂcheckɂЂ̂
+		// GetDynamicMeshElements()のあと、VerifyUsedMaterial()によってマテリアルがコンポーネントにあったものかチェックされるので
+		// SetUsedMaterialForVerification()で登録する手もあるが、レンダースレッド出ないとcheckにひっかかるので
 		bVerifyUsedMaterials = false;
 	}
 
@@ -74,7 +73,6 @@ public:
 		VertexBuffers.PositionVertexBuffer.ReleaseResource();
 		VertexBuffers.DeformableMeshVertexBuffer.ReleaseResource();
 		VertexBuffers.ColorVertexBuffer.ReleaseResource();
-		IndexBuffer.ReleaseResource();
 		VertexFactory.ReleaseResource();
 	}
 
@@ -101,93 +99,91 @@ public:
 		//	MaterialProxy = Material->GetRenderProxy();
 		//}
 
+		// RootNodeの辺の長さはPatchLengthを2のMaxLOD乗したサイズ
+		FQuadNode RootNode;
+		RootNode.Length = PatchLength * (1 << MaxLOD);
+		RootNode.BottomRight = GetLocalToWorld().GetOrigin() + FVector(-RootNode.Length * 0.5f, -RootNode.Length * 0.5f, 0.0f);
+		RootNode.LOD = MaxLOD;
+
+		// 先にすべてのビューのQuadtreeの構築をタスクで開始しておき、メッシュバッチを作るときにビューごとに完了を待つ
+		FQuadtreeViewBuildTasks BuildTasks;
+
 		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
 		{
 			if (VisibilityMap & (1 << ViewIndex))
 			{
 				const FSceneView* View = Views[ViewIndex];
 
-				// RootNode̕ӂ̒PatchLength2MaxLOD悵TCY
-				FQuadNode RootNode;
-				RootNode.Length = PatchLength * (1 << MaxLOD);
-				RootNode.BottomRight = GetLocalToWorld().GetOrigin() + FVector(-RootNode.Length * 0.5f, -RootNode.Length * 0.5f, 0.0f);
-				RootNode.LOD = MaxLOD;
-
-				// Area()Ƃ֐邪A傫ȐŊĐx𗎂ƂȂ悤2iKŊ
-				float MaxScreenCoverage = (float)GridMaxPixelCoverage * GridMaxPixelCoverage / View->UnscaledViewRect.Width() / View->UnscaledViewRect.Height();
-
-				TArray<FQuadNode> QuadNodeList;
-				QuadNodeList.Reserve(128); //TODO:Ƃ肠̌X128BŖmۂ͏sʂÅ֐constȂ̂łƂ肠
-				TArray<FQuadNode> RenderList;
-				RenderList.Reserve(64); //TODO:Ƃ肠̌X64BŖmۂ͏sʂÅ֐constȂ̂łƂ肠
-
-				Quadtree::BuildQuadtree(MaxLOD, NumGridDivision, MaxScreenCoverage, PatchLength, View->ViewMatrices.GetViewOrigin(), View->ViewMatrices.GetProjectionScale(), View->ViewMatrices.GetViewProjectionMatrix(), RootNode, QuadNodeList, RenderList);
+				FQuadtreeBuildParameters BuildParams;
+				BuildParams.MaxLOD = MaxLOD;
+				BuildParams.NumRowColumn = NumGridDivision;
+				// Area()という関数もあるが、大きな数で割って精度を落とさないように2段階で割る
+				BuildParams.MaxScreenCoverage = (float)GridMaxPixelCoverage * GridMaxPixelCoverage / View->UnscaledViewRect.Width() / View->UnscaledViewRect.Height();
+				BuildParams.PatchLength = PatchLength;
+				// 頂点を変位させないので、フラスタムカリングのAABBは平らでよい
+				BuildParams.MaxDisplacement = 0.0f;
+				BuildParams.CameraPosition = View->ViewMatrices.GetViewOrigin();
+				BuildParams.ProjectionScale = View->ViewMatrices.GetProjectionScale();
+				BuildParams.ViewProjectionMatrix = View->ViewMatrices.GetViewProjectionMatrix();
+				BuildParams.RootNode = RootNode;
+
+				// ビューごとのワークメモリと前フレームのQuadtreeはフレームをまたいで使いまわす。GetDynamicMeshElements()はレンダースレッドからしか呼ばれないのでmutableで持つ
+				BuildTasks.Launch(ViewIndex, FindOrAddViewArena(ViewArenas, *View), BuildParams);
+			}
+		}
 
-				for (const FQuadNode& Node : RenderList)
+		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
+		{
+			if (VisibilityMap & (1 << ViewIndex))
+			{
+				// 同じフレームで同じパラメータのビューやコンポーネントがあれば、その結果を共有している
+				const FQuadtreeBuildResult& BuildResult = BuildTasks.Wait(ViewIndex);
+				if (BuildResult.RenderQuadNodeList.Num() == 0)
 				{
-					if(!bWireframe)
-					{
-						MaterialProxy = LODMIDList[Node.LOD]->GetRenderProxy();
-					}
+					continue;
+				}
 
-					// אڂm[hƂLOD̍Agp郁bVg|W[pӂ̂̂ȂI
-					const FVector2D& RightAdjPos = FVector2D(Node.BottomRight.X - PatchLength * 0.5f, Node.BottomRight.Y + Node.Length * 0.5f);
-					const FVector2D& LeftAdjPos = FVector2D(Node.BottomRight.X + Node.Length + PatchLength * 0.5f, Node.BottomRight.Y + Node.Length * 0.5f);
-					const FVector2D& BottomAdjPos = FVector2D(Node.BottomRight.X + Node.Length * 0.5f, Node.BottomRight.Y - PatchLength * 0.5f);
-					const FVector2D& TopAdjPos = FVector2D(Node.BottomRight.X + Node.Length * 0.5f, Node.BottomRight.Y + Node.Length + PatchLength * 0.5f);
+				// QuadNodeごとにメッシュバッチを作らず、メッシュパターンが同じQuadNodeをまとめてインスタンシングで描画する。LODはインスタンスごとにマテリアルへ渡す
+				// インスタンスのバッファはプロキシがフレームをまたいで持ち、足りなくなったときだけ作り直す
+				FQuadNodeInstancedMesh& InstancedMesh = InstancedMeshes.Allocate(*Views[ViewIndex], GetScene().GetFeatureLevel());
+				InstancedMesh.Init(BuildResult, GetLocalToWorld(), MaxLOD, NumGridDivision * GridLength, VertexBuffers);
 
-					EAdjacentQuadNodeLODDifference RightAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, RightAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference LeftAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, LeftAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference BottomAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, BottomAdjPos, RenderList);
-					EAdjacentQuadNodeLODDifference TopAdjLODDiff = Quadtree::QueryAdjacentNodeType(Node, TopAdjPos, RenderList);
+				if(!bWireframe)
+				{
+					MaterialProxy = QuadNodeMID->GetRenderProxy();
+				}
 
-					// 3iɂ4̗׃m[h̃^CvƃCfbNXΉ
-					uint32 QuadMeshParamsIndex = 27 * (uint32)RightAdjLODDiff + 9 * (uint32)LeftAdjLODDiff + 3 * (uint32)BottomAdjLODDiff + (uint32)TopAdjLODDiff;
-					const FQuadMeshParameter& MeshParams = QuadMeshParams[QuadMeshParamsIndex];
+				for (const FQuadNodeInstancedMesh::FBucket& Bucket : InstancedMesh.GetBuckets())
+				{
+					uint32 QuadMeshPartIndices[NUM_QUAD_MESH_PARTS];
+					Quadtree::GetQuadMeshPartIndices(Bucket.QuadMeshParamsIndex, QuadMeshPartIndices);
 
 					// Draw the mesh.
 					FMeshBatch& Mesh = Collector.AllocateMesh();
-					FMeshBatchElement& BatchElement = Mesh.Elements[0];
-					BatchElement.IndexBuffer = &IndexBuffer;
 					Mesh.bWireframe = bWireframe;
-					Mesh.VertexFactory = &VertexFactory;
+					Mesh.VertexFactory = InstancedMesh.GetVertexFactory();
 					Mesh.MaterialRenderProxy = MaterialProxy;
 
-					bool bHasPrecomputedVolumetricLightmap;
-					FMatrix PreviousLocalToWorld;
-					int32 SingleCaptureIndex;
-					bool bOutputVelocity;
-					GetScene().GetPrimitiveUniformShaderParameters_RenderThread(GetPrimitiveSceneInfo(), bHasPrecomputedVolumetricLightmap, PreviousLocalToWorld, SingleCaptureIndex, bOutputVelocity);
-
-					// bVTCYQuadNodẽTCYɉăXP[
-					float MeshScale = Node.Length / (NumGridDivision * GridLength);
-
-					FDynamicPrimitiveUniformBuffer& DynamicPrimitiveUniformBuffer = Collector.AllocateOneFrameResource<FDynamicPrimitiveUniformBuffer>();
-					// FPrimitiveSceneProxy::ApplyLateUpdateTransform()Qlɂ
-					const FMatrix& NewLocalToWorld = GetLocalToWorld().ApplyScale(MeshScale).ConcatTranslation(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f));
-					PreviousLocalToWorld = PreviousLocalToWorld.ApplyScale(MeshScale).ConcatTranslation(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f));
-
-					// R|[lgCalcBounds()RootNodẽTCYɍ킹ĎĂ̂ŃXP[B
-					// ۂ͕`悷郁bVQuadtreeۂ̓ƎtX^JOőIĂ̂Boundsׂ͂RootNodeTCYł
-					// \ȂAꉞmȃTCYɂĂ
-					float BoundScale = Node.Length / RootNode.Length;
-
-					FBoxSphereBounds NewBounds = GetBounds();
-					NewBounds = FBoxSphereBounds(NewBounds.Origin + NewLocalToWorld.TransformPosition(FVector(Node.BottomRight.X, Node.BottomRight.Y, 0.0f)), NewBounds.BoxExtent * BoundScale, NewBounds.SphereRadius * BoundScale);
-
-					FBoxSphereBounds NewLocalBounds = GetLocalBounds();
-					NewLocalBounds = FBoxSphereBounds(NewLocalBounds.Origin, NewLocalBounds.BoxExtent * BoundScale, NewLocalBounds.SphereRadius * BoundScale);
-
-					//DynamicPrimitiveUniformBuffer.Set(GetLocalToWorld(), PreviousLocalToWorld, GetBounds(), GetLocalBounds(), true, bHasPrecomputedVolumetricLightmap, DrawsVelocity(), false);
-					DynamicPrimitiveUniformBuffer.Set(NewLocalToWorld, PreviousLocalToWorld, NewBounds, NewLocalBounds, true, bHasPrecomputedVolumetricLightmap, DrawsVelocity(), false);
-					BatchElement.PrimitiveUniformBufferResource = &DynamicPrimitiveUniformBuffer.UniformBuffer;
-
-					BatchElement.FirstIndex = MeshParams.IndexBufferOffset;
-					BatchElement.NumPrimitives = MeshParams.NumIndices / 3;
-					BatchElement.MinVertexIndex = 0;
-					BatchElement.MaxVertexIndex = VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
-					//Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
-					Mesh.ReverseCulling = (NewLocalToWorld.Determinant() < 0.0f);
+					// 内側のメッシュと4辺の境界メッシュはインデックスバッファ上で連続していないので別々のバッチエレメントにする
+					Mesh.Elements.SetNum(NUM_QUAD_MESH_PARTS);
+					for (uint32 PartIndex = 0; PartIndex < NUM_QUAD_MESH_PARTS; PartIndex++)
+					{
+						const FQuadMeshParameter& MeshParams = IndexBuffer->GetQuadMeshParams()[QuadMeshPartIndices[PartIndex]];
+
+						FMeshBatchElement& BatchElement = Mesh.Elements[PartIndex];
+						BatchElement.IndexBuffer = IndexBuffer.Get();
+						BatchElement.PrimitiveUniformBuffer = GetUniformBuffer();
+						BatchElement.FirstIndex = MeshParams.IndexBufferOffset;
+						BatchElement.NumPrimitives = MeshParams.NumIndices / 3;
+						BatchElement.MinVertexIndex = 0;
+						BatchElement.MaxVertexIndex = VertexBuffers.PositionVertexBuffer.GetNumVertices() - 1;
+						// FInstancedStaticMeshVertexFactoryはUserIndexをインスタンスのオフセットとして使う
+						BatchElement.NumInstances = Bucket.NumInstances;
+						BatchElement.UserIndex = Bucket.FirstInstance;
+						BatchElement.UserData = nullptr;
+					}
+
+					Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
 					Mesh.Type = PT_TriangleList;
 					Mesh.DepthPriorityGroup = SDPG_World;
 					Mesh.bCanApplyViewModeOverrides = false;
@@ -223,23 +219,33 @@ public:
 
 	virtual uint32 GetMemoryFootprint( void ) const override { return( sizeof( *this ) + GetAllocatedSize() ); }
 
-	uint32 GetAllocatedSize( void ) const { return( FPrimitiveSceneProxy::GetAllocatedSize() ); }
+	uint32 GetAllocatedSize( void ) const
+	{
+		SIZE_T ArenaSize = ViewArenas.GetAllocatedSize();
+		for (const TPair<uint64, TUniquePtr<FQuadtreeBuildArena>>& Pair : ViewArenas)
+		{
+			ArenaSize += sizeof(FQuadtreeBuildArena) + Pair.Value->GetAllocatedSize();
+		}
+		ArenaSize += InstancedMeshes.GetAllocatedSize();
+		return( FPrimitiveSceneProxy::GetAllocatedSize() + ArenaSize );
+	}
 
 
 private:
 	UMaterialInterface* Material;
 	FDeformableVertexBuffers VertexBuffers;
-	FDynamicMeshIndexBuffer32 IndexBuffer;
-	FLocalVertexFactory VertexFactory;
+	Quadtree::FQuadMeshIndexBufferPtr IndexBuffer; // NumGridDivisionが同じコンポーネント間で共有する
+	FLocalVertexFactory VertexFactory; // 頂点バッファの初期化に使う。描画はFQuadNodeInstancedMeshの頂点ファクトリで行う
 
 	FMaterialRelevance MaterialRelevance;
-	TArray<UMaterialInstanceDynamic*> LODMIDList; // ComponentUMaterialInstanceDynamic͕ێĂ̂GCŉ͂Ȃ
-	TArray<Quadtree::FQuadMeshParameter> QuadMeshParams;
+	UMaterialInstanceDynamic* QuadNodeMID = nullptr; // Component側でUMaterialInstanceDynamicは保持されてるのでGCで解放はされない
 	int32 NumGridDivision;
 	float GridLength;
 	int32 MaxLOD;
 	int32 GridMaxPixelCoverage;
 	int32 PatchLength;
+	mutable Quadtree::FQuadtreeViewArenaMap ViewArenas;
+	mutable Quadtree::FQuadNodeInstancedMeshPool InstancedMeshes;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -252,7 +258,7 @@ UQuadtreeMeshComponent::UQuadtreeMeshComponent()
 FPrimitiveSceneProxy* UQuadtreeMeshComponent::CreateSceneProxy()
 {
 	FPrimitiveSceneProxy* Proxy = NULL;
-	if(_Vertices.Num() > 0 && _Indices.Num() > 0)
+	if(_Vertices.Num() > 0 && QuadMeshIndexBuffer.IsValid())
 	{
 		Proxy = new FQuadtreeMeshSceneProxy(this);
 	}
@@ -263,8 +269,8 @@ void UQuadtreeMeshComponent::OnRegister()
 {
 	Super::OnRegister();
 
-	// ObhbV^VertexBufferTexCoordsBufferpӂ̂UDeformableGridMeshComponent::Ini:tGridMeshSetting()ƓA
-	// ڂQuadNodeLOD̍lĐp^[̃CfbNXzpӂ˂΂ȂȂ̂œƎ̎
+	// グリッドメッシュ型のVertexBufferやTexCoordsBufferを用意するのはUDeformableGridMeshComponent::Ini:tGridMeshSetting()と同じだが、
+	// 接するQuadNodeのLODの差を考慮して数パターンのインデックス配列を用意せねばならないので独自の実装をする
 	_NumRow = NumGridDivision;
 	_NumColumn = NumGridDivision;
 	_GridWidth = GridLength;
@@ -272,7 +278,7 @@ void UQuadtreeMeshComponent::OnRegister()
 	_Vertices.Reset((NumGridDivision + 1) * (NumGridDivision + 1));
 	_TexCoords.Reset((NumGridDivision + 1) * (NumGridDivision + 1));
 
-	// ł͐`̒S_ɂ镽sړLODɉXP[͂ȂBۂɃbV`ɓnƂɕsړƃXP[sB
+	// ここでは正方形の中心を原点にする平行移動やLODに応じたスケールはしない。実際にメッシュを描画に渡すときに平行移動とスケールを行う。
 
 	for (int32 y = 0; y < NumGridDivision + 1; y++)
 	{
@@ -290,14 +296,16 @@ void UQuadtreeMeshComponent::OnRegister()
 		}
 	}
 
-	// QuadNode̋E̘AIȕω̂߁ÃObhłȂƓK؂ȃWIgɂłȂ
+	// QuadNodeの境界部分の連続的な変化のため、偶数のグリッド分割でないと適切なジオメトリにできない
 	if (NumGridDivision % 2 == 1)
 	{
 		UE_LOG(LogTemp, Error, TEXT("NumGridDivision must be an even number."));
 		return;
 	}
 
-	Quadtree::CreateQuadMeshes(NumGridDivision, _Indices, QuadMeshParams);
+	// インデックスバッファはNumGridDivisionが同じコンポーネント間で共有する
+	FQuadMeshIndexBuffer::Release(QuadMeshIndexBuffer);
+	QuadMeshIndexBuffer = FQuadMeshIndexBuffer::Acquire(NumGridDivision);
 
 	UMaterialInterface* Material = GetMaterial(0);
 	if(Material == NULL)
@@ -305,30 +313,39 @@ void UQuadtreeMeshComponent::OnRegister()
 		Material = UMaterial::GetDefaultMaterial(MD_Surface);
 	}
 
-	// QuadNode̐́AMaxLOD-2ŏxȂ̂łׂčŏQuadNodeŕ~l߂
-	// 2^(MaxLOD-2)*2^(MaxLOD-2)
-	// ʏ͂܂łȂBJ牓Ȃɂ2{ɂȂĂ
-	// 2*6=12ɂȂ邾낤B͌_ɃJƂŁAJ̍0ɋ߂ƂȂ̂ŁA
-	// 4{x̐ƌςĂł͂
-
-	float InvMaxLOD = 1.0f / MaxLOD;
-	//LODMIDList.SetNumZeroed(48);
-	//for (int32 i = 0; i < 48; i++)
-	LODMIDList.SetNumZeroed(MaxLOD + 1);
-	for (int32 LOD = 0; LOD < MaxLOD + 1; LOD++)
+	// QuadNodeはFInstancedStaticMeshVertexFactoryで描画するので、マテリアルにインスタンシング用のシェーダをコンパイルさせる。
+	// クックしたビルドではシェーダを追加できないので、bUsedWithInstancedStaticMeshesが立っていなければ黙ってデフォルトマテリアルで描画されてしまう。気づけるようにログを出しておく
+	if (!Material->CheckMaterialUsage(MATUSAGE_InstancedStaticMeshes))
 	{
-		LODMIDList[LOD] = UMaterialInstanceDynamic::Create(Material, this);
-		LODMIDList[LOD]->SetVectorParameterValue(FName("LODColor"), FLinearColor((MaxLOD - LOD) * InvMaxLOD, 0.0f, LOD * InvMaxLOD));
+		UE_LOG(LogTemp, Warning, TEXT("%s: Material %s is not usable with instanced static meshes. The default material is used instead. Enable bUsedWithInstancedStaticMeshes on the material."), *GetPathName(), *Material->GetPathName());
+		Material = UMaterial::GetDefaultMaterial(MD_Surface);
 	}
 
+	// QuadNodeの数は、MaxLOD-2が最小レベルなのですべて最小のQuadNodeで敷き詰めると
+	// 2^(MaxLOD-2)*2^(MaxLOD-2)
+	// 通常はそこまでいかない。カメラから遠くなるにつれて2倍になっていけば
+	// 2*6=12になるだろう。それは原点にカメラがあるときで、かつカメラの高さが0に近いときなので、
+	// せいぜその4倍程度の数と見積もってでいいはず
+
+	// 全LODを1つのマテリアルで描く。LODColorはPerInstanceRandomに入っているLOD / MaxLODからマテリアルで求める。QuadtreeLOD.ushを参照
+	QuadNodeMID = UMaterialInstanceDynamic::Create(Material, this);
+	QuadNodeMID->SetScalarParameterValue(FName("MaxLOD"), (float)MaxLOD);
+
 	MarkRenderStateDirty();
 	UpdateBounds();
 }
 
+void UQuadtreeMeshComponent::OnUnregister()
+{
+	FQuadMeshIndexBuffer::Release(QuadMeshIndexBuffer);
+
+	Super::OnUnregister();
+}
+
 FBoxSphereBounds UQuadtreeMeshComponent::CalcBounds(const FTransform& LocalToWorld) const
 {
-	// QuadtreeRootNodẽTCYɂĂBAN^BPGfB^̃r[|[g\tH[JXȂǂłBoundĝłȂׂmɂ
-	// ܂AQuadNode̊ebVBoundvZTCYƂĂgB
+	// QuadtreeのRootNodeのサイズにしておく。アクタのBPエディタのビューポート表示やフォーカス操作などでこのBoundが使われるのでなるべく正確にする
+	// また、QuadNodeの各メッシュのBoundを計算する基準サイズとしても使う。
 	float HalfRootNodeLength = PatchLength * (1 << (MaxLOD - 1));
 	const FVector& Min = LocalToWorld.TransformPosition(FVector(-HalfRootNodeLength, -HalfRootNodeLength, 0.0f));
 	const FVector& Max = LocalToWorld.TransformPosition(FVector(HalfRootNodeLength, HalfRootNodeLength, 0.0f));
@@ -338,13 +355,13 @@ FBoxSphereBounds UQuadtreeMeshComponent::CalcBounds(const FTransform& LocalToWor
 	return Ret;
 }
 
-const TArray<class UMaterialInstanceDynamic*>& UQuadtreeMeshComponent::GetLODMIDList() const
+UMaterialInstanceDynamic* UQuadtreeMeshComponent::GetQuadNodeMID() const
 {
-	return LODMIDList;
+	return QuadNodeMID;
 }
 
-const TArray<Quadtree::FQuadMeshParameter>& UQuadtreeMeshComponent::GetQuadMeshParams() const
+const Quadtree::FQuadMeshIndexBufferPtr& UQuadtreeMeshComponent::GetQuadMeshIndexBuffer() const
 {
-	return QuadMeshParams;
+	return QuadMeshIndexBuffer;
 }
 
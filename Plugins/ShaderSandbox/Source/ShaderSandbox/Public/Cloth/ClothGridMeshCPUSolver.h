@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PackedNormal.h"
+#include "Cloth/ClothGridMeshParameters.h"
+
+/**
+ * Vertices of one grid cloth as structure of arrays for the CPU backend. Each array has Num() elements and a padding
+ * so that the solver can process every row and the whole cloth in groups of 4 vertices.
+ */
+struct FClothGridMeshCPUState
+{
+	TArray<float> PositionX;
+	TArray<float> PositionY;
+	TArray<float> PositionZ;
+	TArray<float> PrevPositionX;
+	TArray<float> PrevPositionY;
+	TArray<float> PrevPositionZ;
+	TArray<float> InvMass;
+	/** External acceleration in cm/s^2, used when FGridClothParameters::bUseExternalAcceleration is set. */
+	TArray<float> ExternalAccelerationX;
+	TArray<float> ExternalAccelerationY;
+	TArray<float> ExternalAccelerationZ;
+
+	/** W of Positions is the inverse mass. The previous positions are initialized to Positions and the external accelerations to zero. */
+	void Init(const TArray<FVector4>& Positions);
+	/** Overwrites the external accelerations of the vertices from FirstVertex. */
+	void SetExternalAccelerations(uint32 FirstVertex, TArrayView<const FVector> ExternalAccelerations);
+
+	uint32 Num() const { return NumVertex; }
+	/** W is the inverse mass. */
+	FVector4 GetPosition(uint32 VertIdx) const { return FVector4(PositionX[VertIdx], PositionY[VertIdx], PositionZ[VertIdx], InvMass[VertIdx]); }
+	FVector GetPrevPosition(uint32 VertIdx) const { return FVector(PrevPositionX[VertIdx], PrevPositionY[VertIdx], PrevPositionZ[VertIdx]); }
+
+private:
+	uint32 NumVertex = 0;
+};
+
+/** Render data of a cloth simulated by the CPU backend, in the layout of the vertex buffers of FClothVertexBuffers. */
+struct FClothGridMeshCPUResult
+{
+	/** W is the inverse mass. */
+	TArray<FVector4> Positions;
+	/** TangentX and TangentZ of each vertex. */
+	TArray<FPackedNormal> Tangents;
+};
+
+/**
+ * SIMD CPU version of one dispatch of ClothSimulationGridMesh.usf for one cloth, in the same colored order.
+ * Processes 4 vertices, cells or edges of a color at once with VectorRegister. Params.VertexIndexOffset, Params.SphereCollisionOffset and Params.WorldToLocalX/Y/Z are ignored.
+ * SphereCollisionParams are the Params.NumSphereCollision spheres of this cloth, xyz : RelativeCenter, w : Radius.
+ */
+void SimulateClothGridMeshCPU(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshCPUState& InOutState);
+
+/** Positions and the tangents GridMeshTangent.usf would compute from them. */
+void GetClothGridMeshCPUResult(uint32 NumRow, uint32 NumColumn, const FClothGridMeshCPUState& State, FClothGridMeshCPUResult& OutResult);
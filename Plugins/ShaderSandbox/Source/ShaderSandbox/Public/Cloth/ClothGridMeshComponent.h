@@ -1,8 +1,18 @@
 #pragma once
 
 #include "DeformMesh/DeformableGridMeshComponent.h"
+#include "Cloth/ClothGridMeshCPUSolver.h"
+#include "Async/TaskGraphInterfaces.h"
 #include "ClothGridMeshComponent.generated.h"
 
+UENUM()
+enum class EClothSimulationBackend : uint8
+{
+	/** Simulate all GPU cloths in one compute shader dispatch on the render thread through AClothManager. */
+	GPU = 0,
+	/** Simulate with SimulateClothGridMeshCPU() in a task graph task per cloth, started at the tick. Works without RHI such as dedicated servers. The result is uploaded to the vertex buffers for rendering. */
+	CPU,
+};
 
 // almost all is copy of UCustomMeshComponent
 UCLASS(hidecategories=(Object,LOD, Physics, Collision), editinlinenew, meta=(BlueprintSpawnableComponent), ClassGroup=Rendering)
@@ -11,6 +21,10 @@ class SHADERSANDBOX_API UClothGridMeshComponent : public UDeformableGridMeshComp
 	GENERATED_BODY()
 
 public:
+	/** Where the cloth is simulated. Takes effect at the next InitClothSettings(). */
+	UPROPERTY(EditAnywhere, Category=Simulation, BlueprintReadOnly)
+	EClothSimulationBackend SimulationBackend = EClothSimulationBackend::GPU;
+
 	/** Set the geometry and vertex paintings to use on this triangle mesh as cloth. */
 	UFUNCTION(BlueprintCallable, Category="Components|ClothGridMesh")
 	void InitClothSettings(int32 NumRow, int32 NumColumn, float GridWidth, float GridHeight, float Stiffness, float Damping, float LinearDrag, float FluidDensity, float LiftCoefficient, float DragCoefficient, float VertexRadius, int32 NumIteration);
@@ -19,23 +33,47 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Components|ClothGridMesh")
 	void IgnoreVelocityDiscontinuityNextFrame();
 
+	/**
+	 * Set per vertex accelerations in cm/s^2 in the local space of the cloth, applied on top of gravity and inertia, to the vertices from FirstVertexIndex.
+	 * Only the changed range is uploaded to the simulation. Cleared by InitClothSettings().
+	 */
+	UFUNCTION(BlueprintCallable, Category="Components|ClothGridMesh")
+	void SetExternalAccelerations(int32 FirstVertexIndex, const TArray<FVector>& Accelerations);
+
+	/** Stop applying the per vertex accelerations set by SetExternalAccelerations(). */
+	UFUNCTION(BlueprintCallable, Category="Components|ClothGridMesh")
+	void ClearExternalAccelerations();
+
 	virtual ~UClothGridMeshComponent();
 
 	//~ Begin UPrimitiveComponent Interface.
 	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
 	//~ End UPrimitiveComponent Interface.
 
-	const TArray<FVector>& GetAccelerationMoves() const { return _AccelerationMoves; }
+	/** Empty if SetExternalAccelerations() has not been called. */
+	const TArray<FVector>& GetExternalAccelerations() const { return _ExternalAccelerations; }
+
+	/** True if the cloth is simulated by the CPU backend, decided by SimulationBackend at the last InitClothSettings(). */
+	bool IsCPUBackend() const { return _bCPUBackend; }
+
+	/** State of the CPU backend after the simulation of the last tick. Waits for the simulation task. Null if the cloth is not simulated on the CPU. Game thread only. */
+	const FClothGridMeshCPUState* GetCPUState();
 
 protected:
 	//~ Begin UActorComponent Interface
+	virtual void OnUnregister() override;
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction) override;
 	virtual void SendRenderDynamicData_Concurrent() override;
 	//~ End UActorComponent Interface
 
 private:
 	bool _IgnoreVelocityDiscontinuityNextFrame = false;
 
-	TArray<FVector> _AccelerationMoves;
+	// 頂点ごとの外力による加速度。空なら使わない。重力と慣性力は全頂点で同じなのでFGridClothParameters::AccelerationMoveで渡す
+	TArray<FVector> _ExternalAccelerations;
+	// _ExternalAccelerationsのうちまだシミュレーション側に送っていない範囲。[Begin, End)
+	int32 _DirtyExternalAccelerationBegin = 0;
+	int32 _DirtyExternalAccelerationEnd = 0;
 	float _LogStiffness;
 	float _LogDamping;
 	float _LinearLogDrag;
@@ -53,6 +91,18 @@ private:
 	FVector _CurLinearVelocity;
 	FVector _PrevLinearVelocity;
 
+	// CPUバックエンドの状態。InitClothSettings()のときのSimulationBackendで決まる
+	bool _bCPUBackend = false;
+	FClothGridMeshCPUState _CPUState;
+	// 最後のシミュレーションの結果。_CPUResultPoolのどれか
+	TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe> _CPUResult;
+	// レンダースレッドに渡した結果を、参照がなくなってから使い回すためのプール
+	TArray<TSharedPtr<FClothGridMeshCPUResult, ESPMode::ThreadSafe>> _CPUResultPool;
+	FGraphEventRef _CPUSimulationTask;
+
 	void MakeDeformCommand(struct FClothGridMeshDeformCommand& Command);
+	bool ConsumeDirtyExternalAccelerations(uint32& OutFirstVertex, TArray<FVector>& OutExternalAccelerations);
+	void SimulateOnCPU();
+	void WaitCPUSimulation();
 };
 
@@ -5,11 +5,13 @@
 #include "Engine/EngineTypes.h"
 #include "RHICommandList.h"
 #include "ClothGridMeshParameters.h"
-#include "Cloth/ClothParameterStructuredBuffer.h"
+#include "Cloth/ClothStructuredBuffer.h"
 
 struct FClothGridMeshDeformCommand
 {
 	FGridClothParameters Params;
+	/** Params.NumSphereCollision spheres in world space, xyz : Center, w : Radius. The shader moves them into the cloth with Params.WorldToLocalX/Y/Z. */
+	TArray<FVector4> SphereCollisionParams;
 	struct FClothVertexBuffers* VertexBuffers = nullptr;
 };
 
@@ -17,9 +19,11 @@ struct FClothGridMeshDeformer
 {
 	~FClothGridMeshDeformer();
 	void EnqueueDeformCommand(const FClothGridMeshDeformCommand& Command);
-	void FlushDeformCommandQueue(FRHICommandListImmediate& RHICmdList, FRHIUnorderedAccessView* WorkAccelerationMoveVertexBufferUAV, FRHIUnorderedAccessView* WorkPrevVertexBufferUAV, FRHIUnorderedAccessView* WorkVertexBufferUAV);
+	/** Simulates all queued cloths in place in GClothVertexPool. Sphere collisions equal to the previous command's are uploaded only once. */
+	void FlushDeformCommandQueue(FRHICommandListImmediate& RHICmdList);
 
-	FClothParameterStructuredBuffer ClothParameterStructuredBuffer;
+	FClothStructuredBuffer ClothParameterStructuredBuffer;
+	FClothStructuredBuffer SphereCollisionStructuredBuffer;
 	TArray<FClothGridMeshDeformCommand> DeformCommandQueue;
 };
 
@@ -1,12 +1,11 @@
 #pragma once
 
-// StructuredBufferp̍\̂128biti16BytejPʂłȂƃfoCXXg₨ȋɂȂ̂Œӂ邱
+// StructuredBuffer用の構造体は128bit（16Byte）単位でないとデバイスロストやおかしな挙動になるので注意すること
 struct FGridClothParameters
 {
-	// TODO:̍\̂́A̒萔܂߂ĂȂƂŎĝł̃wb_oׂ
-	// 邢͂̃wb_cpp܂邲ClothVertexBuffers.h/cppɓ邩
+	// TODO:この構造体は、この定数を含めていろんなところで使うのでこのヘッダから出すべき
+	// あるいはこのヘッダとcppをまるごとClothVertexBuffers.h/cppに入れるか
 	static const FVector GRAVITY;
-	static const uint32 MAX_SPHERE_COLLISION_PER_MESH = 16;
 	static const float BASE_FREQUENCY;
 
 	uint32 NumIteration = 0;
@@ -25,8 +24,17 @@ struct FGridClothParameters
 	float DragCoefficient = 0.0f;
 	float IterDeltaTime = 0.0f;
 	float VertexRadius = 0.0f;
-	FVector AlignmentDummy = FVector::ZeroVector;
+	// スフィアコリジョンは全クロスぶんをまとめた別のStructuredBufferに入れ、その中の範囲だけを持つ。使っている数だけアップロードすればいいように
+	uint32 SphereCollisionOffset = 0;
 	uint32 NumSphereCollision = 0;
-	// xyz : RelativeCenter, w : Radius;
-	FVector4 SphereCollisionParams[MAX_SPHERE_COLLISION_PER_MESH];
+	FVector2D AlignmentDummy = FVector2D::ZeroVector;
+	// 全頂点に共通の慣性力と重力による移動量 (Inertia + Gravity) * IterDeltaTime^2 - LinearDrag。毎フレーム頂点ごとのバッファをアップロードしないようにパラメータで渡す
+	FVector AccelerationMove = FVector::ZeroVector;
+	// 0でなければ頂点ごとの外力の加速度（cm/s^2）をAccelerationMoveに加える
+	uint32 bUseExternalAcceleration = 0;
+	// ワールド座標からクロスのローカル座標への3x4行列の列。スフィアコリジョンはワールド座標で全クロスに共通のものをアップロードし、シェーダでこれで変換する。
+	// ローカル座標のxはdot(float4(WorldPos, 1), WorldToLocalX)
+	FVector4 WorldToLocalX = FVector4(1.0f, 0.0f, 0.0f, 0.0f);
+	FVector4 WorldToLocalY = FVector4(0.0f, 1.0f, 0.0f, 0.0f);
+	FVector4 WorldToLocalZ = FVector4(0.0f, 0.0f, 1.0f, 0.0f);
 };
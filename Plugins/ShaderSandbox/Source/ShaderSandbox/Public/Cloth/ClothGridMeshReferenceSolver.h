@@ -0,0 +1,53 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Cloth/ClothGridMeshParameters.h"
+
+/** Order in which a grid cloth applies the wind per cell and projects its distance constraints. */
+enum class EClothGridMeshSolveOrder : uint8
+{
+	/** Cell by cell and vertex by vertex (right edge, then lower edge), as the single-threaded compute shader did. */
+	Serial,
+	/** Four colors of cells and edges whose members share no vertex, in the order ClothSimulationGridMesh.usf processes them in parallel. */
+	Colored,
+};
+
+/** Vertices of one grid cloth in the layout of the work buffers of ClothSimulationGridMesh.usf. */
+struct FClothGridMeshReferenceState
+{
+	/** W is the inverse mass. */
+	TArray<FVector4> Positions;
+	/** W is not used. */
+	TArray<FVector4> PrevPositions;
+	/** cm/s^2. Used when FGridClothParameters::bUseExternalAcceleration is set. */
+	TArray<FVector> ExternalAccelerations;
+};
+
+/**
+ * Scalar CPU version of one dispatch of ClothSimulationGridMesh.usf for one cloth: NumIteration times Integrate, ApplyWind, SolveDistanceConstraint and SolveCollision.
+ * Reference to check the shader and the solve orders against each other. Params.VertexIndexOffset, Params.SphereCollisionOffset and Params.WorldToLocalX/Y/Z are ignored.
+ * SphereCollisionParams are the Params.NumSphereCollision spheres of this cloth, xyz : RelativeCenter, w : Radius.
+ */
+void SimulateClothGridMeshReference(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, EClothGridMeshSolveOrder Order, FClothGridMeshReferenceState& InOutState);
+
+/**
+ * Hanging cloth of NumRow * NumRow cells for verifications and benchmarks: first row pinned like UClothGridMeshComponent::InitClothSettings(),
+ * parameters like UClothGridMeshComponent at 60 fps with a constant wind and one sphere collision.
+ * OutState always has an external acceleration on the last row. bUseExternalAcceleration sets OutParams.bUseExternalAcceleration, so both paths of the solvers can be checked.
+ */
+void MakeClothGridMeshVerificationSetup(uint32 NumRow, bool bUseExternalAcceleration, FGridClothParameters& OutParams, TArray<FVector4>& OutSphereCollisionParams, FClothGridMeshReferenceState& OutState);
+
+#if WITH_DEV_AUTOMATION_TESTS
+class FAutomationTestBase;
+
+/**
+ * Automation test body shared by the checks of the cloth solvers. For each row count in NumRows, with and without external acceleration, simulates the setup of
+ * MakeClothGridMeshVerificationSetup() for 300 frames with the solver under test and with SimulateClothGridMeshReference() in ReferenceOrder, and reports the differences and ms/frame.
+ * InitSolver resets the solver to InitialState. StepSolver advances it by one frame and writes its positions and previous positions to InOutState; its ms/frame includes that write.
+ * The one frame difference is measured by stepping the previous state of the solver with the reference; it is only reported when FrameTolerance is 0.
+ * Tolerances are in grid widths.
+ */
+void VerifyClothGridMeshSolver(FAutomationTestBase& Test, const TCHAR* SolverName, EClothGridMeshSolveOrder ReferenceOrder, TArrayView<const uint32> NumRows, float FrameTolerance, float AccumulatedTolerance,
+	TFunctionRef<void(const FClothGridMeshReferenceState& InitialState)> InitSolver,
+	TFunctionRef<void(const FGridClothParameters& Params, TArrayView<const FVector4> SphereCollisionParams, FClothGridMeshReferenceState& InOutState)> StepSolver);
+#endif // WITH_DEV_AUTOMATION_TESTS
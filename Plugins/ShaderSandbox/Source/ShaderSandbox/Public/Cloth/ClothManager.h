@@ -3,7 +3,6 @@
 #include "Components/PrimitiveComponent.h"
 #include "GameFramework/Actor.h"
 #include "Cloth/ClothGridMeshDeformer.h"
-#include "DeformMesh/DeformableVertexBuffers.h"
 #include "ClothManager.generated.h"
 
 UCLASS(hidecategories=(Object,LOD, Physics, Collision), ClassGroup=Rendering)
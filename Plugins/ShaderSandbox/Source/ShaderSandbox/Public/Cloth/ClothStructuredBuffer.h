@@ -0,0 +1,21 @@
+#pragma once
+
+#include "RenderResource.h"
+
+/** Dynamic structured buffer of the cloth simulation, for either FGridClothParameters or float4 elements, rewritten every frame. Grows geometrically when more elements are set than it can hold. */
+struct FClothStructuredBuffer : public FRenderResource
+{
+public:
+	void SetData(const TArray<struct FGridClothParameters>& Data);
+	void SetData(const TArray<FVector4>& Data);
+	virtual void ReleaseDynamicRHI() override;
+
+	FRHIShaderResourceView* GetSRV() const { return ComponentsDataSRV; }
+
+private:
+	void SetData(const void* Data, uint32 ByteStride, uint32 NumElements);
+
+	FStructuredBufferRHIRef ComponentsData;
+	FShaderResourceViewRHIRef ComponentsDataSRV;
+	uint32 Capacity = 0;
+};
@@ -1,20 +1,80 @@
 #pragma once
 
 #include "DeformMesh/DeformableVertexBuffers.h"
-#include "Rendering/PositionVertexBuffer.h"
+#include "PackedNormal.h"
 
-struct FClothVertexBuffers : public FDeformableVertexBuffers 
+/**
+ * Vertex buffer the CPU backend rewrites every frame. Created with BUF_Dynamic so that the lock doesn't wait for the GPU to finish reading the last contents.
+ * Bound to the vertex factory with a shader resource view for manual vertex fetch.
+ */
+class FClothDynamicVertexBuffer : public FVertexBuffer
 {
-	/** The buffer containing the previous frame position vertex data. */
-	FDeformablePositionVertexBuffer PrevPositionVertexBuffer;
-	/** The buffer containing the translation by acceralation vertex data. */
-	FPositionVertexBuffer AccelerationMoveVertexBuffer;
+public:
+	/** Call before InitResource(). InSRVFormat is the format of the 4 byte elements the shader resource view reads. */
+	void Init(uint32 InNumVertices, uint32 InStride, EPixelFormat InSRVFormat);
+
+	/** Overwrites the whole buffer. Size must be the number of vertices times the stride. Render thread only. */
+	void Write(const void* Data, uint32 Size);
+
+	FRHIShaderResourceView* GetSRV() const { return SRV; }
+	uint32 GetStride() const { return Stride; }
+
+	virtual void InitRHI() override;
+	virtual void ReleaseRHI() override;
+	virtual FString GetFriendlyName() const override { return TEXT("FClothDynamicVertexBuffer"); }
 
+private:
+	FShaderResourceViewRHIRef SRV;
+	uint32 NumVertices = 0;
+	uint32 Stride = 0;
+	EPixelFormat SRVFormat = PF_Unknown;
+};
+
+/**
+ * Vertex buffers of a cloth. Position, previous position and external acceleration live in a range of GClothVertexPool,
+ * which the simulation updates in place and the vertex factory binds as its position stream.
+ * Before 4.26 a shader resource view can't start at the range, so manual vertex fetch would read the head of the pool.
+ * There the vertex factory binds PositionVertexBuffer of FDeformableVertexBuffers instead, and the range is copied into it after the simulation.
+ * A cloth simulated by the CPU backend doesn't use the pool. Its positions and tangents are in FClothDynamicVertexBuffer, rewritten by WriteCPUResult().
+ */
+struct FClothVertexBuffers : public FDeformableVertexBuffers 
+{
 	virtual ~FClothVertexBuffers() {}
 	/* This is a temporary function to refactor and convert old code, do not copy this as is and try to build your data as SoA from the beginning.*/
-	void InitFromClothVertexAttributes(class FLocalVertexFactory* VertexFactory, const TArray<struct FDynamicMeshVertex>& Vertices,  const TArray<float>& InvMasses, const TArray<FVector>& AccelerationMoves, uint32 NumTexCoords = 1, uint32 LightMapIndex = 0);
+	/* ExternalAccelerations may be empty, which means zero for all vertices. bInCPUBackend selects the dynamic buffers of the CPU backend instead of the pool. */
+	void InitFromClothVertexAttributes(class FLocalVertexFactory* InVertexFactory, const TArray<struct FDynamicMeshVertex>& Vertices,  const TArray<float>& InvMasses, const TArray<FVector>& ExternalAccelerations, bool bInCPUBackend, uint32 NumTexCoords = 1, uint32 InLightMapIndex = 0);
 
-	/* Set translation by acceralation vertex buffer. */
-	void SetAccelerationMoves(const TArray<FVector>& AccelerationMoves);
-};
+	/* Enqueues an upload of the external accelerations of the vertices from FirstVertex. Only this range is written. */
+	void UpdateExternalAccelerations(uint32 FirstVertex, const TArray<FVector>& ExternalAccelerations);
+
+	/** Overwrites the positions and tangents to render with a result of the CPU backend. W of Positions is the inverse mass, Tangents are TangentX and TangentZ of each vertex. Render thread only. */
+	void WriteCPUResult(TArrayView<const FVector4> Positions, TArrayView<const FPackedNormal> Tangents);
+
+	/** Releases the dynamic buffers of the CPU backend. Call on the render thread with the other buffers. */
+	void ReleaseCPUBackendResources();
+
+	/** Returns the range to GClothVertexPool. Call on the render thread before releasing the vertex factory. */
+	void ReleasePoolRange();
 
+	/** Index of the first vertex of this cloth in the buffers of GClothVertexPool. The range must be placed. Render thread only. */
+	uint32 GetPoolOffset() const;
+	/** False until GClothVertexPool places the range at the first simulation after the initialization. Render thread only. */
+	bool IsPoolRangePlaced() const;
+	uint32 GetNumVertex() const { return NumVertex; }
+
+private:
+	/** Binds the current range of the pool and the other buffers to the vertex factory, which initializes it. Called again when the pool relocates the range. */
+	void BindVertexFactory();
+
+	class FLocalVertexFactory* VertexFactory = nullptr;
+	int32 PoolAllocationId = INDEX_NONE;
+	uint32 NumVertex = 0;
+	uint32 LightMapIndex = 0;
+	FShaderResourceViewRHIRef PositionComponentSRV;
+
+	bool bCPUBackend = false;
+	/** float4 per vertex. W is the inverse mass. */
+	FClothDynamicVertexBuffer CPUPositionBuffer;
+	/** TangentX and TangentZ per vertex in the layout of FDeformableMeshVertexBuffer. */
+	FClothDynamicVertexBuffer CPUTangentBuffer;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "RenderResource.h"
+#include "RHICommandList.h"
+#include "Containers/SparseArray.h"
+#include "Cloth/ClothVertexRanges.h"
+
+class FRDGBuilder;
+
+/** Vertex buffer of float4 per vertex in FClothVertexPool. Bound as the position stream of cloth vertex factories and as RWBuffer<float> by the simulation. */
+class FClothVertexPoolBuffer : public FVertexBuffer
+{
+public:
+	FRHIUnorderedAccessView* GetUAV() const { return UAV; }
+	uint32 GetNumVertices() const { return NumVertices; }
+
+	/** Replaces VertexBufferRHI and the UAV with new ones of InNumVertices vertices, initializing the resource at the first call. The contents are not kept. */
+	void Reallocate(uint32 InNumVertices);
+
+	virtual void InitRHI() override;
+	virtual void ReleaseRHI() override;
+	virtual FString GetFriendlyName() const override { return TEXT("FClothVertexPoolBuffer"); }
+
+private:
+	FUnorderedAccessViewRHIRef UAV;
+	uint32 NumVertices = 0;
+};
+
+/**
+ * Position, previous position and external acceleration of all cloths, one range of vertices per cloth.
+ * The simulation reads and writes the ranges in place and the vertex factories bind their range of the position buffer,
+ * so the vertices are never copied between per cloth buffers and a merged work buffer.
+ * The ranges are managed by FClothVertexRanges. Placing them and packing the buffers are deferred to ApplyPendingChanges(),
+ * which runs in the graph of the simulation so that the copies never overlap a simulation of another graph.
+ * Render thread only.
+ */
+class FClothVertexPool : public FRenderResource
+{
+public:
+	/**
+	 * Reserves NumVertex vertices. The range is placed at the next ApplyPendingChanges() and the values written before are uploaded then.
+	 * OnRelocated is called on the render thread when the range is placed and whenever it moves. Returns the allocation ID.
+	 */
+	int32 Allocate(uint32 NumVertex, TFunction<void()>&& OnRelocated);
+	void Free(int32 AllocationId);
+
+	/**
+	 * Places the allocations made since the last call, and packs the ranges into new buffers when they don't fit or when less than a quarter is in use.
+	 * The copies are added to GraphBuilder as passes on the same pipe as the simulation. Call before adding the simulation passes.
+	 */
+	void ApplyPendingChanges(FRDGBuilder& GraphBuilder);
+
+	bool IsPlaced(int32 AllocationId) const { return Ranges.IsPlaced(AllocationId); }
+	/** Index of the first vertex of the allocation in the buffers. Changes at compaction. The allocation must be placed. */
+	uint32 GetOffset(int32 AllocationId) const { return Ranges.GetOffset(AllocationId); }
+	uint32 GetNumVertex(int32 AllocationId) const { return Ranges.GetNumVertex(AllocationId); }
+
+	/** Writes Values to the range of the allocation with a buffer lock. Values.Num() must be the number of vertices of the allocation. */
+	void WritePositions(int32 AllocationId, TArrayView<const FVector4> Values) { Write(EStream::Position, AllocationId, 0, Values); }
+	void WritePrevPositions(int32 AllocationId, TArrayView<const FVector4> Values) { Write(EStream::PrevPosition, AllocationId, 0, Values); }
+	/** Writes Values to the vertices from FirstVertex of the allocation, locking only that part of the buffer. */
+	void WriteExternalAccelerations(int32 AllocationId, uint32 FirstVertex, TArrayView<const FVector4> Values) { Write(EStream::ExternalAcceleration, AllocationId, FirstVertex, Values); }
+
+	/** xyz : position, w : inverse mass. */
+	const FClothVertexPoolBuffer& GetPositionBuffer() const { return Buffers[(int32)EStream::Position]; }
+	/** xyz : previous position. */
+	const FClothVertexPoolBuffer& GetPrevPositionBuffer() const { return Buffers[(int32)EStream::PrevPosition]; }
+	/** xyz : external acceleration in cm/s^2, read only by cloths with FGridClothParameters::bUseExternalAcceleration. */
+	const FClothVertexPoolBuffer& GetExternalAccelerationBuffer() const { return Buffers[(int32)EStream::ExternalAcceleration]; }
+
+	uint32 GetCapacity() const { return Ranges.GetCapacity(); }
+	uint32 GetNumAllocatedVertex() const { return Ranges.GetNumAllocatedVertex(); }
+	/** Logs the capacity, the allocations and the free ranges. */
+	void Dump() const { Ranges.Dump(); }
+
+	//~ Begin FRenderResource Interface.
+	virtual void ReleaseResource() override;
+	//~ End FRenderResource Interface.
+
+private:
+	enum class EStream : uint8
+	{
+		Position,
+		PrevPosition,
+		ExternalAcceleration,
+		Num,
+	};
+
+	struct FAllocation
+	{
+		TFunction<void()> OnRelocated;
+		/** Values written before the range is placed. Empty when nothing was written. */
+		TArray<FVector4> PendingValues[(int32)EStream::Num];
+	};
+
+	void Write(EStream Stream, int32 AllocationId, uint32 FirstVertex, TArrayView<const FVector4> Values);
+
+	FClothVertexPoolBuffer Buffers[(int32)EStream::Num];
+	/** Buffers replaced by the last packing. Kept until the next ApplyPendingChanges() since the copies from them run when the graph executes. */
+	TArray<FVertexBufferRHIRef> RetiredBuffers;
+	TArray<FUnorderedAccessViewRHIRef> RetiredUAVs;
+
+	FClothVertexRanges Ranges;
+	TSparseArray<FAllocation> Allocations;
+};
+
+extern TGlobalResource<FClothVertexPool> GClothVertexPool;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/SparseArray.h"
+
+/**
+ * Offsets of the vertex ranges of FClothVertexPool, without the GPU buffers.
+ * Ranges are placed by Place(), first fit from a free list sorted by offset. A removed range is reused only from the Place() after the next one,
+ * so a range the previous simulation may still write is never handed to another cloth.
+ * When an added range does not fit, or when less than a quarter of the capacity is in use, all ranges are packed to the head of a new capacity.
+ */
+class SHADERSANDBOX_API FClothVertexRanges
+{
+public:
+	/** A range placed before a Place() that rebuilt the capacity, to be copied from the old buffers to the new ones. */
+	struct FMove
+	{
+		int32 Id = INDEX_NONE;
+		uint32 SrcOffset = 0;
+		uint32 DstOffset = 0;
+		uint32 NumVertex = 0;
+	};
+
+	/** The capacity is never less than this so that a few small cloths don't rebuild the buffers repeatedly. */
+	static const uint32 MIN_CAPACITY = 4096;
+
+	/** Adds a range of NumVertex vertices, placed at the next Place(). Returns the ID. */
+	int32 Add(uint32 NumVertex);
+	void Remove(int32 Id);
+
+	/**
+	 * Places the ranges added since the last call. Returns true if the capacity has been rebuilt, and then OutMoves has every range placed before.
+	 * OutPlacedIds has the ranges placed by this call.
+	 */
+	bool Place(TArray<FMove>& OutMoves, TArray<int32>& OutPlacedIds);
+
+	bool IsValid(int32 Id) const { return Ranges.IsValidIndex(Id); }
+	bool IsPlaced(int32 Id) const { return Ranges[Id].bPlaced; }
+	uint32 GetOffset(int32 Id) const { check(Ranges[Id].bPlaced); return Ranges[Id].Offset; }
+	uint32 GetNumVertex(int32 Id) const { return Ranges[Id].NumVertex; }
+	uint32 GetCapacity() const { return Capacity; }
+	/** Including the ranges not placed yet. */
+	uint32 GetNumAllocatedVertex() const { return NumAllocatedVertex; }
+	/** Logs the capacity, the ranges and the free ranges. */
+	void Dump() const;
+
+private:
+	struct FRange
+	{
+		uint32 Offset = 0;
+		uint32 NumVertex = 0;
+		bool bPlaced = false;
+	};
+
+	struct FFreeRange
+	{
+		uint32 Offset = 0;
+		uint32 NumVertex = 0;
+	};
+
+	static void AddFreeRange(TArray<FFreeRange>& InOutFreeRanges, const FFreeRange& Freed);
+
+	TSparseArray<FRange> Ranges;
+	/** Added and not placed yet, in the order of Add(). */
+	TArray<int32> PendingIds;
+	/** Sorted by offset. Adjacent ranges are merged. */
+	TArray<FFreeRange> FreeRanges;
+	/** Removed since the last Place(). Moved to FreeRanges at the end of the next Place(). */
+	TArray<FFreeRange> RemovedRanges;
+	uint32 Capacity = 0;
+	uint32 NumAllocatedVertex = 0;
+};
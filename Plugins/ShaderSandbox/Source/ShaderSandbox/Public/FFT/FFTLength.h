@@ -0,0 +1,23 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ShaderPermutation.h"
+
+namespace FFT
+{
+/** The shortest and the longest FFT that FFT.ush can do in one thread group. */
+static const uint32 MinFFTLength = 64;
+static const uint32 MaxFFTLength = 2048;
+
+/**
+ * FFT_LENGTH of the shaders including FFT.ush. Lengths other than powers of 8 add a radix 2 or 4 stage after the radix 8 stages.
+ * Keep the values in sync with MinFFTLength, MaxFFTLength.
+ */
+class FFFTLengthDim : SHADER_PERMUTATION_SPARSE_INT("FFT_LENGTH", 64, 128, 256, 512, 1024, 2048);
+
+/** Whether Length has a FFFTLengthDim permutation. */
+inline bool IsSupportedFFTLength(uint32 Length)
+{
+	return FMath::IsPowerOfTwo(Length) && Length >= MinFFTLength && Length <= MaxFFTLength;
+}
+} // namespace FFT
@@ -15,6 +15,7 @@ enum class EFFTMode : uint8
 
 namespace FFTTexture2D
 {
-	void DoFFTTexture2D512x512(FRHICommandListImmediate& RHICmdList, EFFTMode Mode, const FTextureRHIRef& SrcTexture, FRHIUnorderedAccessView* DstUAV);
+	/** Size x Size texture. Size must satisfy FFT::IsSupportedFFTLength(). */
+	void DoFFTTexture2D(FRHICommandListImmediate& RHICmdList, EFFTMode Mode, const FTextureRHIRef& SrcTexture, FRHIUnorderedAccessView* DstUAV, uint32 Size);
 }; // namespace FFTTexture2D
 
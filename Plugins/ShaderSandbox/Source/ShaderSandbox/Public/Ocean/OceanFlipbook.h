@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Ocean/OceanSimulator.h"
+#include "RHIResources.h"
+#include "OceanFlipbook.generated.h"
+
+/** Storage format of the frames of an ocean flipbook. */
+UENUM()
+enum class EOceanFlipbookFormat : uint8
+{
+	Float32 = 0,
+	Float16,
+	/** 8 bits per value, scaled by the max absolute value of each channel over all frames. */
+	Quantized8,
+};
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+namespace OceanSimulator
+{
+/**
+ * Header of an ocean flipbook file. NumFrames frames of FrameBytes each follow the header.
+ * A frame is 6 planes of DispMapDimension * DispMapDimension values in the order Dx, Dy, Dz, gradient X, gradient Y, folding.
+ */
+struct FOceanFlipbookHeader
+{
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	uint32 DispMapDimension = 0;
+	uint32 NumFrames = 0;
+	uint32 Format = 0;
+	uint32 FrameBytes = 0;
+	/** Time of one loop, in the same unit as UOceanQuadtreeMeshComponent::GetAccumulatedTime(). */
+	float Period = 0.0f;
+	/** Z of the gradient folding map, which is constant. */
+	float GradientZ = 0.0f;
+	/** Max absolute value of each plane over all frames. Used by Quantized8. */
+	float ChannelScales[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+};
+
+uint32 GetOceanFlipbookFrameBytes(uint32 DispMapDimension, EOceanFlipbookFormat Format);
+
+/** Rounds each angular frequency of Omega0 to a multiple of 2 * PI / LoopTime so that the spectrum repeats every LoopTime (in spectrum time, i.e. with TimeScale applied). */
+void QuantizeOmegaToPeriod(float LoopTime, TArrayView<float> InOutOmega0);
+
+/**
+ * Simulates NumFrames frames of one loop of Period with SimulateOceanCPU() and Omega0 quantized by QuantizeOmegaToPeriod(), and writes them to Path.
+ * Params.AccumulatedTime is ignored. Returns false if the file can not be written. OutFileBytes is the size of the written file.
+ * OnProgress is called on the calling thread after each simulated frame with the progress in [0, 1]. Callable from any thread.
+ */
+bool BakeOceanFlipbook(const FString& Path, const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, float TimeScale, float Period, uint32 NumFrames, EOceanFlipbookFormat Format, TFunctionRef<void(float)> OnProgress, int64& OutFileBytes);
+
+/** A baked flipbook opened for playback. Memory-mapped if the platform supports it, read into memory otherwise. Immutable after Open(). */
+class FOceanFlipbook
+{
+public:
+	/** Null if the file does not exist or is not a valid flipbook. */
+	static TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> Open(const FString& Path);
+	~FOceanFlipbook();
+
+	const FOceanFlipbookHeader& GetHeader() const { return Header; }
+	const uint8* GetFrame(uint32 FrameIndex) const;
+	/** The frame shown at Time. Loops every Period. */
+	uint32 GetFrameIndex(float Time) const;
+	int64 GetFileBytes() const { return sizeof(FOceanFlipbookHeader) + (int64)Header.FrameBytes * Header.NumFrames; }
+	/** Bytes per second uploaded by FOceanFlipbookPlayer when a new frame is shown every frame time of the flipbook. */
+	double GetStreamingBytesPerSecond() const { return (double)Header.FrameBytes * Header.NumFrames / Header.Period; }
+	bool IsMemoryMapped() const { return MappedRegion.IsValid(); }
+
+private:
+	FOceanFlipbook();
+
+	FOceanFlipbookHeader Header;
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	TArray64<uint8> FileData;
+	const uint8* Frames = nullptr;
+};
+
+/**
+ * Streams the frames of an FOceanFlipbook into a displacement map and a gradient folding map.
+ * Frames are copied as stored through a ring of dynamic upload buffers and decoded on the GPU. Render thread only.
+ */
+class FOceanFlipbookPlayer
+{
+public:
+	static const int32 NumUploadBuffers = 3;
+
+	explicit FOceanFlipbookPlayer(const TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe>& InFlipbook) : Flipbook(InFlipbook) {}
+
+	uint32 GetDispMapDimension() const { return Flipbook->GetHeader().DispMapDimension; }
+
+	/** Writes the frame at Time to the maps. Does nothing if the frame is the same as the last call. */
+	void Play(FRHICommandListImmediate& RHICmdList, float Time, FRHIUnorderedAccessView* DisplacementMapUAV, FRHIUnorderedAccessView* GradientFoldingMapUAV);
+
+private:
+	TSharedPtr<FOceanFlipbook, ESPMode::ThreadSafe> Flipbook;
+	FStructuredBufferRHIRef UploadBuffers[NumUploadBuffers];
+	FShaderResourceViewRHIRef UploadBufferSRVs[NumUploadBuffers];
+	int32 NextUploadBuffer = 0;
+	uint32 LastFrameIndex = INDEX_NONE;
+};
+} // namespace OceanSimulator
@@ -1,9 +1,46 @@
 #pragma once
 
 #include "DeformMesh/DeformableGridMeshComponent.h"
-#include "Quadtree/Quadtree.h"
+#include "Quadtree/QuadMeshIndexBuffer.h"
+#include "Ocean/OceanSimulator.h"
+#include "Ocean/OceanSharedSimulation.h"
+#include "Ocean/OceanFlipbook.h"
 #include "OceanQuadtreeMeshComponent.generated.h"
 
+UENUM()
+enum class EOceanSimulationBackend : uint8
+{
+	/** Simulate with compute shaders on the render thread. */
+	GPU = 0,
+	/** Simulate on the game thread with SimulateOceanCPU(). Works without RHI such as dedicated servers. The result is uploaded to the displacement map for rendering. */
+	CPU,
+	/** Play back FlipbookFile baked by ShaderSandbox.Ocean.BakeFlipbook. No FFT at runtime. Falls back to the GPU FFT with an error log if the file cannot be played. */
+	Flipbook,
+};
+
+/** One of the patches of different scales summed by a cascaded ocean. */
+USTRUCT(BlueprintType)
+struct SHADERSANDBOX_API FOceanCascade
+{
+	GENERATED_BODY()
+
+	/** The side length (world space) of the patch of this cascade. */
+	UPROPERTY(EditAnywhere, Category="OceanCascade", BlueprintReadOnly, Meta = (UIMin = "10.0", UIMax = "100000.0", ClampMin = "10.0", ClampMax = "100000.0"))
+	float PatchLength = 2000.0f;
+
+	/** Waves shorter than this (world space) are left to the other cascades. 0 means no limit. */
+	UPROPERTY(EditAnywhere, Category="OceanCascade", BlueprintReadOnly, Meta = (UIMin = "0.0", ClampMin = "0.0"))
+	float MinWaveLength = 0.0f;
+
+	/** Waves of this length (world space) and longer are left to the other cascades. 0 means no limit. */
+	UPROPERTY(EditAnywhere, Category="OceanCascade", BlueprintReadOnly, Meta = (UIMin = "0.0", ClampMin = "0.0"))
+	float MaxWaveLength = 0.0f;
+
+	/** The amplitude of the horizontal displacement of this cascade. Replaces ChoppyScale of the component. */
+	UPROPERTY(EditAnywhere, Category="OceanCascade", BlueprintReadOnly, Meta = (UIMin = "0.0", UIMax = "10.0", ClampMin = "0.0", ClampMax = "10.0"))
+	float ChoppyScale = 1.3f;
+};
+
 
 // almost all is copy of UCustomMeshComponent
 UCLASS(hidecategories=(Object,LOD, Physics, Collision), editinlinenew, meta=(BlueprintSpawnableComponent), ClassGroup=Rendering)
@@ -27,6 +64,68 @@ public:
 	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "10", UIMax = "10000", ClampMin = "10", ClampMax = "10000"))
 	int32 PatchLength = 2000;
 
+	/** Max amplitude of wave displacement including perlin noise. Used to extend bounding box of quad nodes for frustum culling. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "0.0", UIMax = "10000.0", ClampMin = "0.0", ClampMax = "10000.0"))
+	float MaxDisplacement = 1000.0f;
+
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	EOceanSimulationBackend SimulationBackend = EOceanSimulationBackend::GPU;
+
+	/** Pack the three real IFFTs of the simulation into about half the transforms using the Hermitian symmetry of the spectrum. Same result within floating point error. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	bool bPackedIFFT = false;
+
+	/**
+	 * Store the spectra and FFT work buffers of the GPU simulation as half2, halving their memory and bandwidth. The IFFT still computes in fp32.
+	 * Meant to be paired with RTF_RGBA16f displacement and gradient folding maps (PF_FloatRGBA for the cascade arrays); a warning is logged otherwise.
+	 * At 512 with the default spectrum, the max displacement error is 7.4e-4 of the max displacement and the RMS error 5.2e-4 of the RMS displacement
+	 * (7.4e-4 and 5.1e-4 with the packed IFFT), measured against the fp32 path by reproducing the half rounding of the shader on the CPU.
+	 * The ShaderSandbox.Ocean.HalfPrecision automation test checks them on the GPU.
+	 */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	bool bHalfPrecision = false;
+
+	/**
+	 * Simulation steps per second. 0 simulates every rendered frame. Otherwise the ocean is simulated at this fixed rate, GPU backend only,
+	 * and the last two steps are kept in DisplacementMap and GradientFoldingMap and in PreviousDisplacementMap and PreviousGradientFoldingMap
+	 * (or their cascade versions), each new step overwriting the older pair. The material should lerp from the Previous maps to the others
+	 * by SimulationAlpha of OceanMPC, which is 1 without SimulationRate, so the rendered ocean lags by one step.
+	 * /Plugin/ShaderSandbox/Private/OceanFixedRate.ush has the functions for a Custom material node which do the lerp.
+	 */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "0.0", UIMax = "120.0", ClampMin = "0.0", ClampMax = "1000.0"))
+	float SimulationRate = 0.0f;
+
+	/** With SimulationRate, split each step across two frames: the spectrum update and horizontal IFFT in one, the vertical IFFT and displacement maps in the next. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	bool bTimeSlicedSimulation = false;
+
+	/** Flipbook file relative to the project directory. Written by ShaderSandbox.Ocean.BakeFlipbook and played back by the Flipbook backend. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	FString FlipbookFile;
+
+	/** Loop period of the baked flipbook, in the same unit as GetAccumulatedTime(). The spectrum frequencies are rounded so that the waves repeat with this period. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "1.0", UIMax = "120.0", ClampMin = "0.1", ClampMax = "3600.0"))
+	float FlipbookPeriod = 20.0f;
+
+	/** Number of frames baked in one FlipbookPeriod. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "1", UIMax = "1800", ClampMin = "1", ClampMax = "100000"))
+	int32 FlipbookNumFrames = 600;
+
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	EOceanFlipbookFormat FlipbookFormat = EOceanFlipbookFormat::Float16;
+
+	/** Number of the most energetic spectrum components summed by QueryOceanDisplacement(). */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "4", UIMax = "4096", ClampMin = "4", ClampMax = "65536"))
+	int32 NumQuerySpectrumComponents = 256;
+
+	/** Number of iterations of QueryOceanDisplacement() to cancel the horizontal choppy displacement. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "0", UIMax = "8", ClampMin = "0", ClampMax = "8"))
+	int32 NumQueryInverseIterations = 3;
+
+	/** Random seed of the initial height map. The same seed makes the same ocean on every client and server. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	int32 Seed = 0;
+
 	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly, Meta = (UIMin = "0.0", UIMax = "10.0", ClampMin = "0.0", ClampMax = "10.0"))
 	float TimeScale = 0.8f;
 
@@ -72,6 +171,40 @@ public:
 	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
 	class UCanvasRenderTarget2D* GradientFoldingMap = nullptr;
 
+	/**
+	 * If not empty, the ocean is simulated as 2 to 4 cascades of different patch lengths and wave length bands instead of PatchLength,
+	 * with one dispatch per pass for all cascades. The result of cascade i is written to slice i of CascadeDisplacementMaps and CascadeGradientFoldingMaps,
+	 * and the material samples slice i with world XY / CascadePatchLengths[i] of OceanMPC. NumCascades of OceanMPC is the number of cascades.
+	 * /Plugin/ShaderSandbox/Private/OceanCascade.ush has the functions for a Custom material node which sum the slices and blend in the Perlin noise.
+	 * GPU backend only. The debug views are not written. PatchLength is still the size of the smallest quad node.
+	 */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	TArray<FOceanCascade> Cascades;
+
+	/** Square, a supported size, at least Cascades.Num() slices and UAV creation enabled. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UTextureRenderTarget2DArray* CascadeDisplacementMaps = nullptr;
+
+	/** Same size and slices as CascadeDisplacementMaps. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UTextureRenderTarget2DArray* CascadeGradientFoldingMaps = nullptr;
+
+	/** The other half of DisplacementMap with SimulationRate, written by the simulation in turns. Same size and format as DisplacementMap. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UCanvasRenderTarget2D* PreviousDisplacementMap = nullptr;
+
+	/** The other half of GradientFoldingMap with SimulationRate, written by the simulation in turns. Same size and format as GradientFoldingMap. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UCanvasRenderTarget2D* PreviousGradientFoldingMap = nullptr;
+
+	/** The other half of CascadeDisplacementMaps with SimulationRate, written by the simulation in turns. Same size, format and slices as CascadeDisplacementMaps, and UAV creation enabled. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UTextureRenderTarget2DArray* PreviousCascadeDisplacementMaps = nullptr;
+
+	/** The other half of CascadeGradientFoldingMaps with SimulationRate, written by the simulation in turns. Same size, format and slices as CascadeGradientFoldingMaps, and UAV creation enabled. */
+	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
+	class UTextureRenderTarget2DArray* PreviousCascadeGradientFoldingMaps = nullptr;
+
 	UPROPERTY(EditAnywhere, Category="Components|OceanQuadtree", BlueprintReadOnly)
 	class UCanvasRenderTarget2D* H0DebugView = nullptr;
 
@@ -91,6 +224,22 @@ public:
 	float DxyzDebugAmplitude = 100.0f;
 
 	float GetAccumulatedTime() const { return _AccumulatedTime; }
+	OceanSimulator::FOceanSpectrumParameters CreateSpectrumParameters(uint32 DispMapDimension) const;
+	/** One per cascade. Seed of cascade i is Seed + i. */
+	TArray<OceanSimulator::FOceanSpectrumParameters, TInlineAllocator<OceanSimulator::MaxOceanCascades>> CreateCascadeSpectrumParameters(uint32 DispMapDimension) const;
+	/** Whether Cascades are valid and simulated. Decided at registration. */
+	bool UsesCascades() const { return _bUseCascades; }
+	/** Whether SimulationRate is valid and the ocean is simulated at the fixed rate. Decided at registration. */
+	bool UsesFixedRateSimulation() const { return _bUseFixedRateSimulation; }
+	/** The spectrum may be still being generated. Wait for GetInitialSpectrumTask() before reading it. */
+	const TSharedPtr<OceanSimulator::FOceanInitialSpectrum, ESPMode::ThreadSafe>& GetInitialSpectrum() const { return _InitialSpectrum; }
+	const FGraphEventRef& GetInitialSpectrumTask() const { return _InitialSpectrumTask; }
+	/** Shared among components with the same spectrum. Null if not registered. */
+	const OceanSimulator::FOceanSharedSimulationPtr& GetSharedSimulation() const { return _SharedSimulation; }
+	/** Opened at registration by the Flipbook backend. Null otherwise or if FlipbookFile cannot be played, in which case the GPU FFT is used. */
+	const TSharedPtr<OceanSimulator::FOceanFlipbook, ESPMode::ThreadSafe>& GetFlipbook() const { return _Flipbook; }
+	/** Latest result of the CPU backend. Null if SimulationBackend is not CPU. */
+	const TSharedPtr<OceanSimulator::FOceanCPUDisplacement, ESPMode::ThreadSafe>& GetCPUDisplacement() const { return _CPUDisplacement; }
 
 	UCanvasRenderTarget2D* GetDisplacementMap() const { return DisplacementMap; }
 	FShaderResourceViewRHIRef GetDisplacementMapSRV() const { return _DisplacementMapSRV; }
@@ -101,6 +250,13 @@ public:
 	FUnorderedAccessViewRHIRef GetDkxDebugViewUAV() const { return _DkxDebugViewUAV; }
 	FUnorderedAccessViewRHIRef GetDkyDebugViewUAV() const { return _DkyDebugViewUAV; }
 	FUnorderedAccessViewRHIRef GetDxyzDebugViewUAV() const { return _DxyzDebugViewUAV; }
+	FShaderResourceViewRHIRef GetCascadeDisplacementMapsSRV() const { return _CascadeDisplacementMapsSRV; }
+	FUnorderedAccessViewRHIRef GetCascadeDisplacementMapsUAV() const { return _CascadeDisplacementMapsUAV; }
+	FUnorderedAccessViewRHIRef GetCascadeGradientFoldingMapsUAV() const { return _CascadeGradientFoldingMapsUAV; }
+	/** Views of PreviousDisplacementMap and PreviousGradientFoldingMap, or of their cascade versions. Valid only if UsesFixedRateSimulation(). */
+	FShaderResourceViewRHIRef GetPreviousDisplacementMapSRV() const { return _PreviousDisplacementMapSRV; }
+	FUnorderedAccessViewRHIRef GetPreviousDisplacementMapUAV() const { return _PreviousDisplacementMapUAV; }
+	FUnorderedAccessViewRHIRef GetPreviousGradientFoldingMapUAV() const { return _PreviousGradientFoldingMapUAV; }
 
 public:
 	UOceanQuadtreeMeshComponent();
@@ -114,17 +270,49 @@ public:
 	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
 	//~ End USceneComponent Interface.
 
-	const TArray<class UMaterialInstanceDynamic*>& GetLODMIDList() const;
+	class UMaterialInstanceDynamic* GetQuadNodeMID() const;
 	class UMaterialParameterCollectionInstance* GetMPCInstance() const;
-	const TArray<Quadtree::FQuadMeshParameter>& GetQuadMeshParams() const;
+	const Quadtree::FQuadMeshIndexBufferPtr& GetQuadMeshIndexBuffer() const;
+
+	/**
+	 * Evaluates the ocean displacement at world space XY Positions without FFT nor GPU readback, by summing NumQuerySpectrumComponents components of the spectrum (of each cascade if UsesCascades()).
+	 * Time is in the same unit as GetAccumulatedTime(). OutDisplacements[i].Z is the height of the surface above Positions[i]. Perlin noise of the material is not included.
+	 * Callable from any thread while the component is registered. It reads an immutable snapshot of the spectrum, the location and TimeScale
+	 * published by the game thread, so the component may be moved or re-registered concurrently.
+	 */
+	void QueryOceanDisplacement(TArrayView<const FVector2D> Positions, float Time, TArrayView<FVector> OutDisplacements) const;
+
+	/**
+	 * Starts baking FlipbookNumFrames frames of one FlipbookPeriod to FlipbookFile with the CPU simulation on a background task. Game thread only.
+	 * Logs the progress, then the file size and the streaming bandwidth. Returns false if the bake could not be started.
+	 */
+	bool BakeFlipbook() const;
 
 protected:
 	//~ Begin UActorComponent Interface.
 	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction) override;
 	virtual void SendRenderDynamicData_Concurrent() override;
 	//~ End UActorComponent Interface.
 
+	//~ Begin USceneComponent Interface.
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport = ETeleportType::None) override;
+	//~ End USceneComponent Interface.
+
 private:
+	uint32 GetDispMapDimension() const;
+	bool ValidateCascades() const;
+	bool ValidateFixedRateSimulation() const;
+	void WarnHalfPrecisionTargetFormats() const;
+	bool HasSimulationViews() const;
+	void InitSpectrum();
+	void PublishDisplacementQuerySnapshot();
+	void SimulateOnCPU();
+	void OpenFlipbook();
+	TSharedPtr<OceanSimulator::FOceanFlipbook, ESPMode::ThreadSafe> OpenFlipbookFile() const;
+	FString GetFlipbookPath() const;
+
 	FShaderResourceViewRHIRef _DisplacementMapSRV;
 	FUnorderedAccessViewRHIRef _DisplacementMapUAV;
 	FUnorderedAccessViewRHIRef _GradientFoldingMapUAV;
@@ -133,12 +321,43 @@ private:
 	FUnorderedAccessViewRHIRef _DkxDebugViewUAV;
 	FUnorderedAccessViewRHIRef _DkyDebugViewUAV;
 	FUnorderedAccessViewRHIRef _DxyzDebugViewUAV;
+	FShaderResourceViewRHIRef _CascadeDisplacementMapsSRV;
+	FUnorderedAccessViewRHIRef _CascadeDisplacementMapsUAV;
+	FUnorderedAccessViewRHIRef _CascadeGradientFoldingMapsUAV;
+	FShaderResourceViewRHIRef _PreviousDisplacementMapSRV;
+	FUnorderedAccessViewRHIRef _PreviousDisplacementMapUAV;
+	FUnorderedAccessViewRHIRef _PreviousGradientFoldingMapUAV;
+	bool _bUseCascades = false;
+	bool _bUseFixedRateSimulation = false;
 
 	UPROPERTY(Transient)
-	TArray<class UMaterialInstanceDynamic*> _LODMIDList;
+	class UMaterialInstanceDynamic* _QuadNodeMID = nullptr;
 	UPROPERTY(Transient)
 	class UMaterialParameterCollectionInstance* _MPCInstance = nullptr;
 
-	TArray<Quadtree::FQuadMeshParameter> QuadMeshParams;
+	Quadtree::FQuadMeshIndexBufferPtr QuadMeshIndexBuffer;
+
+	// H0とOmega0はプロキシ、CPUバックエンド、QueryOceanDisplacement()で共有する
+	TSharedPtr<OceanSimulator::FOceanInitialSpectrum, ESPMode::ThreadSafe> _InitialSpectrum;
+	FGraphEventRef _InitialSpectrumTask;
+	TSharedPtr<OceanSimulator::FOceanFlipbook, ESPMode::ThreadSafe> _Flipbook;
+	OceanSimulator::FOceanSharedSimulationPtr _SharedSimulation;
+	OceanSimulator::FOceanCPUSimulationWork _CPUSimulationWork;
+	// QueryOceanDisplacement()が任意のスレッドから読むゲームスレッドの状態。差し替えるだけで中身は書き換えない
+	struct FDisplacementQuerySnapshot
+	{
+		// SpectrumComponentsはInitialSpectrumTaskの完了後に読む
+		TSharedPtr<const OceanSimulator::FOceanInitialSpectrum, ESPMode::ThreadSafe> InitialSpectrum;
+		FGraphEventRef InitialSpectrumTask;
+		FVector2D Origin;
+		float TimeScale;
+		int32 NumInverseIterations;
+	};
+	TSharedPtr<const FDisplacementQuerySnapshot, ESPMode::ThreadSafe> _DisplacementQuerySnapshot;
+	mutable FCriticalSection _DisplacementQuerySnapshotLock;
+	// 最後のシミュレーションの結果。_CPUDisplacementPoolのどれか
+	TSharedPtr<OceanSimulator::FOceanCPUDisplacement, ESPMode::ThreadSafe> _CPUDisplacement;
+	// レンダースレッドに渡した結果を、参照がなくなってから使い回すためのプール
+	TArray<TSharedPtr<OceanSimulator::FOceanCPUDisplacement, ESPMode::ThreadSafe>> _CPUDisplacementPool;
 };
 
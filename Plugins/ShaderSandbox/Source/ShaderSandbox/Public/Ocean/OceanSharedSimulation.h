@@ -0,0 +1,157 @@
+#pragma once
+
+#include "Ocean/OceanSimulator.h"
+#include "Ocean/ResourceArrayStructuredBuffer.h"
+#include "Containers/DynamicRHIResourceArray.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/ThreadSafeCounter.h"
+
+namespace OceanSimulator
+{
+/** H0 and Omega0 of the ocean and the spectrum components for queries. Shared by components, scene proxies and FOceanSharedSimulation. */
+struct FOceanInitialSpectrum
+{
+	// CPUバックエンドでも使うので、RHIのバッファを作った後もCPU側のデータを破棄しない
+	FOceanInitialSpectrum() : H0Data(true), Omega0Data(true) {}
+
+	/** DispMapDimension * DispMapDimension elements per cascade, cascades back to back as SimulateOceanCascades() expects. */
+	TResourceArray<FComplex> H0Data;
+	TResourceArray<float> Omega0Data;
+	/** One per cascade. One element without cascades. */
+	TArray<FOceanSpectrumComponents> SpectrumComponents;
+};
+
+/** The parameters which differ among cascades. */
+struct FOceanCascadeBand
+{
+	float PatchLength = 0.0f;
+	float MinWaveLength = 0.0f;
+	float MaxWaveLength = 0.0f;
+	float ChoppyScale = 0.0f;
+
+	bool operator==(const FOceanCascadeBand& Other) const
+	{
+		return PatchLength == Other.PatchLength && MinWaveLength == Other.MinWaveLength && MaxWaveLength == Other.MaxWaveLength && ChoppyScale == Other.ChoppyScale;
+	}
+};
+
+/** Everything which determines the result of a simulation. Scene proxies with the same key share one FOceanSharedSimulation. */
+struct FOceanSimulationKey
+{
+	uint32 DispMapDimension = 0;
+	/** One element without cascades. Seed of cascade i is Seed + i. */
+	TArray<FOceanCascadeBand, TInlineAllocator<MaxOceanCascades>> Cascades;
+	float AmplitudeScale = 0.0f;
+	FVector2D WindDirection = FVector2D::ZeroVector;
+	float WindSpeed = 0.0f;
+	float WindDependency = 0.0f;
+	uint32 Seed = 0;
+	float GravityZ = 0.0f;
+	float TimeScale = 0.0f;
+	/** Not a simulation parameter, but FOceanInitialSpectrum::SpectrumComponents depends on it. */
+	int32 NumQuerySpectrumComponents = 0;
+	bool bCPUBackend = false;
+	/** Steps per second of SimulateFixedRate(). 0 if Simulate() is used. */
+	float SimulationRate = 0.0f;
+	/** If true, SimulateFixedRate() splits a step across two frames. */
+	bool bTimeSliced = false;
+	/** FOceanSpectrumParameters::bHalfPrecision. Changes the layout of the H0 buffer. */
+	bool bHalfPrecision = false;
+
+	FOceanSimulationKey() {}
+	FOceanSimulationKey(const FOceanSpectrumParameters& Params, float InGravityZ, float InTimeScale);
+	/** The parameters other than PatchLength, MinWaveLength, MaxWaveLength, ChoppyScale and Seed, including bHalfPrecision, are taken from CascadeParams[0]. */
+	FOceanSimulationKey(TArrayView<const FOceanSpectrumParameters> CascadeParams, float InGravityZ, float InTimeScale);
+
+	bool operator==(const FOceanSimulationKey& Other) const;
+	friend uint32 GetTypeHash(const FOceanSimulationKey& Key);
+};
+
+typedef TSharedPtr<class FOceanSharedSimulation, ESPMode::ThreadSafe> FOceanSharedSimulationPtr;
+
+/**
+ * Spectrum and displacement buffers of one ocean simulation. Shared among all scene proxies which have the same FOceanSimulationKey,
+ * so that GPU time and memory scale with the number of distinct seas instead of the number of actors.
+ */
+class FOceanSharedSimulation
+{
+public:
+	/** Get the shared simulation for Key. Create it if not exist. Game thread only. */
+	static FOceanSharedSimulationPtr Acquire(const FOceanSimulationKey& Key);
+
+	/** Null until the first acquirer calls SetInitialSpectrum(). Wait for GetInitialSpectrumTask() before reading the contents. */
+	const TSharedPtr<FOceanInitialSpectrum, ESPMode::ThreadSafe>& GetInitialSpectrum() const { return InitialSpectrum; }
+	const FGraphEventRef& GetInitialSpectrumTask() const { return InitialSpectrumTask; }
+	/** Game thread only. InTask can be null if InInitialSpectrum is already complete. */
+	void SetInitialSpectrum(const TSharedPtr<FOceanInitialSpectrum, ESPMode::ThreadSafe>& InInitialSpectrum, const FGraphEventRef& InTask);
+
+	/**
+	 * Render thread only. The spectrum update and IFFT run only at the first call in a frame with Params.AccumulatedTime of that call,
+	 * or at every call if bForceUpdate. The other calls only write the result to the displacement map and gradient folding map of OutputViews,
+	 * and do nothing if those textures have already been written in the frame.
+	 * OutputViews needs the debug views, DisplacementMap and GradientFoldingMap views. If CPUDisplacement is not null, it is uploaded instead of the spectrum update and IFFT.
+	 */
+	void Simulate(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, const FOceanCPUDisplacement* CPUDisplacement, bool bForceUpdate = false);
+	/** Same as above for a simulation keyed with cascades, by SimulateOceanCascades(). The output textures are Texture2DArrays. GPU only. */
+	void Simulate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, bool bForceUpdate = false);
+
+	/**
+	 * Render thread only. Fixed-rate version of Simulate() for a simulation keyed with SimulationRate.
+	 * StepIndex is the step CascadeParams are taken at (AccumulatedTime = StepIndex / SimulationRate * TimeScale). The simulation advances at most one step
+	 * per frame, at the first call in the frame, and splits the step across two frames if Key.bTimeSliced. OutputViews are two sets of output maps
+	 * which hold the last two steps: a new step overwrites the set with the older one, so that materials can interpolate between the two without copies.
+	 * Only OutputViews[0] needs the debug views. Owner identifies the caller whose output state is tracked, and DisplacementMapTexture is the texture of
+	 * OutputViews[0]; owners sharing it are written once per step. OutNewestOutput is the index of the set with the returned step.
+	 * Returns the newest step the output sets hold, or INDEX_NONE if nothing has been simulated yet.
+	 */
+	int64 SimulateFixedRate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, int64 StepIndex, const void* Owner, const FOceanBufferViews (&OutputViews)[2], FRHITexture* DisplacementMapTexture, int32& OutNewestOutput);
+
+	/** Render thread only. Forgets the output state of Owner. Call when Owner stops calling SimulateFixedRate(). */
+	void ReleaseFixedRateOutput(const void* Owner);
+
+	/** CPU memory held by this simulation, including the initial spectrum. GPU buffers are not counted. */
+	SIZE_T GetAllocatedSize() const;
+
+	/** Count the scene proxies which hold this simulation, so that each of them reports GetAllocatedSize() / GetNumProxyOwners(). Any thread. */
+	void AddProxyOwner() { NumProxyOwners.Increment(); }
+	void RemoveProxyOwner() { NumProxyOwners.Decrement(); }
+	int32 GetNumProxyOwners() const { return NumProxyOwners.GetValue(); }
+
+private:
+	void SimulateInternal(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, const FOceanBufferViews& OutputViews, FRHITexture* DisplacementMapTexture, FRHITexture* GradientFoldingMapTexture, const FOceanCPUDisplacement* CPUDisplacement, bool bForceUpdate);
+	void AdvanceFixedRate(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, bool bCascades, int64 StepIndex, const FOceanBufferViews& Views);
+	FOceanBufferViews GetSimulationViews(const FOceanBufferViews& OutputViews) const;
+	void InitBuffers(uint32 DispMapDimension);
+	void ReleaseBuffers();
+
+	FOceanSimulationKey Key;
+	TSharedPtr<FOceanInitialSpectrum, ESPMode::ThreadSafe> InitialSpectrum;
+	FGraphEventRef InitialSpectrumTask;
+	// コンポーネントやレンダーコマンドも参照を持つので、参照カウントとは別にプロキシの数を数える
+	FThreadSafeCounter NumProxyOwners;
+
+	// 以下はレンダースレッドでのみアクセスする
+	bool bBuffersInitialized = false;
+	uint32 LastSimulatedFrameNumber = INDEX_NONE;
+	TArray<TPair<FRHITexture*, FRHITexture*>, TInlineAllocator<4>> WrittenOutputTextures;
+
+	// SimulateFixedRate()の状態。Dx、Dy、DzはSimulatedStepIndexのステップの結果を持つ
+	int64 SimulatedStepIndex = INDEX_NONE;
+	int64 PendingStepIndex = INDEX_NONE;
+	FOceanTimeSlicedState TimeSlicedState;
+	struct FFixedRateOutput
+	{
+		FRHITexture* DisplacementMapTexture = nullptr;
+		int64 StepIndices[2] = { INDEX_NONE, INDEX_NONE };
+	};
+	TMap<const void*, FFixedRateOutput> FixedRateOutputs; // 呼び出し元ごとの出力先と2組の出力が持つステップ。ReleaseFixedRateOutput()で削除する
+
+	// Ht、Dkx、Dky、FFTのワークバッファはSimulateOcean()のグラフ内で一時的に確保される。
+	// Dx、Dy、DzはCPUバックエンドの結果のアップロード先と同じフレームでの使いまわしのために残す
+	FResourceArrayStructuredBuffer H0Buffer;
+	FResourceArrayStructuredBuffer Omega0Buffer;
+	FResourceArrayStructuredBuffer DxBuffer;
+	FResourceArrayStructuredBuffer DyBuffer;
+	FResourceArrayStructuredBuffer DzBuffer;
+};
+} // namespace OceanSimulator
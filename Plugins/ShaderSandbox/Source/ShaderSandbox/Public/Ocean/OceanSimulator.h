@@ -4,6 +4,10 @@
 #include "UObject/ObjectMacros.h"
 #include "Engine/EngineTypes.h"
 #include "RHICommandList.h"
+#include "RenderGraphResources.h"
+#include "Stats/Stats.h"
+
+DECLARE_STATS_GROUP(TEXT("Ocean"), STATGROUP_Ocean, STATCAT_Advanced);
 
 typedef FVector2D FComplex;
 
@@ -12,7 +16,7 @@ namespace OceanSimulator
 /** Phillips spectrum configuration */
 struct FOceanSpectrumParameters
 {
-	/** The size of displacement map. Must be power of 2. */
+	/** The size of displacement map. Must be power of 2. SimulateOcean() also requires IsSupportedDispMapDimension(). */
 	uint32 DispMapDimension = 512;
 	/** The side length (world space) of square patch. Typical value is 1000 ~ 2000. */
 	float PatchLength = 2000.0f;
@@ -26,6 +30,23 @@ struct FOceanSpectrumParameters
 	float WindDependency = 0.85f;
 	/** The amplitude for longitudinal wave. Higher value creates pointy crests. Must  be positive. */
 	float ChoppyScale = 1.3f;
+	/** Random seed of the initial height map. The same seed and parameters make the same ocean on every machine. */
+	uint32 Seed = 0;
+	/** Waves shorter than this (world space) are removed from the spectrum. 0 means no limit. Used to split the spectrum among cascades. */
+	float MinWaveLength = 0.0f;
+	/** Waves of this length (world space) and longer are removed from the spectrum. 0 means no limit. */
+	float MaxWaveLength = 0.0f;
+	/**
+	 * Use the Hermitian symmetry of the spectrum to pack the three real IFFTs into about half the transforms.
+	 * Same result as the default path within floating point error. DispMapDimension must be at least 8 for SimulateOceanCPU().
+	 */
+	bool bPackedIFFT = false;
+	/**
+	 * Store H0, Ht, Dk and the FFT work buffers of SimulateOcean() as half2 instead of float2. The spectrum update and the IFFT still compute in fp32,
+	 * only the values written to memory are rounded. H0SRV must then hold H0 packed by PackOceanComplexToHalf(). Omega and Dx, Dy, Dz stay fp32.
+	 * SimulateOceanCPU() ignores it.
+	 */
+	bool bHalfPrecision = false;
 
 	float AccumulatedTime = 0.0f;
 
@@ -33,17 +54,20 @@ struct FOceanSpectrumParameters
 	float DxyzDebugAmplitude = 100.0f;
 };
 
+/** Byte stride of the complex elements of the GPU spectrum buffers. */
+inline uint32 GetOceanComplexStride(bool bHalfPrecision)
+{
+	return bHalfPrecision ? sizeof(uint32) : sizeof(FComplex);
+}
+
+/** Packs each complex into a uint32 of two halves, real part in the low 16 bits, as the shaders read with FOceanSpectrumParameters::bHalfPrecision. */
+void PackOceanComplexToHalf(TArrayView<const FComplex> Src, class TResourceArray<uint32>& Dst);
+
+/** Persistent buffers and textures of SimulateOcean(). Ht, Dkx, Dky and the FFT work buffer are transient in the render graph and not listed here. */
 struct FOceanBufferViews
 {
 	FRHIShaderResourceView* H0SRV = nullptr;
 	FRHIShaderResourceView* OmegaSRV = nullptr;
-	FRHIShaderResourceView* HtSRV = nullptr;
-	FRHIUnorderedAccessView* HtUAV = nullptr;
-	FRHIShaderResourceView* DkxSRV = nullptr;
-	FRHIUnorderedAccessView* DkxUAV = nullptr;
-	FRHIShaderResourceView* DkySRV = nullptr;
-	FRHIUnorderedAccessView* DkyUAV = nullptr;
-	FRHIUnorderedAccessView* FFTWorkUAV = nullptr;
 	FRHIShaderResourceView* DxSRV = nullptr;
 	FRHIUnorderedAccessView* DxUAV = nullptr;
 	FRHIShaderResourceView* DySRV = nullptr;
@@ -60,10 +84,156 @@ struct FOceanBufferViews
 	FRHIUnorderedAccessView* GradientFoldingMapUAV = nullptr;
 };
 
-float GaussianRand();
+/** Which passes SimulateOcean() and SimulateOceanCascades() run. */
+enum class EOceanSimulationPasses : uint8
+{
+	/** The spectrum update and IFFT unless bDisplacementReady, then the displacement map, gradient folding map and debug passes. */
+	All,
+	/** The spectrum update and IFFT into the Dx, Dy, Dz buffers only. */
+	SpectrumAndIFFT,
+	/** The first half of SpectrumAndIFFT for time slicing. The row transformed spectra are kept in FOceanTimeSlicedState. */
+	SpectrumAndHorizontalIFFT,
+	/** The second half of SpectrumAndIFFT. Consumes FOceanTimeSlicedState. */
+	VerticalIFFT,
+};
+
+#if ENGINE_MINOR_VERSION >= 26
+typedef TRefCountPtr<FRDGPooledBuffer> FOceanPooledBufferRef;
+#else
+typedef TRefCountPtr<FPooledRDGBuffer> FOceanPooledBufferRef;
+#endif
+
+/** The row transformed spectra kept between EOceanSimulationPasses::SpectrumAndHorizontalIFFT and EOceanSimulationPasses::VerticalIFFT. Render thread only. */
+struct FOceanTimeSlicedState
+{
+	/** Dkx, Dky, Ht. Only the first one holds all three fields if bPackedIFFT. */
+	FOceanPooledBufferRef HorizontalIFFTBuffers[3];
+	bool bPackedIFFT = false;
+	bool bHalfPrecision = false;
+
+	bool IsPending() const { return HorizontalIFFTBuffers[0].IsValid(); }
+	void Reset()
+	{
+		for (FOceanPooledBufferRef& Buffer : HorizontalIFFTBuffers)
+		{
+			Buffer.SafeRelease();
+		}
+	}
+};
+
+/** Intermediate spectrum buffers of SimulateOceanCPU(). Kept across frames to avoid reallocation. */
+struct FOceanCPUSimulationWork
+{
+	uint32 DispMapDimension = 0;
+	/** e^(-2 * PI * i * k / DispMapDimension) for k in [0, DispMapDimension / 2). */
+	TArray<FComplex> Twiddles;
+	TArray<float, TAlignedHeapAllocator<16>> HtRe;
+	TArray<float, TAlignedHeapAllocator<16>> HtIm;
+	TArray<float, TAlignedHeapAllocator<16>> DkxRe;
+	TArray<float, TAlignedHeapAllocator<16>> DkxIm;
+	TArray<float, TAlignedHeapAllocator<16>> DkyRe;
+	TArray<float, TAlignedHeapAllocator<16>> DkyIm;
+	/** Whether Init() allocated PackedRe and PackedIm instead of the Ht, Dkx and Dky arrays. */
+	bool bPackedIFFT = false;
+	/** Used instead of Ht, Dkx and Dky if bPackedIFFT. Rows 0 to DispMapDimension / 2 of the Hermitian part of Dkx, Dky and Ht, each padded to a multiple of 4 rows. */
+	TArray<float, TAlignedHeapAllocator<16>> PackedRe;
+	TArray<float, TAlignedHeapAllocator<16>> PackedIm;
+	/** Scratch of the parallel FFT passes, one slice per worker chunk. Grown on demand. */
+	TArray<float, TAlignedHeapAllocator<16>> ChunkScratch;
+
+	void Init(uint32 InDispMapDimension, bool bInPackedIFFT = false);
+};
+
+/** Result of SimulateOceanCPU(). Same layout as the Dx, Dy, Dz buffers of the GPU simulation. */
+struct FOceanCPUDisplacement
+{
+	uint32 DispMapDimension = 0;
+	TArray<float, TAlignedHeapAllocator<16>> Dx;
+	TArray<float, TAlignedHeapAllocator<16>> Dy;
+	TArray<float, TAlignedHeapAllocator<16>> Dz;
+
+	void Init(uint32 InDispMapDimension);
+	FVector GetDisplacement(uint32 X, uint32 Y) const { uint32 Index = Y * DispMapDimension + X; return FVector(Dx[Index], Dy[Index], Dz[Index]); }
+};
+
+/**
+ * The most energetic components of the spectrum, selected by SelectSpectrumComponents().
+ * Evaluates the displacement at arbitrary points without FFT. Arrays are padded to a multiple of 4 with zero amplitude.
+ */
+struct FOceanSpectrumComponents
+{
+	uint32 DispMapDimension = 0;
+	float PatchLength = 0.0f;
+	float ChoppyScale = 0.0f;
+	/** Wave vector in world space. */
+	TArray<float, TAlignedHeapAllocator<16>> Kx;
+	TArray<float, TAlignedHeapAllocator<16>> Ky;
+	/** Normalized wave vector. Zero for k = 0. */
+	TArray<float, TAlignedHeapAllocator<16>> KxNorm;
+	TArray<float, TAlignedHeapAllocator<16>> KyNorm;
+	/** H(k, 0) */
+	TArray<float, TAlignedHeapAllocator<16>> H0Re;
+	TArray<float, TAlignedHeapAllocator<16>> H0Im;
+	/** H(-k, 0) in the same indexing as UpdateSpectrumCS. */
+	TArray<float, TAlignedHeapAllocator<16>> H0MinusRe;
+	TArray<float, TAlignedHeapAllocator<16>> H0MinusIm;
+	TArray<float, TAlignedHeapAllocator<16>> Omega;
+
+	int32 Num() const { return Kx.Num(); }
+	SIZE_T GetAllocatedSize() const
+	{
+		return Kx.GetAllocatedSize() + Ky.GetAllocatedSize() + KxNorm.GetAllocatedSize() + KyNorm.GetAllocatedSize()
+			+ H0Re.GetAllocatedSize() + H0Im.GetAllocatedSize() + H0MinusRe.GetAllocatedSize() + H0MinusIm.GetAllocatedSize() + Omega.GetAllocatedSize();
+	}
+};
+
 float CalculatePhillipsCoefficient(const FVector2D& K, float Gravity, const FOceanSpectrumParameters& Params);
+/** OutH0 and OutOmega0 must have DispMapDimension * DispMapDimension elements. Deterministic for Params.Seed regardless of the number of worker threads. Callable from any thread. */
 void CreateInitialHeightMap(const FOceanSpectrumParameters& Params, float GravityZ, class TResourceArray<FComplex>& OutH0, class TResourceArray<float>& OutOmega0);
-void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& Views);
+/**
+ * Same result as CreateInitialHeightMap() but loads it from Saved/OceanSpectrumCache if the same parameters were generated before, and saves it otherwise.
+ * The least recently used files are deleted when the cache exceeds ShaderSandbox.Ocean.InitialHeightMapCacheMaxMB. Hits and misses are logged at Verbose.
+ * Returns true if loaded from the cache. Callable from any thread.
+ */
+bool LoadOrCreateInitialHeightMap(const FOceanSpectrumParameters& Params, float GravityZ, class TResourceArray<FComplex>& OutH0, class TResourceArray<float>& OutOmega0);
+/** Whether SimulateOcean() has the IFFT shader permutation for DispMapDimension (a power of 2 from 64 to 2048). SimulateOceanCPU() supports any power of 2 of at least 4. */
+bool IsSupportedDispMapDimension(uint32 DispMapDimension);
+/**
+ * Ht, Dkx, Dky and the FFT work buffer are allocated from the render graph pool only for the spectrum and IFFT passes.
+ * Unless bDisplacementReady is true, Params.DispMapDimension must satisfy IsSupportedDispMapDimension() and nothing is done otherwise.
+ * If Params.bPackedIFFT is true, the Ht, Dkx, Dky debug views are not written.
+ * If bDisplacementReady is true, Dx, Dy, Dz buffers must already hold the result (of SimulateOceanCPU() or an earlier simulation in the frame) and the spectrum and IFFT passes are skipped.
+ * Passes other than All split the simulation, e.g. across frames. TimeSlicedState is required by SpectrumAndHorizontalIFFT and VerticalIFFT.
+ */
+void SimulateOcean(FRHICommandListImmediate& RHICmdList, const FOceanSpectrumParameters& Params, const FOceanBufferViews& Views, bool bDisplacementReady = false, EOceanSimulationPasses Passes = EOceanSimulationPasses::All, FOceanTimeSlicedState* TimeSlicedState = nullptr);
+
+/** The number of cascades SimulateOceanCascades() can handle in one dispatch. */
+static const int32 MaxOceanCascades = 4;
+/**
+ * SimulateOcean() for up to MaxOceanCascades spectra of the same DispMapDimension, e.g. different PatchLength and wave length bands.
+ * The spectrum update and each IFFT pass of all cascades are one dispatch, with the cascade index in the Z group count.
+ * H0, Omega, Dx, Dy, Dz buffers hold the cascades back to back, DispMapDimension * DispMapDimension elements each.
+ * DisplacementMap and GradientFoldingMap views are Texture2DArray views with a slice per cascade. The debug views are not written.
+ * AccumulatedTime, bPackedIFFT and bHalfPrecision are taken from CascadeParams[0].
+ */
+void SimulateOceanCascades(FRHICommandListImmediate& RHICmdList, TArrayView<const FOceanSpectrumParameters> CascadeParams, const FOceanBufferViews& Views, bool bDisplacementReady = false, EOceanSimulationPasses Passes = EOceanSimulationPasses::All, FOceanTimeSlicedState* TimeSlicedState = nullptr);
+/** Selects NumComponents components of H0 and Omega0 with the largest energy. */
+void SelectSpectrumComponents(const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, int32 NumComponents, FOceanSpectrumComponents& OutComponents);
+/**
+ * Evaluates the displacement at Positions by summing Components at the simulation time Time. O(Components.Num() * Positions.Num() * (NumInverseIterations + 1)).
+ * Positions are in the displacement map UV multiplied by PatchLength. Because of the choppy horizontal displacement,
+ * the grid point P whose displaced position P + Displacement.XY equals Position is searched with NumInverseIterations fixed point iterations
+ * and the displacement of P is returned, so that OutDisplacements[i].Z is the height of the surface above Positions[i]. Callable from any thread.
+ */
+void EvaluateSpectrumComponents(const FOceanSpectrumComponents& Components, float Time, int32 NumInverseIterations, TArrayView<const FVector2D> Positions, TArrayView<FVector> OutDisplacements);
+/** Same as above for the sum of cascades. Positions are in world space units and wrapped by the PatchLength of each cascade. */
+void EvaluateSpectrumComponents(TArrayView<const FOceanSpectrumComponents> Cascades, float Time, int32 NumInverseIterations, TArrayView<const FVector2D> Positions, TArrayView<FVector> OutDisplacements);
+/**
+ * CPU version of the spectrum update, IFFT and displacement passes of SimulateOcean(). Does not need RHI so that it runs on dedicated servers.
+ * H0 and Omega0 are DispMapDimension * DispMapDimension arrays made by CreateInitialHeightMap(). Callable from any thread.
+ * If Params.bPackedIFFT is true, follows the packed passes of SimulateOcean() step by step, so it is also their reference implementation.
+ */
+void SimulateOceanCPU(const FOceanSpectrumParameters& Params, const FComplex* H0, const float* Omega0, FOceanCPUSimulationWork& Work, FOceanCPUDisplacement& OutDisplacement);
 
 struct FOceanSinWaveParameters
 {
@@ -7,6 +7,10 @@ struct FResourceArrayStructuredBuffer : public FRenderResource
 public:
 	// Caution: ENQUEUE_RENDER_COMMAND() use contents of Data. So don't use transient data.
 	void Initialize(class FResourceArrayInterface& Data, uint32 ByteStride);
+	// Creates the buffer without initial data. Use for buffers which are always written on GPU or by Update() before being read.
+	void Initialize(uint32 ByteStride, uint32 NumElements);
+	// Render thread only. NumBytes must not exceed the size of the data given to Initialize().
+	void Update(const void* Data, uint32 NumBytes);
 	virtual void ReleaseDynamicRHI() override;
 
 	FRHIShaderResourceView* GetSRV() const { return SRV; }
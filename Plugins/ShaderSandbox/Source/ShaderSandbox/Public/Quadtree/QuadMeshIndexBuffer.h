@@ -0,0 +1,30 @@
+#pragma once
+
+#include "DynamicMeshBuilder.h"
+#include "Quadtree.h"
+
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Quad Mesh Index Bytes Saved"), STAT_QuadMeshIndexBytesSaved, STATGROUP_Quadtree, SHADERSANDBOX_API);
+
+namespace Quadtree
+{
+typedef TSharedPtr<class FQuadMeshIndexBuffer, ESPMode::ThreadSafe> FQuadMeshIndexBufferPtr;
+
+/** Index buffer created by CreateQuadMeshes(). Shared among all components which have the same NumGridDivision. */
+class FQuadMeshIndexBuffer : public FDynamicMeshIndexBuffer32
+{
+public:
+	/** Get the shared index buffer for NumGridDivision. Create it if not exist. Game thread only. */
+	static FQuadMeshIndexBufferPtr Acquire(int32 NumGridDivision);
+	/** Release the reference from a component. Game thread only. Scene proxies can keep their reference. */
+	static void Release(FQuadMeshIndexBufferPtr& Buffer);
+
+	const TArray<FQuadMeshParameter>& GetQuadMeshParams() const { return QuadMeshParams; }
+	int32 GetNumComponents() const { return NumComponents; }
+
+private:
+	/** The number of components which acquired this. Scene proxies are not counted. */
+	int32 NumComponents = 0;
+	TArray<FQuadMeshParameter> QuadMeshParams;
+};
+} // namespace Quadtree
+
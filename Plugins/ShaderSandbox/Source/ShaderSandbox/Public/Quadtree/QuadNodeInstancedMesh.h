@@ -0,0 +1,88 @@
+#pragma once
+
+#include "SceneManagement.h"
+#include "InstancedStaticMesh.h"
+#include "Quadtree.h"
+
+struct FDeformableVertexBuffers;
+
+namespace Quadtree
+{
+/** Dynamic vertex buffer of float4 per instance data with SRV for manual vertex fetch. It is kept across frames and only grows. */
+class FQuadNodeInstanceVertexBuffer : public FVertexBuffer
+{
+public:
+	/**
+	 * Lock the buffer to rewrite the first NumElements. Render thread only.
+	 * @param bOutReallocated - Set to true if the buffer was recreated to grow, so the streams and SRV bound to the vertex factory are stale.
+	 */
+	FVector4* Lock(uint32 NumElements, bool& bOutReallocated);
+	/** Unlock the buffer. Render thread only. */
+	void Unlock();
+
+	virtual void InitRHI() override;
+	virtual void ReleaseRHI() override;
+
+	FShaderResourceViewRHIRef SRV;
+
+private:
+	uint32 Capacity = 0;
+};
+
+/**
+ * Per instance data and vertex factory to draw quad nodes of a view with instancing.
+ * Quad nodes are bucketed by mesh pattern only, so there are at most NUM_QUAD_MESH_PATTERNS draw calls whatever the number of nodes and LODs.
+ * PerInstanceRandom holds LOD / MaxLOD, from which the material derives what used to be per LOD material parameters.
+ * Owned by FQuadNodeInstancedMeshPool and rewritten every frame, so the buffers and vertex factory are only recreated when they grow.
+ */
+class FQuadNodeInstancedMesh
+{
+public:
+	/** Range of instances which have the same mesh pattern. */
+	struct FBucket
+	{
+		uint32 QuadMeshParamsIndex = 0;
+		uint32 FirstInstance = 0;
+		uint32 NumInstances = 0;
+	};
+
+	FQuadNodeInstancedMesh(ERHIFeatureLevel::Type InFeatureLevel);
+	virtual ~FQuadNodeInstancedMesh();
+
+	/**
+	 * Write per instance data of leaf nodes in Result, and initialize the vertex factory if it is the first time or the buffers grew. Render thread only.
+	 * @param MeshLength - The edge length of the grid mesh in local space.
+	 */
+	void Init(const FQuadtreeBuildResult& Result, const FMatrix& LocalToWorld, int32 MaxLOD, float MeshLength, const FDeformableVertexBuffers& VertexBuffers);
+
+	const TArray<FBucket>& GetBuckets() const { return Buckets; }
+	const FInstancedStaticMeshVertexFactory* GetVertexFactory() const { return &VertexFactory; }
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	FQuadNodeInstanceVertexBuffer InstanceOriginBuffer;
+	FQuadNodeInstanceVertexBuffer InstanceTransformBuffer;
+	FQuadNodeInstanceVertexBuffer InstanceLightmapBuffer;
+	FInstancedStaticMeshVertexFactory VertexFactory;
+	TArray<FBucket> Buckets;
+};
+
+/**
+ * FQuadNodeInstancedMesh of a scene proxy kept across frames. Each view drawn in a frame gets its own one,
+ * because all mesh batches of a frame are gathered before any of them is drawn.
+ */
+class FQuadNodeInstancedMeshPool
+{
+public:
+	/** An instanced mesh which is not used by other views in the frame of View. Render thread only. */
+	FQuadNodeInstancedMesh& Allocate(const FSceneView& View, ERHIFeatureLevel::Type FeatureLevel);
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	TArray<TUniquePtr<FQuadNodeInstancedMesh>> Meshes;
+	uint32 FrameNumber = 0;
+	int32 NumAllocated = 0;
+};
+} // namespace Quadtree
+
@@ -1,6 +1,17 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "Async/TaskGraphInterfaces.h"
+
+DECLARE_STATS_GROUP(TEXT("Quadtree"), STATGROUP_Quadtree, STATCAT_Advanced);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Build Arena Allocations"), STAT_QuadtreeBuildArenaAllocations, STATGROUP_Quadtree, SHADERSANDBOX_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Evaluated Split Decisions"), STAT_QuadtreeEvaluatedSplitDecisions, STATGROUP_Quadtree, SHADERSANDBOX_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Result Cache Lookups"), STAT_QuadtreeResultCacheLookups, STATGROUP_Quadtree, SHADERSANDBOX_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Result Cache Hits"), STAT_QuadtreeResultCacheHits, STATGROUP_Quadtree, SHADERSANDBOX_API);
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Result Cache Time Saved (ms)"), STAT_QuadtreeResultCacheTimeSaved, STATGROUP_Quadtree, SHADERSANDBOX_API);
+
+class FSceneView;
 
 namespace Quadtree
 {
@@ -26,12 +37,14 @@ struct FQuadNode
 	int32 LOD = 0;
 	/** Indices of child nodes in render list. If a child does not exist, it is INDEX_NONE. */
 	int32 ChildNodeIndices[4] = {INDEX_NONE, INDEX_NONE, INDEX_NONE, INDEX_NONE};
+	/** Bit mask of frustum planes which the node is completely inside. Children inherit it so that they skip testing those planes. */
+	uint8 FrustumInsideMask = 0;
 
 	bool IsLeaf() const;
 	bool ContainsPosition2D(const FVector2D& Position2D) const;
 };
 
-/** Mesh for quad node have several pattern by LOD of adjacent quad nodes. An index buffer contains all pattern. This is parameters to reference the index buffer. */
+/** Mesh for quad node is composed of an inner mesh and 4 boundary meshes which depend on LOD of adjacent quad nodes. An index buffer contains all of them. This is parameters to reference the index buffer. */
 struct FQuadMeshParameter
 {
 	/** Position of bottom right corner. */
@@ -50,14 +63,171 @@ enum class EAdjacentQuadNodeLODDifference : uint8
 	MAX = 3,
 };
 
+/** Leaf node kept over frames to refine quadtree incrementally. */
+struct FTemporalQuadNode
+{
+	FQuadNode Node;
+	/** The decision not to split the node does not change while the camera stays within DecisionMargin from EvaluatedCameraPosition. */
+	FVector EvaluatedCameraPosition = FVector::ZeroVector;
+	float DecisionMargin = -1.0f;
+	/** Same as above for the decision to keep the parent node split. 4 siblings have the same value. */
+	FVector ParentEvaluatedCameraPosition = FVector::ZeroVector;
+	float ParentDecisionMargin = -1.0f;
+	/** Whether the node is frustum culled. Culled nodes are not split. */
+	bool bCulled = false;
+};
+
+/** Parameters which decide the shape of quadtree except for the camera. */
+struct FQuadtreeShapeParameters
+{
+	FVector RootBottomRight = FVector::ZeroVector;
+	float RootLength = 0.0f;
+	int32 RootLOD = 0;
+	int32 NumRowColumn = 0;
+	float MaxScreenCoverage = 0.0f;
+	float PatchLength = 0.0f;
+	FVector2D ProjectionScale = FVector2D::ZeroVector;
+
+	bool operator==(const FQuadtreeShapeParameters& Other) const;
+	bool operator!=(const FQuadtreeShapeParameters& Other) const { return !(*this == Other); }
+};
+
+/** Work memory of BuildQuadtree(). Keep it per view over frames so that building quadtree does not allocate memory in steady state and reuses the tree of the last frame. */
+struct FQuadtreeBuildArena
+{
+	/** Explicit stack of nodes to visit instead of recursive call. */
+	TArray<FQuadNode> NodeStack;
+	/** Leaf nodes which should be rendered. */
+	TArray<FQuadNode> RenderQuadNodeList;
+	/** Index of QuadMeshParams for each node in RenderQuadNodeList. Decided by LOD difference from adjacent nodes. */
+	TArray<uint32> QuadMeshParamsIndices;
+	/** Hashed index from LOD and cell coordinate of leaf node to index in RenderQuadNodeList. */
+	TMap<uint64, int32> LeafIndexMap;
+
+	/** All leaf nodes of the last frame including culled ones in depth first order. */
+	TArray<FTemporalQuadNode> TemporalLeaves;
+	/** Double buffer to write TemporalLeaves of the current frame. */
+	TArray<FTemporalQuadNode> TemporalLeavesBack;
+	/** Parameters TemporalLeaves was built with. If they change, quadtree is built from the root node again. */
+	FQuadtreeShapeParameters TemporalShape;
+
+	/** Work memory to build each of 4 subtrees of the root node in parallel. */
+	struct FSubtree
+	{
+		TArray<FQuadNode> NodeStack;
+		TArray<FTemporalQuadNode> Leaves;
+		TArray<FTemporalQuadNode> LeavesBack;
+	};
+	FSubtree Subtrees[4];
+
+	/** Position of bottom right corner of root node. */
+	FVector2D RootBottomRight = FVector2D::ZeroVector;
+	/** Length of edge of LOD0 node. */
+	float LOD0Length = 1.0f;
+	/** LOD level of root node. */
+	int32 RootLOD = 0;
+
+	/** Frame number when the arena was used last. */
+	uint32 LastUsedFrameNumber = 0;
+
+	/** Empty the lists of the current frame with keeping allocated memory. TemporalLeaves is kept. */
+	void Reset();
+	SIZE_T GetAllocatedSize() const;
+};
+
+/**
+ * Arenas of views keyed by an id stable over frames: the view state key, or a hash of the render target, view rect and stereo pass for views without a state.
+ * Each arena is allocated separately so that its address does not change while a build task uses it.
+ */
+typedef TMap<uint64, TUniquePtr<FQuadtreeBuildArena>> FQuadtreeViewArenaMap;
+
+/** Find the arena for the view, or add it. Arenas of views which have not been rendered for a while are discarded. Render thread only. */
+FQuadtreeBuildArena& FindOrAddViewArena(FQuadtreeViewArenaMap& ViewArenas, const FSceneView& View);
+
+/** Arguments of BuildQuadtree() for a view. Also the key of the frame scoped result cache. */
+struct FQuadtreeBuildParameters
+{
+	int32 MaxLOD = 0;
+	int32 NumRowColumn = 0;
+	float MaxScreenCoverage = 0.0f;
+	float PatchLength = 0.0f;
+	float MaxDisplacement = 0.0f;
+	FVector CameraPosition = FVector::ZeroVector;
+	FVector2D ProjectionScale = FVector2D::ZeroVector;
+	FMatrix ViewProjectionMatrix = FMatrix::Identity;
+	FQuadNode RootNode;
+
+	bool operator==(const FQuadtreeBuildParameters& Other) const;
+	friend uint32 GetTypeHash(const FQuadtreeBuildParameters& Parameters);
+};
+
+/** Leaf nodes to render and their mesh patterns. Swapped out of FQuadtreeBuildArena so that other views and components can reuse it in the same frame. */
+struct FQuadtreeBuildResult
+{
+	TArray<FQuadNode> RenderQuadNodeList;
+	TArray<uint32> QuadMeshParamsIndices;
+	/** Time in milliseconds it took to build. */
+	float BuildTimeMs = 0.0f;
+};
+
+/**
+ * Tasks to build quadtree of views in parallel in GetDynamicMeshElements(). Render thread only.
+ * Launch() the build of all views first, then Wait() for each view before reading its result.
+ * Results are cached during a frame, so views and components with the same parameters share one build. Up to 64 results are cached per frame;
+ * the rest are built without caching. The results of a frame are dropped, or recycled for their allocations, in the next frame.
+ */
+class FQuadtreeViewBuildTasks
+{
+public:
+	~FQuadtreeViewBuildTasks();
+
+	/** Launch a task to build quadtree of a view. If async build is disabled or another view already uses the arena, the build runs in Wait() instead. */
+	void Launch(int32 ViewIndex, FQuadtreeBuildArena& Arena, const FQuadtreeBuildParameters& Parameters);
+	/** Wait for the build of a view to complete and return the result. */
+	const FQuadtreeBuildResult& Wait(int32 ViewIndex);
+
+	struct FCachedResult;
+
+private:
+	struct FViewTask
+	{
+		TSharedPtr<FCachedResult, ESPMode::ThreadSafe> Result;
+		FQuadtreeBuildParameters Parameters;
+		bool bCacheHit = false;
+	};
+
+	TArray<FViewTask, TInlineAllocator<4>> ViewTasks;
+	TArray<const FQuadtreeBuildArena*, TInlineAllocator<4>> LaunchedArenas;
+};
+
 /** 
- * Build quad tree from given root node, and return two list.
- * One is all quad node in quadtree, another is list which should be rendered.
+ * Build quad tree from given root node without recursion, and write leaf nodes which should be rendered to Arena.RenderQuadNodeList.
+ * Index of QuadMeshParams for each leaf node is also written to Arena.QuadMeshParamsIndices.
+ * The tree of the last frame in Arena is refined incrementally. Only nodes whose split decision may have changed by the camera motion or whose culling changed are evaluated again.
+ * 4 subtrees of the root node are built in parallel unless r.ShaderSandbox.QuadtreeAsyncBuild is 0.
+ * @param MaxDisplacement - Max amplitude of vertex displacement. Bounding box of each node is extended by it for frustum culling.
  */
-void BuildQuadtree(int32 MaxLOD, int32 NumRowColumn, float MaxScreenCoverage, float PatchLength, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, FQuadNode& RootNode, TArray<FQuadNode>& OutAllQuadNodeList, TArray<FQuadNode>& OutRenderQuadNodeList);
+void BuildQuadtree(int32 MaxLOD, int32 NumRowColumn, float MaxScreenCoverage, float PatchLength, float MaxDisplacement, const FVector& CameraPosition, const FVector2D& ProjectionScale, const FMatrix& ViewProjectionMatrix, const FQuadNode& RootNode, FQuadtreeBuildArena& Arena);
 
-EAdjacentQuadNodeLODDifference QueryAdjacentNodeType(const FQuadNode& Node, const FVector2D& AdjacentPosition, const TArray<FQuadNode>& RenderQuadNodeList);
+/** The number of boundary meshes. 4 edges x 3 LOD difference. */
+static constexpr uint32 NUM_QUAD_MESH_BOUNDARY_PARAMS = 4 * (uint32)EAdjacentQuadNodeLODDifference::MAX;
+/** The number of FQuadMeshParameter created by CreateQuadMeshes(). The inner mesh and the boundary meshes. */
+static constexpr uint32 NUM_QUAD_MESH_PARAMS = 1 + NUM_QUAD_MESH_BOUNDARY_PARAMS;
+/** The number of mesh patterns by LOD difference of 4 adjacent quad nodes. */
+static constexpr uint32 NUM_QUAD_MESH_PATTERNS = 81;
+/** The number of meshes to draw a quad node. The inner mesh and 4 edges. */
+static constexpr uint32 NUM_QUAD_MESH_PARTS = 5;
 
+/**
+ * Create one inner mesh and the boundary meshes for each edge and LOD difference into a index buffer.
+ * OutQuadMeshParams[0] is the inner mesh, and OutQuadMeshParams[1 + Edge * 3 + LODDifference] is the boundary mesh. Edge is in order of right, left, bottom, top.
+ */
 void CreateQuadMeshes(int32 NumRowColumn, TArray<uint32>& OutIndices, TArray<Quadtree::FQuadMeshParameter>& OutQuadMeshParams);
+
+/** Convert the index of 81 pattern (RightType * 27 + LeftType * 9 + BottomType * 3 + TopType) to indices of FQuadMeshParameter of the inner mesh and 4 boundary meshes. */
+void GetQuadMeshPartIndices(uint32 QuadMeshParamsIndex, uint32 OutPartIndices[NUM_QUAD_MESH_PARTS]);
+
+/** The number of indices if the index buffer contained the whole mesh of all 81 pattern. */
+uint32 CalculateUndedupedQuadMeshIndexCount(const TArray<Quadtree::FQuadMeshParameter>& QuadMeshParams);
 } // namespace Quadtree
 
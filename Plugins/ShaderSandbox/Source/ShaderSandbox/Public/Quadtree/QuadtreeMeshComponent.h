@@ -1,7 +1,7 @@
 #pragma once
 
 #include "DeformMesh/DeformableGridMeshComponent.h"
-#include "Quadtree.h"
+#include "QuadMeshIndexBuffer.h"
 #include "QuadtreeMeshComponent.generated.h"
 
 // almost all is copy of UCustomMeshComponent
@@ -37,16 +37,17 @@ public:
 	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
 	//~ Begin USceneComponent Interface.
 
-	const TArray<class UMaterialInstanceDynamic*>& GetLODMIDList() const;
-	const TArray<Quadtree::FQuadMeshParameter>& GetQuadMeshParams() const;
+	class UMaterialInstanceDynamic* GetQuadNodeMID() const;
+	const Quadtree::FQuadMeshIndexBufferPtr& GetQuadMeshIndexBuffer() const;
 
 protected:
 	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
 
 private:
 	UPROPERTY(Transient)
-	TArray<class UMaterialInstanceDynamic*> LODMIDList;
+	class UMaterialInstanceDynamic* QuadNodeMID = nullptr;
 
-	TArray<Quadtree::FQuadMeshParameter> QuadMeshParams;
+	Quadtree::FQuadMeshIndexBufferPtr QuadMeshIndexBuffer;
 };
 